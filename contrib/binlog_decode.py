@@ -0,0 +1,86 @@
+#!/usr/bin/env python
+#
+# decode the binary request logs generated by --log-format-binary
+# (and the text lines framed by the "binary" log encoder)
+#
+# usage: binlog_decode.py [--csv] [--fields uri,host,...] [file ...]
+#
+# --fields gives a name to the --log-format variables (in the same order),
+# the unnamed ones are reported as var0, var1...
+#
+import sys
+import struct
+import json
+import csv
+import argparse
+
+HEADER = struct.Struct('<HBBQIHHHIQ')
+FIXED = ('time', 'micros', 'status', 'wid', 'core', 'hsize', 'rsize')
+
+
+def records(f):
+    while True:
+        size = f.read(2)
+        if len(size) < 2:
+            return
+        (n,) = struct.unpack('<H', size)
+        body = f.read(n - 2)
+        if len(body) < n - 2:
+            return
+        yield size + body
+
+
+def decode(record, names):
+    kind = ord(record[2:3])
+    if kind == 2:
+        return {'kind': 'text', 'line': record[4:].decode('utf-8', 'replace')}
+    if kind != 1:
+        return {'kind': 'unknown', 'size': len(record)}
+    header = HEADER.unpack_from(record)
+    fields = header[2]
+    item = {'kind': 'request'}
+    item.update(zip(FIXED, header[3:]))
+    pos = HEADER.size
+    for i in range(fields):
+        name = names[i] if i < len(names) else 'var%d' % i
+        t = record[pos:pos+1]
+        if t == b'i':
+            (item[name],) = struct.unpack_from('<q', record, pos + 1)
+            pos += 9
+        elif t == b's':
+            (vlen,) = struct.unpack_from('<H', record, pos + 1)
+            item[name] = record[pos+3:pos+3+vlen].decode('utf-8', 'replace')
+            pos += 3 + vlen
+        else:
+            break
+    return item
+
+
+def main():
+    parser = argparse.ArgumentParser(description='decode uWSGI binary request logs')
+    parser.add_argument('--csv', action='store_true', help='output CSV instead of JSON lines')
+    parser.add_argument('--fields', default='', help='comma separated names of the --log-format variables')
+    parser.add_argument('files', nargs='*')
+    args = parser.parse_args()
+
+    names = [n for n in args.fields.split(',') if n]
+    stdin = getattr(sys.stdin, 'buffer', sys.stdin)
+    files = [open(name, 'rb') for name in args.files] or [stdin]
+
+    writer = None
+    if args.csv:
+        columns = ['kind'] + list(FIXED) + names + ['line']
+        writer = csv.DictWriter(sys.stdout, fieldnames=columns, extrasaction='ignore')
+        writer.writeheader()
+
+    for f in files:
+        for record in records(f):
+            item = decode(record, names)
+            if writer:
+                writer.writerow(item)
+            else:
+                sys.stdout.write(json.dumps(item) + '\n')
+
+
+if __name__ == '__main__':
+    main()
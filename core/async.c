@@ -287,6 +287,16 @@ static int async_wait_fd_write(int fd, int timeout) {
 	return 1;
 }
 
+// async timers have a resolution of one second, the core is resumed at the first tick after the timeout
+static int async_wait_milliseconds(int timeout) {
+	struct wsgi_request *wsgi_req = current_wsgi_req();
+	if (!uwsgi.schedule_to_main) return uwsgi_simple_wait_milliseconds_hook(timeout);
+	async_add_timeout(wsgi_req, (timeout + 999) / 1000);
+	uwsgi.schedule_to_main(wsgi_req);
+	wsgi_req->async_timed_out = 0;
+	return 0;
+}
+
 void async_schedule_to_req(void) {
 #ifdef UWSGI_ROUTING
         if (uwsgi_apply_routes(uwsgi.wsgi_req) == UWSGI_ROUTE_BREAK) {
@@ -295,7 +305,12 @@ void async_schedule_to_req(void) {
 	// a trick to avoid calling routes again
 	uwsgi.wsgi_req->is_routing = 1;
 #endif
-        if (uwsgi.p[uwsgi.wsgi_req->uh->modifier1]->request(uwsgi.wsgi_req) <= UWSGI_OK) {
+	// this function is called again after every suspension
+	if (uwsgi.histogram_slots && !uwsgi.wsgi_req->app_start) uwsgi.wsgi_req->app_start = uwsgi_micros();
+	uint64_t span = uwsgi_span_begin();
+	int ret = uwsgi.p[uwsgi.wsgi_req->uh->modifier1]->request(uwsgi.wsgi_req);
+	uwsgi_span_end(uwsgi.wsgi_req, UWSGI_SPAN_APP, span);
+        if (ret <= UWSGI_OK) {
 		goto end;
 	}
 
@@ -319,8 +334,12 @@ void async_schedule_to_req_green(void) {
                 goto end;
         }
 #endif
+	if (uwsgi.histogram_slots) wsgi_req->app_start = uwsgi_micros();
         for(;;) {
-                if (uwsgi.p[wsgi_req->uh->modifier1]->request(wsgi_req) <= UWSGI_OK) {
+		uint64_t span = uwsgi_span_begin();
+		int ret = uwsgi.p[wsgi_req->uh->modifier1]->request(wsgi_req);
+		uwsgi_span_end(wsgi_req, UWSGI_SPAN_APP, span);
+                if (ret <= UWSGI_OK) {
                         break;
                 }
                 wsgi_req->switches++;
@@ -370,6 +389,7 @@ void async_loop() {
 
 	uwsgi.wait_write_hook = async_wait_fd_write;
         uwsgi.wait_read_hook = async_wait_fd_read;
+	uwsgi.wait_milliseconds_hook = async_wait_milliseconds;
 
 	if (uwsgi.signal_socket > -1) {
 		event_queue_add_fd_read(uwsgi.async_queue, uwsgi.signal_socket);
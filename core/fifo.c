@@ -73,6 +73,8 @@ void uwsgi_master_fifo_prepare() {
 	uwsgi_fifo_table['s'] = stats;
 	uwsgi_fifo_table['w'] = uwsgi_reload_workers;
 	uwsgi_fifo_table['W'] = uwsgi_brutally_reload_workers;
+	uwsgi_fifo_table['x'] = uwsgi_profiler_start;
+	uwsgi_fifo_table['X'] = uwsgi_profiler_stop;
 
 }
 
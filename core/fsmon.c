@@ -54,6 +54,17 @@ void uwsgi_fsmon_setup() {
 next:
                 usl = usl->next;
         }
+
+	usl = uwsgi.static_cache_fds_monitor;
+        while(usl) {
+                if (uwsgi_register_fsmon(usl)) {
+                        uwsgi_log("[uwsgi-fsmon] unable to register monitor for \"%s\"\n", usl->value);
+                }
+                else {
+                        uwsgi_log("[uwsgi-fsmon] registered monitor for \"%s\"\n", usl->value);
+                }
+                usl = usl->next;
+        }
 }
 
 
@@ -131,6 +142,14 @@ static struct uwsgi_string_list *uwsgi_fsmon_ack(int interesting_fd) {
                 }
                 usl = usl->next;
         }
+	usl = uwsgi.static_cache_fds_monitor;
+        while(usl) {
+                if ((int)usl->custom == interesting_fd) {
+                        found_fd = usl->custom;
+                        goto found;
+                }
+                usl = usl->next;
+        }
 found:
 	if (found_fd == -1) return NULL;
 #ifdef UWSGI_EVENT_FILEMONITOR_USE_INOTIFY
@@ -177,6 +196,14 @@ found:
                 usl = usl->next;
         }
 
+	usl = uwsgi.static_cache_fds_monitor;
+        while(usl) {
+                if ((int)usl->custom2 == found_fd) {
+                        return uwsgi.static_cache_fds_monitor;
+                }
+                usl = usl->next;
+        }
+
 	return NULL;
 }
 
@@ -207,6 +234,12 @@ int uwsgi_fsmon_event(int interesting_fd) {
                 return 1;
         }
 
+	// the workers will drop their open-file caches
+	if (usl == uwsgi.static_cache_fds_monitor) {
+		uwsgi.shared->static_cache_generation++;
+		return 1;
+	}
+
 	// fallback to signal
         uwsgi_route_signal(atoi(usl->custom_ptr));
 	return 1;
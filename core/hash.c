@@ -56,6 +56,62 @@ static uint32_t murmur2_hash(char *key, uint64_t keylen) {
 	return h;
 }
 
+// MurmurHash3 (x86, 32bit) by Austin Appleby (public domain)
+// this is not static as it is used (with a random seed) by the subscription system
+uint32_t murmur3_hash(char *key, uint64_t keylen, uint32_t seed) {
+
+	uint32_t h = seed, k;
+	uint8_t *ukey = (uint8_t *) key;
+	uint64_t len = keylen;
+
+	while (len >= 4) {
+		k  = ukey[0];
+		k |= (uint32_t) ukey[1] << 8;
+		k |= (uint32_t) ukey[2] << 16;
+		k |= (uint32_t) ukey[3] << 24;
+
+		k *= 0xcc9e2d51;
+		k = (k << 15) | (k >> 17);
+		k *= 0x1b873593;
+
+		h ^= k;
+		h = (h << 13) | (h >> 19);
+		h = h * 5 + 0xe6546b64;
+
+		ukey += 4;
+		len -= 4;
+	}
+
+	k = 0;
+	switch (len) {
+		case 3:
+			k ^= (uint32_t) ukey[2] << 16;
+			/* fallthrough */
+		case 2:
+			k ^= (uint32_t) ukey[1] << 8;
+			/* fallthrough */
+		case 1:
+			k ^= ukey[0];
+			k *= 0xcc9e2d51;
+			k = (k << 15) | (k >> 17);
+			k *= 0x1b873593;
+			h ^= k;
+	}
+
+	h ^= (uint32_t) keylen;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return h;
+}
+
+static uint32_t murmur3_hash0(char *key, uint64_t keylen) {
+	return murmur3_hash(key, keylen, 0);
+}
+
 static uint32_t random_hash(char *key, uint64_t keylen) {
 	return (uint32_t) rand();
 }
@@ -107,6 +163,7 @@ void uwsgi_hash_algo_register(char *name, uint32_t (*func)(char *, uint64_t)) {
 void uwsgi_hash_algo_register_all() {
 	uwsgi_hash_algo_register("djb33x", djb33x_hash);
 	uwsgi_hash_algo_register("murmur2", murmur2_hash);
+	uwsgi_hash_algo_register("murmur3", murmur3_hash0);
 	uwsgi_hash_algo_register("random", random_hash);
 	uwsgi_hash_algo_register("rand", random_hash);
 	uwsgi_hash_algo_register("rr", rr_hash);
@@ -72,6 +72,7 @@ void uwsgi_init_default() {
 	uwsgi.stats_fd = -1;
 
 	uwsgi.stats_pusher_default_freq = 3;
+	uwsgi.stats_pusher_refresh = 60;
 
 	uwsgi.original_log_fd = -1;
 
@@ -170,6 +171,7 @@ void uwsgi_init_default() {
 
 	uwsgi.wait_read_hook = uwsgi_simple_wait_read_hook;
 	uwsgi.wait_write_hook = uwsgi_simple_wait_write_hook;
+	uwsgi.wait_milliseconds_hook = uwsgi_simple_wait_milliseconds_hook;
 
 	uwsgi_websockets_init();
 	
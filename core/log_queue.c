@@ -0,0 +1,222 @@
+#include "uwsgi.h"
+
+extern struct uwsgi_server uwsgi;
+
+/*
+	asynchronous delivery for loggers supporting batches (--logger-queue)
+
+	loggers registered with uwsgi_register_logger_batch() get a bounded queue and a flush thread:
+	the master (or the threaded logger) only copies the message in the queue, while the thread
+	sends all of the queued messages (up to --logger-queue-batch) with a single call of the
+	batch function (sendmmsg for datagram loggers, pipelining for redis...).
+
+	When the queue is full the message is dropped (and accounted), unless --logger-queue-block is set.
+	Slots memory is reused, so no allocation happens at runtime.
+*/
+
+struct uwsgi_logger_queue_msg {
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+struct uwsgi_logger_queue {
+	struct uwsgi_logger *ul;
+	pthread_mutex_t lock;
+	// signaled when a message is queued
+	pthread_cond_t ready;
+	// signaled when slots are released
+	pthread_cond_t space;
+	uint64_t size;
+	uint64_t head;
+	uint64_t tail;
+	struct uwsgi_logger_queue_msg *msgs;
+	struct iovec *iov;
+	uint64_t drops;
+	uint64_t drops_reported;
+	uint64_t errors;
+	time_t last_report;
+	struct uwsgi_logger_queue *next;
+};
+
+static struct uwsgi_logger_queue *uwsgi_logger_queues;
+
+static void uwsgi_logger_queue_report(struct uwsgi_logger_queue *ulq) {
+	time_t now = uwsgi_now();
+	if (ulq->drops == ulq->drops_reported || now == ulq->last_report) return;
+	uint64_t drops = ulq->drops;
+	ulq->last_report = now;
+	// this message is queued too
+	uwsgi_log("[uwsgi-logger] %s: queue full, %llu messages dropped (%llu total)\n", ulq->ul->name,
+		(unsigned long long) (drops - ulq->drops_reported), (unsigned long long) drops);
+	ulq->drops_reported = drops;
+}
+
+// send the messages from tail to tail + n (the caller does not hold the lock)
+static void uwsgi_logger_queue_send(struct uwsgi_logger_queue *ulq, uint64_t tail, int n) {
+	int i;
+	for(i=0;i<n;i++) {
+		struct uwsgi_logger_queue_msg *msg = &ulq->msgs[(tail + i) % ulq->size];
+		ulq->iov[i].iov_base = msg->buf;
+		ulq->iov[i].iov_len = msg->len;
+	}
+	if (ulq->ul->batch_func(ulq->ul, ulq->iov, n) < 0) {
+		ulq->errors++;
+	}
+}
+
+static void *uwsgi_logger_queue_loop(void *arg) {
+	struct uwsgi_logger_queue *ulq = (struct uwsgi_logger_queue *) arg;
+
+	sigset_t smask;
+	sigfillset(&smask);
+	pthread_sigmask(SIG_BLOCK, &smask, NULL);
+
+	for(;;) {
+		pthread_mutex_lock(&ulq->lock);
+		while(ulq->head == ulq->tail) {
+			pthread_cond_wait(&ulq->ready, &ulq->lock);
+		}
+		// give the producer the time to fill the batch
+		if (uwsgi.log_queue_delay && ulq->head - ulq->tail < (uint64_t) uwsgi.log_queue_batch) {
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += (uwsgi.log_queue_delay % 1000) * 1000000;
+			ts.tv_sec += (uwsgi.log_queue_delay / 1000) + (ts.tv_nsec / 1000000000);
+			ts.tv_nsec %= 1000000000;
+			pthread_cond_timedwait(&ulq->ready, &ulq->lock, &ts);
+		}
+		uint64_t tail = ulq->tail;
+		uint64_t queued = ulq->head - tail;
+		int n = queued > (uint64_t) uwsgi.log_queue_batch ? uwsgi.log_queue_batch : (int) queued;
+		pthread_mutex_unlock(&ulq->lock);
+
+		// the producers never touch the slots between tail and head
+		uwsgi_logger_queue_send(ulq, tail, n);
+
+		pthread_mutex_lock(&ulq->lock);
+		ulq->tail += n;
+		pthread_cond_broadcast(&ulq->space);
+		pthread_mutex_unlock(&ulq->lock);
+
+		uwsgi_logger_queue_report(ulq);
+	}
+
+	return NULL;
+}
+
+static struct uwsgi_logger_queue *uwsgi_logger_queue_new(struct uwsgi_logger *ul) {
+	struct uwsgi_logger_queue *ulq = uwsgi_calloc(sizeof(struct uwsgi_logger_queue));
+	ulq->ul = ul;
+	ulq->size = uwsgi.log_queue_size;
+	ulq->msgs = uwsgi_calloc(sizeof(struct uwsgi_logger_queue_msg) * ulq->size);
+	ulq->iov = uwsgi_malloc(sizeof(struct iovec) * uwsgi.log_queue_batch);
+	pthread_mutex_init(&ulq->lock, NULL);
+	pthread_cond_init(&ulq->ready, NULL);
+	pthread_cond_init(&ulq->space, NULL);
+
+	pthread_t t;
+	if (pthread_create(&t, NULL, uwsgi_logger_queue_loop, ulq)) {
+		uwsgi_error("uwsgi_logger_queue_new()/pthread_create()");
+		free(ulq->iov);
+		free(ulq->msgs);
+		free(ulq);
+		return NULL;
+	}
+	pthread_detach(t);
+
+	ulq->next = uwsgi_logger_queues;
+	uwsgi_logger_queues = ulq;
+	return ulq;
+}
+
+/*
+	queue a message for the logger (the queue is created at the first message, in the logging process):
+	returns -1 when the logger has to be called directly
+*/
+int uwsgi_logger_queue_push(struct uwsgi_logger *ul, char *message, size_t len) {
+	if (!uwsgi.log_queue_size || !ul->batch_func) return -1;
+
+	if (!ul->queue) {
+		if (!uwsgi.log_queue_batch) uwsgi.log_queue_batch = 64;
+		if (uwsgi.log_queue_batch > UWSGI_LOGGER_BATCH_MAX) uwsgi.log_queue_batch = UWSGI_LOGGER_BATCH_MAX;
+		ul->queue = uwsgi_logger_queue_new(ul);
+		if (!ul->queue) {
+			// do not try again
+			ul->batch_func = NULL;
+			return -1;
+		}
+	}
+
+	struct uwsgi_logger_queue *ulq = ul->queue;
+	pthread_mutex_lock(&ulq->lock);
+	while(ulq->head - ulq->tail >= ulq->size) {
+		if (!uwsgi.log_queue_block) {
+			ulq->drops++;
+			pthread_mutex_unlock(&ulq->lock);
+			return 0;
+		}
+		pthread_cond_wait(&ulq->space, &ulq->lock);
+	}
+	struct uwsgi_logger_queue_msg *msg = &ulq->msgs[ulq->head % ulq->size];
+	if (msg->size < len) {
+		free(msg->buf);
+		msg->buf = uwsgi_malloc(len);
+		msg->size = len;
+	}
+	memcpy(msg->buf, message, len);
+	msg->len = len;
+	ulq->head++;
+	pthread_cond_signal(&ulq->ready);
+	pthread_mutex_unlock(&ulq->lock);
+	return 0;
+}
+
+/*
+	send n datagrams with the minimum number of syscalls (sendmmsg on Linux):
+	returns the number of datagrams sent or -1 on error
+*/
+int uwsgi_logger_send_datagrams(int fd, struct msghdr *msgs, int n) {
+	int i;
+#if defined(__linux__) && defined(MSG_WAITFORONE)
+	struct mmsghdr mmsgs[UWSGI_LOGGER_BATCH_MAX];
+	if (n > UWSGI_LOGGER_BATCH_MAX) n = UWSGI_LOGGER_BATCH_MAX;
+	for(i=0;i<n;i++) {
+		mmsgs[i].msg_hdr = msgs[i];
+		mmsgs[i].msg_len = 0;
+	}
+	int sent = 0;
+	while(sent < n) {
+		int ret = sendmmsg(fd, mmsgs + sent, n - sent, 0);
+		if (ret <= 0) {
+			if (ret < 0 && errno == EINTR) continue;
+			return sent > 0 ? sent : -1;
+		}
+		sent += ret;
+	}
+	return sent;
+#else
+	for(i=0;i<n;i++) {
+		if (sendmsg(fd, &msgs[i], 0) < 0) {
+			return i > 0 ? i : -1;
+		}
+	}
+	return n;
+#endif
+}
+
+// wait for the queues to be empty (max 1 second each), used on shutdown
+void uwsgi_logger_queues_flush() {
+	struct uwsgi_logger_queue *ulq = uwsgi_logger_queues;
+	while(ulq) {
+		int i;
+		for(i=0;i<100;i++) {
+			pthread_mutex_lock(&ulq->lock);
+			int empty = ulq->head == ulq->tail;
+			pthread_mutex_unlock(&ulq->lock);
+			if (empty) break;
+			usleep(10000);
+		}
+		ulq = ulq->next;
+	}
+}
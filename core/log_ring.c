@@ -0,0 +1,232 @@
+#include "uwsgi.h"
+
+extern struct uwsgi_server uwsgi;
+
+/*
+	shared memory rings for request logs (--log-master-ring)
+
+	every core of every worker has its own single-producer/single-consumer ring, so request log lines
+	are appended without syscalls and without locks. The consumer (the master or the threaded logger) drains
+	all of the rings, passing whole lines to the loggers. Lines are batched only when no per-line filtering is
+	configured and all of the loggers are streams (file, fd, pipe): message oriented loggers (syslog, socket,
+	graylog2...) get a line per call, as with the log pipe.
+
+	a record is a 32bit length followed by the line, padded to 8 bytes. When a record does not fit at the end
+	of the ring a wrap marker is written and the record starts again from the beginning.
+
+	The producer notifies the consumer (with a byte in log_ring_pipe) only when the consumer already drained
+	everything it wrote before: the store of head/tail and the load of the other index are separated by full
+	barriers, so at least one of the two sides always sees the other one.
+
+	When a ring is full the line is dropped (workers never block on logging) and the drop is accounted.
+*/
+
+#define UWSGI_LOG_RING_WRAP 0xffffffff
+#define UWSGI_LOG_RING_ALIGN(x) (((x) + 7) & ~((uint64_t) 7))
+
+static int uwsgi_log_ring_batch;
+
+// lines can be joined only for stream loggers, the others send a message for each call
+static int uwsgi_log_ring_stream_loggers(struct uwsgi_logger *ul) {
+	while(ul) {
+		if (!ul->id && strcmp(ul->name, "file") && strcmp(ul->name, "fd") && strcmp(ul->name, "pipe")) return 0;
+		ul = ul->next;
+	}
+	return 1;
+}
+
+static struct uwsgi_log_ring *uwsgi_log_ring_get(int wid, int core) {
+	return (struct uwsgi_log_ring *) (uwsgi.log_rings + (((wid - 1) * uwsgi.cores) + core) * (sizeof(struct uwsgi_log_ring) + uwsgi.log_master_ring));
+}
+
+void uwsgi_log_rings_init() {
+	int i, j;
+
+	if (!uwsgi.log_master_ring) return;
+
+	if (!uwsgi.log_master) {
+		uwsgi_log("--log-master-ring requires --log-master\n");
+		exit(1);
+	}
+
+	// power of two (min 16k), so offsets are simple masks
+	uint64_t size = 16384;
+	while(size < uwsgi.log_master_ring) size <<= 1;
+	uwsgi.log_master_ring = size;
+
+	uwsgi.log_rings = uwsgi_calloc_shared((sizeof(struct uwsgi_log_ring) + size) * uwsgi.numproc * uwsgi.cores);
+	for(i=1;i<=uwsgi.numproc;i++) {
+		for(j=0;j<uwsgi.cores;j++) {
+			uwsgi_log_ring_get(i, j)->size = size;
+		}
+	}
+
+	if (pipe(uwsgi.log_ring_pipe)) {
+		uwsgi_error("uwsgi_log_rings_init()/pipe()");
+		exit(1);
+	}
+	uwsgi_socket_nb(uwsgi.log_ring_pipe[0]);
+	uwsgi_socket_nb(uwsgi.log_ring_pipe[1]);
+
+	// checked on the first drain (with --daemonize2 the loggers are not configured yet)
+	uwsgi_log_ring_batch = -1;
+
+	uwsgi_log("request log rings: %llu bytes for each core (%llu KB total)\n", (unsigned long long) size,
+		(unsigned long long) (((sizeof(struct uwsgi_log_ring) + size) * uwsgi.numproc * uwsgi.cores) / 1024));
+}
+
+/*
+	append a log line (as an iovec) to the ring of the current core:
+	returns -1 when the line has to be written to the log pipe (rings not in use or line too big)
+*/
+int uwsgi_log_ring_push(struct wsgi_request *wsgi_req, struct iovec *iov, int iovcnt) {
+	int i;
+
+	if (!uwsgi.log_rings || uwsgi.mywid <= 0 || !wsgi_req) return -1;
+
+	struct uwsgi_log_ring *ring = uwsgi_log_ring_get(uwsgi.mywid, wsgi_req->async_id);
+
+	size_t len = 0;
+	for(i=0;i<iovcnt;i++) len += iov[i].iov_len;
+
+	uint64_t need = UWSGI_LOG_RING_ALIGN(4 + len);
+	if (need > ring->size / 2) return -1;
+
+	uint64_t head = ring->head;
+	uint64_t tail = ring->tail;
+	__sync_synchronize();
+	uint64_t off = head & (ring->size - 1);
+	uint64_t contiguous = ring->size - off;
+	uint64_t total = contiguous < need ? contiguous + need : need;
+
+	if (ring->size - (head - tail) < total) {
+		ring->drops++;
+		return 0;
+	}
+
+	if (contiguous < need) {
+		uint32_t wrap = UWSGI_LOG_RING_WRAP;
+		memcpy(ring->buf + off, &wrap, 4);
+		off = 0;
+	}
+
+	uint32_t len32 = len;
+	memcpy(ring->buf + off, &len32, 4);
+	char *ptr = ring->buf + off + 4;
+	for(i=0;i<iovcnt;i++) {
+		memcpy(ptr, iov[i].iov_base, iov[i].iov_len);
+		ptr += iov[i].iov_len;
+	}
+
+	// publish the record
+	__sync_synchronize();
+	ring->head = head + total;
+	ring->records++;
+	__sync_synchronize();
+
+	// the consumer could be sleeping
+	if (ring->tail == head) {
+		if (write(uwsgi.log_ring_pipe[1], "", 1) < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+			uwsgi_error("uwsgi_log_ring_push()/write()");
+		}
+	}
+	return 0;
+}
+
+static void uwsgi_log_ring_dispatch(char *buf, size_t len) {
+	if (uwsgi.req_log_master) {
+		uwsgi_master_req_log_do(buf, len);
+	}
+	else {
+		uwsgi_master_log_do(buf, len);
+	}
+}
+
+static void uwsgi_log_ring_drain(int wid, int core, struct uwsgi_log_ring *ring) {
+	size_t batched = 0;
+	uint64_t tail = ring->tail;
+	uint64_t mask = ring->size - 1;
+
+	for(;;) {
+		uint64_t head = ring->head;
+		__sync_synchronize();
+		while(tail < head) {
+			uint64_t off = tail & mask;
+			uint32_t len;
+			memcpy(&len, ring->buf + off, 4);
+			if (len == UWSGI_LOG_RING_WRAP) {
+				tail += ring->size - off;
+				continue;
+			}
+			char *line = ring->buf + off + 4;
+			if (uwsgi_log_ring_batch && len <= uwsgi.log_master_bufsize) {
+				if (batched + len > uwsgi.log_master_bufsize) {
+					uwsgi_log_ring_dispatch(uwsgi.log_master_buf, batched);
+					batched = 0;
+				}
+				memcpy(uwsgi.log_master_buf + batched, line, len);
+				batched += len;
+			}
+			else {
+				uwsgi_log_ring_dispatch(line, len);
+			}
+			tail += UWSGI_LOG_RING_ALIGN(4 + len);
+		}
+		// release the space
+		__sync_synchronize();
+		ring->tail = tail;
+		__sync_synchronize();
+		if (ring->head == tail) break;
+	}
+
+	if (batched > 0) {
+		uwsgi_log_ring_dispatch(uwsgi.log_master_buf, batched);
+	}
+
+	if (ring->drops != ring->drops_reported) {
+		uint64_t drops = ring->drops;
+		uwsgi_log("*** request log ring of worker %d core %d is full: %llu lines dropped (%llu total) ***\n", wid, core,
+			(unsigned long long) (drops - ring->drops_reported), (unsigned long long) drops);
+		ring->drops_reported = drops;
+	}
+}
+
+// called by the consumer (notified is set when a notification has been received)
+void uwsgi_log_rings_drain(int notified) {
+	int i, j;
+	char buf[4096];
+
+	if (!uwsgi.log_rings) return;
+
+	// regexps and encoders work on single lines
+	if (uwsgi_log_ring_batch < 0) {
+		if (uwsgi.req_log_master) {
+			uwsgi_log_ring_batch = !uwsgi.requested_log_req_encoders && !uwsgi.log_req_route && uwsgi_log_ring_stream_loggers(uwsgi.choosen_req_logger);
+		}
+		else {
+			uwsgi_log_ring_batch = !uwsgi.requested_log_encoders && !uwsgi.log_route && !uwsgi.log_drain_rules && !uwsgi.log_filter_rules && !uwsgi.alarm_logs_list && uwsgi_log_ring_stream_loggers(uwsgi.choosen_logger);
+		}
+	}
+
+	if (notified) {
+		while(read(uwsgi.log_ring_pipe[0], buf, 4096) > 0);
+	}
+
+	for(i=1;i<=uwsgi.numproc;i++) {
+		for(j=0;j<uwsgi.cores;j++) {
+			uwsgi_log_ring_drain(i, j, uwsgi_log_ring_get(i, j));
+		}
+	}
+}
+
+void uwsgi_log_ring_stats(int wid, uint64_t *records, uint64_t *drops) {
+	int i;
+	*records = 0;
+	*drops = 0;
+	if (!uwsgi.log_rings) return;
+	for(i=0;i<uwsgi.cores;i++) {
+		struct uwsgi_log_ring *ring = uwsgi_log_ring_get(wid, i);
+		*records += ring->records;
+		*drops += ring->drops;
+	}
+}
@@ -725,7 +725,9 @@ void uwsgi_logit_simple(struct wsgi_request *wsgi_req) {
 	logvec[logvecpos].iov_len = rlen;
 
 	// do not check for errors
-	rlen = writev(uwsgi.req_log_fd, logvec, logvecpos + 1);
+	if (uwsgi_log_ring_push(wsgi_req, logvec, logvecpos + 1)) {
+		rlen = writev(uwsgi.req_log_fd, logvec, logvecpos + 1);
+	}
 }
 
 void get_memusage(uint64_t * rss, uint64_t * vsz) {
@@ -866,8 +868,11 @@ void uwsgi_register_logger(char *name, ssize_t(*func) (struct uwsgi_logger *, ch
 
 	ul->name = name;
 	ul->func = func;
+	ul->batch_func = NULL;
+	ul->queue = NULL;
 	ul->next = NULL;
 	ul->configured = 0;
+	ul->count = 0;
 	ul->fd = -1;
 	ul->data = NULL;
 	ul->buf = NULL;
@@ -878,6 +883,13 @@ void uwsgi_register_logger(char *name, ssize_t(*func) (struct uwsgi_logger *, ch
 #endif
 }
 
+// register a logger able to send multiple messages with a single call (see --logger-queue)
+void uwsgi_register_logger_batch(char *name, ssize_t(*func) (struct uwsgi_logger *, char *, size_t), ssize_t(*batch_func) (struct uwsgi_logger *, struct iovec *, int)) {
+	uwsgi_register_logger(name, func);
+	struct uwsgi_logger *ul = uwsgi_get_logger(name);
+	if (ul) ul->batch_func = batch_func;
+}
+
 void uwsgi_append_logger(struct uwsgi_logger *ul) {
 
 	if (!uwsgi.choosen_logger) {
@@ -940,79 +952,398 @@ struct uwsgi_logger *uwsgi_get_logger_from_id(char *id) {
 }
 
 
-void uwsgi_logit_lf(struct wsgi_request *wsgi_req) {
-	struct uwsgi_logchunk *logchunk = uwsgi.logchunks;
-	ssize_t rlen = 0;
-	const char *empty_var = "-";
-	while (logchunk) {
-		int pos = logchunk->vec;
-		// raw string
-		if (logchunk->type == 0) {
-			uwsgi.logvectors[wsgi_req->async_id][pos].iov_base = logchunk->ptr;
-			uwsgi.logvectors[wsgi_req->async_id][pos].iov_len = logchunk->len;
-		}
-		// offsetof
-		else if (logchunk->type == 1) {
-			char **var = (char **) (((char *) wsgi_req) + logchunk->pos);
-			uint16_t *varlen = (uint16_t *) (((char *) wsgi_req) + logchunk->pos_len);
-			uwsgi.logvectors[wsgi_req->async_id][pos].iov_base = *var;
-			uwsgi.logvectors[wsgi_req->async_id][pos].iov_len = *varlen;
+/*
+	the log format is compiled (see uwsgi_compile_log_format()) into a flat array of ops
+	writing directly in a per-core buffer: numbers are formatted in place and
+	the timestamps are rendered only once per second, so no memory is allocated for each request
+*/
+
+static char *uwsgi_lf_copy(char *dst, char *end, char *src, size_t len) {
+	if (len > (size_t) (end - dst)) len = end - dst;
+	memcpy(dst, src, len);
+	return dst + len;
+}
+
+// escape the value for a JSON string (control chars, quotes and backslashes)
+static char *uwsgi_lf_copy_json(char *dst, char *end, char *src, size_t len) {
+	static const char hex[] = "0123456789abcdef";
+	size_t i;
+	for(i=0;i<len;i++) {
+		unsigned char c = (unsigned char) src[i];
+		if (c == '"' || c == '\\') {
+			if (end - dst < 2) break;
+			*dst++ = '\\';
+			*dst++ = c;
+		}
+		else if (c < 0x20) {
+			if (end - dst < 6) break;
+			memcpy(dst, "\\u00", 4);
+			dst[4] = hex[c >> 4];
+			dst[5] = hex[c & 0xf];
+			dst += 6;
 		}
-		// logvar
-		else if (logchunk->type == 2) {
-			struct uwsgi_logvar *lv = uwsgi_logvar_get(wsgi_req, logchunk->ptr, logchunk->len);
-			if (lv) {
-				uwsgi.logvectors[wsgi_req->async_id][pos].iov_base = lv->val;
-				uwsgi.logvectors[wsgi_req->async_id][pos].iov_len = lv->vallen;
+		else {
+			if (dst >= end) break;
+			*dst++ = c;
+		}
+	}
+	return dst;
+}
+
+// the metrics are resolved to a handle at the first use (in each process)
+static int64_t uwsgi_lf_metric(struct uwsgi_logchunk *op) {
+	if (!op->metric) {
+		op->metric = uwsgi_metric_handle(op->ptr, NULL);
+	}
+	return uwsgi_metric_get_handle(op->metric);
+}
+
+static char *uwsgi_lf_num(char *dst, char *end, int64_t n) {
+	char tmp[sizeof(UMAX64_STR)+1];
+	char *ptr = tmp + sizeof(tmp);
+	uint64_t u = n < 0 ? -((uint64_t) n) : (uint64_t) n;
+	do {
+		*--ptr = '0' + (u % 10);
+		u /= 10;
+	} while(u);
+	if (n < 0) *--ptr = '-';
+	return uwsgi_lf_copy(dst, end, ptr, (tmp + sizeof(tmp)) - ptr);
+}
+
+// ltime, ftime and ctime are rendered again only when the second changes
+static struct uwsgi_logformat_time *uwsgi_lf_time_cached(struct uwsgi_logformat_core *ulc, struct uwsgi_logchunk *op, time_t t) {
+	struct uwsgi_logformat_time *ult = &ulc->times[op->slot];
+	if (ult->len > 0 && ult->t == t) return ult;
+	struct tm tm;
+	ult->len = 0;
+	if (op->type == 8) {
+#if defined(__sun__) && !defined(__clang__)
+		ctime_r(&t, ult->buf, 26);
+#else
+		ctime_r(&t, ult->buf);
+#endif
+		ult->len = 24;
+	}
+	else {
+		char *fmt = "%d/%b/%Y:%H:%M:%S %z";
+		if (op->type == 7 && uwsgi.log_strftime) fmt = uwsgi.log_strftime;
+		ult->len = strftime(ult->buf, sizeof(ult->buf), fmt, localtime_r(&t, &tm));
+	}
+	ult->t = t;
+	return ult;
+}
+
+// with --log-format-strftime only the raw strings are strftime() formats (never the values of the variables),
+// they are expanded again only when the second changes
+static void uwsgi_lf_strftime_literals(struct uwsgi_logformat_core *ulc, time_t t) {
+	if (ulc->literals_t == t) return;
+	struct tm tm;
+	localtime_r(&t, &tm);
+	char *dst = ulc->strftime_buf;
+	size_t avail = uwsgi.logformat_bufsize;
+	int i;
+	for(i=0;i<uwsgi.logformat_ops_cnt;i++) {
+		struct uwsgi_logchunk *op = &uwsgi.logformat_ops[i];
+		if (op->type != 0) continue;
+		struct iovec *iov = &ulc->literals[op->slot];
+		size_t rlen = op->len > 0 ? strftime(dst, avail, op->ptr, &tm) : 0;
+		if (rlen == 0) {
+			// empty or too big, use it as is
+			iov->iov_base = op->ptr;
+			iov->iov_len = op->len;
+			continue;
+		}
+		iov->iov_base = dst;
+		iov->iov_len = rlen;
+		dst += rlen;
+		avail -= rlen;
+	}
+	ulc->literals_t = t;
+}
+
+// run the compiled format, returns the size of the line (the newline is always appended)
+static size_t uwsgi_lf_render(struct wsgi_request *wsgi_req, char *buf) {
+	struct uwsgi_logformat_core *ulc = &uwsgi.logformat_cores[wsgi_req->async_id];
+	char *dst = buf;
+	// always leave space for the newline
+	char *end = buf + uwsgi.logformat_bufsize - 1;
+	int i;
+
+	if (ulc->literals) {
+		uwsgi_lf_strftime_literals(ulc, (time_t) (wsgi_req->start_of_request / 1000000));
+	}
+
+	for(i=0;i<uwsgi.logformat_ops_cnt;i++) {
+		struct uwsgi_logchunk *op = &uwsgi.logformat_ops[i];
+		char *value = NULL;
+		size_t value_len = 0;
+		char *func_buf = NULL;
+		switch(op->type) {
+			// raw string
+			case 0:
+				if (ulc->literals) {
+					dst = uwsgi_lf_copy(dst, end, ulc->literals[op->slot].iov_base, ulc->literals[op->slot].iov_len);
+					continue;
+				}
+				dst = uwsgi_lf_copy(dst, end, op->ptr, op->len);
+				continue;
+			// offsetof
+			case 1:
+				value = *((char **) (((char *) wsgi_req) + op->pos));
+				value_len = *((uint16_t *) (((char *) wsgi_req) + op->pos_len));
+				break;
+			// logvar
+			case 2: {
+				struct uwsgi_logvar *lv = uwsgi_logvar_get(wsgi_req, op->ptr, op->len);
+				if (lv) {
+					value = lv->val;
+					value_len = lv->vallen;
+				}
+				break;
 			}
-			else {
-				uwsgi.logvectors[wsgi_req->async_id][pos].iov_base = NULL;
-				uwsgi.logvectors[wsgi_req->async_id][pos].iov_len = 0;
+			// func (allocating the value)
+			case 3: {
+				ssize_t rlen = op->func(wsgi_req, &func_buf);
+				if (rlen > 0) {
+					value = func_buf;
+					value_len = rlen;
+				}
+				break;
+			}
+			// metric
+			case 4:
+				dst = uwsgi_lf_num(dst, end, uwsgi_lf_metric(op));
+				continue;
+			// number
+			case 5:
+				dst = uwsgi_lf_num(dst, end, op->num(wsgi_req));
+				continue;
+			// ltime, ftime, ctime
+			case 6:
+			case 7:
+			case 8: {
+				struct uwsgi_logformat_time *ult = uwsgi_lf_time_cached(ulc, op, op->type == 8 ? (time_t) wsgi_req->start_of_request_in_sec : (time_t) (wsgi_req->start_of_request / 1000000));
+				value = ult->buf;
+				value_len = ult->len;
+				break;
 			}
+			default:
+				break;
+		}
+
+		if (value_len == 0) {
+			dst = uwsgi_lf_copy(dst, end, "-", 1);
+		}
+		else if (uwsgi.logformat_json) {
+			dst = uwsgi_lf_copy_json(dst, end, value, value_len);
+		}
+		else {
+			dst = uwsgi_lf_copy(dst, end, value, value_len);
 		}
-		// func
-		else if (logchunk->type == 3) {
-			rlen = logchunk->func(wsgi_req, (char **) &uwsgi.logvectors[wsgi_req->async_id][pos].iov_base);
-			if (rlen > 0) {
-				uwsgi.logvectors[wsgi_req->async_id][pos].iov_len = rlen;
+
+		if (func_buf) free(func_buf);
+	}
+
+	*dst++ = '\n';
+	return dst - buf;
+}
+
+static void uwsgi_lf_write(struct wsgi_request *wsgi_req, char *buf, size_t len) {
+	struct iovec iov;
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	// do not check for errors
+	if (uwsgi_log_ring_push(wsgi_req, &iov, 1)) {
+		if (write(uwsgi.req_log_fd, buf, len) < 0) {
+			// nothing to do
+		}
+	}
+}
+
+void uwsgi_logit_lf(struct wsgi_request *wsgi_req) {
+	char *buf = uwsgi.logformat_cores[wsgi_req->async_id].buf;
+	uwsgi_lf_write(wsgi_req, buf, uwsgi_lf_render(wsgi_req, buf));
+}
+
+/*
+	binary request logs (--log-format-binary)
+
+	every record is little endian and starts with its size, so a stream of records can be split without parsing:
+
+	uint16 record size (including this field)
+	uint8  kind (1: request, 2: text line, see the "binary" log encoder)
+	uint8  number of fields
+	uint64 start of the request (microseconds since the epoch)
+	uint32 duration (microseconds)
+	uint16 status
+	uint16 worker id
+	uint16 core id
+	uint32 headers size
+	uint64 response size
+
+	followed by the variables of --log-format (raw text is skipped), each one prefixed by its type:
+	's' + uint16 length + bytes or 'i' + int64
+*/
+
+#define UWSGI_BINLOG_HEADER 34
+
+static char *uwsgi_binlog_u16(char *dst, uint16_t n) {
+	dst[0] = n & 0xff;
+	dst[1] = (n >> 8) & 0xff;
+	return dst + 2;
+}
+
+static char *uwsgi_binlog_u32(char *dst, uint32_t n) {
+	dst = uwsgi_binlog_u16(dst, n & 0xffff);
+	return uwsgi_binlog_u16(dst, (n >> 16) & 0xffff);
+}
+
+static char *uwsgi_binlog_u64(char *dst, uint64_t n) {
+	dst = uwsgi_binlog_u32(dst, n & 0xffffffff);
+	return uwsgi_binlog_u32(dst, (n >> 32) & 0xffffffff);
+}
+
+static size_t uwsgi_lf_render_binary(struct wsgi_request *wsgi_req, char *buf) {
+	struct uwsgi_logformat_core *ulc = &uwsgi.logformat_cores[wsgi_req->async_id];
+	char *end = buf + uwsgi.logformat_bufsize;
+	char *dst = buf + 2;
+	int i;
+	uint8_t fields = 0;
+
+	*dst++ = 1;
+	// number of fields, set later
+	dst++;
+	dst = uwsgi_binlog_u64(dst, wsgi_req->start_of_request);
+	dst = uwsgi_binlog_u32(dst, wsgi_req->end_of_request - wsgi_req->start_of_request);
+	dst = uwsgi_binlog_u16(dst, wsgi_req->status);
+	dst = uwsgi_binlog_u16(dst, uwsgi.mywid);
+	dst = uwsgi_binlog_u16(dst, wsgi_req->async_id);
+	dst = uwsgi_binlog_u32(dst, wsgi_req->headers_size);
+	dst = uwsgi_binlog_u64(dst, wsgi_req->response_size);
+
+	for(i=0;i<uwsgi.logformat_ops_cnt && fields < 255;i++) {
+		struct uwsgi_logchunk *op = &uwsgi.logformat_ops[i];
+		char *value = NULL;
+		size_t value_len = 0;
+		char *func_buf = NULL;
+		int64_t num;
+		switch(op->type) {
+			case 0:
+				continue;
+			case 1:
+				value = *((char **) (((char *) wsgi_req) + op->pos));
+				value_len = *((uint16_t *) (((char *) wsgi_req) + op->pos_len));
+				break;
+			case 2: {
+				struct uwsgi_logvar *lv = uwsgi_logvar_get(wsgi_req, op->ptr, op->len);
+				if (lv) {
+					value = lv->val;
+					value_len = lv->vallen;
+				}
+				break;
 			}
-			else {
-				uwsgi.logvectors[wsgi_req->async_id][pos].iov_len = 0;
+			case 3: {
+				ssize_t rlen = op->func(wsgi_req, &func_buf);
+				if (rlen > 0) {
+					value = func_buf;
+					value_len = rlen;
+				}
+				break;
+			}
+			case 4:
+			case 5:
+				num = op->type == 4 ? uwsgi_lf_metric(op) : op->num(wsgi_req);
+				if (end - dst < 9) goto full;
+				*dst++ = 'i';
+				dst = uwsgi_binlog_u64(dst, (uint64_t) num);
+				fields++;
+				continue;
+			case 6:
+			case 7:
+			case 8: {
+				struct uwsgi_logformat_time *ult = uwsgi_lf_time_cached(ulc, op, op->type == 8 ? (time_t) wsgi_req->start_of_request_in_sec : (time_t) (wsgi_req->start_of_request / 1000000));
+				value = ult->buf;
+				value_len = ult->len;
+				break;
 			}
+			default:
+				continue;
 		}
-		// metric
-		else if (logchunk->type == 4) {
-			int64_t metric = uwsgi_metric_get(logchunk->ptr, NULL);
-			uwsgi.logvectors[wsgi_req->async_id][pos].iov_base = uwsgi_64bit2str(metric);
-			uwsgi.logvectors[wsgi_req->async_id][pos].iov_len = strlen(uwsgi.logvectors[wsgi_req->async_id][pos].iov_base);
+		if (end - dst < 3) {
+			if (func_buf) free(func_buf);
+			goto full;
 		}
+		// truncate the value to the available space
+		if (value_len > (size_t) (end - dst) - 3) value_len = (end - dst) - 3;
+		*dst++ = 's';
+		dst = uwsgi_binlog_u16(dst, value_len);
+		memcpy(dst, value, value_len);
+		dst += value_len;
+		fields++;
+		if (func_buf) free(func_buf);
+	}
+full:
+	uwsgi_binlog_u16(buf, dst - buf);
+	buf[3] = fields;
+	return dst - buf;
+}
 
-		if (uwsgi.logvectors[wsgi_req->async_id][pos].iov_len == 0 && logchunk->type != 0) {
-			uwsgi.logvectors[wsgi_req->async_id][pos].iov_base = (char *) empty_var;
-			uwsgi.logvectors[wsgi_req->async_id][pos].iov_len = 1;	
-		}
+void uwsgi_logit_lf_binary(struct wsgi_request *wsgi_req) {
+	char *buf = uwsgi.logformat_cores[wsgi_req->async_id].buf;
+	uwsgi_lf_write(wsgi_req, buf, uwsgi_lf_render_binary(wsgi_req, buf));
+}
+
+// flatten the chunks in an array of ops and allocate the per-core buffers
+void uwsgi_compile_log_format() {
+	int i;
+	struct uwsgi_logchunk *logchunk = uwsgi.logchunks;
+	while(logchunk) {
+		uwsgi.logformat_ops_cnt++;
 		logchunk = logchunk->next;
 	}
 
-	// do not check for errors
-	rlen = writev(uwsgi.req_log_fd, uwsgi.logvectors[wsgi_req->async_id], uwsgi.logformat_vectors);
+	if (!uwsgi.logformat_bufsize) uwsgi.logformat_bufsize = 4096;
+	if (uwsgi.logformat_binary) {
+		// the record size is 16bit
+		if (uwsgi.logformat_bufsize > 65535) uwsgi.logformat_bufsize = 65535;
+		if (uwsgi.logformat_bufsize < UWSGI_BINLOG_HEADER) uwsgi.logformat_bufsize = UWSGI_BINLOG_HEADER;
+	}
 
-	// free allocated memory
+	uwsgi.logformat_ops = uwsgi_calloc(sizeof(struct uwsgi_logchunk) * (uwsgi.logformat_ops_cnt + 1));
+	int slots = 0;
+	int literals = 0;
+	int use_strftime = uwsgi.logformat_strftime && !uwsgi.logformat_binary;
+	i = 0;
 	logchunk = uwsgi.logchunks;
-	while (logchunk) {
-		if (logchunk->free) {
-			if (uwsgi.logvectors[wsgi_req->async_id][logchunk->vec].iov_len > 0) {
-				if (uwsgi.logvectors[wsgi_req->async_id][logchunk->vec].iov_base != empty_var) {
-					free(uwsgi.logvectors[wsgi_req->async_id][logchunk->vec].iov_base);
-				}
-			}
+	while(logchunk) {
+		if (logchunk->type >= 6 && logchunk->type <= 8) {
+			logchunk->slot = slots++;
+		}
+		else if (logchunk->type == 0 && use_strftime) {
+			logchunk->slot = literals++;
 		}
+		memcpy(&uwsgi.logformat_ops[i], logchunk, sizeof(struct uwsgi_logchunk));
+		uwsgi.logformat_ops[i].next = NULL;
+		// strftime() needs a string
+		if (logchunk->type == 0 && use_strftime) {
+			uwsgi.logformat_ops[i].ptr = uwsgi_concat2n(logchunk->ptr, logchunk->len, "", 0);
+		}
+		i++;
 		logchunk = logchunk->next;
 	}
-}
 
-void uwsgi_logit_lf_strftime(struct wsgi_request *wsgi_req) {
-	uwsgi_log("lf strftime\n");
+	uwsgi.logformat_cores = uwsgi_calloc(sizeof(struct uwsgi_logformat_core) * uwsgi.cores);
+	for(i=0;i<uwsgi.cores;i++) {
+		uwsgi.logformat_cores[i].buf = uwsgi_malloc(uwsgi.logformat_bufsize);
+		if (literals > 0) {
+			uwsgi.logformat_cores[i].strftime_buf = uwsgi_malloc(uwsgi.logformat_bufsize);
+			uwsgi.logformat_cores[i].literals = uwsgi_calloc(sizeof(struct iovec) * literals);
+			uwsgi.logformat_cores[i].literals_t = -1;
+		}
+		if (slots > 0) {
+			uwsgi.logformat_cores[i].times = uwsgi_calloc(sizeof(struct uwsgi_logformat_time) * slots);
+		}
+	}
 }
 
 void uwsgi_build_log_format(char *format) {
@@ -1065,152 +1396,125 @@ void uwsgi_build_log_format(char *format) {
 
 }
 
-static ssize_t uwsgi_lf_status(struct wsgi_request *wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->status);
-	return strlen(*buf);
+static int64_t uwsgi_lf_status(struct wsgi_request *wsgi_req) {
+	return wsgi_req->status;
 }
 
-
-static ssize_t uwsgi_lf_rsize(struct wsgi_request *wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->response_size);
-	return strlen(*buf);
+static int64_t uwsgi_lf_rsize(struct wsgi_request *wsgi_req) {
+	return wsgi_req->response_size;
 }
 
-static ssize_t uwsgi_lf_hsize(struct wsgi_request *wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->headers_size);
-	return strlen(*buf);
+static int64_t uwsgi_lf_hsize(struct wsgi_request *wsgi_req) {
+	return wsgi_req->headers_size;
 }
 
-static ssize_t uwsgi_lf_size(struct wsgi_request *wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->headers_size+wsgi_req->response_size);
-	return strlen(*buf);
+static int64_t uwsgi_lf_size(struct wsgi_request *wsgi_req) {
+	return wsgi_req->headers_size+wsgi_req->response_size;
 }
 
-static ssize_t uwsgi_lf_cl(struct wsgi_request *wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->post_cl);
-	return strlen(*buf);
+static int64_t uwsgi_lf_cl(struct wsgi_request *wsgi_req) {
+	return wsgi_req->post_cl;
 }
 
-
-static ssize_t uwsgi_lf_epoch(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(uwsgi_now());
-	return strlen(*buf);
+static int64_t uwsgi_lf_epoch(struct wsgi_request * wsgi_req) {
+	return uwsgi_now();
 }
 
-static ssize_t uwsgi_lf_ctime(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_malloc(26);
-#if defined(__sun__) && !defined(__clang__)
-	ctime_r((const time_t *) &wsgi_req->start_of_request_in_sec, *buf, 26);
-#else
-	ctime_r((const time_t *) &wsgi_req->start_of_request_in_sec, *buf);
-#endif
-	return 24;
+static int64_t uwsgi_lf_time(struct wsgi_request * wsgi_req) {
+	return wsgi_req->start_of_request / 1000000;
 }
 
-static ssize_t uwsgi_lf_time(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->start_of_request / 1000000);
-	return strlen(*buf);
+static int64_t uwsgi_lf_micros(struct wsgi_request * wsgi_req) {
+	return wsgi_req->end_of_request - wsgi_req->start_of_request;
 }
 
-
-static ssize_t uwsgi_lf_ltime(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_malloc(64);
-	time_t now = wsgi_req->start_of_request / 1000000;
-	size_t ret = strftime(*buf, 64, "%d/%b/%Y:%H:%M:%S %z", localtime(&now));
-	if (ret == 0) {
-		*buf[0] = 0;
-		return 0;
-	}
-	return ret;
+static int64_t uwsgi_lf_msecs(struct wsgi_request * wsgi_req) {
+	return (wsgi_req->end_of_request - wsgi_req->start_of_request) / 1000;
 }
 
-static ssize_t uwsgi_lf_ftime(struct wsgi_request * wsgi_req, char **buf) {
-	if (!uwsgi.log_strftime) {
-		return uwsgi_lf_ltime(wsgi_req, buf);
-	}
-	*buf = uwsgi_malloc(64);
-	time_t now = wsgi_req->start_of_request / 1000000;
-	size_t ret = strftime(*buf, 64, uwsgi.log_strftime, localtime(&now));
-	if (ret == 0) {
-		*buf[0] = 0;
-		return 0;
-	}
-	return ret;
+static int64_t uwsgi_lf_pid(struct wsgi_request * wsgi_req) {
+	return uwsgi.mypid;
 }
 
-static ssize_t uwsgi_lf_micros(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->end_of_request - wsgi_req->start_of_request);
-	return strlen(*buf);
+static int64_t uwsgi_lf_wid(struct wsgi_request * wsgi_req) {
+	return uwsgi.mywid;
 }
 
-static ssize_t uwsgi_lf_msecs(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str((wsgi_req->end_of_request - wsgi_req->start_of_request) / 1000);
-	return strlen(*buf);
+static int64_t uwsgi_lf_switches(struct wsgi_request * wsgi_req) {
+	return wsgi_req->switches;
 }
 
-static ssize_t uwsgi_lf_pid(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(uwsgi.mypid);
-	return strlen(*buf);
+static int64_t uwsgi_lf_vars(struct wsgi_request * wsgi_req) {
+	return wsgi_req->var_cnt;
 }
 
-static ssize_t uwsgi_lf_wid(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(uwsgi.mywid);
-	return strlen(*buf);
+static int64_t uwsgi_lf_core(struct wsgi_request * wsgi_req) {
+	return wsgi_req->async_id;
 }
 
-static ssize_t uwsgi_lf_switches(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->switches);
-	return strlen(*buf);
+static int64_t uwsgi_lf_vsz(struct wsgi_request * wsgi_req) {
+	return uwsgi.workers[uwsgi.mywid].vsz_size;
 }
 
-static ssize_t uwsgi_lf_vars(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->var_cnt);
-	return strlen(*buf);
+static int64_t uwsgi_lf_rss(struct wsgi_request * wsgi_req) {
+	return uwsgi.workers[uwsgi.mywid].rss_size;
 }
 
-static ssize_t uwsgi_lf_core(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->async_id);
-	return strlen(*buf);
+static int64_t uwsgi_lf_vszM(struct wsgi_request * wsgi_req) {
+	return uwsgi.workers[uwsgi.mywid].vsz_size / 1024 / 1024;
 }
 
-static ssize_t uwsgi_lf_vsz(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(uwsgi.workers[uwsgi.mywid].vsz_size);
-	return strlen(*buf);
+static int64_t uwsgi_lf_rssM(struct wsgi_request * wsgi_req) {
+	return uwsgi.workers[uwsgi.mywid].rss_size / 1024 / 1024;
 }
 
-static ssize_t uwsgi_lf_rss(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(uwsgi.workers[uwsgi.mywid].rss_size);
-	return strlen(*buf);
+static int64_t uwsgi_lf_pktsize(struct wsgi_request * wsgi_req) {
+	return wsgi_req->uh->pktsize;
 }
 
-static ssize_t uwsgi_lf_vszM(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(uwsgi.workers[uwsgi.mywid].vsz_size / 1024 / 1024);
-	return strlen(*buf);
+static int64_t uwsgi_lf_modifier1(struct wsgi_request * wsgi_req) {
+	return wsgi_req->uh->modifier1;
 }
 
-static ssize_t uwsgi_lf_rssM(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(uwsgi.workers[uwsgi.mywid].rss_size / 1024 / 1024);
-	return strlen(*buf);
+static int64_t uwsgi_lf_modifier2(struct wsgi_request * wsgi_req) {
+	return wsgi_req->uh->modifier2;
 }
 
-static ssize_t uwsgi_lf_pktsize(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->uh->pktsize);
-	return strlen(*buf);
+static int64_t uwsgi_lf_headers(struct wsgi_request * wsgi_req) {
+	return wsgi_req->header_cnt;
 }
 
-static ssize_t uwsgi_lf_modifier1(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->uh->modifier1);
-	return strlen(*buf);
+// tracing spans (in microseconds)
+#define uwsgi_lf_span(x, y) static int64_t uwsgi_lf_span_##x(struct wsgi_request * wsgi_req) {\
+	return wsgi_req->spans[y] / 1000;\
 }
+uwsgi_lf_span(accept, UWSGI_SPAN_ACCEPT)
+uwsgi_lf_span(read, UWSGI_SPAN_READ)
+uwsgi_lf_span(vars, UWSGI_SPAN_VARS)
+uwsgi_lf_span(routing, UWSGI_SPAN_ROUTING)
+uwsgi_lf_span(app, UWSGI_SPAN_APP)
+uwsgi_lf_span(transform, UWSGI_SPAN_TRANSFORM)
+uwsgi_lf_span(write, UWSGI_SPAN_WRITE)
+uwsgi_lf_span(offload, UWSGI_SPAN_OFFLOAD)
 
-static ssize_t uwsgi_lf_modifier2(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->uh->modifier2);
-	return strlen(*buf);
-}
+// in the same order of the UWSGI_SPAN_* defines
+static int64_t (*uwsgi_lf_spans[])(struct wsgi_request *) = {
+	uwsgi_lf_span_accept,
+	uwsgi_lf_span_read,
+	uwsgi_lf_span_vars,
+	uwsgi_lf_span_routing,
+	uwsgi_lf_span_app,
+	uwsgi_lf_span_transform,
+	uwsgi_lf_span_write,
+	uwsgi_lf_span_offload,
+};
 
-static ssize_t uwsgi_lf_headers(struct wsgi_request * wsgi_req, char **buf) {
-	*buf = uwsgi_num2str(wsgi_req->header_cnt);
-	return strlen(*buf);
+static int uwsgi_lf_span_id(char *name, size_t len) {
+	int i;
+	for(i=0;i<UWSGI_SPAN_MAX;i++) {
+		if (!uwsgi_strncmp(name, len, uwsgi_span_names[i], strlen(uwsgi_span_names[i]))) return i;
+	}
+	return -1;
 }
 
 void uwsgi_add_logchunk(int variable, int pos, char *ptr, size_t len) {
@@ -1238,6 +1542,10 @@ void uwsgi_add_logchunk(int variable, int pos, char *ptr, size_t len) {
 	   2 -> logvar
 	   3 -> func
 	   4 -> metric
+	   5 -> number
+	   6 -> ltime
+	   7 -> ftime
+	   8 -> ctime
 	 */
 
 	logchunk->type = variable;
@@ -1280,129 +1588,105 @@ void uwsgi_add_logchunk(int variable, int pos, char *ptr, size_t len) {
 			logchunk->pos_len = offsetof(struct wsgi_request, referer_len);
 		}
 		else if (!uwsgi_strncmp(ptr, len, "status", 6)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_status;
-			logchunk->free = 1;
+			logchunk->type = 5;
+			logchunk->num = uwsgi_lf_status;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "rsize", 5)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_rsize;
-			logchunk->free = 1;
+			logchunk->type = 5;
+			logchunk->num = uwsgi_lf_rsize;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "hsize", 5)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_hsize;
-			logchunk->free = 1;
+			logchunk->type = 5;
+			logchunk->num = uwsgi_lf_hsize;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "size", 4)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_size;
-			logchunk->free = 1;
+			logchunk->type = 5;
+			logchunk->num = uwsgi_lf_size;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "cl", 2)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_cl;
-			logchunk->free = 1;
+			logchunk->type = 5;
+			logchunk->num = uwsgi_lf_cl;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "micros", 6)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_micros;
-			logchunk->free = 1;
+			logchunk->type = 5;
+			logchunk->num = uwsgi_lf_micros;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "msecs", 5)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_msecs;
-			logchunk->free = 1;
+			logchunk->type = 5;
+			logchunk->num = uwsgi_lf_msecs;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "time", 4)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_time;
-			logchunk->free = 1;
+			logchunk->type = 5;
+			logchunk->num = uwsgi_lf_time;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "ltime", 5)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_ltime;
-			logchunk->free = 1;
+			logchunk->type = 6;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "ftime", 5)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_ftime;
-			logchunk->free = 1;
+			logchunk->type = 7;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "ctime", 5)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_ctime;
-			logchunk->free = 1;
+			logchunk->type = 8;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "epoch", 5)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_epoch;
-			logchunk->free = 1;
+			logchunk->type = 5;
+			logchunk->num = uwsgi_lf_epoch;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "pid", 3)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_pid;
-			logchunk->free = 1;
+			logchunk->type = 5;
+			logchunk->num = uwsgi_lf_pid;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "wid", 3)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_wid;
-			logchunk->free = 1;
+			logchunk->type = 5;
+			logchunk->num = uwsgi_lf_wid;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "switches", 8)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_switches;
-			logchunk->free = 1;
+			logchunk->type = 5;
+			logchunk->num = uwsgi_lf_switches;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "vars", 4)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_vars;
-			logchunk->free = 1;
+			logchunk->type = 5;
+			logchunk->num = uwsgi_lf_vars;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "core", 4)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_core;
-			logchunk->free = 1;
+			logchunk->type = 5;
+			logchunk->num = uwsgi_lf_core;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "vsz", 3)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_vsz;
-			logchunk->free = 1;
+			logchunk->type = 5;
+			logchunk->num = uwsgi_lf_vsz;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "rss", 3)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_rss;
-			logchunk->free = 1;
+			logchunk->type = 5;
+			logchunk->num = uwsgi_lf_rss;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "vszM", 4)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_vszM;
-			logchunk->free = 1;
+			logchunk->type = 5;
+			logchunk->num = uwsgi_lf_vszM;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "rssM", 4)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_rssM;
-			logchunk->free = 1;
+			logchunk->type = 5;
+			logchunk->num = uwsgi_lf_rssM;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "pktsize", 7)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_pktsize;
-			logchunk->free = 1;
+			logchunk->type = 5;
+			logchunk->num = uwsgi_lf_pktsize;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "modifier1", 9)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_modifier1;
-			logchunk->free = 1;
+			logchunk->type = 5;
+			logchunk->num = uwsgi_lf_modifier1;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "modifier2", 9)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_modifier2;
-			logchunk->free = 1;
+			logchunk->type = 5;
+			logchunk->num = uwsgi_lf_modifier2;
 		}
 		else if (!uwsgi_strncmp(ptr, len, "headers", 7)) {
-			logchunk->type = 3;
-			logchunk->func = uwsgi_lf_headers;
-			logchunk->free = 1;
+			logchunk->type = 5;
+			logchunk->num = uwsgi_lf_headers;
+		}
+		else if (!uwsgi_starts_with(ptr, len, "span_", 5) && uwsgi_lf_span_id(ptr + 5, len - 5) > -1) {
+			logchunk->type = 5;
+			logchunk->num = uwsgi_lf_spans[uwsgi_lf_span_id(ptr + 5, len - 5)];
 		}
 		else if (!uwsgi_starts_with(ptr, len, "metric.", 7)) {
 			logchunk->type = 4;
@@ -1444,7 +1728,9 @@ next:
 		usl = usl->next;
 	}
 	if (ul) {
-		ul->func(ul, new_msg, new_msg_len);
+		if (uwsgi_logger_queue_push(ul, new_msg, new_msg_len)) {
+			ul->func(ul, new_msg, new_msg_len);
+		}
 	}
 	else {
 		new_msg_len = (size_t) write(uwsgi.original_log_fd, new_msg, new_msg_len);
@@ -1459,114 +1745,122 @@ int uwsgi_master_log(void) {
 
         ssize_t rlen = read(uwsgi.shared->worker_log_pipe[0], uwsgi.log_master_buf, uwsgi.log_master_bufsize);
         if (rlen > 0) {
+		uwsgi_master_log_do(uwsgi.log_master_buf, rlen);
+		return 0;
+	}
+	return -1;
+}
+
+// filter, route and write a chunk of logs
+void uwsgi_master_log_do(char *buf, size_t rlen) {
 #ifdef UWSGI_PCRE
-                uwsgi_alarm_log_check(uwsgi.log_master_buf, rlen);
-                struct uwsgi_regexp_list *url = uwsgi.log_drain_rules;
+        uwsgi_alarm_log_check(buf, rlen);
+        struct uwsgi_regexp_list *url = uwsgi.log_drain_rules;
+        while (url) {
+                if (uwsgi_regexp_match(url->pattern, url->pattern_extra, buf, rlen) >= 0) {
+                        return;
+                }
+                url = url->next;
+        }
+        if (uwsgi.log_filter_rules) {
+                int show = 0;
+                url = uwsgi.log_filter_rules;
                 while (url) {
-                        if (uwsgi_regexp_match(url->pattern, url->pattern_extra, uwsgi.log_master_buf, rlen) >= 0) {
-                                return 0;
+                        if (uwsgi_regexp_match(url->pattern, url->pattern_extra, buf, rlen) >= 0) {
+                                show = 1;
+                                break;
                         }
                         url = url->next;
                 }
-                if (uwsgi.log_filter_rules) {
-                        int show = 0;
-                        url = uwsgi.log_filter_rules;
-                        while (url) {
-                                if (uwsgi_regexp_match(url->pattern, url->pattern_extra, uwsgi.log_master_buf, rlen) >= 0) {
-                                        show = 1;
-                                        break;
-                                }
-                                url = url->next;
-                        }
-                        if (!show)
-                                return 0;
-                }
+                if (!show)
+                        return;
+        }
 
-                url = uwsgi.log_route;
-                int finish = 0;
-                while (url) {
-                        if (uwsgi_regexp_match(url->pattern, url->pattern_extra, uwsgi.log_master_buf, rlen) >= 0) {
-                                struct uwsgi_logger *ul_route = (struct uwsgi_logger *) url->custom_ptr;
-                                if (ul_route) {
-					uwsgi_log_func_do(uwsgi.requested_log_encoders, ul_route, uwsgi.log_master_buf, rlen);
-                                        finish = 1;
-                                }
+        url = uwsgi.log_route;
+        int finish = 0;
+        while (url) {
+                if (uwsgi_regexp_match(url->pattern, url->pattern_extra, buf, rlen) >= 0) {
+                        struct uwsgi_logger *ul_route = (struct uwsgi_logger *) url->custom_ptr;
+                        if (ul_route) {
+				uwsgi_log_func_do(uwsgi.requested_log_encoders, ul_route, buf, rlen);
+                                finish = 1;
                         }
-                        url = url->next;
                 }
-                if (finish)
-                        return 0;
+                url = url->next;
+        }
+        if (finish)
+                return;
 #endif
 
-                int raw_log = 1;
-
-                struct uwsgi_logger *ul = uwsgi.choosen_logger;
-                while (ul) {
-                        // check for named logger
-                        if (ul->id) {
-                                goto next;
-                        }
-                        uwsgi_log_func_do(uwsgi.requested_log_encoders, ul, uwsgi.log_master_buf, rlen);
-                        raw_log = 0;
-next:
-                        ul = ul->next;
-                }
+        int raw_log = 1;
 
-                if (raw_log) {
-			uwsgi_log_func_do(uwsgi.requested_log_encoders, NULL, uwsgi.log_master_buf, rlen);
+        struct uwsgi_logger *ul = uwsgi.choosen_logger;
+        while (ul) {
+                // check for named logger
+                if (ul->id) {
+                        goto next;
                 }
-                return 0;
+                uwsgi_log_func_do(uwsgi.requested_log_encoders, ul, buf, rlen);
+                raw_log = 0;
+next:
+                ul = ul->next;
         }
 
-        return -1;
+        if (raw_log) {
+		uwsgi_log_func_do(uwsgi.requested_log_encoders, NULL, buf, rlen);
+        }
 }
 
 int uwsgi_master_req_log(void) {
 
         ssize_t rlen = read(uwsgi.shared->worker_req_log_pipe[0], uwsgi.log_master_buf, uwsgi.log_master_bufsize);
         if (rlen > 0) {
+		uwsgi_master_req_log_do(uwsgi.log_master_buf, rlen);
+		return 0;
+	}
+	return -1;
+}
+
+// route and write a chunk of request logs
+void uwsgi_master_req_log_do(char *buf, size_t rlen) {
 #ifdef UWSGI_PCRE
-                struct uwsgi_regexp_list *url = uwsgi.log_req_route;
-                int finish = 0;
-                while (url) {
-                        if (uwsgi_regexp_match(url->pattern, url->pattern_extra, uwsgi.log_master_buf, rlen) >= 0) {
-                                struct uwsgi_logger *ul_route = (struct uwsgi_logger *) url->custom_ptr;
-                                if (ul_route) {
-                                        uwsgi_log_func_do(uwsgi.requested_log_req_encoders, ul_route, uwsgi.log_master_buf, rlen);
-                                        finish = 1;
-                                }
+        struct uwsgi_regexp_list *url = uwsgi.log_req_route;
+        int finish = 0;
+        while (url) {
+                if (uwsgi_regexp_match(url->pattern, url->pattern_extra, buf, rlen) >= 0) {
+                        struct uwsgi_logger *ul_route = (struct uwsgi_logger *) url->custom_ptr;
+                        if (ul_route) {
+                                uwsgi_log_func_do(uwsgi.requested_log_req_encoders, ul_route, buf, rlen);
+                                finish = 1;
                         }
-                        url = url->next;
                 }
-                if (finish)
-                        return 0;
+                url = url->next;
+        }
+        if (finish)
+                return;
 #endif
 
-                int raw_log = 1;
-
-                struct uwsgi_logger *ul = uwsgi.choosen_req_logger;
-                while (ul) {
-                        // check for named logger
-                        if (ul->id) {
-                                goto next;
-                        }
-                        uwsgi_log_func_do(uwsgi.requested_log_req_encoders, ul, uwsgi.log_master_buf, rlen);
-                        raw_log = 0;
-next:
-                        ul = ul->next;
-                }
+        int raw_log = 1;
 
-                if (raw_log) {
-			uwsgi_log_func_do(uwsgi.requested_log_req_encoders, NULL, uwsgi.log_master_buf, rlen);
+        struct uwsgi_logger *ul = uwsgi.choosen_req_logger;
+        while (ul) {
+                // check for named logger
+                if (ul->id) {
+                        goto next;
                 }
-                return 0;
+                uwsgi_log_func_do(uwsgi.requested_log_req_encoders, ul, buf, rlen);
+                raw_log = 0;
+next:
+                ul = ul->next;
         }
 
-        return -1;
+        if (raw_log) {
+		uwsgi_log_func_do(uwsgi.requested_log_req_encoders, NULL, buf, rlen);
+        }
 }
 
 static void *logger_thread_loop(void *noarg) {
-        struct pollfd logpoll[2];
+        struct pollfd logpoll[3];
 
         // block all signals
         sigset_t smask;
@@ -1577,28 +1871,47 @@ static void *logger_thread_loop(void *noarg) {
         logpoll[0].fd = uwsgi.shared->worker_log_pipe[0];
 
         int logpolls = 1;
+	int req_poll = -1;
+	int ring_poll = -1;
 
         if (uwsgi.req_log_master) {
-                logpoll[1].events = POLLIN;
-                logpoll[1].fd = uwsgi.shared->worker_req_log_pipe[0];
+                logpoll[logpolls].events = POLLIN;
+                logpoll[logpolls].fd = uwsgi.shared->worker_req_log_pipe[0];
+		req_poll = logpolls++;
         }
 
+	if (uwsgi.log_rings) {
+		logpoll[logpolls].events = POLLIN;
+		logpoll[logpolls].fd = uwsgi.log_ring_pipe[0];
+		ring_poll = logpolls++;
+	}
+
 
         for (;;) {
-                int ret = poll(logpoll, logpolls, -1);
+		// the rings are drained even without notifications (at least once per second)
+                int ret = poll(logpoll, logpolls, uwsgi.log_rings ? 1000 : -1);
                 if (ret > 0) {
                         if (logpoll[0].revents & POLLIN) {
                                 pthread_mutex_lock(&uwsgi.threaded_logger_lock);
                                 uwsgi_master_log();
                                 pthread_mutex_unlock(&uwsgi.threaded_logger_lock);
                         }
-                        else if (logpolls > 1 && logpoll[1].revents & POLLIN) {
+                        if (req_poll > -1 && logpoll[req_poll].revents & POLLIN) {
                                 pthread_mutex_lock(&uwsgi.threaded_logger_lock);
                                 uwsgi_master_req_log();
                                 pthread_mutex_unlock(&uwsgi.threaded_logger_lock);
                         }
-
+			if (ring_poll > -1 && logpoll[ring_poll].revents & POLLIN) {
+				pthread_mutex_lock(&uwsgi.threaded_logger_lock);
+				uwsgi_log_rings_drain(1);
+				pthread_mutex_unlock(&uwsgi.threaded_logger_lock);
+			}
                 }
+		else if (ret == 0 && uwsgi.log_rings) {
+			pthread_mutex_lock(&uwsgi.threaded_logger_lock);
+			uwsgi_log_rings_drain(0);
+			pthread_mutex_unlock(&uwsgi.threaded_logger_lock);
+		}
         }
 
         return NULL;
@@ -1616,6 +1929,9 @@ void uwsgi_threaded_logger_spawn() {
                 if (uwsgi.req_log_master) {
                 	event_queue_add_fd_read(uwsgi.master_queue, uwsgi.shared->worker_req_log_pipe[0]);
                 }
+		if (uwsgi.log_rings) {
+			event_queue_add_fd_read(uwsgi.master_queue, uwsgi.log_ring_pipe[0]);
+		}
                 uwsgi.threaded_logger = 0;
 	}
 }
@@ -1774,6 +2090,24 @@ end:
         return buf;
 }
 
+// frame a text line as a binary log record (kind 2), so it can be mixed with --log-format-binary records
+static char *uwsgi_log_encoder_binary(struct uwsgi_log_encoder *ule, char *msg, size_t len, size_t *rlen) {
+	// already a request record
+	if (len >= UWSGI_BINLOG_HEADER && msg[2] == 1 && (size_t) (((uint8_t) msg[0]) | (((uint8_t) msg[1]) << 8)) == len) {
+		*rlen = len;
+		return uwsgi_concat2n(msg, len, "", 0);
+	}
+	if (len > 0 && msg[len-1] == '\n') len--;
+	if (len > 65535 - 4) len = 65535 - 4;
+	char *buf = uwsgi_malloc(len + 4);
+	uwsgi_binlog_u16(buf, len + 4);
+	buf[2] = 2;
+	buf[3] = 0;
+	memcpy(buf + 4, msg, len);
+	*rlen = len + 4;
+	return buf;
+}
+
 /*
 
 really fast encoder adding only a suffix
@@ -1984,6 +2318,7 @@ void uwsgi_log_encoders_register_embedded() {
 	uwsgi_register_log_encoder("prefix", uwsgi_log_encoder_prefix);
 	uwsgi_register_log_encoder("suffix", uwsgi_log_encoder_suffix);
 	uwsgi_register_log_encoder("nl", uwsgi_log_encoder_nl);
+	uwsgi_register_log_encoder("binary", uwsgi_log_encoder_binary);
 	uwsgi_register_log_encoder("format", uwsgi_log_encoder_format);
 	uwsgi_register_log_encoder("json", uwsgi_log_encoder_json);
 #ifdef UWSGI_ZLIB
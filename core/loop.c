@@ -87,7 +87,10 @@ void uwsgi_setup_thread_req(long core_id, struct wsgi_request *wsgi_req) {
 #ifdef UWSGI_DEBUG
 		sigdelset(&smask, SIGSEGV);
 #endif
+		// the sampling profiler needs all of the request threads
+		if (uwsgi.profiler_ring) sigdelset(&smask, SIGPROF);
 		pthread_sigmask(SIG_BLOCK, &smask, NULL);
+		uwsgi_profiler_thread_init(core_id);
 
 		// run per-thread socket hook
 		struct uwsgi_socket *uwsgi_sock = uwsgi.sockets;
@@ -363,6 +363,9 @@ int master_loop(char **argv, char **environ) {
 			if (uwsgi.req_log_master) {
 				event_queue_add_fd_read(uwsgi.master_queue, uwsgi.shared->worker_req_log_pipe[0]);
 			}
+			if (uwsgi.log_rings) {
+				event_queue_add_fd_read(uwsgi.master_queue, uwsgi.log_ring_pipe[0]);
+			}
 		}
 		else {
 			uwsgi_threaded_logger_spawn();
@@ -416,7 +419,10 @@ int master_loop(char **argv, char **environ) {
 			uwsgi.stats_fd = bind_to_unix(uwsgi.stats, uwsgi.listen_queue, uwsgi.chmod_socket, uwsgi.abstract_socket);
 		}
 
-		event_queue_add_fd_read(uwsgi.master_queue, uwsgi.stats_fd);
+		if (!uwsgi_thread_new(uwsgi_stats_server_loop)) {
+			uwsgi_log("!!! unable to spawn the stats server thread !!!\n");
+			exit(1);
+		}
 		uwsgi_log("*** Stats server enabled on %s fd: %d ***\n", uwsgi.stats, uwsgi.stats_fd);
 	}
 
@@ -668,6 +674,10 @@ int master_loop(char **argv, char **environ) {
 				if (ushared->rb_timers_cnt > 0) {
 					expire_rb_timeouts(rb_timers);
 				}
+				// lines lost by a notification race are drained here
+				if (uwsgi.log_rings && !uwsgi.threaded_logger) {
+					uwsgi_log_rings_drain(0);
+				}
 			}
 
 			// update load counter
@@ -16,20 +16,17 @@ int uwsgi_master_manage_events(int interesting_fd) {
 			uwsgi_master_req_log();
 			return 0;
 		}
+		// req log rings ?
+		if (uwsgi.log_rings && interesting_fd == uwsgi.log_ring_pipe[0]) {
+			uwsgi_log_rings_drain(1);
+			return 0;
+		}
 	}
 
 	if (uwsgi.master_fifo_fd > -1 && interesting_fd == uwsgi.master_fifo_fd) {
 		return uwsgi_master_fifo_manage(uwsgi.master_fifo_fd);
 	}
 
-	// stats server ?
-	if (uwsgi.stats && uwsgi.stats_fd > -1) {
-		if (interesting_fd == uwsgi.stats_fd) {
-			uwsgi_send_stats(uwsgi.stats_fd, uwsgi_master_generate_stats);
-			return 0;
-		}
-	}
-
 	// a zerg connection ?
 	if (uwsgi.zerg_server) {
 		if (interesting_fd == uwsgi.zerg_server_fd) {
@@ -701,6 +701,57 @@ int uwsgi_respawn_worker(int wid) {
 	return 0;
 }
 
+// the histograms (merged) with their non-empty buckets, keyed by the highest value of the bucket
+static int uwsgi_stats_histograms(struct uwsgi_stats *us) {
+	int i;
+	uint64_t *merged = uwsgi_malloc(sizeof(uint64_t) * UWSGI_HISTOGRAM_SLOT_SIZE);
+
+	if (uwsgi_stats_key(us, "histograms")) goto error;
+	if (uwsgi_stats_object_open(us)) goto error;
+
+	struct uwsgi_histogram *uh = uwsgi.histograms;
+	while(uh) {
+		uwsgi_histogram_merge(uh, merged);
+		if (uwsgi_stats_key(us, uh->name)) goto error;
+		if (uwsgi_stats_object_open(us)) goto error;
+		if (uwsgi_stats_keylong_comma(us, "count", (unsigned long long) merged[0])) goto error;
+		if (uwsgi_stats_keylong_comma(us, "sum", (unsigned long long) merged[1])) goto error;
+		if (uwsgi_stats_keylong_comma(us, "max", (unsigned long long) merged[2])) goto error;
+		if (uwsgi_stats_keylong_comma(us, "p50", (unsigned long long) uwsgi_histogram_quantile(merged, 500))) goto error;
+		if (uwsgi_stats_keylong_comma(us, "p90", (unsigned long long) uwsgi_histogram_quantile(merged, 900))) goto error;
+		if (uwsgi_stats_keylong_comma(us, "p99", (unsigned long long) uwsgi_histogram_quantile(merged, 990))) goto error;
+		if (uwsgi_stats_keylong_comma(us, "p999", (unsigned long long) uwsgi_histogram_quantile(merged, 999))) goto error;
+		if (uwsgi_stats_key(us, "buckets")) goto error;
+		if (uwsgi_stats_object_open(us)) goto error;
+		int first = 1;
+		for(i=0;i<UWSGI_HISTOGRAM_BUCKETS;i++) {
+			if (!merged[3 + i]) continue;
+			char key[sizeof(UMAX64_STR)+1];
+			if (!first) {
+				if (uwsgi_stats_comma(us)) goto error;
+			}
+			first = 0;
+			uwsgi_long2str2n(uwsgi_histogram_bucket_value(i), key, sizeof(UMAX64_STR)+1);
+			if (uwsgi_stats_keylong(us, key, (unsigned long long) merged[3 + i])) goto error;
+		}
+		if (uwsgi_stats_object_close(us)) goto error;
+		if (uwsgi_stats_object_close(us)) goto error;
+		uh = uh->next;
+		if (uh) {
+			if (uwsgi_stats_comma(us)) goto error;
+		}
+	}
+
+	if (uwsgi_stats_object_close(us)) goto error;
+	if (uwsgi_stats_comma(us)) goto error;
+
+	free(merged);
+	return 0;
+error:
+	free(merged);
+	return -1;
+}
+
 struct uwsgi_stats *uwsgi_master_generate_stats() {
 
 	int i;
@@ -878,56 +929,43 @@ struct uwsgi_stats *uwsgi_master_generate_stats() {
 		if (uwsgi_stats_object_open(us))
 			goto end;
 
-		uwsgi_rlock(uwsgi.metrics_lock);
 		struct uwsgi_metric *um = uwsgi.metrics;
 		while(um) {
-        		int64_t um_val = *um->value;
+        		int64_t um_val = uwsgi_metric_get_handle(um);
 
-			if (uwsgi_stats_key(us, um->name)) {
-				uwsgi_rwunlock(uwsgi.metrics_lock);
+			if (uwsgi_stats_key(us, um->name))
                 		goto end;
-			}
 
-			if (uwsgi_stats_object_open(us)) {
-				uwsgi_rwunlock(uwsgi.metrics_lock);
+			if (uwsgi_stats_object_open(us))
                                 goto end;
-			}
 
-			if (uwsgi_stats_keylong(us, "type", (long long) um->type)) {
-        			uwsgi_rwunlock(uwsgi.metrics_lock);
+			if (uwsgi_stats_keylong(us, "type", (long long) um->type))
 				goto end;
-			} 
 
-			if (uwsgi_stats_comma(us)) {
-        			uwsgi_rwunlock(uwsgi.metrics_lock);
+			if (uwsgi_stats_comma(us))
 				goto end;
-			}
 
-			if (uwsgi_stats_keyslong(us, "value", (long long) um_val)) {
-        			uwsgi_rwunlock(uwsgi.metrics_lock);
+			if (uwsgi_stats_keyslong(us, "value", (long long) um_val))
 				goto end;
-			} 
 
-			if (uwsgi_stats_object_close(us)) {
-                                uwsgi_rwunlock(uwsgi.metrics_lock);
+			if (uwsgi_stats_object_close(us))
                                 goto end;
-                        }
 
 			um = um->next;
 			if (um) {
-				if (uwsgi_stats_comma(us)) {
-        				uwsgi_rwunlock(uwsgi.metrics_lock);
+				if (uwsgi_stats_comma(us))
 					goto end;
-				}
 			}
 		}
-        	uwsgi_rwunlock(uwsgi.metrics_lock);
 
 		if (uwsgi_stats_object_close(us))
 			goto end;
 
 		if (uwsgi_stats_comma(us))
 		goto end;
+
+		if (uwsgi_stats_histograms(us))
+			goto end;
 	}
 
 	if (uwsgi_stats_key(us, "sockets"))
@@ -1043,6 +1081,15 @@ struct uwsgi_stats *uwsgi_master_generate_stats() {
 		if (uwsgi_stats_keylong_comma(us, "avg_rt", (unsigned long long) uwsgi.workers[i + 1].avg_response_time))
 			goto end;
 
+		if (uwsgi.log_rings) {
+			uint64_t log_records, log_drops;
+			uwsgi_log_ring_stats(i + 1, &log_records, &log_drops);
+			if (uwsgi_stats_keylong_comma(us, "log_ring_records", (unsigned long long) log_records))
+				goto end;
+			if (uwsgi_stats_keylong_comma(us, "log_ring_drops", (unsigned long long) log_drops))
+				goto end;
+		}
+
 		// applications list
 		if (uwsgi_stats_key(us, "apps"))
 			goto end;
@@ -53,7 +53,14 @@ extern struct uwsgi_server uwsgi;
 
 	uwsgi.metric_get("worker.1.requests")
 
-	Updating metrics from your app MUST BE ATOMIC, for such a reason a uWSGI rwlock is initialized on startup and used for each operation (simple reading from a metric does not require locking)
+	Updating metrics from your app MUST BE ATOMIC, but a single lock shared by all of the workers would be a contention point
+	for counters updated at every request. For such a reason each metric updatable by the api has a shard (a cache line in shared memory) for
+	each worker (or for each core in multithread mode): inc/dec are atomic adds to the shard of the caller, while the value of the metric
+	is their sum plus a base value, aggregated only when read (or collected). set/mul/div (rarely used) rewrite the base value, so they
+	are serialized by a uWSGI rwlock. Simple reading from a metric does not require locking.
+
+	Plugins can resolve a metric to a handle once (uwsgi_metric_handle()) and update it via the *_handle() functions without any lookup,
+	the name-based api uses a hash table built at the end of the setup.
 
 	Metrics can be updated from the internal routing subsystem too:
 
@@ -451,14 +458,16 @@ static void *uwsgi_metrics_loop(void *arg) {
 			else {
 				if ((uint32_t) (now - metric->last_update) < metric->freq) goto next;
 			}
-			uwsgi_wlock(uwsgi.metrics_lock);
+			// this thread is the only writer of the value, so no locking is needed
 			int64_t value = *metric->value;
 			// gather the new value based on the type of collection strategy
 			if (metric->collector) {
 				*metric->value = metric->initial_value + metric->collector->func(metric);
 			}
+			else if (metric->shards) {
+				*metric->value = uwsgi_metric_get_handle(metric);
+			}
 			int64_t new_value = *metric->value;
-			uwsgi_rwunlock(uwsgi.metrics_lock);
 
 			metric->last_update = now;
 
@@ -476,9 +485,12 @@ static void *uwsgi_metrics_loop(void *arg) {
 			while(umt) {
 				if (new_value >= umt->value) {
 					if (umt->reset) {
-						uwsgi_wlock(uwsgi.metrics_lock);
-						*metric->value = umt->reset_value;
-						uwsgi_rwunlock(uwsgi.metrics_lock);
+						if (metric->shards) {
+							uwsgi_metric_set_handle(metric, umt->reset_value);
+						}
+						else {
+							*metric->value = umt->reset_value;
+						}
 					}
 
 					if (umt->alarm) {
@@ -513,18 +525,22 @@ void uwsgi_metrics_start_collector() {
 }
 
 struct uwsgi_metric *uwsgi_metric_find_by_name(char *name) {
-	struct uwsgi_metric *um = uwsgi.metrics;
-	while(um) {
-		if (!strcmp(um->name, name)) {
-			return um;
-		}	
-		um = um->next;
-	}
-
-	return NULL;
+	return uwsgi_metric_find_by_namen(name, strlen(name));
 }
 
 struct uwsgi_metric *uwsgi_metric_find_by_namen(char *name, size_t len) {
+	// the table is available after the setup
+	if (uwsgi.metrics_hash) {
+		struct uwsgi_metric *um = uwsgi.metrics_hash[djb33x_hash(name, len) & (uwsgi.metrics_hash_size - 1)];
+		while(um) {
+			if (!uwsgi_strncmp(um->name, um->name_len, name, len)) {
+				return um;
+			}
+			um = um->hash_next;
+		}
+		return NULL;
+	}
+
         struct uwsgi_metric *um = uwsgi.metrics;
         while(um) {
                 if (!uwsgi_strncmp(um->name, um->name_len, name, len)) {
@@ -601,81 +617,120 @@ struct uwsgi_metric *uwsgi_metric_find_by_asn(char *asn, size_t len) {
 	metric_mul
 	metric_div
 
+	the *_handle() variants take an already resolved metric
+
 */
 
-#define um_op struct uwsgi_metric *um = NULL;\
-	if (!uwsgi.has_metrics) return -1;\
-	if (name) {\
-                um = uwsgi_metric_find_by_name(name);\
-        }\
-        else if (oid) {\
-                um = uwsgi_metric_find_by_oid(oid);\
-        }\
-        if (!um) return -1;\
-	if (um->collector || um->type == UWSGI_METRIC_ALIAS) return -1;\
-	uwsgi_rlock(uwsgi.metrics_lock)
+struct uwsgi_metric *uwsgi_metric_handle(char *name, char *oid) {
+	if (!uwsgi.has_metrics) return NULL;
+	if (name) {
+		return uwsgi_metric_find_by_name(name);
+	}
+	if (oid) {
+		return uwsgi_metric_find_by_oid(oid);
+	}
+	return NULL;
+}
+
+// the shard of the caller (workers map to their own shards, the other processes share the first one)
+static int64_t *uwsgi_metric_shard(struct uwsgi_metric *um) {
+	int pos = 0;
+	if (uwsgi.mywid > 0 && uwsgi.mywid <= uwsgi.numproc) {
+		pos = uwsgi.mywid * uwsgi.metric_shards_per_worker;
+		if (uwsgi.metric_shards_per_worker > 1) {
+			struct wsgi_request *wsgi_req = current_wsgi_req();
+			if (wsgi_req) pos += wsgi_req->async_id;
+		}
+	}
+	return um->shards + ((pos + 1) * UWSGI_METRIC_SHARD_STRIDE);
+}
 
-int uwsgi_metric_set(char *name, char *oid, int64_t value) {
-	um_op;
-	*um->value = value;
-	uwsgi_rwunlock(uwsgi.metrics_lock);
+static int64_t uwsgi_metric_shards_sum(struct uwsgi_metric *um) {
+	int i;
+	int64_t total = 0;
+	for(i=1;i<=uwsgi.metric_shards;i++) {
+		total += um->shards[i * UWSGI_METRIC_SHARD_STRIDE];
+	}
+	return total;
+}
+
+int uwsgi_metric_inc_handle(struct uwsgi_metric *um, int64_t value) {
+	if (!um || !um->shards) return -1;
+	__sync_add_and_fetch(uwsgi_metric_shard(um), value);
 	return 0;
 }
 
-int uwsgi_metric_inc(char *name, char *oid, int64_t value) {
-        um_op;
-	*um->value += value;
-	uwsgi_rwunlock(uwsgi.metrics_lock);
+int uwsgi_metric_dec_handle(struct uwsgi_metric *um, int64_t value) {
+	if (!um || !um->shards) return -1;
+	__sync_sub_and_fetch(uwsgi_metric_shard(um), value);
 	return 0;
 }
 
-int uwsgi_metric_dec(char *name, char *oid, int64_t value) {
-        um_op;
-	*um->value -= value;
+/*
+	the base is computed against the deltas read under the lock: concurrent inc/dec
+	are applied on top of the new value instead of being lost
+*/
+int uwsgi_metric_set_handle(struct uwsgi_metric *um, int64_t value) {
+	if (!um || !um->shards) return -1;
+	uwsgi_wlock(uwsgi.metrics_lock);
+	um->shards[0] = value - uwsgi_metric_shards_sum(um);
 	uwsgi_rwunlock(uwsgi.metrics_lock);
 	return 0;
 }
 
-int uwsgi_metric_mul(char *name, char *oid, int64_t value) {
-        um_op;
-	*um->value *= value;
+int uwsgi_metric_mul_handle(struct uwsgi_metric *um, int64_t value) {
+	if (!um || !um->shards) return -1;
+	uwsgi_wlock(uwsgi.metrics_lock);
+	int64_t deltas = uwsgi_metric_shards_sum(um);
+	um->shards[0] = ((um->shards[0] + deltas) * value) - deltas;
 	uwsgi_rwunlock(uwsgi.metrics_lock);
 	return 0;
 }
 
-int uwsgi_metric_div(char *name, char *oid, int64_t value) {
+int uwsgi_metric_div_handle(struct uwsgi_metric *um, int64_t value) {
 	// avoid division by zero
-	if (value == 0) return -1;
-        um_op;
-	*um->value /= value;
+	if (!um || !um->shards || value == 0) return -1;
+	uwsgi_wlock(uwsgi.metrics_lock);
+	int64_t deltas = uwsgi_metric_shards_sum(um);
+	um->shards[0] = ((um->shards[0] + deltas) / value) - deltas;
 	uwsgi_rwunlock(uwsgi.metrics_lock);
 	return 0;
 }
 
-int64_t uwsgi_metric_get(char *name, char *oid) {
-	if (!uwsgi.has_metrics) return 0;
-	int64_t ret = 0;
-	struct uwsgi_metric *um = NULL;
-	if (name) {
-		um = uwsgi_metric_find_by_name(name);
-	}
-	else if (oid) {
-		um = uwsgi_metric_find_by_oid(oid);
-	}
+int64_t uwsgi_metric_get_handle(struct uwsgi_metric *um) {
 	if (!um) return 0;
+	if (um->shards) {
+		return um->shards[0] + uwsgi_metric_shards_sum(um);
+	}
+	return *um->value;
+}
 
-	// now (in rlocked context) we get the value from
-	// the map
-	uwsgi_rlock(uwsgi.metrics_lock);
-	ret = *um->value;
-	// unlock
-	uwsgi_rwunlock(uwsgi.metrics_lock);
-	return ret;
+int uwsgi_metric_set(char *name, char *oid, int64_t value) {
+	return uwsgi_metric_set_handle(uwsgi_metric_handle(name, oid), value);
+}
+
+int uwsgi_metric_inc(char *name, char *oid, int64_t value) {
+	return uwsgi_metric_inc_handle(uwsgi_metric_handle(name, oid), value);
+}
+
+int uwsgi_metric_dec(char *name, char *oid, int64_t value) {
+	return uwsgi_metric_dec_handle(uwsgi_metric_handle(name, oid), value);
+}
+
+int uwsgi_metric_mul(char *name, char *oid, int64_t value) {
+	return uwsgi_metric_mul_handle(uwsgi_metric_handle(name, oid), value);
+}
+
+int uwsgi_metric_div(char *name, char *oid, int64_t value) {
+	return uwsgi_metric_div_handle(uwsgi_metric_handle(name, oid), value);
+}
+
+int64_t uwsgi_metric_get(char *name, char *oid) {
+	return uwsgi_metric_get_handle(uwsgi_metric_handle(name, oid));
 }
 
 int64_t uwsgi_metric_getn(char *name, size_t nlen, char *oid, size_t olen) {
         if (!uwsgi.has_metrics) return 0;
-        int64_t ret = 0;
         struct uwsgi_metric *um = NULL;
         if (name) {
                 um = uwsgi_metric_find_by_namen(name, nlen);
@@ -683,17 +738,11 @@ int64_t uwsgi_metric_getn(char *name, size_t nlen, char *oid, size_t olen) {
         else if (oid) {
                 um = uwsgi_metric_find_by_oidn(oid, olen);
         }
-        if (!um) return 0;
-
-        // now (in rlocked context) we get the value from
-        // the map
-        uwsgi_rlock(uwsgi.metrics_lock);
-        ret = *um->value;
-        // unlock
-        uwsgi_rwunlock(uwsgi.metrics_lock);
-        return ret;
+        return uwsgi_metric_get_handle(um);
 }
 
+static void uwsgi_histograms_setup(void);
+
 #define uwsgi_metric_name(f, n) if (snprintf(buf, 4096, f, n) <= 1) { uwsgi_log("unable to register metric name %s\n", f); exit(1);}
 #define uwsgi_metric_name2(f, n, n2) if (snprintf(buf, 4096, f, n, n2) <= 1) { uwsgi_log("unable to register metric name %s\n", f); exit(1);}
 
@@ -802,6 +851,14 @@ void uwsgi_setup_metrics() {
 		uwsgi_sock = uwsgi_sock->next;
 	}
 
+	// latency and size histograms
+	uwsgi.histogram_request_time = uwsgi_histogram_register("request_time");
+	uwsgi.histogram_app_time = uwsgi_histogram_register("app_time");
+	uwsgi.histogram_headers_size = uwsgi_histogram_register("headers_size");
+	uwsgi.histogram_response_size = uwsgi_histogram_register("response_size");
+	uwsgi_spans_register_histograms();
+	uwsgi_histograms_setup();
+
 	// create aliases
 	uwsgi_register_metric("rss_size", NULL, UWSGI_METRIC_ALIAS, NULL, total_rss, 0, NULL);
 	uwsgi_register_metric("vsz_size", NULL, UWSGI_METRIC_ALIAS, NULL, total_vsz, 0, NULL);
@@ -826,6 +883,20 @@ void uwsgi_setup_metrics() {
 		metric = metric->next;
 	}
 
+	// shards for the metrics updatable by the api (a base value + one for each worker/core, the master and the other processes share the first one)
+	uwsgi.metric_shards_per_worker = uwsgi.threads > 1 ? uwsgi.cores : 1;
+	uwsgi.metric_shards = (uwsgi.numproc + 1) * uwsgi.metric_shards_per_worker;
+	uint64_t shards_cnt = 0;
+	metric = uwsgi.metrics;
+	while(metric) {
+		if (!metric->collector && metric->type != UWSGI_METRIC_ALIAS) shards_cnt++;
+		metric = metric->next;
+	}
+	int64_t *shards = NULL;
+	if (shards_cnt > 0) {
+		shards = uwsgi_calloc_shared(sizeof(int64_t) * UWSGI_METRIC_SHARD_STRIDE * (uwsgi.metric_shards + 1) * shards_cnt);
+	}
+
 	// remap aliases
 	metric = uwsgi.metrics;
         while(metric) {
@@ -838,6 +909,11 @@ void uwsgi_setup_metrics() {
 			metric->value = alias->value;
 			metric->oid = alias->oid;
 		}
+		else if (!metric->collector) {
+			metric->shards = shards;
+			shards += UWSGI_METRIC_SHARD_STRIDE * (uwsgi.metric_shards + 1);
+			metric->shards[0] = metric->initial_value;
+		}
 		if (metric->initial_value) {
 			*metric->value = metric->initial_value;
 		}
@@ -914,6 +990,19 @@ void uwsgi_setup_metrics() {
 		uwsgi_log("added threshold for metric %s (value: %lld)\n", um->name, umt->value);
 	}
 
+	// the name lookup table (a power of two, at least twice the number of metrics)
+	uwsgi.metrics_hash_size = 64;
+	while(uwsgi.metrics_hash_size < uwsgi.metrics_cnt * 2) uwsgi.metrics_hash_size <<= 1;
+	struct uwsgi_metric **metrics_hash = uwsgi_calloc(sizeof(struct uwsgi_metric *) * uwsgi.metrics_hash_size);
+	metric = uwsgi.metrics;
+	while(metric) {
+		uint32_t slot = djb33x_hash(metric->name, metric->name_len) & (uwsgi.metrics_hash_size - 1);
+		metric->hash_next = metrics_hash[slot];
+		metrics_hash[slot] = metric;
+		metric = metric->next;
+	}
+	uwsgi.metrics_hash = metrics_hash;
+
 	uwsgi_log("initialized %llu metrics\n", uwsgi.metrics_cnt);
 
 	if (uwsgi.metrics_dir) {
@@ -923,6 +1012,7 @@ void uwsgi_setup_metrics() {
         		while(metric) {
 				if (metric->map) {
 					metric->initial_value = strtoll(metric->map, NULL, 10);
+					if (metric->shards) metric->shards[0] = metric->initial_value;
 				}
 				metric = metric->next;
 			}
@@ -980,9 +1070,199 @@ static int64_t uwsgi_metric_collector_func(struct uwsgi_metric *um) {
         return func(um);
 }
 
+/*
+
+	histograms
+
+	a histogram counts values (request times in microseconds, sizes in bytes) in log-linear buckets.
+	Every worker (or every core in multithread mode) has its own slot in shared memory, so it is updated
+	without locks: the readers (the metrics collector and the stats server) merge the slots.
+
+	each histogram is exported as a group of metrics (so snmp and the stats pushers get them too):
+
+	histogram.<name>.count
+	histogram.<name>.sum
+	histogram.<name>.max
+	histogram.<name>.p50
+	histogram.<name>.p90
+	histogram.<name>.p99
+	histogram.<name>.p999
+
+	histograms can be registered before the metrics subsystem is initialized (for example by the routing subsystem)
+
+*/
+
+struct uwsgi_histogram *uwsgi_histogram_find(char *name) {
+	struct uwsgi_histogram *uh = uwsgi.histograms;
+	while(uh) {
+		if (!strcmp(uh->name, name)) return uh;
+		uh = uh->next;
+	}
+	return NULL;
+}
+
+struct uwsgi_histogram *uwsgi_histogram_register(char *name) {
+	struct uwsgi_histogram *old_uh = NULL, *uh = uwsgi.histograms;
+	while(uh) {
+		if (!strcmp(uh->name, name)) return uh;
+		old_uh = uh;
+		uh = uh->next;
+	}
+
+	if (!uwsgi_validate_metric_name(name)) {
+		uwsgi_log("invalid histogram name: %s\n", name);
+		return NULL;
+	}
+
+	if (uwsgi.histogram_slots) {
+		uwsgi_log("unable to register histogram %s: the metrics subsystem is already initialized\n", name);
+		return NULL;
+	}
+
+	uh = uwsgi_calloc(sizeof(struct uwsgi_histogram));
+	uh->name = uwsgi_str(name);
+	uh->id = uwsgi.histograms_cnt++;
+	if (old_uh) {
+		old_uh->next = uh;
+	}
+	else {
+		uwsgi.histograms = uh;
+	}
+	return uh;
+}
+
+static int uwsgi_histogram_bucket(uint64_t value) {
+	if (value < (1 << UWSGI_HISTOGRAM_SUB_BITS)) return value;
+	if (value >= (1ULL << UWSGI_HISTOGRAM_MAX_BITS)) value = (1ULL << UWSGI_HISTOGRAM_MAX_BITS) - 1;
+	int msb = 63 - __builtin_clzll(value);
+	int shift = msb - UWSGI_HISTOGRAM_SUB_BITS;
+	return ((shift + 1) << UWSGI_HISTOGRAM_SUB_BITS) + (int) ((value >> shift) - (1 << UWSGI_HISTOGRAM_SUB_BITS));
+}
+
+// the highest value counted by the bucket
+uint64_t uwsgi_histogram_bucket_value(int bucket) {
+	if (bucket < (1 << UWSGI_HISTOGRAM_SUB_BITS)) return bucket;
+	int shift = (bucket >> UWSGI_HISTOGRAM_SUB_BITS) - 1;
+	uint64_t base = (1 << UWSGI_HISTOGRAM_SUB_BITS) + (bucket & ((1 << UWSGI_HISTOGRAM_SUB_BITS) - 1));
+	return ((base + 1) << shift) - 1;
+}
+
+void uwsgi_histogram_add(struct uwsgi_histogram *uh, struct wsgi_request *wsgi_req, uint64_t value) {
+	if (!uh || !uh->slots || uwsgi.mywid <= 0) return;
+	int slot = (uwsgi.mywid - 1) * uwsgi.histogram_slots;
+	if (uwsgi.histogram_slots > 1) slot += wsgi_req->async_id;
+	uint64_t *counters = uh->slots + (slot * UWSGI_HISTOGRAM_SLOT_SIZE);
+	// this slot has a single writer
+	counters[0]++;
+	counters[1] += value;
+	if (value > counters[2]) counters[2] = value;
+	counters[3 + uwsgi_histogram_bucket(value)]++;
+}
+
+// sum all of the slots in dst (UWSGI_HISTOGRAM_SLOT_SIZE items)
+void uwsgi_histogram_merge(struct uwsgi_histogram *uh, uint64_t *dst) {
+	int i, j;
+	memset(dst, 0, sizeof(uint64_t) * UWSGI_HISTOGRAM_SLOT_SIZE);
+	if (!uh->slots) return;
+	for(i=0;i<uwsgi.numproc * uwsgi.histogram_slots;i++) {
+		uint64_t *counters = uh->slots + (i * UWSGI_HISTOGRAM_SLOT_SIZE);
+		if (!counters[0]) continue;
+		dst[0] += counters[0];
+		dst[1] += counters[1];
+		if (counters[2] > dst[2]) dst[2] = counters[2];
+		for(j=3;j<UWSGI_HISTOGRAM_SLOT_SIZE;j++) {
+			dst[j] += counters[j];
+		}
+	}
+}
+
+// the value at the specified quantile (in permille) of a merged histogram
+uint64_t uwsgi_histogram_quantile(uint64_t *merged, uint64_t permille) {
+	if (!merged[0]) return 0;
+	uint64_t target = ((merged[0] * permille) + 999) / 1000;
+	uint64_t count = 0;
+	int i;
+	if (target == 0) target = 1;
+	for(i=0;i<UWSGI_HISTOGRAM_BUCKETS;i++) {
+		count += merged[3 + i];
+		if (count >= target) {
+			uint64_t value = uwsgi_histogram_bucket_value(i);
+			return value > merged[2] ? merged[2] : value;
+		}
+	}
+	return merged[2];
+}
+
+// called by uwsgi_close_request()
+void uwsgi_histograms_account(struct wsgi_request *wsgi_req) {
+	if (!uwsgi.histogram_slots) return;
+	uint64_t rt = wsgi_req->end_of_request - wsgi_req->start_of_request;
+	uwsgi_histogram_add(uwsgi.histogram_request_time, wsgi_req, rt);
+	if (wsgi_req->app_start) {
+		uwsgi_histogram_add(uwsgi.histogram_app_time, wsgi_req, wsgi_req->end_of_request - wsgi_req->app_start);
+	}
+	uwsgi_histogram_add(uwsgi.histogram_headers_size, wsgi_req, wsgi_req->headers_size);
+	uwsgi_histogram_add(uwsgi.histogram_response_size, wsgi_req, wsgi_req->response_size);
+	if (wsgi_req->histogram) {
+		uwsgi_histogram_add(wsgi_req->histogram, wsgi_req, rt);
+	}
+}
+
+// arg1n is the kind of value (0: count, 1: sum, 2: max, N: quantile in permille)
+static int64_t uwsgi_metric_collector_histogram(struct uwsgi_metric *um) {
+	struct uwsgi_histogram *uh = (struct uwsgi_histogram *) um->custom;
+	// the metrics of the same histogram share the merged view
+	time_t now = uwsgi_now();
+	if (uh->merged_at != now) {
+		uwsgi_histogram_merge(uh, uh->merged);
+		uh->merged_at = now;
+	}
+	if (um->arg1n < 3) return uh->merged[um->arg1n];
+	return uwsgi_histogram_quantile(uh->merged, um->arg1n);
+}
+
+static void uwsgi_histograms_setup() {
+	char buf[4096];
+	char buf2[4096];
+	int i;
+	struct {
+		char *name;
+		uint8_t type;
+		int64_t kind;
+	} values[] = {
+		{"count", UWSGI_METRIC_COUNTER, 0},
+		{"sum", UWSGI_METRIC_COUNTER, 1},
+		{"max", UWSGI_METRIC_GAUGE, 2},
+		{"p50", UWSGI_METRIC_GAUGE, 500},
+		{"p90", UWSGI_METRIC_GAUGE, 900},
+		{"p99", UWSGI_METRIC_GAUGE, 990},
+		{"p999", UWSGI_METRIC_GAUGE, 999},
+	};
+
+	// in multithread mode every core needs its own slot
+	uwsgi.histogram_slots = uwsgi.threads > 1 ? uwsgi.cores : 1;
+
+	struct uwsgi_histogram *uh = uwsgi.histograms;
+	while(uh) {
+		uh->slots = uwsgi_calloc_shared(sizeof(uint64_t) * UWSGI_HISTOGRAM_SLOT_SIZE * uwsgi.numproc * uwsgi.histogram_slots);
+		uh->merged = uwsgi_calloc(sizeof(uint64_t) * UWSGI_HISTOGRAM_SLOT_SIZE);
+		for(i=0;i<(int)(sizeof(values)/sizeof(values[0]));i++) {
+			if (snprintf(buf, 4096, "histogram.%s.%s", uh->name, values[i].name) <= 1) {
+				uwsgi_log("unable to register metric name for histogram %s\n", uh->name);
+				exit(1);
+			}
+			uwsgi_metric_oid2("8.%d.%d", uh->id + 1, i + 1);
+			struct uwsgi_metric *um = uwsgi_register_metric(buf, buf2, values[i].type, "histogram", NULL, 0, uh);
+			if (um) um->arg1n = values[i].kind;
+		}
+		uh = uh->next;
+	}
+}
+
 void uwsgi_metrics_collectors_setup() {
 	uwsgi_register_metric_collector("ptr", uwsgi_metric_collector_ptr);
 	uwsgi_register_metric_collector("file", uwsgi_metric_collector_file);
 	uwsgi_register_metric_collector("sum", uwsgi_metric_collector_sum);
 	uwsgi_register_metric_collector("func", uwsgi_metric_collector_func);
+	uwsgi_register_metric_collector("histogram", uwsgi_metric_collector_histogram);
 }
@@ -79,6 +79,7 @@ static int u_offload_pipe_prepare(struct wsgi_request *wsgi_req, struct uwsgi_of
         memory offload engine:
                 buf -> pointer to the memory to transfer (memory is freed at the end)
                 len -> amount of data to transfer
+                iov -> (optional) slices to transfer instead of the whole buf (iov_cnt items, freed at the end)
 
 */
 
@@ -197,6 +198,10 @@ static void uwsgi_offload_close(struct uwsgi_thread *ut, struct uwsgi_offload_re
 		uwsgi_buffer_destroy(uor->ubuf);
 	}
 
+	if (uor->iov) {
+		free(uor->iov);
+	}
+
 	if (uor->pipe[0] != -1) {
 		close(uor->pipe[1]);
 		close(uor->pipe[0]);
@@ -280,6 +285,7 @@ struct uwsgi_thread *uwsgi_offload_thread_start() {
         uor->len -> the size of the memory chunk
         uor->buf -> the memory to transfer
 	uor->written -> written bytes
+	uor->iov -> the slices to transfer (uor->pos is the current one, consumed in place)
 
         status: none
 
@@ -290,7 +296,24 @@ static int u_offload_memory_do(struct uwsgi_thread *ut, struct uwsgi_offload_req
                 if (event_queue_add_fd_write(ut->queue, uor->s)) return -1;
                 return 0;
         }
-	ssize_t rlen = write(uor->s, uor->buf + uor->written, uor->len - uor->written);
+	ssize_t rlen;
+	if (uor->iov) {
+		rlen = writev(uor->s, uor->iov + uor->pos, uor->iov_cnt - uor->pos);
+		if (rlen > 0) {
+			size_t remains = rlen;
+			while((size_t) uor->pos < uor->iov_cnt && remains >= uor->iov[uor->pos].iov_len) {
+				remains -= uor->iov[uor->pos].iov_len;
+				uor->pos++;
+			}
+			if ((size_t) uor->pos < uor->iov_cnt) {
+				uor->iov[uor->pos].iov_base = ((char *) uor->iov[uor->pos].iov_base) + remains;
+				uor->iov[uor->pos].iov_len -= remains;
+			}
+		}
+	}
+	else {
+		rlen = write(uor->s, uor->buf + uor->written, uor->len - uor->written);
+	}
 	if (rlen > 0) {
 		uor->written += rlen;
 		if (uor->written >= uor->len) {
@@ -549,7 +572,7 @@ static int u_offload_transfer_do(struct uwsgi_thread *ut, struct uwsgi_offload_r
 	return -1;
 }
 
-int uwsgi_offload_run(struct wsgi_request *wsgi_req, struct uwsgi_offload_request *uor, int *wait) {
+static int uwsgi_offload_run_do(struct wsgi_request *wsgi_req, struct uwsgi_offload_request *uor, int *wait) {
 
 	if (uor->engine->prepare_func(wsgi_req, uor)) {
 		return -1;
@@ -582,6 +605,14 @@ int uwsgi_offload_run(struct wsgi_request *wsgi_req, struct uwsgi_offload_reques
 	
 };
 
+// the hand-over to the offload threads is timed as a tracing span
+int uwsgi_offload_run(struct wsgi_request *wsgi_req, struct uwsgi_offload_request *uor, int *wait) {
+	uint64_t span = uwsgi_span_begin();
+	int ret = uwsgi_offload_run_do(wsgi_req, uor, wait);
+	uwsgi_span_end(wsgi_req, UWSGI_SPAN_OFFLOAD, span);
+	return ret;
+}
+
 struct uwsgi_offload_engine *uwsgi_offload_engine_by_name(char *name) {
 	struct uwsgi_offload_engine *uoe = uwsgi.offload_engines;
 	while(uoe) {
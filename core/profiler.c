@@ -0,0 +1,391 @@
+#include "uwsgi.h"
+
+extern struct uwsgi_server uwsgi;
+
+/*
+	native sampling profiler (--sampling-profiler)
+
+	the master allocates a shared ring of stack samples before forking. The profiling session is
+	started and stopped with the master fifo:
+
+	echo x > myfifo (start)
+	echo X > myfifo (stop and dump)
+
+	every worker runs a control thread (with all of the signals blocked) checking the session state in the
+	shared ring every UWSGI_PROFILER_CONTROL_INTERVAL milliseconds: when a session is started it arms the
+	timers (--sampling-profiler-hz), and disarms them when the session is stopped.
+	No signal is sent by the master, so workers still loading their apps cannot be killed by SIGPROF.
+
+	On Linux every request thread (the main one and the --threads ones) registers itself, and the control
+	thread creates a timer on the cpu clock of each of them, delivering SIGPROF (SIGEV_THREAD_ID) only to
+	that thread. The timers only tick while the thread consumes cpu, so idle threads blocked in
+	accept()/poll() are not interrupted, and threads started by the apps are not sampled.
+	Elsewhere a process-wide ITIMER_PROF timer is used: the signal is delivered to any thread not blocking
+	SIGPROF (the request threads leave it unblocked), not necessarily the one consuming cpu, and it can
+	interrupt blocking syscalls with EINTR.
+
+	The handler reserves a slot of the ring with an atomic increment and stores the native
+	backtrace there (the oldest samples are overwritten when the ring is full).
+
+	On stop the master copies the ring and a thread aggregates the stacks and writes them in the
+	"folded" format (one line per stack, frames separated by ';', followed by the number of samples),
+	ready for flamegraph.pl. Frames are resolved with dladdr() in the master address space, so static
+	functions are reported as the nearest exported symbol and the libraries loaded after fork()
+	(lazy apps) as address offsets.
+*/
+
+#if defined(__linux__) || (defined(__APPLE__) && !defined(NO_EXECINFO)) || defined(UWSGI_HAS_EXECINFO)
+#define UWSGI_PROFILER_HAS_EXECINFO 1
+#include <execinfo.h>
+#endif
+
+// the signal handler and the signal trampoline
+#define UWSGI_PROFILER_SKIP_FRAMES 2
+// milliseconds between checks of the session state
+#define UWSGI_PROFILER_CONTROL_INTERVAL 100
+
+#if defined(__linux__) && defined(SIGEV_THREAD_ID)
+#define UWSGI_PROFILER_THREAD_TIMERS 1
+#include <sys/syscall.h>
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+// a request thread of the worker (indexed by core id)
+struct uwsgi_profiler_thread {
+	// set by the thread itself, 0 until it is registered
+	pid_t tid;
+	clockid_t clock;
+	// managed by the control thread
+	pid_t timer_tid;
+	timer_t timer;
+};
+
+static struct uwsgi_profiler_thread *uwsgi_profiler_threads;
+#endif
+
+static int uwsgi_profiler_armed;
+
+struct uwsgi_profiler_dump {
+	struct uwsgi_profiler_sample *samples;
+	uint64_t n;
+	uint64_t lost;
+	char *path;
+	int fd;
+};
+
+void uwsgi_profiler_init() {
+	if (!uwsgi.sampling_profiler) return;
+
+#ifndef UWSGI_PROFILER_HAS_EXECINFO
+	uwsgi_log("--sampling-profiler is not supported on this platform\n");
+	exit(1);
+#else
+	if (!uwsgi.sampling_profiler_hz) uwsgi.sampling_profiler_hz = 99;
+	if (uwsgi.sampling_profiler_hz > 1000) uwsgi.sampling_profiler_hz = 1000;
+	if (!uwsgi.sampling_profiler_samples) uwsgi.sampling_profiler_samples = 16384;
+
+	uwsgi.profiler_ring = uwsgi_calloc_shared(sizeof(struct uwsgi_profiler_ring) + (sizeof(struct uwsgi_profiler_sample) * uwsgi.sampling_profiler_samples));
+	uwsgi.profiler_ring->size = uwsgi.sampling_profiler_samples;
+
+	uwsgi_log("sampling profiler ready: %d Hz, %llu samples (%llu KB)\n", uwsgi.sampling_profiler_hz, (unsigned long long) uwsgi.sampling_profiler_samples,
+		(unsigned long long) ((sizeof(struct uwsgi_profiler_sample) * uwsgi.sampling_profiler_samples) / 1024));
+#endif
+}
+
+#ifdef UWSGI_PROFILER_HAS_EXECINFO
+#ifdef UWSGI_PROFILER_THREAD_TIMERS
+// called at every check, threads can register during a session
+static void uwsgi_profiler_arm(int on) {
+	int i;
+	struct itimerspec its;
+	memset(&its, 0, sizeof(struct itimerspec));
+	uint64_t interval = 1000000000ULL / uwsgi.sampling_profiler_hz;
+	its.it_interval.tv_sec = interval / 1000000000ULL;
+	its.it_interval.tv_nsec = interval % 1000000000ULL;
+	its.it_value = its.it_interval;
+
+	for(i=0;i<uwsgi.threads;i++) {
+		struct uwsgi_profiler_thread *upt = &uwsgi_profiler_threads[i];
+		pid_t tid = upt->tid;
+		__sync_synchronize();
+		// disarm, or the thread has been replaced
+		if (upt->timer_tid && (!on || upt->timer_tid != tid)) {
+			timer_delete(upt->timer);
+			upt->timer_tid = 0;
+		}
+		if (!on || !tid || upt->timer_tid) continue;
+
+		struct sigevent sev;
+		memset(&sev, 0, sizeof(struct sigevent));
+		sev.sigev_notify = SIGEV_THREAD_ID;
+		sev.sigev_signo = SIGPROF;
+		sev.sigev_notify_thread_id = tid;
+		if (timer_create(upt->clock, &sev, &upt->timer)) {
+			uwsgi_error("uwsgi_profiler_arm()/timer_create()");
+			// do not retry at every check
+			upt->tid = 0;
+			continue;
+		}
+		if (timer_settime(upt->timer, 0, &its, NULL)) {
+			uwsgi_error("uwsgi_profiler_arm()/timer_settime()");
+			timer_delete(upt->timer);
+			upt->tid = 0;
+			continue;
+		}
+		upt->timer_tid = tid;
+	}
+	uwsgi_profiler_armed = on;
+}
+#else
+static void uwsgi_profiler_arm(int on) {
+	if (on == uwsgi_profiler_armed) return;
+	struct itimerval it;
+	memset(&it, 0, sizeof(struct itimerval));
+	if (on) {
+		it.it_interval.tv_usec = 1000000 / uwsgi.sampling_profiler_hz;
+		it.it_value.tv_usec = it.it_interval.tv_usec;
+	}
+	setitimer(ITIMER_PROF, &it, NULL);
+	uwsgi_profiler_armed = on;
+}
+#endif
+
+static void uwsgi_profiler_signal(int signum, siginfo_t *si, void *ctx) {
+	struct uwsgi_profiler_ring *ring = uwsgi.profiler_ring;
+	int saved_errno = errno;
+
+	// the last ticks before the control thread disarms the timers
+	if (!ring->enabled) goto end;
+
+	// only the timer generates samples
+	if (si && si->si_code == SI_USER) goto end;
+
+	uint64_t pos = __sync_fetch_and_add(&ring->head, 1);
+	struct uwsgi_profiler_sample *sample = &ring->samples[pos % ring->size];
+	sample->seq = 0;
+	__sync_synchronize();
+	sample->depth = backtrace(sample->frames, UWSGI_PROFILER_DEPTH);
+	__sync_synchronize();
+	sample->seq = pos + 1;
+end:
+	errno = saved_errno;
+}
+
+static void *uwsgi_profiler_control_loop(void *arg) {
+	sigset_t smask;
+	sigfillset(&smask);
+	pthread_sigmask(SIG_BLOCK, &smask, NULL);
+
+	for(;;) {
+		uwsgi_profiler_arm(uwsgi.profiler_ring->enabled);
+		usleep(UWSGI_PROFILER_CONTROL_INTERVAL * 1000);
+	}
+	return NULL;
+}
+#endif
+
+// called by each worker after fork()
+void uwsgi_profiler_worker_init() {
+#ifdef UWSGI_PROFILER_HAS_EXECINFO
+	if (!uwsgi.profiler_ring) return;
+
+	// the first call of backtrace() loads the unwinder, do not do it in the signal handler
+	void *frames[2];
+	backtrace(frames, 2);
+
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(struct sigaction));
+	sa.sa_sigaction = uwsgi_profiler_signal;
+	sa.sa_flags = SA_SIGINFO | SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGPROF, &sa, NULL) < 0) {
+		uwsgi_error("uwsgi_profiler_worker_init()/sigaction()");
+		return;
+	}
+
+#ifdef UWSGI_PROFILER_THREAD_TIMERS
+	uwsgi_profiler_threads = uwsgi_calloc(sizeof(struct uwsgi_profiler_thread) * uwsgi.threads);
+	uwsgi_profiler_thread_init(0);
+#endif
+
+	// it arms the timers immediately if the worker is respawned during a session
+	pthread_t t;
+	if (pthread_create(&t, NULL, uwsgi_profiler_control_loop, NULL)) {
+		uwsgi_error("uwsgi_profiler_worker_init()/pthread_create()");
+		return;
+	}
+	pthread_detach(t);
+#endif
+}
+
+// called by each request thread (the main thread is core 0)
+void uwsgi_profiler_thread_init(int core_id) {
+#ifdef UWSGI_PROFILER_THREAD_TIMERS
+	if (!uwsgi_profiler_threads || core_id >= uwsgi.threads) return;
+	struct uwsgi_profiler_thread *upt = &uwsgi_profiler_threads[core_id];
+	if (pthread_getcpuclockid(pthread_self(), &upt->clock)) {
+		uwsgi_log("[uwsgi-profiler] unable to get the cpu clock of thread %d\n", core_id);
+		return;
+	}
+	__sync_synchronize();
+	upt->tid = (pid_t) syscall(SYS_gettid);
+#endif
+}
+
+// the master fifo 'x' command
+void uwsgi_profiler_start(int signum) {
+	struct uwsgi_profiler_ring *ring = uwsgi.profiler_ring;
+	uint64_t i;
+
+	if (!ring) {
+		uwsgi_log("[uwsgi-profiler] the sampling profiler is not enabled (use --sampling-profiler)\n");
+		return;
+	}
+
+	if (ring->enabled) return;
+
+	for(i=0;i<ring->size;i++) {
+		ring->samples[i].seq = 0;
+	}
+	ring->head = 0;
+	__sync_synchronize();
+	// the control threads of the workers will arm the timers
+	ring->enabled = 1;
+
+	uwsgi_log("[uwsgi-profiler] sampling started (%d Hz)\n", uwsgi.sampling_profiler_hz);
+}
+
+static int uwsgi_profiler_cmp(const void *a, const void *b) {
+	const struct uwsgi_profiler_sample *s1 = *(const struct uwsgi_profiler_sample **) a;
+	const struct uwsgi_profiler_sample *s2 = *(const struct uwsgi_profiler_sample **) b;
+	if (s1->depth != s2->depth) return s1->depth - s2->depth;
+	return memcmp(s1->frames, s2->frames, sizeof(void *) * s1->depth);
+}
+
+static void uwsgi_profiler_frame(FILE *f, void *addr) {
+	Dl_info info;
+	if (dladdr(addr, &info) && info.dli_fname) {
+		if (info.dli_sname) {
+			fprintf(f, "%s", info.dli_sname);
+			return;
+		}
+		char *name = uwsgi_get_last_char((char *) info.dli_fname, '/');
+		fprintf(f, "%s+0x%lx", name ? name + 1 : info.dli_fname, (unsigned long) ((char *) addr - (char *) info.dli_fbase));
+		return;
+	}
+	fprintf(f, "0x%lx", (unsigned long) addr);
+}
+
+static void uwsgi_profiler_write_stack(FILE *f, struct uwsgi_profiler_sample *sample, uint64_t count) {
+	int i;
+	int first = 1;
+	// from the outermost frame
+	for(i=sample->depth-1;i>=UWSGI_PROFILER_SKIP_FRAMES;i--) {
+		if (!first) fputc(';', f);
+		uwsgi_profiler_frame(f, sample->frames[i]);
+		first = 0;
+	}
+	fprintf(f, " %llu\n", (unsigned long long) count);
+}
+
+static void *uwsgi_profiler_dump_loop(void *arg) {
+	struct uwsgi_profiler_dump *upd = (struct uwsgi_profiler_dump *) arg;
+	uint64_t i, stacks = 0;
+
+	sigset_t smask;
+	sigfillset(&smask);
+	pthread_sigmask(SIG_BLOCK, &smask, NULL);
+
+	FILE *f = fdopen(upd->fd, "w");
+	if (!f) {
+		uwsgi_error("uwsgi_profiler_dump_loop()/fdopen()");
+		close(upd->fd);
+		goto end;
+	}
+
+	// identical stacks are adjacent after sorting
+	struct uwsgi_profiler_sample **sorted = uwsgi_malloc(sizeof(struct uwsgi_profiler_sample *) * upd->n);
+	for(i=0;i<upd->n;i++) sorted[i] = &upd->samples[i];
+	qsort(sorted, upd->n, sizeof(struct uwsgi_profiler_sample *), uwsgi_profiler_cmp);
+
+	uint64_t count = 0;
+	for(i=0;i<upd->n;i++) {
+		count++;
+		if (i + 1 < upd->n && !uwsgi_profiler_cmp(&sorted[i], &sorted[i+1])) continue;
+		uwsgi_profiler_write_stack(f, sorted[i], count);
+		stacks++;
+		count = 0;
+	}
+	free(sorted);
+	fclose(f);
+
+	uwsgi_log("[uwsgi-profiler] %llu samples (%llu lost), %llu stacks written to %s\n", (unsigned long long) upd->n, (unsigned long long) upd->lost,
+		(unsigned long long) stacks, upd->path);
+end:
+	free(upd->samples);
+	free(upd->path);
+	free(upd);
+	return NULL;
+}
+
+// the master fifo 'X' command
+void uwsgi_profiler_stop(int signum) {
+	struct uwsgi_profiler_ring *ring = uwsgi.profiler_ring;
+	uint64_t pos;
+
+	if (!ring || !ring->enabled) return;
+
+	// the control threads of the workers will disarm their timers
+	ring->enabled = 0;
+	__sync_synchronize();
+
+	uint64_t head = ring->head;
+	uint64_t start = head > ring->size ? head - ring->size : 0;
+
+	struct uwsgi_profiler_dump *upd = uwsgi_calloc(sizeof(struct uwsgi_profiler_dump));
+	upd->samples = uwsgi_malloc(sizeof(struct uwsgi_profiler_sample) * (head - start));
+	for(pos=start;pos<head;pos++) {
+		struct uwsgi_profiler_sample *sample = &ring->samples[pos % ring->size];
+		struct uwsgi_profiler_sample *dst = &upd->samples[upd->n];
+		if (sample->seq != pos + 1) continue;
+		memcpy(dst, sample, sizeof(struct uwsgi_profiler_sample));
+		__sync_synchronize();
+		// overwritten while copying
+		if (sample->seq != pos + 1 || dst->depth <= UWSGI_PROFILER_SKIP_FRAMES) continue;
+		upd->n++;
+	}
+	upd->lost = head - upd->n;
+
+	// the master could run as root, never follow symlinks (and do not use predictable names in /tmp)
+	if (uwsgi.sampling_profiler_output) {
+		upd->path = uwsgi_str(uwsgi.sampling_profiler_output);
+		upd->fd = open(upd->path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, 0600);
+	}
+	else {
+		upd->path = uwsgi_malloc(64);
+		snprintf(upd->path, 64, "/tmp/uwsgi-profile-%d-XXXXXX", (int) getpid());
+		upd->fd = mkstemp(upd->path);
+	}
+
+	if (upd->fd < 0) {
+		uwsgi_error_open(upd->path);
+		free(upd->samples);
+		free(upd->path);
+		free(upd);
+		return;
+	}
+
+	uwsgi_log("[uwsgi-profiler] sampling stopped, dumping %llu samples to %s\n", (unsigned long long) upd->n, upd->path);
+
+	pthread_t t;
+	if (pthread_create(&t, NULL, uwsgi_profiler_dump_loop, upd)) {
+		uwsgi_error("uwsgi_profiler_stop()/pthread_create()");
+		close(upd->fd);
+		free(upd->samples);
+		free(upd->path);
+		free(upd);
+		return;
+	}
+	pthread_detach(t);
+}
@@ -334,6 +334,8 @@ static void uwsgi_parse_http_range(char *buf, uint16_t len, size_t *from, size_t
 static int uwsgi_proto_check_10(struct wsgi_request *wsgi_req, char *key, char *buf, uint16_t len) {
 
 	if (uwsgi.honour_range && !uwsgi_proto_key("HTTP_RANGE", 10)) {
+		wsgi_req->range = buf;
+		wsgi_req->range_len = len;
 		uwsgi_parse_http_range(buf, len, &wsgi_req->range_from, &wsgi_req->range_to);
 		return 0;
 	}
@@ -481,6 +483,11 @@ static int uwsgi_proto_check_13(struct wsgi_request *wsgi_req, char *key, char *
 		wsgi_req->document_root_len = len;
 		return 0;
 	}
+	if (uwsgi.honour_range && !uwsgi_proto_key("HTTP_IF_RANGE", 13)) {
+		wsgi_req->if_range = buf;
+		wsgi_req->if_range_len = len;
+		return 0;
+	}
 	return 0;
 }
 
@@ -612,7 +619,7 @@ void uwsgi_proto_hooks_setup() {
 }
 
 
-int uwsgi_parse_vars(struct wsgi_request *wsgi_req) {
+static int uwsgi_parse_vars_do(struct wsgi_request *wsgi_req) {
 
 	char *buffer = wsgi_req->buffer;
 
@@ -926,6 +933,14 @@ nextsm2:
 	return 0;
 }
 
+// the vars parsing is timed as a tracing span
+int uwsgi_parse_vars(struct wsgi_request *wsgi_req) {
+	uint64_t span = uwsgi_span_begin();
+	int ret = uwsgi_parse_vars_do(wsgi_req);
+	uwsgi_span_end(wsgi_req, UWSGI_SPAN_VARS, span);
+	return ret;
+}
+
 int uwsgi_hooked_parse(char *buffer, size_t len, void (*hook) (char *, uint16_t, char *, uint16_t, void *), void *data) {
 
 	char *ptrbuf, *bufferend;
@@ -0,0 +1,280 @@
+#include "uwsgi.h"
+
+extern struct uwsgi_server uwsgi;
+
+/*
+	HTTP Range support for bodies already in memory (cache items, generated responses)
+
+	the Range header is parsed against the size of the body: a single range generates a plain 206 response,
+	multiple ranges generate a multipart/byteranges one. The part headers are built once in a uwsgi_buffer
+	and the body is never copied: the slices are written directly (or passed to the offload engine as an iovec).
+
+	Invalid Range headers (or too many ranges) are ignored and the whole body is sent. If-Range is honoured
+	only when it exactly matches the validator (ETag or Last-Modified) of the body.
+*/
+
+static int uwsgi_ranges_num(char *buf, size_t len, uint64_t *n) {
+	size_t i;
+	if (len == 0 || len > 19) return -1;
+	*n = 0;
+	for(i=0;i<len;i++) {
+		if (!isdigit((int) buf[i])) return -1;
+		*n = (*n * 10) + (buf[i] - '0');
+	}
+	return 0;
+}
+
+int uwsgi_ranges_parse(struct wsgi_request *wsgi_req, uint64_t size, char *validator, uint16_t validator_len, struct uwsgi_ranges *ur) {
+	int unsatisfiable = 0;
+
+	memset(ur, 0, sizeof(struct uwsgi_ranges));
+	ur->size = size;
+
+	if (!wsgi_req->range_len) return 0;
+
+	// the ranges refer to a different representation, send the whole body
+	if (wsgi_req->if_range_len) {
+		if (!validator || uwsgi_strncmp(wsgi_req->if_range, wsgi_req->if_range_len, validator, validator_len)) return 0;
+	}
+
+	if (wsgi_req->range_len < 7 || strncasecmp(wsgi_req->range, "bytes=", 6)) return 0;
+
+	char *ptr = wsgi_req->range + 6;
+	char *end = wsgi_req->range + wsgi_req->range_len;
+
+	while(ptr < end) {
+		char *comma = memchr(ptr, ',', end - ptr);
+		if (!comma) comma = end;
+		char *spec = ptr;
+		char *spec_end = comma;
+		ptr = comma + 1;
+
+		while(spec < spec_end && (*spec == ' ' || *spec == '\t')) spec++;
+		while(spec_end > spec && (*(spec_end-1) == ' ' || *(spec_end-1) == '\t')) spec_end--;
+		if (spec == spec_end) continue;
+
+		char *dash = memchr(spec, '-', spec_end - spec);
+		if (!dash) goto invalid;
+
+		uint64_t from, to;
+		// suffix range (the last N bytes)
+		if (dash == spec) {
+			uint64_t n;
+			if (uwsgi_ranges_num(dash + 1, spec_end - (dash + 1), &n)) goto invalid;
+			if (n == 0 || size == 0) {
+				unsatisfiable = 1;
+				continue;
+			}
+			from = n > size ? 0 : size - n;
+			to = size - 1;
+		}
+		else {
+			if (uwsgi_ranges_num(spec, dash - spec, &from)) goto invalid;
+			if (dash + 1 == spec_end) {
+				to = size - 1;
+			}
+			else {
+				if (uwsgi_ranges_num(dash + 1, spec_end - (dash + 1), &to)) goto invalid;
+				if (to < from) goto invalid;
+				if (to >= size) to = size - 1;
+			}
+			if (from >= size) {
+				unsatisfiable = 1;
+				continue;
+			}
+		}
+
+		if (ur->n >= UWSGI_MAX_RANGES) goto invalid;
+		ur->r[ur->n].from = from;
+		ur->r[ur->n].to = to;
+		ur->n++;
+	}
+
+	if (ur->n == 0 && unsatisfiable) {
+		ur->n = -1;
+	}
+	return ur->n;
+
+invalid:
+	ur->n = 0;
+	return 0;
+}
+
+static int uwsgi_ranges_content_range(struct wsgi_request *wsgi_req, struct uwsgi_range *r, uint64_t size) {
+	char buf[6+(sizeof(UMAX64_STR)*3)+4];
+	int ret = snprintf(buf, sizeof(buf), "bytes %llu-%llu/%llu", (unsigned long long) r->from, (unsigned long long) r->to, (unsigned long long) size);
+	if (ret <= 0 || ret >= (int) sizeof(buf)) {
+		wsgi_req->write_errors++;
+		return -1;
+	}
+	return uwsgi_response_add_header(wsgi_req, "Content-Range", 13, buf, ret);
+}
+
+// build the part headers and the closing boundary of a multipart/byteranges body
+static int uwsgi_ranges_build_parts(struct uwsgi_ranges *ur, char *content_type, uint16_t content_type_len) {
+	int i;
+	char size_str[sizeof(UMAX64_STR)+1];
+	int size_len = uwsgi_long2str2n(ur->size, size_str, sizeof(UMAX64_STR)+1);
+
+	snprintf(ur->boundary, 17, "%08x%08x", (uint32_t) rand(), (uint32_t) rand());
+	ur->parts = uwsgi_buffer_new(uwsgi.page_size);
+
+	for(i=0;i<ur->n;i++) {
+		struct uwsgi_range *r = &ur->r[i];
+		r->header_pos = ur->parts->pos;
+		if (uwsgi_buffer_append(ur->parts, "\r\n--", 4)) return -1;
+		if (uwsgi_buffer_append(ur->parts, ur->boundary, 16)) return -1;
+		if (content_type_len > 0) {
+			if (uwsgi_buffer_append(ur->parts, "\r\nContent-Type: ", 16)) return -1;
+			if (uwsgi_buffer_append(ur->parts, content_type, content_type_len)) return -1;
+		}
+		if (uwsgi_buffer_append(ur->parts, "\r\nContent-Range: bytes ", 23)) return -1;
+		if (uwsgi_buffer_num64(ur->parts, r->from)) return -1;
+		if (uwsgi_buffer_append(ur->parts, "-", 1)) return -1;
+		if (uwsgi_buffer_num64(ur->parts, r->to)) return -1;
+		if (uwsgi_buffer_append(ur->parts, "/", 1)) return -1;
+		if (uwsgi_buffer_append(ur->parts, size_str, size_len)) return -1;
+		if (uwsgi_buffer_append(ur->parts, "\r\n\r\n", 4)) return -1;
+		r->header_len = ur->parts->pos - r->header_pos;
+	}
+
+	ur->closing_pos = ur->parts->pos;
+	if (uwsgi_buffer_append(ur->parts, "\r\n--", 4)) return -1;
+	if (uwsgi_buffer_append(ur->parts, ur->boundary, 16)) return -1;
+	if (uwsgi_buffer_append(ur->parts, "--\r\n", 4)) return -1;
+	return 0;
+}
+
+/*
+	prepare the status and the headers of the response (200, 206 or 416):
+	the other headers can be added after this call
+*/
+int uwsgi_response_prepare_ranges(struct wsgi_request *wsgi_req, struct uwsgi_ranges *ur, char *content_type, uint16_t content_type_len, int add_content_length) {
+	int i;
+
+	if (ur->n < 0) {
+		char buf[8+sizeof(UMAX64_STR)+1];
+		if (uwsgi_response_prepare_headers(wsgi_req, "416 Requested Range Not Satisfiable", 35)) return -1;
+		int ret = snprintf(buf, sizeof(buf), "bytes */%llu", (unsigned long long) ur->size);
+		if (ret <= 0 || ret >= (int) sizeof(buf)) return -1;
+		if (uwsgi_response_add_header(wsgi_req, "Content-Range", 13, buf, ret)) return -1;
+		return uwsgi_response_add_content_length(wsgi_req, 0);
+	}
+
+	if (ur->n == 0) {
+		if (uwsgi_response_prepare_headers(wsgi_req, "200 OK", 6)) return -1;
+		if (content_type_len > 0) {
+			if (uwsgi_response_add_content_type(wsgi_req, content_type, content_type_len)) return -1;
+		}
+		if (add_content_length) {
+			if (uwsgi_response_add_content_length(wsgi_req, ur->size)) return -1;
+		}
+		return 0;
+	}
+
+	if (uwsgi_response_prepare_headers(wsgi_req, "206 Partial Content", 19)) return -1;
+
+	if (ur->n == 1) {
+		if (content_type_len > 0) {
+			if (uwsgi_response_add_content_type(wsgi_req, content_type, content_type_len)) return -1;
+		}
+		if (uwsgi_ranges_content_range(wsgi_req, &ur->r[0], ur->size)) return -1;
+		return uwsgi_response_add_content_length(wsgi_req, (ur->r[0].to - ur->r[0].from) + 1);
+	}
+
+	if (uwsgi_ranges_build_parts(ur, content_type, content_type_len)) return -1;
+
+	char ct[31+16];
+	memcpy(ct, "multipart/byteranges; boundary=", 31);
+	memcpy(ct + 31, ur->boundary, 16);
+	if (uwsgi_response_add_content_type(wsgi_req, ct, 31+16)) return -1;
+
+	uint64_t cl = ur->parts->pos;
+	for(i=0;i<ur->n;i++) {
+		cl += (ur->r[i].to - ur->r[i].from) + 1;
+	}
+	return uwsgi_response_add_content_length(wsgi_req, cl);
+}
+
+// write the body (or its slices) prepared by uwsgi_response_prepare_ranges()
+int uwsgi_response_write_ranges(struct wsgi_request *wsgi_req, char *buf, struct uwsgi_ranges *ur) {
+	int i;
+
+	if (ur->n < 0) {
+		return uwsgi_response_write_headers_do(wsgi_req);
+	}
+
+	if (ur->n == 0) {
+		return uwsgi_response_write_body_do(wsgi_req, buf, ur->size);
+	}
+
+	if (ur->n == 1) {
+		return uwsgi_response_write_body_do(wsgi_req, buf + ur->r[0].from, (ur->r[0].to - ur->r[0].from) + 1);
+	}
+
+	for(i=0;i<ur->n;i++) {
+		struct uwsgi_range *r = &ur->r[i];
+		if (uwsgi_response_write_body_do(wsgi_req, ur->parts->buf + r->header_pos, r->header_len)) return -1;
+		if (uwsgi_response_write_body_do(wsgi_req, buf + r->from, (r->to - r->from) + 1)) return -1;
+	}
+	return uwsgi_response_write_body_do(wsgi_req, ur->parts->buf + ur->closing_pos, ur->parts->pos - ur->closing_pos);
+}
+
+/*
+	offload the ranges of buf (the headers must be already sent):
+	on success buf and the part headers are owned (and freed) by the offload thread
+*/
+int uwsgi_offload_request_memory_ranges_do(struct wsgi_request *wsgi_req, char *buf, struct uwsgi_ranges *ur) {
+	int i;
+
+	if (ur->n < 0) return -1;
+
+	if (ur->n == 0) {
+		return uwsgi_offload_request_memory_do(wsgi_req, buf, ur->size);
+	}
+
+	struct uwsgi_offload_request uor;
+	uwsgi_offload_setup(uwsgi.offload_engine_memory, &uor, wsgi_req, 1);
+	uor.buf = buf;
+
+	if (ur->n == 1) {
+		uor.iov_cnt = 1;
+		uor.iov = uwsgi_malloc(sizeof(struct iovec));
+		uor.iov[0].iov_base = buf + ur->r[0].from;
+		uor.iov[0].iov_len = (ur->r[0].to - ur->r[0].from) + 1;
+	}
+	else {
+		uor.iov_cnt = (ur->n * 2) + 1;
+		uor.iov = uwsgi_malloc(sizeof(struct iovec) * uor.iov_cnt);
+		for(i=0;i<ur->n;i++) {
+			struct uwsgi_range *r = &ur->r[i];
+			uor.iov[i*2].iov_base = ur->parts->buf + r->header_pos;
+			uor.iov[i*2].iov_len = r->header_len;
+			uor.iov[(i*2)+1].iov_base = buf + r->from;
+			uor.iov[(i*2)+1].iov_len = (r->to - r->from) + 1;
+		}
+		uor.iov[i*2].iov_base = ur->parts->buf + ur->closing_pos;
+		uor.iov[i*2].iov_len = ur->parts->pos - ur->closing_pos;
+		uor.ubuf = ur->parts;
+	}
+
+	for(i=0;i<(int)uor.iov_cnt;i++) {
+		uor.len += uor.iov[i].iov_len;
+	}
+
+	if (uwsgi_offload_run(wsgi_req, &uor, NULL)) {
+		free(uor.iov);
+		return -1;
+	}
+
+	// now the part headers belong to the offload thread
+	ur->parts = NULL;
+	return 0;
+}
+
+void uwsgi_ranges_free(struct uwsgi_ranges *ur) {
+	if (ur->parts) {
+		uwsgi_buffer_destroy(ur->parts);
+		ur->parts = NULL;
+	}
+}
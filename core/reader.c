@@ -24,6 +24,11 @@ int uwsgi_simple_wait_read_hook(int fd, int timeout) {
         return ret;
 }
 
+// sleep without blocking the other cores (loop engines can override it)
+int uwsgi_simple_wait_milliseconds_hook(int timeout) {
+	return poll(NULL, 0, timeout);
+}
+
 /*
 	seek()/rewind() language-independent implementations.
 */
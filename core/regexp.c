@@ -3,6 +3,156 @@
 
 extern struct uwsgi_server uwsgi;
 
+#ifdef UWSGI_PCRE2
+/*
+	pcre2 backend
+
+	patterns are jit-compiled at build time (unless --pcre-no-jit is specified or the library
+	lacks jit support). Matching requires a pcre2_match_data area and (for jit) a stack:
+	instead of allocating them on every call, each thread gets its own set the first time it
+	runs a regexp. A match never suspends, so async cores sharing a thread can safely share it too.
+
+	The match data is sized for the pattern with the biggest number of capture groups (it is
+	enlarged when a bigger one is built at runtime, like with regexp route conditions)
+*/
+
+struct uwsgi_regexp_thread {
+	pcre2_match_data *match_data;
+	uint32_t pairs;
+	pcre2_match_context *match_context;
+	pcre2_jit_stack *jit_stack;
+};
+
+static pthread_key_t uwsgi_regexp_key;
+static pthread_once_t uwsgi_regexp_once = PTHREAD_ONCE_INIT;
+static uint32_t uwsgi_regexp_max_pairs = 1;
+static int uwsgi_regexp_has_jit = -1;
+
+static void uwsgi_regexp_key_create() {
+	if (pthread_key_create(&uwsgi_regexp_key, NULL)) {
+		uwsgi_error("pthread_key_create()");
+		exit(1);
+	}
+}
+
+static struct uwsgi_regexp_thread *uwsgi_regexp_thread_get(uint32_t pairs) {
+	pthread_once(&uwsgi_regexp_once, uwsgi_regexp_key_create);
+	struct uwsgi_regexp_thread *urt = pthread_getspecific(uwsgi_regexp_key);
+	if (!urt) {
+		urt = uwsgi_calloc(sizeof(struct uwsgi_regexp_thread));
+		if (uwsgi_regexp_jit()) {
+			urt->match_context = pcre2_match_context_create(NULL);
+			urt->jit_stack = pcre2_jit_stack_create(32 * 1024, 512 * 1024, NULL);
+			if (!urt->match_context || !urt->jit_stack) {
+				uwsgi_log("unable to allocate pcre2 jit stack\n");
+				exit(1);
+			}
+			pcre2_jit_stack_assign(urt->match_context, NULL, urt->jit_stack);
+		}
+		pthread_setspecific(uwsgi_regexp_key, urt);
+	}
+
+	if (pairs < uwsgi_regexp_max_pairs) pairs = uwsgi_regexp_max_pairs;
+	if (urt->pairs < pairs) {
+		if (urt->match_data) pcre2_match_data_free(urt->match_data);
+		urt->match_data = pcre2_match_data_create(pairs, NULL);
+		if (!urt->match_data) {
+			uwsgi_log("unable to allocate pcre2 match data\n");
+			exit(1);
+		}
+		urt->pairs = pairs;
+	}
+	return urt;
+}
+
+int uwsgi_regexp_jit() {
+	if (uwsgi.pcre_no_jit) return 0;
+	if (uwsgi_regexp_has_jit < 0) {
+		uint32_t has_jit = 0;
+		if (pcre2_config(PCRE2_CONFIG_JIT, &has_jit) < 0) has_jit = 0;
+		uwsgi_regexp_has_jit = has_jit ? 1 : 0;
+	}
+	return uwsgi_regexp_has_jit;
+}
+
+void uwsgi_opt_pcre_jit(char *opt, char *value, void *foobar) {
+	// jit is the default with pcre2
+	uwsgi.pcre_no_jit = 0;
+}
+
+int uwsgi_regexp_build(char *re, uwsgi_pcre ** pattern, uwsgi_pcre_extra ** pattern_extra) {
+
+	int errnum;
+	PCRE2_SIZE erroff;
+
+	*pattern_extra = NULL;
+	*pattern = pcre2_compile((PCRE2_SPTR) re, PCRE2_ZERO_TERMINATED, 0, &errnum, &erroff, NULL);
+	if (!*pattern) {
+		PCRE2_UCHAR errstr[256];
+		pcre2_get_error_message(errnum, errstr, sizeof(errstr));
+		uwsgi_log("pcre error: %s at offset %d\n", errstr, (int) erroff);
+		return -1;
+	}
+
+	if (uwsgi_regexp_jit()) {
+		// a failed jit compilation is not fatal, the interpreter will be used
+		int ret = pcre2_jit_compile(*pattern, PCRE2_JIT_COMPLETE);
+		if (ret < 0 && ret != PCRE2_ERROR_JIT_BADOPTION) {
+			PCRE2_UCHAR errstr[256];
+			pcre2_get_error_message(ret, errstr, sizeof(errstr));
+			uwsgi_log("pcre (jit) error: %s\n", errstr);
+		}
+	}
+
+	uint32_t pairs = uwsgi_regexp_ovector(*pattern, NULL) + 1;
+	if (pairs > uwsgi_regexp_max_pairs) uwsgi_regexp_max_pairs = pairs;
+
+	return 0;
+
+}
+
+void uwsgi_regexp_free(uwsgi_pcre * pattern, uwsgi_pcre_extra * pattern_extra) {
+	pcre2_code_free(pattern);
+}
+
+int uwsgi_regexp_match(uwsgi_pcre * pattern, uwsgi_pcre_extra * pattern_extra, char *subject, int length) {
+
+	struct uwsgi_regexp_thread *urt = uwsgi_regexp_thread_get(1);
+	return pcre2_match(pattern, (PCRE2_SPTR) subject, length, 0, 0, urt->match_data, urt->match_context);
+}
+
+int uwsgi_regexp_match_ovec(uwsgi_pcre * pattern, uwsgi_pcre_extra * pattern_extra, char *subject, int length, int *ovec, int n) {
+
+	struct uwsgi_regexp_thread *urt = uwsgi_regexp_thread_get(n + 1);
+	int ret = pcre2_match(pattern, (PCRE2_SPTR) subject, length, 0, 0, urt->match_data, urt->match_context);
+	if (ret < 0 || n <= 0)
+		return ret;
+
+	// the routing subsystem expects the pcre1 layout (int pairs, -1 for unset groups)
+	PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(urt->match_data);
+	int i;
+	for (i = 0; i < (n + 1) * 2; i++) {
+		ovec[i] = ovector[i] == PCRE2_UNSET ? -1 : (int) ovector[i];
+	}
+	return ret;
+}
+
+int uwsgi_regexp_ovector(uwsgi_pcre * pattern, uwsgi_pcre_extra * pattern_extra) {
+
+	uint32_t n;
+
+	if (pcre2_pattern_info(pattern, PCRE2_INFO_CAPTURECOUNT, &n))
+		return 0;
+
+	return n;
+}
+
+#else
+
+int uwsgi_regexp_jit() {
+	return uwsgi.pcre_jit;
+}
+
 void uwsgi_opt_pcre_jit(char *opt, char *value, void *foobar) {
 #if defined(PCRE_STUDY_JIT_COMPILE) && defined(PCRE_CONFIG_JIT)
 	int has_jit = 0, ret;
@@ -13,7 +163,7 @@ void uwsgi_opt_pcre_jit(char *opt, char *value, void *foobar) {
 #endif
 }
 
-int uwsgi_regexp_build(char *re, pcre ** pattern, pcre_extra ** pattern_extra) {
+int uwsgi_regexp_build(char *re, uwsgi_pcre ** pattern, uwsgi_pcre_extra ** pattern_extra) {
 
 	const char *errstr;
 	int erroff;
@@ -24,7 +174,7 @@ int uwsgi_regexp_build(char *re, pcre ** pattern, pcre_extra ** pattern_extra) {
 		return -1;
 	}
 
-	int opt = uwsgi.pcre_jit;
+	int opt = uwsgi.pcre_no_jit ? 0 : uwsgi.pcre_jit;
 
 	*pattern_extra = (pcre_extra *) pcre_study((const pcre *) *pattern, opt, &errstr);
 	if (*pattern_extra == NULL && errstr != NULL) {
@@ -37,12 +187,22 @@ int uwsgi_regexp_build(char *re, pcre ** pattern, pcre_extra ** pattern_extra) {
 
 }
 
-int uwsgi_regexp_match(pcre * pattern, pcre_extra * pattern_extra, char *subject, int length) {
+void uwsgi_regexp_free(uwsgi_pcre * pattern, uwsgi_pcre_extra * pattern_extra) {
+	pcre_free(pattern);
+	if (!pattern_extra) return;
+#ifdef PCRE_STUDY_JIT_COMPILE
+	pcre_free_study(pattern_extra);
+#else
+	pcre_free(pattern_extra);
+#endif
+}
+
+int uwsgi_regexp_match(uwsgi_pcre * pattern, uwsgi_pcre_extra * pattern_extra, char *subject, int length) {
 
 	return pcre_exec((const pcre *) pattern, (const pcre_extra *) pattern_extra, subject, length, 0, 0, NULL, 0);
 }
 
-int uwsgi_regexp_match_ovec(pcre * pattern, pcre_extra * pattern_extra, char *subject, int length, int *ovec, int n) {
+int uwsgi_regexp_match_ovec(uwsgi_pcre * pattern, uwsgi_pcre_extra * pattern_extra, char *subject, int length, int *ovec, int n) {
 
 	if (n > 0) {
 		return pcre_exec((const pcre *) pattern, (const pcre_extra *) pattern_extra, subject, length, 0, 0, ovec, (n + 1) * 3);
@@ -50,7 +210,7 @@ int uwsgi_regexp_match_ovec(pcre * pattern, pcre_extra * pattern_extra, char *su
 	return pcre_exec((const pcre *) pattern, (const pcre_extra *) pattern_extra, subject, length, 0, 0, NULL, 0);
 }
 
-int uwsgi_regexp_ovector(pcre * pattern, pcre_extra * pattern_extra) {
+int uwsgi_regexp_ovector(uwsgi_pcre * pattern, uwsgi_pcre_extra * pattern_extra) {
 
 	int n;
 
@@ -60,6 +220,8 @@ int uwsgi_regexp_ovector(pcre * pattern, pcre_extra * pattern_extra) {
 	return n;
 }
 
+#endif
+
 char *uwsgi_regexp_apply_ovec(char *src, int src_n, char *dst, int dst_n, int *ovector, int n) {
 
 	int i;
@@ -150,6 +150,231 @@ error:
 	return NULL;
 }
 
+/*
+
+	compiled routing tables
+
+	a list of routes is compiled in an array (indexed by route position) and in a literal prefix trie
+	for each subject: regexps anchored with a literal prefix (like ^/foo/bar) are indexed in the trie
+	of their subject, everything else (conditions, run, labels-less regexps without a usable prefix)
+	is always evaluated.
+
+	on each request the tries are walked with the subjects, building a bitmap of the candidate routes,
+	then the routing engine jumps from a candidate to the next one. As only non-matching regexps are skipped,
+	ordering, goto and labels semantics are the same of the plain list walk. The bitmap is rebuilt after
+	every action that does not end the routing, as it could have changed the subjects.
+
+*/
+
+struct uwsgi_route_trie {
+	unsigned char c;
+	struct uwsgi_route_trie *child;
+	struct uwsgi_route_trie *sibling;
+	// routes whose literal prefix ends here
+	uint64_t *routes;
+	uint64_t routes_cnt;
+};
+
+struct uwsgi_route_group {
+	size_t subject;
+	size_t subject_len;
+	struct uwsgi_route_trie trie;
+	struct uwsgi_route_group *next;
+};
+
+struct uwsgi_route_table {
+	struct uwsgi_route **routes;
+	uint64_t count;
+	// size of the bitmaps in 64bit words
+	uint64_t words;
+	// routes to always evaluate
+	uint64_t *always;
+	// per-core candidates bitmap
+	uint64_t **candidates;
+	struct uwsgi_route_group *groups;
+};
+
+// extract the literal prefix of an anchored regexp (returns its length, 0 if not available)
+static size_t uwsgi_route_literal_prefix(char *re, char *prefix) {
+	size_t len = 0;
+	if (re[0] != '^')
+		return 0;
+	// alternations and inline options could invalidate the prefix
+	char *ptr = re;
+	while (*ptr) {
+		if (*ptr == '\\') {
+			if (!ptr[1]) return 0;
+			ptr += 2;
+			continue;
+		}
+		if (*ptr == '|') return 0;
+		if (*ptr == '(' && ptr[1] == '?') return 0;
+		ptr++;
+	}
+
+	ptr = re + 1;
+	while (*ptr) {
+		char c = *ptr;
+		size_t skip = 1;
+		if (c == '\\') {
+			// character classes, back references, anchors...
+			if (isalnum((int) ptr[1]))
+				break;
+			c = ptr[1];
+			skip = 2;
+		}
+		else if (strchr(".[]()*+?{}^$", c)) {
+			break;
+		}
+		// an optional (or repeated zero times) char is not part of the prefix
+		if (ptr[skip] == '?' || ptr[skip] == '*' || ptr[skip] == '{')
+			break;
+		prefix[len++] = c;
+		ptr += skip;
+		if (*ptr == '+')
+			break;
+	}
+	return len;
+}
+
+static void uwsgi_route_trie_add(struct uwsgi_route_trie *node, char *prefix, size_t len, uint64_t pos) {
+	size_t i;
+	for (i = 0; i < len; i++) {
+		struct uwsgi_route_trie *child = node->child;
+		while (child) {
+			if (child->c == (unsigned char) prefix[i])
+				break;
+			child = child->sibling;
+		}
+		if (!child) {
+			child = uwsgi_calloc(sizeof(struct uwsgi_route_trie));
+			child->c = (unsigned char) prefix[i];
+			child->sibling = node->child;
+			node->child = child;
+		}
+		node = child;
+	}
+	node->routes = realloc(node->routes, sizeof(uint64_t) * (node->routes_cnt + 1));
+	if (!node->routes) {
+		uwsgi_error("uwsgi_route_trie_add()/realloc()");
+		exit(1);
+	}
+	node->routes[node->routes_cnt++] = pos;
+}
+
+static struct uwsgi_route_table *uwsgi_route_table_build(struct uwsgi_route *routes) {
+	uint64_t count = 0, indexed = 0;
+	struct uwsgi_route *ur = routes;
+	while (ur) {
+		// routes added by other means cannot be compiled
+		if (ur->pos != count)
+			return NULL;
+		count++;
+		ur = ur->next;
+	}
+
+	struct uwsgi_route_table *urt = uwsgi_calloc(sizeof(struct uwsgi_route_table));
+	urt->count = count;
+	urt->words = (count / 64) + 1;
+	urt->routes = uwsgi_malloc(sizeof(struct uwsgi_route *) * count);
+	urt->always = uwsgi_calloc(sizeof(uint64_t) * urt->words);
+
+	char *prefix = uwsgi_malloc(uwsgi.buffer_size);
+
+	ur = routes;
+	while (ur) {
+		urt->routes[ur->pos] = ur;
+		if (ur->label)
+			goto next;
+		size_t prefix_len = 0;
+		if (!ur->if_func && ur->subject && ur->pattern && strlen(ur->regexp) < uwsgi.buffer_size) {
+			prefix_len = uwsgi_route_literal_prefix(ur->regexp, prefix);
+		}
+		if (prefix_len == 0) {
+			urt->always[ur->pos / 64] |= ((uint64_t) 1) << (ur->pos % 64);
+			goto next;
+		}
+		struct uwsgi_route_group *urg = urt->groups, *old_urg = NULL;
+		while (urg) {
+			if (urg->subject == ur->subject && urg->subject_len == ur->subject_len)
+				break;
+			old_urg = urg;
+			urg = urg->next;
+		}
+		if (!urg) {
+			urg = uwsgi_calloc(sizeof(struct uwsgi_route_group));
+			urg->subject = ur->subject;
+			urg->subject_len = ur->subject_len;
+			if (old_urg) {
+				old_urg->next = urg;
+			}
+			else {
+				urt->groups = urg;
+			}
+		}
+		uwsgi_route_trie_add(&urg->trie, prefix, prefix_len, ur->pos);
+		indexed++;
+next:
+		ur = ur->next;
+	}
+
+	free(prefix);
+
+	int i;
+	urt->candidates = uwsgi_malloc(sizeof(uint64_t *) * uwsgi.cores);
+	for (i = 0; i < uwsgi.cores; i++) {
+		urt->candidates[i] = uwsgi_malloc(sizeof(uint64_t) * urt->words);
+	}
+
+	uwsgi_log_verbose("compiled routing table: %llu rules (%llu indexed by prefix)\n", (unsigned long long) count, (unsigned long long) indexed);
+	return urt;
+}
+
+// build the bitmap of the routes that could match the current request
+static uint64_t *uwsgi_route_table_candidates(struct uwsgi_route_table *urt, struct wsgi_request *wsgi_req) {
+	uint64_t *candidates = urt->candidates[wsgi_req->async_id];
+	memcpy(candidates, urt->always, sizeof(uint64_t) * urt->words);
+	struct uwsgi_route_group *urg = urt->groups;
+	while (urg) {
+		char *subject = *((char **) (((char *) (wsgi_req)) + urg->subject));
+		uint16_t subject_len = *((uint16_t *) (((char *) (wsgi_req)) + urg->subject_len));
+		struct uwsgi_route_trie *node = &urg->trie;
+		uint16_t i;
+		for (i = 0; i < subject_len; i++) {
+			struct uwsgi_route_trie *child = node->child;
+			while (child) {
+				if (child->c == (unsigned char) subject[i])
+					break;
+				child = child->sibling;
+			}
+			if (!child)
+				break;
+			node = child;
+			uint64_t j;
+			for (j = 0; j < node->routes_cnt; j++) {
+				candidates[node->routes[j] / 64] |= ((uint64_t) 1) << (node->routes[j] % 64);
+			}
+		}
+		urg = urg->next;
+	}
+	return candidates;
+}
+
+// get the position of the first candidate >= pos (urt->count if none)
+static uint64_t uwsgi_route_table_next(struct uwsgi_route_table *urt, uint64_t *candidates, uint64_t pos) {
+	while (pos < urt->count) {
+		uint64_t word = candidates[pos / 64] >> (pos % 64);
+		if (word) {
+			pos += __builtin_ctzll(word);
+			break;
+		}
+		pos = ((pos / 64) + 1) * 64;
+	}
+	if (pos > urt->count)
+		pos = urt->count;
+	return pos;
+}
+
 static void uwsgi_routing_reset_memory(struct wsgi_request *wsgi_req, struct uwsgi_route *routes) {
 	// free dynamic memory structures
 	if (routes->if_func) {
@@ -189,8 +414,27 @@ int uwsgi_apply_routes_do(struct uwsgi_route *routes, struct wsgi_request *wsgi_
 		r_pc = &wsgi_req->final_route_pc;
 	}
 
+	// the compiled table can be used only for a fresh walk with the default subjects
+	struct uwsgi_route_table *urt = routes ? routes->table : NULL;
+	uint64_t *candidates = NULL;
+	if (urt && !subject && *r_pc == 0) {
+		candidates = uwsgi_route_table_candidates(urt, wsgi_req);
+	}
+
 	while (routes) {
 
+		if (candidates) {
+			// jump to the next candidate (honouring a pending goto)
+			uint64_t pos = routes->pos;
+			if (*r_goto > pos)
+				pos = *r_goto;
+			pos = uwsgi_route_table_next(urt, candidates, pos);
+			if (pos >= urt->count)
+				break;
+			routes = urt->routes[pos];
+			*r_pc = pos;
+		}
+
 		if (routes->label) goto next;
 
 		if (*r_goto > 0 && *r_pc < *r_goto) {
@@ -242,6 +486,12 @@ run:
 			wsgi_req->is_routing = 1;
 			int ret = routes->func(wsgi_req, routes);
 			uwsgi_routing_reset_memory(wsgi_req, routes);
+			// name the transformations added by the action
+			struct uwsgi_transformation *ut = wsgi_req->transformations;
+			while(ut) {
+				if (!ut->name) ut->name = routes->action;
+				ut = ut->next;
+			}
 			wsgi_req->is_routing = 0;
 			if (ret == UWSGI_ROUTE_BREAK) {
 				uwsgi.workers[uwsgi.mywid].cores[wsgi_req->async_id].routed_requests++;
@@ -254,6 +504,10 @@ run:
 			if (ret == -1) {
 				return UWSGI_ROUTE_BREAK;
 			}
+			// the action could have changed the subjects (rewrite, setpathinfo...)
+			if (candidates) {
+				candidates = uwsgi_route_table_candidates(urt, wsgi_req);
+			}
 		}
 next:
 		subject = orig_subject;
@@ -283,7 +537,10 @@ int uwsgi_apply_routes(struct wsgi_request *wsgi_req) {
 		return UWSGI_ROUTE_CONTINUE;
 	}
 
-	return uwsgi_apply_routes_do(uwsgi.routes, wsgi_req, NULL, 0);
+	uint64_t span = uwsgi_span_begin();
+	int ret = uwsgi_apply_routes_do(uwsgi.routes, wsgi_req, NULL, 0);
+	uwsgi_span_end(wsgi_req, UWSGI_SPAN_ROUTING, span);
+	return ret;
 }
 
 void uwsgi_apply_final_routes(struct wsgi_request *wsgi_req) {
@@ -497,6 +754,7 @@ done:
 }
 
 void uwsgi_fixup_routes(struct uwsgi_route *ur) {
+	struct uwsgi_route *routes = ur;
 	while(ur) {
 		// prepare the main pointers
 		ur->ovn = uwsgi_calloc(sizeof(int) * uwsgi.cores);
@@ -519,6 +777,10 @@ void uwsgi_fixup_routes(struct uwsgi_route *ur) {
 		}
 		ur = ur->next;
         }
+
+	if (routes && !uwsgi.route_no_compile) {
+		routes->table = uwsgi_route_table_build(routes);
+	}
 }
 
 int uwsgi_route_api_func(struct wsgi_request *wsgi_req, char *router, char *args) {
@@ -813,6 +1075,28 @@ static int uwsgi_router_addheader(struct uwsgi_route *ur, char *arg) {
         return 0;
 }
 
+// header-template route (the template is resolved on the first run, templates are created after the routes)
+static int uwsgi_router_header_template_func(struct wsgi_request *wsgi_req, struct uwsgi_route *ur) {
+	struct uwsgi_header_template *uht = (struct uwsgi_header_template *) ur->data2;
+	if (!uht) {
+		uht = uwsgi_header_template_get(ur->data);
+		if (!uht) {
+			uwsgi_log("[uwsgi-routing] unknown header template: %s\n", ur->data);
+			return UWSGI_ROUTE_BREAK;
+		}
+		ur->data2 = uht;
+	}
+	if (uwsgi_response_prepare_template(wsgi_req, uht)) return UWSGI_ROUTE_BREAK;
+	return UWSGI_ROUTE_NEXT;
+}
+
+static int uwsgi_router_header_template(struct uwsgi_route *ur, char *arg) {
+	ur->func = uwsgi_router_header_template_func;
+	ur->data = arg;
+	ur->data_len = strlen(arg);
+	return 0;
+}
+
 // remheader route
 static int uwsgi_router_remheader_func(struct wsgi_request *wsgi_req, struct uwsgi_route *ur) {
 
@@ -1256,8 +1540,8 @@ static int uwsgi_route_condition_regexp(struct wsgi_request *wsgi_req, struct uw
         ur->condition_ub[wsgi_req->async_id] = uwsgi_routing_translate(wsgi_req, ur, NULL, 0, ur->subject_str, semicolon - ur->subject_str);
         if (!ur->condition_ub[wsgi_req->async_id]) return -1;
 
-	pcre *pattern;
-	pcre_extra *pattern_extra;
+	uwsgi_pcre *pattern;
+	uwsgi_pcre_extra *pattern_extra;
 	char *re = uwsgi_concat2n(semicolon+1, ur->subject_str_len - ((semicolon+1) - ur->subject_str), "", 0);
 	if (uwsgi_regexp_build(re, &pattern, &pattern_extra)) {
 		free(re);
@@ -1272,21 +1556,11 @@ static int uwsgi_route_condition_regexp(struct wsgi_request *wsgi_req, struct uw
         }
 
 	if (uwsgi_regexp_match_ovec(pattern, pattern_extra, ur->condition_ub[wsgi_req->async_id]->buf, ur->condition_ub[wsgi_req->async_id]->pos, ur->ovector[wsgi_req->async_id], ur->ovn[wsgi_req->async_id] ) >= 0) {
-		pcre_free(pattern);
-#ifdef PCRE_STUDY_JIT_COMPILE
-		pcre_free_study(pattern_extra);
-#else
-		pcre_free(pattern_extra);
-#endif
+		uwsgi_regexp_free(pattern, pattern_extra);
 		return 1;
 	}
 
-	pcre_free(pattern);
-#ifdef PCRE_STUDY_JIT_COMPILE
-	pcre_free_study(pattern_extra);
-#else
-	pcre_free(pattern_extra);
-#endif
+	uwsgi_regexp_free(pattern, pattern_extra);
         return 0;
 }
 
@@ -1597,7 +1871,7 @@ static char *uwsgi_route_var_httptime(struct wsgi_request *wsgi_req, char *key,
         // 30+1
         char *ht = uwsgi_calloc(31);
 	size_t t = uwsgi_str_num(key, keylen);
-        int len = uwsgi_http_date(uwsgi_now() + t, ht);
+        int len = uwsgi_http_date_cached(uwsgi_now() + t, ht);
 	if (len == 0) {
 		free(ht);
 		return NULL;
@@ -1692,6 +1966,7 @@ void uwsgi_register_embedded_routers() {
         uwsgi_register_router("goto", uwsgi_router_goto);
         uwsgi_register_router("addvar", uwsgi_router_addvar);
         uwsgi_register_router("addheader", uwsgi_router_addheader);
+        uwsgi_register_router("header-template", uwsgi_router_header_template);
         uwsgi_register_router("delheader", uwsgi_router_remheader);
         uwsgi_register_router("remheader", uwsgi_router_remheader);
         uwsgi_register_router("clearheaders", uwsgi_router_clearheaders);
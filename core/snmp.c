@@ -230,9 +230,7 @@ void manage_snmp(int fd, uint8_t * buffer, int size, struct sockaddr_in *client_
 		char *metric_asn = (char *) ptr;
 		struct uwsgi_metric *um = uwsgi_metric_find_by_asn(metric_asn, metric_asn_len);
 		if (!um) return;
-		uwsgi_rlock(uwsgi.metrics_lock);
-		int64_t value = *um->value;
-		uwsgi_rwunlock(uwsgi.metrics_lock);
+		int64_t value = uwsgi_metric_get_handle(um);
 		size = build_snmp_metric_response(value, um->type, buffer, size, seq1, seq2, seq3);
 	}
 
@@ -2,11 +2,10 @@
 
 extern struct uwsgi_server uwsgi;
 
-int uwsgi_static_want_gzip(struct wsgi_request *wsgi_req, char *filename, size_t *filename_len, struct stat *st) {
-	// check for filename size
-	if (*filename_len + 4 > PATH_MAX) return 0;
-	// check for supported encodings
-	if (!uwsgi_contains_n(wsgi_req->encoding, wsgi_req->encoding_len, "gzip", 4) ) return 0;
+// check if the static-gzip-* rules apply to the file (the encodings supported by the client are not checked)
+static int uwsgi_static_variant_rules(char *filename, size_t filename_len) {
+	// check for filename size (the longest suffix is .zst)
+	if (filename_len + 5 > PATH_MAX) return 0;
 
 	// check for 'all'
 	if (uwsgi.static_gzip_all) goto gzip;
@@ -14,7 +13,7 @@ int uwsgi_static_want_gzip(struct wsgi_request *wsgi_req, char *filename, size_t
 	// check for dirs/prefix
 	struct uwsgi_string_list *usl = uwsgi.static_gzip_dir;
 	while(usl) {
-		if (!uwsgi_starts_with(filename, *filename_len, usl->value, usl->len)) {
+		if (!uwsgi_starts_with(filename, filename_len, usl->value, usl->len)) {
 			goto gzip;
 		}
 		usl = usl->next;
@@ -23,7 +22,7 @@ int uwsgi_static_want_gzip(struct wsgi_request *wsgi_req, char *filename, size_t
 	// check for ext/suffix
 	usl = uwsgi.static_gzip_ext;
         while(usl) {
-		if (!uwsgi_strncmp(filename + (*filename_len - usl->len), usl->len, usl->value, usl->len)) {
+		if (!uwsgi_strncmp(filename + (filename_len - usl->len), usl->len, usl->value, usl->len)) {
 			goto gzip;
 		}
                 usl = usl->next;
@@ -33,26 +32,41 @@ int uwsgi_static_want_gzip(struct wsgi_request *wsgi_req, char *filename, size_t
 	// check for regexp
 	struct uwsgi_regexp_list *url = uwsgi.static_gzip;
 	while(url) {
-		if (uwsgi_regexp_match(url->pattern, url->pattern_extra, filename, *filename_len) >= 0) {
+		if (uwsgi_regexp_match(url->pattern, url->pattern_extra, filename, filename_len) >= 0) {
 			goto gzip;
 		}
 		url = url->next;
 	}
 #endif
 	return 0;
-
 gzip:
+	return 1;
+}
 
-	memcpy(filename + *filename_len, ".gz\0", 4);
-	*filename_len += 3;
-	
-	if (stat(filename, st)) {
-		*filename_len -= 3;
-		filename[*filename_len] = 0;
-		return 0;
+/*
+	choose the best compressed variant of the file accepted by the client:
+	filename and st are overwritten with the ones of the variant
+*/
+struct uwsgi_static_encoding *uwsgi_static_want_encoding(struct wsgi_request *wsgi_req, char *filename, size_t *filename_len, struct stat *st) {
+	char variant[PATH_MAX + 1];
+	size_t variant_len = 0;
+	struct stat vst;
+	int i;
+
+	if (!wsgi_req->encoding_len) return NULL;
+
+	for (i = 0; uwsgi.static_encodings[i]; i++) {
+		struct uwsgi_static_encoding *use = uwsgi.static_encodings[i];
+		if (!uwsgi_static_accepts_encoding(wsgi_req, use)) continue;
+		if (!uwsgi_static_variant(use, filename, *filename_len, st, 1, variant, &variant_len, &vst)) {
+			memcpy(filename, variant, variant_len + 1);
+			*filename_len = variant_len;
+			memcpy(st, &vst, sizeof(struct stat));
+			return use;
+		}
 	}
-	
-	return 1;
+
+	return NULL;
 }
 
 int uwsgi_http_date(time_t t, char *dst) {
@@ -179,7 +193,7 @@ int uwsgi_add_expires_type(struct wsgi_request *wsgi_req, char *mime_type, int m
 	while (udd) {
 		if (!uwsgi_strncmp(udd->key, udd->keylen, mime_type, mime_type_len)) {
 			int delta = uwsgi_str_num(udd->value, udd->vallen);
-			int size = uwsgi_http_date(now + delta, expires);
+			int size = uwsgi_http_date_cached(now + delta, expires);
 			if (size > 0) {
 				if (uwsgi_response_add_header(wsgi_req, "Expires", 7, expires, size)) return -1;
 			}
@@ -192,7 +206,7 @@ int uwsgi_add_expires_type(struct wsgi_request *wsgi_req, char *mime_type, int m
 	while (udd) {
 		if (!uwsgi_strncmp(udd->key, udd->keylen, mime_type, mime_type_len)) {
 			int delta = uwsgi_str_num(udd->value, udd->vallen);
-			int size = uwsgi_http_date(st->st_mtime + delta, expires);
+			int size = uwsgi_http_date_cached(st->st_mtime + delta, expires);
 			if (size > 0) {
 				if (uwsgi_response_add_header(wsgi_req, "Expires", 7, expires, size)) return -1;
 			}
@@ -215,7 +229,7 @@ int uwsgi_add_expires(struct wsgi_request *wsgi_req, char *filename, int filenam
 	while (udd) {
 		if (uwsgi_regexp_match(udd->pattern, udd->pattern_extra, filename, filename_len) >= 0) {
 			int delta = uwsgi_str_num(udd->value, udd->vallen);
-			int size = uwsgi_http_date(now + delta, expires);
+			int size = uwsgi_http_date_cached(now + delta, expires);
 			if (size > 0) {
 				if (uwsgi_response_add_header(wsgi_req, "Expires", 7, expires, size)) return -1;
 			}
@@ -228,7 +242,7 @@ int uwsgi_add_expires(struct wsgi_request *wsgi_req, char *filename, int filenam
 	while (udd) {
 		if (uwsgi_regexp_match(udd->pattern, udd->pattern_extra, filename, filename_len) >= 0) {
 			int delta = uwsgi_str_num(udd->value, udd->vallen);
-			int size = uwsgi_http_date(st->st_mtime + delta, expires);
+			int size = uwsgi_http_date_cached(st->st_mtime + delta, expires);
 			if (size > 0) {
 				if (uwsgi_response_add_header(wsgi_req, "Expires", 7, expires, size)) return -1;
 			}
@@ -250,7 +264,7 @@ int uwsgi_add_expires_path_info(struct wsgi_request *wsgi_req, struct stat *st)
 	while (udd) {
 		if (uwsgi_regexp_match(udd->pattern, udd->pattern_extra, wsgi_req->path_info, wsgi_req->path_info_len) >= 0) {
 			int delta = uwsgi_str_num(udd->value, udd->vallen);
-			int size = uwsgi_http_date(now + delta, expires);
+			int size = uwsgi_http_date_cached(now + delta, expires);
 			if (size > 0) {
 				if (uwsgi_response_add_header(wsgi_req, "Expires", 7, expires, size)) return -1;
 			}
@@ -263,7 +277,7 @@ int uwsgi_add_expires_path_info(struct wsgi_request *wsgi_req, struct stat *st)
 	while (udd) {
 		if (uwsgi_regexp_match(udd->pattern, udd->pattern_extra, wsgi_req->path_info, wsgi_req->path_info_len) >= 0) {
 			int delta = uwsgi_str_num(udd->value, udd->vallen);
-			int size = uwsgi_http_date(st->st_mtime + delta, expires);
+			int size = uwsgi_http_date_cached(st->st_mtime + delta, expires);
 			if (size > 0) {
 				if (uwsgi_response_add_header(wsgi_req, "Expires", 7, expires, size)) return -1;
 			}
@@ -285,7 +299,7 @@ int uwsgi_add_expires_uri(struct wsgi_request *wsgi_req, struct stat *st) {
 	while (udd) {
 		if (uwsgi_regexp_match(udd->pattern, udd->pattern_extra, wsgi_req->uri, wsgi_req->uri_len) >= 0) {
 			int delta = uwsgi_str_num(udd->value, udd->vallen);
-			int size = uwsgi_http_date(now + delta, expires);
+			int size = uwsgi_http_date_cached(now + delta, expires);
 			if (size > 0) {
 				if (uwsgi_response_add_header(wsgi_req, "Expires", 7, expires, size)) return -1;
 			}
@@ -298,7 +312,7 @@ int uwsgi_add_expires_uri(struct wsgi_request *wsgi_req, struct stat *st) {
 	while (udd) {
 		if (uwsgi_regexp_match(udd->pattern, udd->pattern_extra, wsgi_req->uri, wsgi_req->uri_len) >= 0) {
 			int delta = uwsgi_str_num(udd->value, udd->vallen);
-			int size = uwsgi_http_date(st->st_mtime + delta, expires);
+			int size = uwsgi_http_date_cached(st->st_mtime + delta, expires);
 			if (size > 0) {
 				if (uwsgi_response_add_header(wsgi_req, "Expires", 7, expires, size)) return -1;
 			}
@@ -315,11 +329,58 @@ int uwsgi_add_expires_uri(struct wsgi_request *wsgi_req, struct stat *st) {
 #endif
 
 
-char *uwsgi_get_mime_type(char *name, int namelen, size_t *size) {
+/*
+	the mime types loaded from the mime files are compiled (after all of them have been parsed)
+	in an open-addressing (linear probing) hash table indexed by extension.
+	The table is never modified after startup, so lookups do not need locking.
+*/
+void uwsgi_mime_table_build() {
+	uint32_t entries = 0;
+	struct uwsgi_dyn_dict *udd = uwsgi.mimetypes;
+	while (udd) {
+		entries++;
+		udd = udd->next;
+	}
+
+	if (!entries) return;
+
+	// keep the load factor under 50%
+	uint32_t size = 16;
+	while (size < entries * 2) size <<= 1;
+
+	uwsgi.mime_table = uwsgi_calloc(sizeof(struct uwsgi_mime_type) * size);
+	uwsgi.mime_table_mask = size - 1;
+
+	udd = uwsgi.mimetypes;
+	while (udd) {
+		uint32_t pos = djb33x_hash(udd->key, udd->keylen) & uwsgi.mime_table_mask;
+		for (;;) {
+			struct uwsgi_mime_type *umt = &uwsgi.mime_table[pos];
+			if (!umt->ext) {
+				umt->ext = udd->key;
+				umt->ext_len = udd->keylen;
+				umt->type = udd->value;
+				umt->type_len = udd->vallen;
+				umt->header = uwsgi_concat3n("Content-Type: ", 14, udd->value, udd->vallen, "\r\n", 2);
+				umt->header_len = 14 + udd->vallen + 2;
+				break;
+			}
+			// the first definition of an extension wins
+			if (!uwsgi_strncmp(umt->ext, umt->ext_len, udd->key, udd->keylen)) break;
+			pos = (pos + 1) & uwsgi.mime_table_mask;
+		}
+		udd = udd->next;
+	}
+}
+
+struct uwsgi_mime_type *uwsgi_mime_type_get(char *name, int namelen) {
 
 	int i;
 	int count = 0;
 	char *ext = NULL;
+
+	if (!uwsgi.mime_table) return NULL;
+
 	for (i = namelen - 1; i >= 0; i--) {
 		if (!isalnum((int) name[i])) {
 			if (name[i] == '.') {
@@ -333,49 +394,20 @@ char *uwsgi_get_mime_type(char *name, int namelen, size_t *size) {
 	if (!ext)
 		return NULL;
 
-
-	if (uwsgi.threads > 1)
-                pthread_mutex_lock(&uwsgi.lock_static);
-
-	struct uwsgi_dyn_dict *udd = uwsgi.mimetypes;
-	while (udd) {
-		if (!uwsgi_strncmp(ext, count, udd->key, udd->keylen)) {
-			udd->hits++;
-			// auto optimization
-			if (udd->prev) {
-				if (udd->hits > udd->prev->hits) {
-					struct uwsgi_dyn_dict *udd_parent = udd->prev->prev, *udd_prev = udd->prev;
-					if (udd_parent) {
-						udd_parent->next = udd;
-					}
-
-					if (udd->next) {
-						udd->next->prev = udd_prev;
-					}
-
-					udd_prev->prev = udd;
-					udd_prev->next = udd->next;
-
-					udd->prev = udd_parent;
-					udd->next = udd_prev;
-
-					if (udd->prev == NULL) {
-						uwsgi.mimetypes = udd;
-					}
-				}
-			}
-			*size = udd->vallen;
-			if (uwsgi.threads > 1)
-                		pthread_mutex_unlock(&uwsgi.lock_static);
-			return udd->value;
-		}
-		udd = udd->next;
+	uint32_t pos = djb33x_hash(ext, count) & uwsgi.mime_table_mask;
+	for (;;) {
+		struct uwsgi_mime_type *umt = &uwsgi.mime_table[pos];
+		if (!umt->ext) return NULL;
+		if (!uwsgi_strncmp(ext, count, umt->ext, umt->ext_len)) return umt;
+		pos = (pos + 1) & uwsgi.mime_table_mask;
 	}
+}
 
-	if (uwsgi.threads > 1)
-        	pthread_mutex_unlock(&uwsgi.lock_static);
-
-	return NULL;
+char *uwsgi_get_mime_type(char *name, int namelen, size_t *size) {
+	struct uwsgi_mime_type *umt = uwsgi_mime_type_get(name, namelen);
+	if (!umt) return NULL;
+	*size = umt->type_len;
+	return umt->type;
 }
 
 ssize_t uwsgi_append_static_path(char *dir, size_t dir_len, char *file, size_t file_len) {
@@ -436,16 +468,196 @@ static int uwsgi_static_stat(struct wsgi_request *wsgi_req, char *filename, size
 	return -1;
 }
 
-int uwsgi_real_file_serve(struct wsgi_request *wsgi_req, char *real_filename, size_t real_filename_len, struct stat *st) {
+/*
+	open-file cache (--static-cache-fds)
+
+	every worker keeps a direct-mapped table (indexed by the hash of the requested path) of already
+	resolved static files: the open descriptor, the stat() result, the mime type, the Last-Modified value
+	and the available compressed variants. A hit skips realpath(), stat() and open() so a static
+	request only costs the transfer.
+
+	Entries expire after --static-cache-fds-ttl seconds, and all of them are dropped whenever the master
+	notices (via the fsmon subsystem) a change in one of the --static-cache-fds-monitor directories.
+	An entry being transferred (async cores or offloading can suspend the request) is only closed
+	when its last user releases it.
+*/
+
+// a compressed variant (same index of uwsgi.static_encodings), encoding is NULL if not available
+struct uwsgi_static_fd_variant {
+	struct uwsgi_static_encoding *encoding;
+	char *filename;
+	size_t filename_len;
+	int fd;
+	struct stat st;
+	char last_modified[31];
+	int last_modified_len;
+};
+
+struct uwsgi_static_fd {
+	uint32_t hash;
+	char *key;
+	size_t key_len;
+
+	// the resolved file (index included)
+	char *filename;
+	size_t filename_len;
+	struct uwsgi_string_list *index;
+
+	// -1 when the transfer is delegated to the webserver (--file-serve-mode)
+	int fd;
+	struct stat st;
+	char last_modified[31];
+	int last_modified_len;
+
+	struct uwsgi_mime_type *mime_type;
+
+	// the static-gzip rules apply (Vary is needed)
+	int has_variants;
+	struct uwsgi_static_fd_variant variants[UWSGI_STATIC_ENCODINGS];
+
+	time_t expires;
+	uint64_t generation;
+	int refs;
+	int evicted;
+};
+
+static struct uwsgi_static_fd **static_fds;
+
+static void uwsgi_static_fd_free(struct uwsgi_static_fd *usf) {
+	int i;
+	if (usf->fd > -1) close(usf->fd);
+	for (i = 0; i < UWSGI_STATIC_ENCODINGS; i++) {
+		if (usf->variants[i].fd > -1) close(usf->variants[i].fd);
+		free(usf->variants[i].filename);
+	}
+	free(usf->key);
+	free(usf->filename);
+	free(usf);
+}
 
-	size_t mime_type_size = 0;
-	char http_last_modified[49];
-	int use_gzip = 0;
+// must be called with lock_static held
+static void uwsgi_static_fd_evict(struct uwsgi_static_fd **slot) {
+	struct uwsgi_static_fd *usf = *slot;
+	*slot = NULL;
+	usf->evicted = 1;
+	if (!usf->refs) uwsgi_static_fd_free(usf);
+}
 
-	char *mime_type = uwsgi_get_mime_type(real_filename, real_filename_len, &mime_type_size);
+static struct uwsgi_static_fd *uwsgi_static_fd_get(char *key, size_t key_len) {
+	struct uwsgi_static_fd *usf = NULL;
+	uint32_t hash = djb33x_hash(key, key_len);
+
+	if (uwsgi.threads > 1)
+		pthread_mutex_lock(&uwsgi.lock_static);
 
-	// here we need to choose if we want the gzip variant;
-	if (uwsgi_static_want_gzip(wsgi_req, real_filename, &real_filename_len, st)) use_gzip = 1;
+	if (!static_fds) goto end;
+
+	struct uwsgi_static_fd **slot = &static_fds[hash % uwsgi.static_cache_fds];
+	if (!*slot || (*slot)->hash != hash || uwsgi_strncmp((*slot)->key, (*slot)->key_len, key, key_len)) goto end;
+
+	if ((*slot)->generation != uwsgi.shared->static_cache_generation || uwsgi_now() >= (*slot)->expires) {
+		uwsgi_static_fd_evict(slot);
+		goto end;
+	}
+
+	usf = *slot;
+	usf->refs++;
+end:
+	if (uwsgi.threads > 1)
+		pthread_mutex_unlock(&uwsgi.lock_static);
+	return usf;
+}
+
+static void uwsgi_static_fd_release(struct uwsgi_static_fd *usf) {
+	if (uwsgi.threads > 1)
+		pthread_mutex_lock(&uwsgi.lock_static);
+	usf->refs--;
+	if (usf->evicted && !usf->refs) uwsgi_static_fd_free(usf);
+	if (uwsgi.threads > 1)
+		pthread_mutex_unlock(&uwsgi.lock_static);
+}
+
+static struct uwsgi_static_fd *uwsgi_static_fd_add(struct wsgi_request *wsgi_req, char *key, size_t key_len, char *filename, size_t filename_len, struct stat *st, struct uwsgi_string_list *index) {
+
+	struct uwsgi_static_fd *usf = uwsgi_calloc(sizeof(struct uwsgi_static_fd));
+	int i;
+	usf->fd = -1;
+	for (i = 0; i < UWSGI_STATIC_ENCODINGS; i++) {
+		usf->variants[i].fd = -1;
+	}
+	// read it before opening files, so a change happening in the meantime will invalidate the item
+	usf->generation = uwsgi.shared->static_cache_generation;
+
+	if (!uwsgi.file_serve_mode) {
+		usf->fd = open(filename, O_RDONLY);
+		if (usf->fd < 0) {
+			free(usf);
+			return NULL;
+		}
+	}
+
+	usf->hash = djb33x_hash(key, key_len);
+	usf->key = uwsgi_concat2n(key, key_len, "", 0);
+	usf->key_len = key_len;
+	usf->filename = uwsgi_concat2n(filename, filename_len, "", 0);
+	usf->filename_len = filename_len;
+	usf->index = index;
+	memcpy(&usf->st, st, sizeof(struct stat));
+	usf->last_modified_len = uwsgi_http_date_cached(st->st_mtime, usf->last_modified);
+	usf->mime_type = uwsgi_mime_type_get(filename, filename_len);
+
+	if (uwsgi_static_variant_rules(filename, filename_len)) {
+		usf->has_variants = 1;
+		char variant[PATH_MAX + 1];
+		size_t variant_len = 0;
+		for (i = 0; uwsgi.static_encodings[i]; i++) {
+			struct uwsgi_static_fd_variant *usfv = &usf->variants[i];
+			// compress only for the encodings accepted by the current client
+			int can_compress = uwsgi_static_accepts_encoding(wsgi_req, uwsgi.static_encodings[i]);
+			if (uwsgi_static_variant(uwsgi.static_encodings[i], filename, filename_len, st, can_compress, variant, &variant_len, &usfv->st)) continue;
+			if (!uwsgi.file_serve_mode) {
+				usfv->fd = open(variant, O_RDONLY);
+				if (usfv->fd < 0) continue;
+			}
+			usfv->encoding = uwsgi.static_encodings[i];
+			usfv->filename = uwsgi_concat2n(variant, variant_len, "", 0);
+			usfv->filename_len = variant_len;
+			usfv->last_modified_len = uwsgi_http_date_cached(usfv->st.st_mtime, usfv->last_modified);
+		}
+	}
+
+	usf->expires = uwsgi_now() + uwsgi.static_cache_fds_ttl;
+	usf->refs = 1;
+
+	if (uwsgi.threads > 1)
+		pthread_mutex_lock(&uwsgi.lock_static);
+
+	if (!static_fds) {
+		static_fds = uwsgi_calloc(sizeof(struct uwsgi_static_fd *) * uwsgi.static_cache_fds);
+	}
+
+	struct uwsgi_static_fd **slot = &static_fds[usf->hash % uwsgi.static_cache_fds];
+	if (*slot) uwsgi_static_fd_evict(slot);
+	*slot = usf;
+
+	if (uwsgi.threads > 1)
+		pthread_mutex_unlock(&uwsgi.lock_static);
+
+	return usf;
+}
+
+/*
+	fd > -1 is an already opened (cached) descriptor: it is not closed after the transfer
+	http_last_modified can be precomputed too (NULL otherwise)
+*/
+static int uwsgi_real_file_serve_do(struct wsgi_request *wsgi_req, char *real_filename, size_t real_filename_len, struct stat *st, struct uwsgi_mime_type *mime_type, int has_variants, struct uwsgi_static_encoding *encoding, int fd, char *http_last_modified, int http_last_modified_len) {
+
+	char last_modified_buf[49];
+
+	if (!http_last_modified) {
+		http_last_modified = last_modified_buf;
+		http_last_modified_len = uwsgi_http_date_cached(st->st_mtime, http_last_modified);
+	}
 
 	if (wsgi_req->if_modified_since_len) {
 		time_t ims = parse_http_date(wsgi_req->if_modified_since, wsgi_req->if_modified_since_len);
@@ -491,15 +703,20 @@ int uwsgi_real_file_serve(struct wsgi_request *wsgi_req, char *real_filename, si
 	uwsgi_add_expires_uri(wsgi_req, st);
 #endif
 
-	if (use_gzip) {
-		if (uwsgi_response_add_header(wsgi_req, "Content-Encoding", 16, "gzip", 4)) return -1;
+	if (encoding) {
+		if (uwsgi_response_add_header(wsgi_req, "Content-Encoding", 16, encoding->name, encoding->name_len)) return -1;
+	}
+
+	// the response depends on the Accept-Encoding header
+	if (has_variants) {
+		if (uwsgi_response_add_header(wsgi_req, "Vary", 4, "Accept-Encoding", 15)) return -1;
 	}
 
 	// Content-Type (if available)
-	if (mime_type_size > 0 && mime_type) {
-		if (uwsgi_response_add_content_type(wsgi_req, mime_type, mime_type_size)) return -1;
+	if (mime_type && mime_type->type_len > 0) {
+		if (uwsgi_response_add_header_line(wsgi_req, "Content-Type", 12, mime_type->type, mime_type->type_len, mime_type->header, mime_type->header_len)) return -1;
 		// check for content-type related headers
-		uwsgi_add_expires_type(wsgi_req, mime_type, mime_type_size, st);
+		uwsgi_add_expires_type(wsgi_req, mime_type->type, mime_type->type_len, st);
 	}
 
 	// increase static requests counter
@@ -509,15 +726,13 @@ int uwsgi_real_file_serve(struct wsgi_request *wsgi_req, char *real_filename, si
 	if (uwsgi.file_serve_mode == 1) {
 		if (uwsgi_response_add_header(wsgi_req, "X-Accel-Redirect", 16, real_filename, real_filename_len)) return -1;
 		// this is the final header (\r\n added)
-		int size = uwsgi_http_date(st->st_mtime, http_last_modified);
-		if (uwsgi_response_add_header(wsgi_req, "Last-Modified", 13, http_last_modified, size)) return -1;
+		if (uwsgi_response_add_header(wsgi_req, "Last-Modified", 13, http_last_modified, http_last_modified_len)) return -1;
 	}
 	// apache
 	else if (uwsgi.file_serve_mode == 2) {
 		if (uwsgi_response_add_header(wsgi_req, "X-Sendfile", 10, real_filename, real_filename_len)) return -1;
 		// this is the final header (\r\n added)
-		int size = uwsgi_http_date(st->st_mtime, http_last_modified);
-		if (uwsgi_response_add_header(wsgi_req, "Last-Modified", 13, http_last_modified, size)) return -1;
+		if (uwsgi_response_add_header(wsgi_req, "Last-Modified", 13, http_last_modified, http_last_modified_len)) return -1;
 	}
 	// raw
 	else {
@@ -527,8 +742,7 @@ int uwsgi_real_file_serve(struct wsgi_request *wsgi_req, char *real_filename, si
 			// here use the original size !!!
 			if (uwsgi_response_add_content_range(wsgi_req, wsgi_req->range_from, wsgi_req->range_to, st->st_size)) return -1;
 		}
-		int size = uwsgi_http_date(st->st_mtime, http_last_modified);
-		if (uwsgi_response_add_header(wsgi_req, "Last-Modified", 13, http_last_modified, size)) return -1;
+		if (uwsgi_response_add_header(wsgi_req, "Last-Modified", 13, http_last_modified, http_last_modified_len)) return -1;
 
 		// if it is a HEAD request just skip transfer
 		if (!uwsgi_strncmp(wsgi_req->method, wsgi_req->method_len, "HEAD", 4)) {
@@ -538,16 +752,50 @@ int uwsgi_real_file_serve(struct wsgi_request *wsgi_req, char *real_filename, si
 
 		// Ok, the file must be transferred from uWSGI
 		// offloading will be automatically managed
-		int fd = open(real_filename, O_RDONLY);
-		if (fd < 0) return -1;
-		// fd will be closed in the following function
-		uwsgi_response_sendfile_do(wsgi_req, fd, wsgi_req->range_from, fsize);
+		if (fd > -1) {
+			uwsgi_response_sendfile_do_can_close(wsgi_req, fd, wsgi_req->range_from, fsize, 0);
+		}
+		else {
+			fd = open(real_filename, O_RDONLY);
+			if (fd < 0) return -1;
+			// fd will be closed in the following function
+			uwsgi_response_sendfile_do(wsgi_req, fd, wsgi_req->range_from, fsize);
+		}
 	}
 
 	wsgi_req->status = 200;
 	return 0;
 }
 
+int uwsgi_real_file_serve(struct wsgi_request *wsgi_req, char *real_filename, size_t real_filename_len, struct stat *st) {
+
+	struct uwsgi_static_encoding *encoding = NULL;
+
+	struct uwsgi_mime_type *mime_type = uwsgi_mime_type_get(real_filename, real_filename_len);
+
+	// here we need to choose if we want a compressed variant
+	int has_variants = uwsgi_static_variant_rules(real_filename, real_filename_len);
+	if (has_variants) {
+		encoding = uwsgi_static_want_encoding(wsgi_req, real_filename, &real_filename_len, st);
+	}
+
+	return uwsgi_real_file_serve_do(wsgi_req, real_filename, real_filename_len, st, mime_type, has_variants, encoding, -1, NULL, 0);
+}
+
+static int uwsgi_static_fd_serve(struct wsgi_request *wsgi_req, struct uwsgi_static_fd *usf) {
+	int i;
+
+	if (usf->has_variants && wsgi_req->encoding_len) {
+		for (i = 0; i < UWSGI_STATIC_ENCODINGS; i++) {
+			struct uwsgi_static_fd_variant *usfv = &usf->variants[i];
+			if (!usfv->encoding || !uwsgi_static_accepts_encoding(wsgi_req, usfv->encoding)) continue;
+			return uwsgi_real_file_serve_do(wsgi_req, usfv->filename, usfv->filename_len, &usfv->st, usf->mime_type, 1, usfv->encoding, usfv->fd, usfv->last_modified, usfv->last_modified_len);
+		}
+	}
+
+	return uwsgi_real_file_serve_do(wsgi_req, usf->filename, usf->filename_len, &usf->st, usf->mime_type, usf->has_variants, NULL, usf->fd, usf->last_modified, usf->last_modified_len);
+}
+
 
 int uwsgi_file_serve(struct wsgi_request *wsgi_req, char *document_root, uint16_t document_root_len, char *path_info, uint16_t path_info_len, int is_a_file) {
 
@@ -556,6 +804,8 @@ int uwsgi_file_serve(struct wsgi_request *wsgi_req, char *document_root, uint16_
 	size_t real_filename_len = 0;
 	char *filename = NULL;
 	size_t filename_len = 0;
+	struct uwsgi_static_fd *usf = NULL;
+	int ret;
 
 	struct uwsgi_string_list *index = NULL;
 
@@ -572,6 +822,15 @@ int uwsgi_file_serve(struct wsgi_request *wsgi_req, char *document_root, uint16_
 	uwsgi_log("[uwsgi-fileserve] checking for %s\n", filename);
 #endif
 
+	if (uwsgi.static_cache_fds) {
+		usf = uwsgi_static_fd_get(filename, filename_len);
+		if (usf) {
+			free(filename);
+			index = usf->index;
+			goto serve;
+		}
+	}
+
 	if (uwsgi.static_cache_paths) {
 		uwsgi_rlock(uwsgi.static_cache_paths->lock);
 		uint64_t item_len;
@@ -602,7 +861,6 @@ int uwsgi_file_serve(struct wsgi_request *wsgi_req, char *document_root, uint16_
 	}
 
 found:
-	free(filename);
 
 	if (uwsgi_starts_with(real_filename, real_filename_len, document_root, document_root_len)) {
 		struct uwsgi_string_list *safe = uwsgi.static_safe;
@@ -613,47 +871,68 @@ found:
 			safe = safe->next;
 		}
 		uwsgi_log("[uwsgi-fileserve] security error: %s is not under %.*s or a safe path\n", real_filename, document_root_len, document_root);
+		free(filename);
 		return -1;
 	}
 
 safe:
 
-	if (!uwsgi_static_stat(wsgi_req, real_filename, &real_filename_len, &st, &index)) {
+	if (uwsgi_static_stat(wsgi_req, real_filename, &real_filename_len, &st, &index)) {
+		free(filename);
+		return -1;
+	}
 
-		if (index) {
-			// if we are here the PATH_INFO need to be changed
-			if (uwsgi_req_append_path_info_with_index(wsgi_req, index->value, index->len)) {
-                        	return -1;
-                        }
+	// check for skippable ext
+	struct uwsgi_string_list *sse = uwsgi.static_skip_ext;
+	while (sse) {
+		if (real_filename_len >= sse->len) {
+			if (!uwsgi_strncmp(real_filename + (real_filename_len - sse->len), sse->len, sse->value, sse->len)) {
+				free(filename);
+				return -1;
+			}
 		}
+		sse = sse->next;
+	}
 
-		// skip methods other than GET and HEAD
-        	if (uwsgi_strncmp(wsgi_req->method, wsgi_req->method_len, "GET", 3) && uwsgi_strncmp(wsgi_req->method, wsgi_req->method_len, "HEAD", 4)) {
-			return -1;
-        	}
+	if (uwsgi.static_cache_fds) {
+		usf = uwsgi_static_fd_add(wsgi_req, filename, filename_len, real_filename, real_filename_len, &st, index);
+	}
+	free(filename);
 
-		// check for skippable ext
-		struct uwsgi_string_list *sse = uwsgi.static_skip_ext;
-		while (sse) {
-			if (real_filename_len >= sse->len) {
-				if (!uwsgi_strncmp(real_filename + (real_filename_len - sse->len), sse->len, sse->value, sse->len)) {
-					return -1;
-				}
-			}
-			sse = sse->next;
+serve:
+
+	if (index) {
+		// if we are here the PATH_INFO need to be changed
+		if (uwsgi_req_append_path_info_with_index(wsgi_req, index->value, index->len)) {
+			ret = -1;
+			goto end;
 		}
+	}
+
+	// skip methods other than GET and HEAD
+	if (uwsgi_strncmp(wsgi_req->method, wsgi_req->method_len, "GET", 3) && uwsgi_strncmp(wsgi_req->method, wsgi_req->method_len, "HEAD", 4)) {
+		ret = -1;
+		goto end;
+	}
 
 #ifdef UWSGI_ROUTING
-		// before sending the file, we need to check if some rule applies
-		if (!wsgi_req->is_routing && uwsgi_apply_routes_do(uwsgi.routes, wsgi_req, NULL, 0) == UWSGI_ROUTE_BREAK) {
-			return 0;
-		}
-		wsgi_req->routes_applied = 1;
+	// before sending the file, we need to check if some rule applies
+	if (!wsgi_req->is_routing && uwsgi_apply_routes_do(uwsgi.routes, wsgi_req, NULL, 0) == UWSGI_ROUTE_BREAK) {
+		ret = 0;
+		goto end;
+	}
+	wsgi_req->routes_applied = 1;
 #endif
 
-		return uwsgi_real_file_serve(wsgi_req, real_filename, real_filename_len, &st);
+	if (usf) {
+		ret = uwsgi_static_fd_serve(wsgi_req, usf);
+	}
+	else {
+		ret = uwsgi_real_file_serve(wsgi_req, real_filename, real_filename_len, &st);
 	}
 
-	return -1;
+end:
+	if (usf) uwsgi_static_fd_release(usf);
+	return ret;
 
 }
@@ -0,0 +1,441 @@
+#include "uwsgi.h"
+
+extern struct uwsgi_server uwsgi;
+
+/*
+	compressed variants of static files
+
+	for every file matching the static-gzip-* rules, the encodings configured with --static-encoding
+	(default: gzip only) are checked, in order, against the client Accept-Encoding header.
+
+	A precompressed sibling (file.br, file.zst, file.gz) is always preferred. When it is missing and
+	--static-compress-store is set, the file is compressed once and the result is stored in that directory
+	(named after the hash of the file path, with the mtime of the original file). Later hits find it
+	with a single stat() and transfer it with sendfile() like any other static file.
+
+	Compression runs in background threads (at most UWSGI_STATIC_STORE_JOBS per process), the original
+	file is served until the variant is ready.
+
+	Variants not smaller than the original are stored as empty files, so they are not compressed again.
+	The store is bounded by --static-compress-store-size (shared between all of the processes), when it is
+	full the least recently used variants are evicted.
+*/
+
+#ifdef UWSGI_ZLIB
+static struct uwsgi_buffer *uwsgi_static_compress_gzip(char *buf, size_t len) {
+	z_stream z;
+	memset(&z, 0, sizeof(z_stream));
+	// 31 -> gzip wrapper
+	if (deflateInit2(&z, 9, Z_DEFLATED, 31, 9, Z_DEFAULT_STRATEGY) != Z_OK) return NULL;
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(deflateBound(&z, len));
+	z.next_in = (Bytef *) buf;
+	z.avail_in = len;
+	z.next_out = (Bytef *) ub->buf;
+	z.avail_out = ub->len;
+	if (deflate(&z, Z_FINISH) != Z_STREAM_END) {
+		deflateEnd(&z);
+		uwsgi_buffer_destroy(ub);
+		return NULL;
+	}
+	ub->pos = z.total_out;
+	deflateEnd(&z);
+	return ub;
+}
+#endif
+
+#ifdef UWSGI_BROTLI
+#include <brotli/encode.h>
+static struct uwsgi_buffer *uwsgi_static_compress_brotli(char *buf, size_t len) {
+	size_t olen = BrotliEncoderMaxCompressedSize(len);
+	if (!olen) return NULL;
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(olen);
+	if (!BrotliEncoderCompress(9, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC, len, (const uint8_t *) buf, &olen, (uint8_t *) ub->buf)) {
+		uwsgi_buffer_destroy(ub);
+		return NULL;
+	}
+	ub->pos = olen;
+	return ub;
+}
+#endif
+
+#ifdef UWSGI_ZSTD
+#include <zstd.h>
+static struct uwsgi_buffer *uwsgi_static_compress_zstd(char *buf, size_t len) {
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(ZSTD_compressBound(len));
+	size_t olen = ZSTD_compress(ub->buf, ub->len, buf, len, 12);
+	if (ZSTD_isError(olen)) {
+		uwsgi_buffer_destroy(ub);
+		return NULL;
+	}
+	ub->pos = olen;
+	return ub;
+}
+#endif
+
+static struct uwsgi_static_encoding uwsgi_static_encodings_table[] = {
+#ifdef UWSGI_BROTLI
+	{"br", 2, ".br", 3, uwsgi_static_compress_brotli},
+#else
+	{"br", 2, ".br", 3, NULL},
+#endif
+#ifdef UWSGI_ZSTD
+	{"zstd", 4, ".zst", 4, uwsgi_static_compress_zstd},
+#else
+	{"zstd", 4, ".zst", 4, NULL},
+#endif
+#ifdef UWSGI_ZLIB
+	{"gzip", 4, ".gz", 3, uwsgi_static_compress_gzip},
+#else
+	{"gzip", 4, ".gz", 3, NULL},
+#endif
+	{NULL, 0, NULL, 0, NULL},
+};
+
+void uwsgi_static_encodings_init() {
+	int n = 0;
+
+	if (!uwsgi.static_encodings_list) {
+		uwsgi_string_new_list(&uwsgi.static_encodings_list, "gzip");
+	}
+
+	struct uwsgi_string_list *usl = NULL;
+	uwsgi_foreach(usl, uwsgi.static_encodings_list) {
+		struct uwsgi_static_encoding *use = uwsgi_static_encodings_table;
+		while (use->name) {
+			if (!strcmp(use->name, usl->value)) break;
+			use++;
+		}
+		if (!use->name) {
+			uwsgi_log("unsupported static encoding: \"%s\" (available: br, zstd, gzip)\n", usl->value);
+			exit(1);
+		}
+		if (n >= UWSGI_STATIC_ENCODINGS) {
+			uwsgi_log("too many static encodings specified\n");
+			exit(1);
+		}
+		uwsgi.static_encodings[n++] = use;
+	}
+
+	if (!uwsgi.static_compress_store) return;
+
+	if (!uwsgi.static_compress_store_size) uwsgi.static_compress_store_size = 128 * 1024 * 1024;
+	if (!uwsgi.static_compress_max_size) uwsgi.static_compress_max_size = 16 * 1024 * 1024;
+	if (!uwsgi.static_compress_min_size) uwsgi.static_compress_min_size = 256;
+
+	if (mkdir(uwsgi.static_compress_store, 0755) && errno != EEXIST) {
+		uwsgi_error("uwsgi_static_encodings_init()/mkdir()");
+		exit(1);
+	}
+
+	// account the variants already in the store
+	DIR *d = opendir(uwsgi.static_compress_store);
+	if (!d) {
+		uwsgi_error("uwsgi_static_encodings_init()/opendir()");
+		exit(1);
+	}
+	struct dirent *de;
+	while ((de = readdir(d)) != NULL) {
+		if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+		struct stat st;
+		char *path = uwsgi_concat3(uwsgi.static_compress_store, "/", de->d_name);
+		// leftovers of interrupted compressions
+		if (de->d_name[0] == '.') {
+			unlink(path);
+		}
+		else if (!stat(path, &st) && S_ISREG(st.st_mode)) {
+			uwsgi.shared->static_compress_store_used += st.st_size;
+		}
+		free(path);
+	}
+	closedir(d);
+
+	for (n = 0; uwsgi.static_encodings[n]; n++) {
+		if (!uwsgi.static_encodings[n]->compress) {
+			uwsgi_log("*** static encoding \"%s\" is not supported by this build, only precompressed files will be used ***\n", uwsgi.static_encodings[n]->name);
+		}
+	}
+
+	uwsgi_log("static compressed variants store: %s (%llu/%llu bytes used)\n", uwsgi.static_compress_store,
+		(unsigned long long) uwsgi.shared->static_compress_store_used, (unsigned long long) uwsgi.static_compress_store_size);
+}
+
+int uwsgi_static_accepts_encoding(struct wsgi_request *wsgi_req, struct uwsgi_static_encoding *use) {
+	return uwsgi_contains_n(wsgi_req->encoding, wsgi_req->encoding_len, use->name, use->name_len);
+}
+
+static int uwsgi_static_store_path(struct uwsgi_static_encoding *use, char *filename, size_t filename_len, char *path, size_t *path_len) {
+	int ret = snprintf(path, PATH_MAX, "%s/%08x%08x%s", uwsgi.static_compress_store,
+		murmur3_hash(filename, filename_len, 0), djb33x_hash(filename, filename_len), use->suffix);
+	if (ret <= 0 || ret >= PATH_MAX) return -1;
+	*path_len = ret;
+	return 0;
+}
+
+// variants being built in background by this process
+static int uwsgi_static_store_jobs;
+#define UWSGI_STATIC_STORE_JOBS 2
+// a temp file older than this belongs to a dead process
+#define UWSGI_STATIC_STORE_STALE 60
+
+struct uwsgi_static_store_job {
+	struct uwsgi_static_encoding *use;
+	char *filename;
+	struct stat st;
+	int fd;
+	char path[PATH_MAX + 1];
+	char tmp[PATH_MAX + 1];
+};
+
+struct uwsgi_static_store_entry {
+	char name[32];
+	time_t last_use;
+	off_t size;
+};
+
+// the space of removed variants is given back without wrapping (a variant could be accounted twice by racing removals)
+static void uwsgi_static_store_release(uint64_t size) {
+	for (;;) {
+		uint64_t used = uwsgi.shared->static_compress_store_used;
+		uint64_t new_used = used > size ? used - size : 0;
+		if (__sync_bool_compare_and_swap(&uwsgi.shared->static_compress_store_used, used, new_used)) return;
+	}
+}
+
+static int uwsgi_static_store_entry_cmp(const void *a, const void *b) {
+	const struct uwsgi_static_store_entry *e1 = (const struct uwsgi_static_store_entry *) a;
+	const struct uwsgi_static_store_entry *e2 = (const struct uwsgi_static_store_entry *) b;
+	if (e1->last_use < e2->last_use) return -1;
+	if (e1->last_use > e2->last_use) return 1;
+	return 0;
+}
+
+/*
+	the store is full: remove the least recently used variants (by atime, or by the time they have been
+	stored when the filesystem does not update it) until a quarter of the store is free.
+	Variants of removed or renamed files are never used again, so they are the first to go.
+*/
+static void uwsgi_static_store_evict() {
+	if (!__sync_bool_compare_and_swap(&uwsgi.shared->static_compress_store_evicting, 0, 1)) return;
+
+	size_t n = 0, max = 256;
+	struct uwsgi_static_store_entry *entries = uwsgi_malloc(sizeof(struct uwsgi_static_store_entry) * max);
+	DIR *d = opendir(uwsgi.static_compress_store);
+	if (!d) {
+		uwsgi_error("uwsgi_static_store_evict()/opendir()");
+		goto end;
+	}
+	struct dirent *de;
+	while ((de = readdir(d)) != NULL) {
+		// temp files are not accounted
+		if (de->d_name[0] == '.' || strlen(de->d_name) >= 32) continue;
+		struct stat st;
+		char *path = uwsgi_concat3(uwsgi.static_compress_store, "/", de->d_name);
+		int ret = stat(path, &st);
+		free(path);
+		if (ret || !S_ISREG(st.st_mode)) continue;
+		if (n >= max) {
+			max *= 2;
+			entries = realloc(entries, sizeof(struct uwsgi_static_store_entry) * max);
+			if (!entries) {
+				uwsgi_error("uwsgi_static_store_evict()/realloc()");
+				exit(1);
+			}
+		}
+		strcpy(entries[n].name, de->d_name);
+		entries[n].last_use = UMAX(st.st_atime, st.st_ctime);
+		entries[n].size = st.st_size;
+		n++;
+	}
+	closedir(d);
+
+	qsort(entries, n, sizeof(struct uwsgi_static_store_entry), uwsgi_static_store_entry_cmp);
+
+	uint64_t target = (uwsgi.static_compress_store_size / 4) * 3;
+	size_t i, removed = 0;
+	for (i = 0; i < n && uwsgi.shared->static_compress_store_used > target; i++) {
+		char *path = uwsgi_concat3(uwsgi.static_compress_store, "/", entries[i].name);
+		if (!unlink(path)) {
+			uwsgi_static_store_release(entries[i].size);
+			removed++;
+		}
+		free(path);
+	}
+
+	uwsgi_log("[uwsgi-static] evicted %llu variants from %s (%llu/%llu bytes used)\n", (unsigned long long) removed, uwsgi.static_compress_store,
+		(unsigned long long) uwsgi.shared->static_compress_store_used, (unsigned long long) uwsgi.static_compress_store_size);
+end:
+	free(entries);
+	uwsgi.shared->static_compress_store_evicting = 0;
+}
+
+// compress the file and atomically place the result in the store
+static int uwsgi_static_store_build(struct uwsgi_static_store_job *job) {
+
+	if (uwsgi.shared->static_compress_store_used >= uwsgi.static_compress_store_size) {
+		uwsgi_static_store_evict();
+		if (uwsgi.shared->static_compress_store_used >= uwsgi.static_compress_store_size) return -1;
+	}
+
+	int fd = open(job->filename, O_RDONLY);
+	if (fd < 0) return -1;
+
+	char *addr = mmap(NULL, job->st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED) {
+		uwsgi_error("uwsgi_static_store_build()/mmap()");
+		return -1;
+	}
+
+	struct uwsgi_buffer *ub = job->use->compress(addr, job->st.st_size);
+	munmap(addr, job->st.st_size);
+	if (!ub) return -1;
+
+	// not worth it, leave an empty marker
+	if (ub->pos >= (size_t) job->st.st_size) ub->pos = 0;
+
+	size_t written = 0;
+	while (written < ub->pos) {
+		ssize_t wlen = write(job->fd, ub->buf + written, ub->pos - written);
+		if (wlen <= 0) {
+			uwsgi_error("uwsgi_static_store_build()/write()");
+			goto error;
+		}
+		written += wlen;
+	}
+
+	// the mtime of the variant is the one of the original file
+	struct timespec times[2];
+	times[0].tv_sec = job->st.st_mtime;
+	times[0].tv_nsec = 0;
+	times[1].tv_sec = job->st.st_mtime;
+	times[1].tv_nsec = 0;
+	if (futimens(job->fd, times)) {
+		uwsgi_error("uwsgi_static_store_build()/futimens()");
+		goto error;
+	}
+	close(job->fd);
+	job->fd = -1;
+
+	// the stale variant (if any) is replaced, only the owner of the temp file can get here
+	struct stat vst;
+	uint64_t old_size = 0;
+	if (!stat(job->path, &vst)) old_size = vst.st_size;
+
+	if (rename(job->tmp, job->path)) {
+		uwsgi_error("uwsgi_static_store_build()/rename()");
+		goto error;
+	}
+
+	__sync_add_and_fetch(&uwsgi.shared->static_compress_store_used, ub->pos);
+	if (old_size) uwsgi_static_store_release(old_size);
+	uwsgi_buffer_destroy(ub);
+	return 0;
+
+error:
+	uwsgi_buffer_destroy(ub);
+	return -1;
+}
+
+static void *uwsgi_static_store_loop(void *arg) {
+	struct uwsgi_static_store_job *job = (struct uwsgi_static_store_job *) arg;
+
+	sigset_t smask;
+	sigfillset(&smask);
+	pthread_sigmask(SIG_BLOCK, &smask, NULL);
+
+	if (uwsgi_static_store_build(job)) {
+		if (job->fd >= 0) close(job->fd);
+		unlink(job->tmp);
+	}
+
+	__sync_sub_and_fetch(&uwsgi_static_store_jobs, 1);
+	free(job->filename);
+	free(job);
+	return NULL;
+}
+
+/*
+	the temp file (named after the variant) is the lock of the variant: only one process at a time builds it,
+	the others keep serving the original file
+*/
+static int uwsgi_static_store_claim(char *path, char *tmp) {
+	int ret = snprintf(tmp, PATH_MAX, "%s/.%s.tmp", uwsgi.static_compress_store, path + strlen(uwsgi.static_compress_store) + 1);
+	if (ret <= 0 || ret >= PATH_MAX) return -1;
+
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0644);
+	if (fd >= 0 || errno != EEXIST) return fd;
+
+	struct stat st;
+	if (stat(tmp, &st) || st.st_mtime + UWSGI_STATIC_STORE_STALE > uwsgi_now()) return -1;
+	unlink(tmp);
+	return open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0644);
+}
+
+// compression of big files (up to --static-compress-max-size) is too slow for the request path, it runs in a thread
+static void uwsgi_static_store_add(struct uwsgi_static_encoding *use, char *filename, size_t filename_len, struct stat *st, char *path) {
+
+	if (__sync_add_and_fetch(&uwsgi_static_store_jobs, 1) > UWSGI_STATIC_STORE_JOBS) goto busy;
+
+	struct uwsgi_static_store_job *job = uwsgi_calloc(sizeof(struct uwsgi_static_store_job));
+	job->fd = uwsgi_static_store_claim(path, job->tmp);
+	if (job->fd < 0) {
+		free(job);
+		goto busy;
+	}
+	job->use = use;
+	job->filename = uwsgi_concat2n(filename, filename_len, "", 0);
+	memcpy(&job->st, st, sizeof(struct stat));
+	strcpy(job->path, path);
+
+	pthread_t t;
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	int ret = pthread_create(&t, &attr, uwsgi_static_store_loop, job);
+	pthread_attr_destroy(&attr);
+	if (ret) {
+		uwsgi_error("uwsgi_static_store_add()/pthread_create()");
+		close(job->fd);
+		unlink(job->tmp);
+		free(job->filename);
+		free(job);
+		goto busy;
+	}
+	return;
+busy:
+	__sync_sub_and_fetch(&uwsgi_static_store_jobs, 1);
+}
+
+/*
+	search (or build) the variant of filename for the specified encoding:
+	on success the path is written in variant (PATH_MAX + 1 bytes), and its stat() in vst
+*/
+int uwsgi_static_variant(struct uwsgi_static_encoding *use, char *filename, size_t filename_len, struct stat *st, int can_compress, char *variant, size_t *variant_len, struct stat *vst) {
+
+	// precompressed sibling
+	if (filename_len + use->suffix_len <= PATH_MAX) {
+		memcpy(variant, filename, filename_len);
+		memcpy(variant + filename_len, use->suffix, use->suffix_len);
+		variant[filename_len + use->suffix_len] = 0;
+		if (!stat(variant, vst) && S_ISREG(vst->st_mode)) {
+			*variant_len = filename_len + use->suffix_len;
+			return 0;
+		}
+	}
+
+	if (!uwsgi.static_compress_store) return -1;
+	if ((uint64_t) st->st_size < uwsgi.static_compress_min_size || (uint64_t) st->st_size > uwsgi.static_compress_max_size) return -1;
+	if (uwsgi_static_store_path(use, filename, filename_len, variant, variant_len)) return -1;
+
+	if (!stat(variant, vst) && vst->st_mtime == st->st_mtime) {
+		// empty marker, the file does not compress
+		if (vst->st_size == 0) return -1;
+		return 0;
+	}
+
+	// missing or stale, the original file is served while the variant is built
+	if (can_compress && use->compress) {
+		uwsgi_static_store_add(use, filename, filename_len, st, variant);
+	}
+	return -1;
+}
@@ -436,6 +436,41 @@ struct uwsgi_stats_pusher_instance *uwsgi_stats_pusher_add(struct uwsgi_stats_pu
 	return uspi;
 }
 
+/*
+	compact snapshot of the metrics for the raw pushers: the values (in the order of the metrics list) are
+	taken once per cycle, and every instance keeps the values of its last successful push, so it can send
+	only the metrics changed in the meantime. Every --stats-pusher-refresh seconds all of them are sent again.
+*/
+static void uwsgi_stats_pusher_snapshot() {
+	uint64_t pos = 0;
+	if (!uwsgi.stats_pusher_snapshot) {
+		uwsgi.stats_pusher_snapshot = uwsgi_calloc(sizeof(int64_t) * uwsgi.metrics_cnt);
+	}
+	struct uwsgi_metric *um = uwsgi.metrics;
+	while(um && pos < uwsgi.metrics_cnt) {
+		uwsgi.stats_pusher_snapshot[pos++] = uwsgi_metric_get_handle(um);
+		um = um->next;
+	}
+}
+
+// has the metric at position pos changed since the last push of the instance ?
+int uwsgi_stats_pusher_changed(struct uwsgi_stats_pusher_instance *uspi, uint64_t pos) {
+	if (uspi->full || !uspi->pushed) return 1;
+	return uspi->pushed[pos] != uwsgi.stats_pusher_snapshot[pos];
+}
+
+// the push succeeded, the snapshot becomes the base of the next deltas
+void uwsgi_stats_pusher_commit(struct uwsgi_stats_pusher_instance *uspi) {
+	if (!uwsgi.stats_pusher_snapshot) return;
+	if (!uspi->pushed) {
+		uspi->pushed = uwsgi_malloc(sizeof(int64_t) * uwsgi.metrics_cnt);
+	}
+	memcpy(uspi->pushed, uwsgi.stats_pusher_snapshot, sizeof(int64_t) * uwsgi.metrics_cnt);
+	if (uspi->full) {
+		uspi->last_full = uwsgi_now();
+	}
+}
+
 void uwsgi_stats_pusher_loop(struct uwsgi_thread *ut) {
 	void *events = event_queue_alloc(1);
 	for (;;) {
@@ -460,11 +495,17 @@ void uwsgi_stats_pusher_loop(struct uwsgi_thread *ut) {
 		time_t now = uwsgi_now();
 		struct uwsgi_stats_pusher_instance *uspi = uwsgi.stats_pusher_instances;
 		struct uwsgi_stats *us = NULL;
+		int snapshot_taken = 0;
 		while (uspi) {
 			int delta = uspi->freq ? uspi->freq : uwsgi.stats_pusher_default_freq;
 			if (((uspi->last_run + delta) <= now) || (uspi->needs_retry && (uspi->next_retry <= now))) {
 				if (uspi->needs_retry) uspi->retries++;
 				if (uspi->raw) {
+					if (uwsgi.has_metrics && !snapshot_taken) {
+						uwsgi_stats_pusher_snapshot();
+						snapshot_taken = 1;
+					}
+					uspi->full = !uspi->pushed || (uwsgi.stats_pusher_refresh > 0 && uspi->last_full + uwsgi.stats_pusher_refresh <= now);
 					uspi->pusher->func(uspi, now, NULL, 0);
 				}
 				else {
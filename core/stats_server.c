@@ -0,0 +1,437 @@
+#include "uwsgi.h"
+
+extern struct uwsgi_server uwsgi;
+
+/*
+	the stats server (--stats)
+
+	it runs in a thread of the master, so a slow (or stuck) client can never block the management of the workers:
+	the client sockets are non-blocking and they are all multiplexed on the event queue of the thread.
+
+	The document (the json one or, for the /metrics path in --stats-http mode, the prometheus text format) is a
+	snapshot of the shared counters generated once and shared by all of the clients connecting in the same second.
+	The prometheus output is generated directly from the counters, without building the json document.
+*/
+
+struct uwsgi_stats_snapshot {
+	char *buf;
+	size_t len;
+	time_t t;
+	int refs;
+};
+
+struct uwsgi_stats_client {
+	int fd;
+	// 0 -> waiting for the http request, 1 -> sending the response
+	int status;
+	time_t deadline;
+	char req[4096];
+	size_t req_len;
+	char *headers;
+	size_t headers_len;
+	struct uwsgi_stats_snapshot *snapshot;
+	size_t pos;
+	struct uwsgi_stats_client *prev;
+	struct uwsgi_stats_client *next;
+};
+
+static struct uwsgi_stats_client *uwsgi_stats_clients;
+static struct uwsgi_stats_snapshot *uwsgi_stats_snapshot_json;
+static struct uwsgi_stats_snapshot *uwsgi_stats_snapshot_prometheus;
+
+static char *uwsgi_stats_json_headers = "HTTP/1.0 200 OK\r\nConnection: close\r\nAccess-Control-Allow-Origin: *\r\nContent-Type: application/json\r\n\r\n";
+static char *uwsgi_stats_prometheus_headers = "HTTP/1.0 200 OK\r\nConnection: close\r\nContent-Type: text/plain; version=0.0.4\r\n\r\n";
+
+static void uwsgi_stats_snapshot_unref(struct uwsgi_stats_snapshot *uss) {
+	if (!uss) return;
+	uss->refs--;
+	if (uss->refs > 0) return;
+	free(uss->buf);
+	free(uss);
+}
+
+static int uwsgi_prometheus_family(struct uwsgi_buffer *ub, char *name, char *type, char *help) {
+	if (uwsgi_buffer_append(ub, "# HELP uwsgi_", 13)) return -1;
+	if (uwsgi_buffer_append(ub, name, strlen(name))) return -1;
+	if (uwsgi_buffer_append(ub, " ", 1)) return -1;
+	if (uwsgi_buffer_append(ub, help, strlen(help))) return -1;
+	if (uwsgi_buffer_append(ub, "\n# TYPE uwsgi_", 14)) return -1;
+	if (uwsgi_buffer_append(ub, name, strlen(name))) return -1;
+	if (uwsgi_buffer_append(ub, " ", 1)) return -1;
+	if (uwsgi_buffer_append(ub, type, strlen(type))) return -1;
+	return uwsgi_buffer_append(ub, "\n", 1);
+}
+
+// uwsgi_<name>[{<label>="<value>"}] <num>
+static int uwsgi_prometheus_sample(struct uwsgi_buffer *ub, char *name, char *label, char *value, size_t value_len, int64_t num) {
+	size_t i;
+	if (uwsgi_buffer_append(ub, "uwsgi_", 6)) return -1;
+	if (uwsgi_buffer_append(ub, name, strlen(name))) return -1;
+	if (label) {
+		if (uwsgi_buffer_append(ub, "{", 1)) return -1;
+		if (uwsgi_buffer_append(ub, label, strlen(label))) return -1;
+		if (uwsgi_buffer_append(ub, "=\"", 2)) return -1;
+		for(i=0;i<value_len;i++) {
+			if (value[i] == '"' || value[i] == '\\') {
+				if (uwsgi_buffer_append(ub, "\\", 1)) return -1;
+			}
+			else if (value[i] == '\n') {
+				if (uwsgi_buffer_append(ub, "\\n", 2)) return -1;
+				continue;
+			}
+			if (uwsgi_buffer_append(ub, value + i, 1)) return -1;
+		}
+		if (uwsgi_buffer_append(ub, "\"}", 2)) return -1;
+	}
+	if (uwsgi_buffer_append(ub, " ", 1)) return -1;
+	if (uwsgi_buffer_num64(ub, num)) return -1;
+	return uwsgi_buffer_append(ub, "\n", 1);
+}
+
+static int uwsgi_prometheus_worker_sample(struct uwsgi_buffer *ub, char *name, int wid, int64_t num) {
+	char wid_str[sizeof(UMAX64_STR)+1];
+	int wid_len = uwsgi_long2str2n(wid, wid_str, sizeof(UMAX64_STR)+1);
+	return uwsgi_prometheus_sample(ub, name, "worker", wid_str, wid_len, num);
+}
+
+static struct uwsgi_prometheus_worker_counter {
+	char *name;
+	char *type;
+	char *help;
+	size_t offset;
+} uwsgi_prometheus_worker_counters[] = {
+	{"worker_requests_total", "counter", "Requests managed by the worker.", offsetof(struct uwsgi_worker, requests)},
+	{"worker_failed_requests_total", "counter", "Failed requests of the worker.", offsetof(struct uwsgi_worker, failed_requests)},
+	{"worker_harakiri_total", "counter", "Harakiri of the worker.", offsetof(struct uwsgi_worker, harakiri_count)},
+	{"worker_signals_total", "counter", "Signals managed by the worker.", offsetof(struct uwsgi_worker, signals)},
+	{"worker_respawns_total", "counter", "Respawns of the worker.", offsetof(struct uwsgi_worker, respawn_count)},
+	{"worker_tx_bytes_total", "counter", "Bytes sent by the worker.", offsetof(struct uwsgi_worker, tx)},
+	{"worker_running_time_microseconds_total", "counter", "Time spent by the worker managing requests.", offsetof(struct uwsgi_worker, running_time)},
+	{"worker_avg_response_time_microseconds", "gauge", "Average response time of the worker.", offsetof(struct uwsgi_worker, avg_response_time)},
+	{"worker_rss_bytes", "gauge", "Resident memory of the worker.", offsetof(struct uwsgi_worker, rss_size)},
+	{"worker_vsz_bytes", "gauge", "Virtual memory of the worker.", offsetof(struct uwsgi_worker, vsz_size)},
+	{NULL, NULL, NULL, 0},
+};
+
+// metric names can contain dots and dashes
+static int uwsgi_prometheus_metric_name(char *dst, size_t dst_len, char *prefix, char *name, char *suffix) {
+	int ret = snprintf(dst, dst_len, "%s%s%s", prefix, name, suffix);
+	if (ret <= 0 || ret >= (int) dst_len) return -1;
+	char *ptr = dst;
+	while(*ptr) {
+		if (*ptr == '.' || *ptr == '-') *ptr = '_';
+		ptr++;
+	}
+	return 0;
+}
+
+static int uwsgi_prometheus_histogram(struct uwsgi_buffer *ub, struct uwsgi_histogram *uh, uint64_t *merged) {
+	char name[256];
+	uint64_t quantiles[] = {500, 900, 990, 999};
+	char *quantiles_str[] = {"0.5", "0.9", "0.99", "0.999"};
+	int i;
+
+	uwsgi_histogram_merge(uh, merged);
+
+	if (uwsgi_prometheus_metric_name(name, 256, "histogram_", uh->name, "")) return 0;
+	if (uwsgi_prometheus_family(ub, name, "summary", "Latency/size distribution.")) return -1;
+	for(i=0;i<4;i++) {
+		if (uwsgi_prometheus_sample(ub, name, "quantile", quantiles_str[i], strlen(quantiles_str[i]), uwsgi_histogram_quantile(merged, quantiles[i]))) return -1;
+	}
+	if (uwsgi_prometheus_metric_name(name, 256, "histogram_", uh->name, "_sum")) return 0;
+	if (uwsgi_prometheus_sample(ub, name, NULL, NULL, 0, merged[1])) return -1;
+	if (uwsgi_prometheus_metric_name(name, 256, "histogram_", uh->name, "_count")) return 0;
+	return uwsgi_prometheus_sample(ub, name, NULL, NULL, 0, merged[0]);
+}
+
+struct uwsgi_buffer *uwsgi_stats_prometheus() {
+	int i;
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size * 4);
+
+	if (uwsgi_prometheus_family(ub, "listen_queue", "gauge", "Requests waiting in the listen queue.")) goto error;
+	struct uwsgi_socket *uwsgi_sock = uwsgi.sockets;
+	while(uwsgi_sock) {
+		if (uwsgi_sock->name) {
+			if (uwsgi_prometheus_sample(ub, "listen_queue", "socket", uwsgi_sock->name, strlen(uwsgi_sock->name), uwsgi_sock->queue)) goto error;
+		}
+		uwsgi_sock = uwsgi_sock->next;
+	}
+
+	if (uwsgi_prometheus_family(ub, "listen_queue_errors_total", "counter", "Listen queue overflows.")) goto error;
+	if (uwsgi_prometheus_sample(ub, "listen_queue_errors_total", NULL, NULL, 0, uwsgi.shared->options[UWSGI_OPTION_BACKLOG_ERRORS])) goto error;
+
+	if (uwsgi_prometheus_family(ub, "load", "gauge", "Requests being managed.")) goto error;
+	if (uwsgi_prometheus_sample(ub, "load", NULL, NULL, 0, uwsgi.shared->load)) goto error;
+
+	struct uwsgi_prometheus_worker_counter *upwc = uwsgi_prometheus_worker_counters;
+	while(upwc->name) {
+		if (uwsgi_prometheus_family(ub, upwc->name, upwc->type, upwc->help)) goto error;
+		for(i=1;i<=uwsgi.numproc;i++) {
+			uint64_t *value = (uint64_t *) (((char *) &uwsgi.workers[i]) + upwc->offset);
+			if (uwsgi_prometheus_worker_sample(ub, upwc->name, i, *value)) goto error;
+		}
+		upwc++;
+	}
+
+	if (uwsgi_prometheus_family(ub, "worker_exceptions_total", "counter", "Exceptions raised in the worker.")) goto error;
+	for(i=1;i<=uwsgi.numproc;i++) {
+		if (uwsgi_prometheus_worker_sample(ub, "worker_exceptions_total", i, uwsgi_worker_exceptions(i))) goto error;
+	}
+
+	if (uwsgi_prometheus_family(ub, "worker_busy", "gauge", "1 if the worker is managing a request.")) goto error;
+	for(i=1;i<=uwsgi.numproc;i++) {
+		if (uwsgi_prometheus_worker_sample(ub, "worker_busy", i, uwsgi.workers[i].cheaped ? 0 : uwsgi_worker_is_busy(i))) goto error;
+	}
+
+	if (!uwsgi.has_metrics) goto done;
+
+	// the metrics subsystem (the histograms are exported as summaries)
+	char name[256];
+	struct uwsgi_metric *um = uwsgi.metrics;
+	while(um) {
+		if (um->collector && !strcmp(um->collector->name, "histogram")) goto next;
+		if (uwsgi_prometheus_metric_name(name, 256, "metric_", um->name, "")) goto next;
+		if (uwsgi_prometheus_family(ub, name, um->type == UWSGI_METRIC_COUNTER ? "counter" : "gauge", um->name)) goto error;
+		if (uwsgi_prometheus_sample(ub, name, NULL, NULL, 0, uwsgi_metric_get_handle(um))) goto error;
+next:
+		um = um->next;
+	}
+
+	if (uwsgi.histograms) {
+		uint64_t *merged = uwsgi_malloc(sizeof(uint64_t) * UWSGI_HISTOGRAM_SLOT_SIZE);
+		struct uwsgi_histogram *uh = uwsgi.histograms;
+		while(uh) {
+			if (uwsgi_prometheus_histogram(ub, uh, merged)) {
+				free(merged);
+				goto error;
+			}
+			uh = uh->next;
+		}
+		free(merged);
+	}
+
+done:
+	return ub;
+error:
+	uwsgi_buffer_destroy(ub);
+	return NULL;
+}
+
+// get the current snapshot (or generate a new one)
+static struct uwsgi_stats_snapshot *uwsgi_stats_snapshot_get(int prometheus) {
+	struct uwsgi_stats_snapshot **cached = prometheus ? &uwsgi_stats_snapshot_prometheus : &uwsgi_stats_snapshot_json;
+	time_t now = uwsgi_now();
+
+	if (*cached && (*cached)->t == now) {
+		(*cached)->refs++;
+		return *cached;
+	}
+
+	struct uwsgi_stats_snapshot *uss = uwsgi_calloc(sizeof(struct uwsgi_stats_snapshot));
+	if (prometheus) {
+		struct uwsgi_buffer *ub = uwsgi_stats_prometheus();
+		if (!ub) goto error;
+		uss->buf = ub->buf;
+		uss->len = ub->pos;
+		ub->buf = NULL;
+		uwsgi_buffer_destroy(ub);
+	}
+	else {
+		struct uwsgi_stats *us = uwsgi_master_generate_stats();
+		if (!us) goto error;
+		uss->buf = us->base;
+		uss->len = us->pos;
+		free(us);
+	}
+	uss->t = now;
+	// one reference for the cache
+	uss->refs = 2;
+	uwsgi_stats_snapshot_unref(*cached);
+	*cached = uss;
+	return uss;
+error:
+	free(uss);
+	return NULL;
+}
+
+static void uwsgi_stats_client_close(struct uwsgi_stats_client *usc) {
+	close(usc->fd);
+	uwsgi_stats_snapshot_unref(usc->snapshot);
+	if (usc->prev) {
+		usc->prev->next = usc->next;
+	}
+	else {
+		uwsgi_stats_clients = usc->next;
+	}
+	if (usc->next) {
+		usc->next->prev = usc->prev;
+	}
+	free(usc);
+}
+
+// attach the snapshot and start sending (returns -1 on error)
+static int uwsgi_stats_client_respond(int queue, struct uwsgi_stats_client *usc, int prometheus) {
+	usc->snapshot = uwsgi_stats_snapshot_get(prometheus);
+	if (!usc->snapshot) return -1;
+	if (uwsgi.stats_http) {
+		usc->headers = prometheus ? uwsgi_stats_prometheus_headers : uwsgi_stats_json_headers;
+		usc->headers_len = strlen(usc->headers);
+	}
+	usc->status = 1;
+	usc->pos = 0;
+	if (event_queue_fd_read_to_write(queue, usc->fd)) return -1;
+	return 0;
+}
+
+static void uwsgi_stats_client_accept(int queue, int fd) {
+	struct sockaddr_un client_src;
+	socklen_t client_src_len = sizeof(struct sockaddr_un);
+
+	int client_fd = accept(fd, (struct sockaddr *) &client_src, &client_src_len);
+	if (client_fd < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			uwsgi_error("uwsgi_stats_client_accept()/accept()");
+		}
+		return;
+	}
+	uwsgi_socket_nb(client_fd);
+
+	struct uwsgi_stats_client *usc = uwsgi_calloc(sizeof(struct uwsgi_stats_client));
+	usc->fd = client_fd;
+	usc->deadline = uwsgi_now() + uwsgi.shared->options[UWSGI_OPTION_SOCKET_TIMEOUT];
+	usc->next = uwsgi_stats_clients;
+	if (uwsgi_stats_clients) uwsgi_stats_clients->prev = usc;
+	uwsgi_stats_clients = usc;
+
+	if (event_queue_add_fd_read(queue, client_fd)) {
+		uwsgi_stats_client_close(usc);
+		return;
+	}
+
+	// in raw mode the document is sent as soon as the client connects
+	if (!uwsgi.stats_http) {
+		if (uwsgi_stats_client_respond(queue, usc, 0)) {
+			uwsgi_stats_client_close(usc);
+		}
+	}
+}
+
+// read the http request line, /metrics selects the prometheus format
+static int uwsgi_stats_client_read(int queue, struct uwsgi_stats_client *usc) {
+	ssize_t rlen = read(usc->fd, usc->req + usc->req_len, sizeof(usc->req) - usc->req_len);
+	if (rlen < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return 0;
+	if (rlen <= 0) return -1;
+	usc->req_len += rlen;
+
+	char *eol = memchr(usc->req, '\n', usc->req_len);
+	if (!eol) {
+		if (usc->req_len >= sizeof(usc->req)) return -1;
+		return 0;
+	}
+
+	int prometheus = 0;
+	char *path = memchr(usc->req, ' ', eol - usc->req);
+	if (path) {
+		path++;
+		char *path_end = memchr(path, ' ', eol - path);
+		if (!path_end) path_end = eol;
+		char *qs = memchr(path, '?', path_end - path);
+		if (qs) path_end = qs;
+		if (!uwsgi_strncmp(path, path_end - path, "/metrics", 8)) {
+			prometheus = 1;
+		}
+	}
+	return uwsgi_stats_client_respond(queue, usc, prometheus);
+}
+
+// returns 1 when the whole response has been sent
+static int uwsgi_stats_client_write(struct uwsgi_stats_client *usc) {
+	struct iovec iov[2];
+	int iovcnt = 0;
+	if (usc->pos < usc->headers_len) {
+		iov[iovcnt].iov_base = usc->headers + usc->pos;
+		iov[iovcnt].iov_len = usc->headers_len - usc->pos;
+		iovcnt++;
+		iov[iovcnt].iov_base = usc->snapshot->buf;
+		iov[iovcnt].iov_len = usc->snapshot->len;
+		iovcnt++;
+	}
+	else {
+		size_t pos = usc->pos - usc->headers_len;
+		iov[iovcnt].iov_base = usc->snapshot->buf + pos;
+		iov[iovcnt].iov_len = usc->snapshot->len - pos;
+		iovcnt++;
+	}
+	ssize_t wlen = writev(usc->fd, iov, iovcnt);
+	if (wlen < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return 0;
+	if (wlen <= 0) return -1;
+	usc->pos += wlen;
+	if (usc->pos >= usc->headers_len + usc->snapshot->len) return 1;
+	return 0;
+}
+
+static void uwsgi_stats_clients_expire(time_t now) {
+	struct uwsgi_stats_client *usc = uwsgi_stats_clients;
+	while(usc) {
+		struct uwsgi_stats_client *next = usc->next;
+		if (usc->deadline <= now) {
+			uwsgi_stats_client_close(usc);
+		}
+		usc = next;
+	}
+}
+
+void uwsgi_stats_server_loop(struct uwsgi_thread *ut) {
+	int i;
+	int nevents = 64;
+	void *events = event_queue_alloc(nevents);
+
+	uwsgi_socket_nb(uwsgi.stats_fd);
+	event_queue_add_fd_read(ut->queue, uwsgi.stats_fd);
+
+	for(;;) {
+		int ret = event_queue_wait_multi(ut->queue, 1, events, nevents);
+		if (ret < 0) {
+			if (errno == EINTR) continue;
+			uwsgi_error("uwsgi_stats_server_loop()/event_queue_wait_multi()");
+			return;
+		}
+		for(i=0;i<ret;i++) {
+			int interesting_fd = event_queue_interesting_fd(events, i);
+			if (interesting_fd == ut->pipe[1]) {
+				char buf[4096];
+				ssize_t len = read(interesting_fd, buf, 4096);
+				if (len <= 0) {
+					if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) continue;
+					// the master is gone
+					return;
+				}
+				continue;
+			}
+
+			if (interesting_fd == uwsgi.stats_fd) {
+				uwsgi_stats_client_accept(ut->queue, uwsgi.stats_fd);
+				continue;
+			}
+
+			struct uwsgi_stats_client *usc = uwsgi_stats_clients;
+			while(usc) {
+				if (usc->fd == interesting_fd) break;
+				usc = usc->next;
+			}
+			if (!usc) continue;
+
+			int status;
+			if (usc->status == 0) {
+				status = uwsgi_stats_client_read(ut->queue, usc);
+			}
+			else {
+				status = uwsgi_stats_client_write(usc);
+			}
+			if (status) {
+				uwsgi_stats_client_close(usc);
+			}
+		}
+		uwsgi_stats_clients_expire(uwsgi_now());
+	}
+}
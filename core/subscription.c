@@ -6,9 +6,10 @@
 
 	each subscription slot is as an hashed item in a dictionary
 
-	each slot has a circular linked list containing the nodes names
+	each slot has a linked list containing the nodes names
 
-	the structure and system is very similar to uwsgi_dyn_dict already used by the mime type parser
+	the dictionary is an open hash table (murmur3 with a random seed) whose buckets are doubled
+	when the number of slots exceeds them. Lookups never modify the table (chains are not reordered).
 
 	This system is not mean to run on shared memory. If you have multiple processes for the same app, you have to create
 	a new subscriptions slot list.
@@ -20,74 +21,60 @@
 
 extern struct uwsgi_server uwsgi;
 
-struct uwsgi_subscribe_slot *uwsgi_get_subscribe_slot(struct uwsgi_subscribe_slot **slot, char *key, uint16_t keylen) {
+// log every new slot/node (disabled during bulk loads)
+static int uwsgi_subscriptions_verbose = 1;
 
-	if (keylen > 0xff)
-		return NULL;
-
-	uint32_t hash = djb33x_hash(key, keylen);
-	int hash_key = hash % 0xffff;
+struct uwsgi_subscribe_slot *uwsgi_get_subscribe_slot(struct uwsgi_subscriptions *ht, char *key, uint16_t keylen) {
 
-	struct uwsgi_subscribe_slot *current_slot = slot[hash_key];
+	uint32_t hash = murmur3_hash(key, keylen, ht->seed);
+	struct uwsgi_subscribe_slot *current_slot = ht->buckets[hash & (ht->size - 1)];
 
-
-#ifdef UWSGI_DEBUG
-	uwsgi_log("****************************\n");
 	while (current_slot) {
-		uwsgi_log("slot %.*s %d\n", current_slot->keylen, current_slot->key, current_slot->hits);
+		if (current_slot->hash == hash && !uwsgi_strncmp(key, keylen, current_slot->key, current_slot->keylen)) {
+			return current_slot;
+		}
 		current_slot = current_slot->next;
 	}
-	uwsgi_log("****************************\n");
-	current_slot = slot[hash_key];
-#endif
 
-	while (current_slot) {
-		if (!uwsgi_strncmp(key, keylen, current_slot->key, current_slot->keylen)) {
-			// auto optimization
-			if (current_slot->prev) {
-				if (current_slot->hits > current_slot->prev->hits) {
-					struct uwsgi_subscribe_slot *slot_parent = current_slot->prev->prev, *slot_prev = current_slot->prev;
-					if (slot_parent) {
-						slot_parent->next = current_slot;
-					}
-					else {
-						slot[hash_key] = current_slot;
-					}
-
-					if (current_slot->next) {
-						current_slot->next->prev = slot_prev;
-					}
-
-					slot_prev->prev = current_slot;
-					slot_prev->next = current_slot->next;
-
-					current_slot->next = slot_prev;
-					current_slot->prev = slot_parent;
+	return NULL;
+}
 
-				}
-			}
-			return current_slot;
+// move the slots to a bigger table (size must be a power of 2)
+static void uwsgi_subscriptions_resize(struct uwsgi_subscriptions *ht, uint64_t size) {
+	if (size <= ht->size)
+		return;
+
+	struct uwsgi_subscribe_slot **buckets = uwsgi_calloc(sizeof(struct uwsgi_subscribe_slot *) * size);
+	uint64_t i;
+	for (i = 0; i < ht->size; i++) {
+		struct uwsgi_subscribe_slot *current_slot = ht->buckets[i];
+		while (current_slot) {
+			struct uwsgi_subscribe_slot *next_slot = current_slot->next;
+			uint64_t pos = current_slot->hash & (size - 1);
+			current_slot->prev = NULL;
+			current_slot->next = buckets[pos];
+			if (buckets[pos])
+				buckets[pos]->prev = current_slot;
+			buckets[pos] = current_slot;
+			current_slot = next_slot;
 		}
-		current_slot = current_slot->next;
-		// check for loopy optimization
-		if (current_slot == slot[hash_key])
-			break;
 	}
 
-	return NULL;
+	free(ht->buckets);
+	ht->buckets = buckets;
+	ht->size = size;
 }
 
-// least reference count
-static struct uwsgi_subscribe_node *uwsgi_subscription_algo_lrc(struct uwsgi_subscribe_slot *current_slot, struct uwsgi_subscribe_node *node) {
-	// if node is NULL we are in the second step (in lrc mode we do not use the first step)
-	if (node)
-		return NULL;
+// dead or ejected (by the health checker) nodes cannot be choosen
+#define uwsgi_subscription_node_down(x) ((x)->death_mark || (x)->ejected)
 
+// least reference count
+static struct uwsgi_subscribe_node *uwsgi_subscription_algo_lrc(struct uwsgi_subscribe_slot *current_slot, struct uwsgi_subscription_client *client) {
 	struct uwsgi_subscribe_node *choosen_node = NULL;
-	node = current_slot->nodes;
+	struct uwsgi_subscribe_node *node = current_slot->nodes;
 	uint64_t min_rc = 0;
 	while (node) {
-		if (!node->death_mark) {
+		if (!uwsgi_subscription_node_down(node)) {
 			if (min_rc == 0 || node->reference < min_rc) {
 				min_rc = node->reference;
 				choosen_node = node;
@@ -106,16 +93,12 @@ static struct uwsgi_subscribe_node *uwsgi_subscription_algo_lrc(struct uwsgi_sub
 }
 
 // weighted least reference count
-static struct uwsgi_subscribe_node *uwsgi_subscription_algo_wlrc(struct uwsgi_subscribe_slot *current_slot, struct uwsgi_subscribe_node *node) {
-	// if node is NULL we are in the second step (in wlrc mode we do not use the first step)
-	if (node)
-		return NULL;
-
+static struct uwsgi_subscribe_node *uwsgi_subscription_algo_wlrc(struct uwsgi_subscribe_slot *current_slot, struct uwsgi_subscription_client *client) {
 	struct uwsgi_subscribe_node *choosen_node = NULL;
-	node = current_slot->nodes;
+	struct uwsgi_subscribe_node *node = current_slot->nodes;
 	double min_rc = 0;
 	while (node) {
-		if (!node->death_mark) {
+		if (!uwsgi_subscription_node_down(node)) {
 			// node->weight is always >= 1, we can safely use it as divider
 			double ref = (double) node->reference / (double) node->weight;
 			double next_node_ref = 0;
@@ -140,22 +123,23 @@ static struct uwsgi_subscribe_node *uwsgi_subscription_algo_wlrc(struct uwsgi_su
 }
 
 // weighted round robin algo
-static struct uwsgi_subscribe_node *uwsgi_subscription_algo_wrr(struct uwsgi_subscribe_slot *current_slot, struct uwsgi_subscribe_node *node) {
-	// if node is NULL we are in the second step
-	if (node) {
-		if (node->death_mark == 0 && node->wrr > 0) {
+static struct uwsgi_subscribe_node *uwsgi_subscription_algo_wrr(struct uwsgi_subscribe_slot *current_slot, struct uwsgi_subscription_client *client) {
+	// first step: get the first node with wrr > 0
+	struct uwsgi_subscribe_node *node = current_slot->nodes;
+	while (node) {
+		if (!uwsgi_subscription_node_down(node) && node->wrr > 0) {
 			node->wrr--;
 			node->reference++;
 			return node;
 		}
-		return NULL;
+		node = node->next;
 	}
 
 	// no wrr > 0 node found, reset them
 	node = current_slot->nodes;
 	uint64_t min_weight = 0;
 	while (node) {
-		if (!node->death_mark) {
+		if (!uwsgi_subscription_node_down(node)) {
 			if (min_weight == 0 || node->weight < min_weight)
 				min_weight = node->weight;
 		}
@@ -166,7 +150,7 @@ static struct uwsgi_subscribe_node *uwsgi_subscription_algo_wrr(struct uwsgi_sub
 	node = current_slot->nodes;
 	struct uwsgi_subscribe_node *choosen_node = NULL;
 	while (node) {
-		if (!node->death_mark) {
+		if (!uwsgi_subscription_node_down(node)) {
 			node->wrr = node->weight / min_weight;
 			choosen_node = node;
 		}
@@ -179,78 +163,321 @@ static struct uwsgi_subscribe_node *uwsgi_subscription_algo_wrr(struct uwsgi_sub
 	return choosen_node;
 }
 
-void uwsgi_subscription_set_algo(char *algo) {
+static int uwsgi_subscription_ketama_cmp(const void *a, const void *b) {
+	const struct uwsgi_subscribe_ketama_point *p1 = a, *p2 = b;
+	if (p1->hash < p2->hash) return -1;
+	if (p1->hash > p2->hash) return 1;
+	return 0;
+}
 
-	if (!algo)
-		goto wrr;
+// number of points of each node in the ketama ring (scaled by weight)
+#define UWSGI_KETAMA_POINTS 160
+#define UWSGI_KETAMA_MAX_POINTS 1600
 
-	if (!strcmp(algo, "wrr")) {
-		uwsgi.subscription_algo = uwsgi_subscription_algo_wrr;
-		return;
+// rebuild the nodes index and the ketama ring of a slot
+static void uwsgi_subscription_reindex(struct uwsgi_subscribe_slot *current_slot) {
+	struct uwsgi_subscribe_node *node = current_slot->nodes;
+	uint64_t count = 0, points = 0, min_weight = 0;
+	while (node) {
+		count++;
+		if (min_weight == 0 || node->weight < min_weight)
+			min_weight = node->weight;
+		node = node->next;
 	}
 
-	if (!strcmp(algo, "lrc")) {
-		uwsgi.subscription_algo = uwsgi_subscription_algo_lrc;
-		return;
+	free(current_slot->index);
+	free(current_slot->ring);
+	current_slot->index = uwsgi_malloc(sizeof(struct uwsgi_subscribe_node *) * (count + 1));
+	current_slot->index_len = 0;
+
+	node = current_slot->nodes;
+	while (node) {
+		current_slot->index[current_slot->index_len++] = node;
+		points += UMIN(UWSGI_KETAMA_POINTS * (node->weight / min_weight), UWSGI_KETAMA_MAX_POINTS);
+		node = node->next;
+	}
+
+	current_slot->ring = uwsgi_malloc(sizeof(struct uwsgi_subscribe_ketama_point) * (points + 1));
+	current_slot->ring_len = 0;
+
+	char point_name[0xff + 32];
+	node = current_slot->nodes;
+	while (node) {
+		uint64_t i, node_points = UMIN(UWSGI_KETAMA_POINTS * (node->weight / min_weight), UWSGI_KETAMA_MAX_POINTS);
+		for (i = 0; i < node_points; i++) {
+			int point_name_len = snprintf(point_name, sizeof(point_name), "%.*s-%llu", (int) node->len, node->name, (unsigned long long) i);
+			struct uwsgi_subscribe_ketama_point *point = &current_slot->ring[current_slot->ring_len++];
+			point->hash = murmur3_hash(point_name, point_name_len, 0);
+			point->node = node;
+		}
+		node = node->next;
+	}
+
+	qsort(current_slot->ring, current_slot->ring_len, sizeof(struct uwsgi_subscribe_ketama_point), uwsgi_subscription_ketama_cmp);
+	current_slot->dirty = 0;
+}
+
+// consistent hashing (ketama) on the client hash key
+static struct uwsgi_subscribe_node *uwsgi_subscription_algo_ketama(struct uwsgi_subscribe_slot *current_slot, struct uwsgi_subscription_client *client) {
+	if (!client || !client->hash_key_len) {
+		return uwsgi_subscription_algo_wrr(current_slot, client);
+	}
+
+	if (current_slot->dirty || !current_slot->ring) {
+		uwsgi_subscription_reindex(current_slot);
+	}
+
+	if (current_slot->ring_len == 0)
+		return NULL;
+
+	uint32_t hash = murmur3_hash(client->hash_key, client->hash_key_len, 0);
+
+	// get the first point >= hash
+	uint64_t low = 0, high = current_slot->ring_len;
+	while (low < high) {
+		uint64_t mid = low + (high - low) / 2;
+		if (current_slot->ring[mid].hash < hash) {
+			low = mid + 1;
+		}
+		else {
+			high = mid;
+		}
 	}
 
-	if (!strcmp(algo, "wlrc")) {
-		uwsgi.subscription_algo = uwsgi_subscription_algo_wlrc;
+	// walk the ring skipping dead nodes
+	uint64_t i;
+	for (i = 0; i < current_slot->ring_len; i++) {
+		struct uwsgi_subscribe_node *node = current_slot->ring[(low + i) % current_slot->ring_len].node;
+		if (!uwsgi_subscription_node_down(node)) {
+			node->reference++;
+			return node;
+		}
+	}
+
+	return NULL;
+}
+
+// xorshift, good enough for choosing nodes
+static uint32_t uwsgi_subscription_random() {
+	static uint32_t state = 0;
+	if (!state) {
+		state = (uint32_t) uwsgi_micros() | 1;
+	}
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+// decay the peak-EWMA of a node (10 seconds window)
+#define UWSGI_EWMA_DECAY 10000000.0
+
+static double uwsgi_subscription_ewma(struct uwsgi_subscribe_node *node, uint64_t now) {
+	if (node->ewma_last == 0 || now <= node->ewma_last)
+		return node->ewma;
+	return node->ewma * exp(-((double) (now - node->ewma_last)) / UWSGI_EWMA_DECAY);
+}
+
+// update the peak-EWMA of a node with a new response time
+void uwsgi_subscribe_node_rtt(struct uwsgi_subscribe_node *node, uint64_t rtt) {
+	uint64_t now = uwsgi_micros();
+	double ewma = uwsgi_subscription_ewma(node, now);
+	// peaks are taken immediately, then slowly decayed
+	if ((double) rtt > ewma) {
+		node->ewma = rtt;
+	}
+	else {
+		// blend the stored value (the decay is already the weight of the old samples)
+		double w = 0;
+		if (node->ewma_last && now > node->ewma_last) {
+			w = exp(-((double) (now - node->ewma_last)) / UWSGI_EWMA_DECAY);
+		}
+		node->ewma = (node->ewma * w) + ((double) rtt * (1.0 - w));
+	}
+	node->ewma_last = now;
+}
+
+static double uwsgi_subscription_cost(struct uwsgi_subscribe_node *node, uint64_t now, int ewma) {
+	double cost = (double) (node->reference + 1) / (double) node->weight;
+	if (ewma) {
+		cost *= uwsgi_subscription_ewma(node, now) + 1;
+	}
+	return cost;
+}
+
+// power of two choices, with or without the peak-EWMA response time
+static struct uwsgi_subscribe_node *uwsgi_subscription_p2c(struct uwsgi_subscribe_slot *current_slot, int ewma) {
+	if (current_slot->dirty || !current_slot->index) {
+		uwsgi_subscription_reindex(current_slot);
+	}
+
+	struct uwsgi_subscribe_node *choosen_node = NULL;
+	if (current_slot->index_len == 0)
+		return NULL;
+
+	if (current_slot->index_len == 1) {
+		choosen_node = current_slot->index[0];
+		if (uwsgi_subscription_node_down(choosen_node))
+			return NULL;
+		goto found;
+	}
+
+	uint64_t now = ewma ? uwsgi_micros() : 0;
+	int retries;
+	for (retries = 0; retries < 3; retries++) {
+		uint64_t a = uwsgi_subscription_random() % current_slot->index_len;
+		uint64_t b = uwsgi_subscription_random() % (current_slot->index_len - 1);
+		if (b >= a)
+			b++;
+		struct uwsgi_subscribe_node *node_a = current_slot->index[a];
+		struct uwsgi_subscribe_node *node_b = current_slot->index[b];
+		if (uwsgi_subscription_node_down(node_a) && uwsgi_subscription_node_down(node_b))
+			continue;
+		if (uwsgi_subscription_node_down(node_a)) {
+			choosen_node = node_b;
+		}
+		else if (uwsgi_subscription_node_down(node_b)) {
+			choosen_node = node_a;
+		}
+		else if (uwsgi_subscription_cost(node_b, now, ewma) < uwsgi_subscription_cost(node_a, now, ewma)) {
+			choosen_node = node_b;
+		}
+		else {
+			choosen_node = node_a;
+		}
+		goto found;
+	}
+
+	// too many dead nodes, fallback to the least loaded one
+	return uwsgi_subscription_algo_wlrc(current_slot, NULL);
+
+found:
+	choosen_node->reference++;
+	return choosen_node;
+}
+
+static struct uwsgi_subscribe_node *uwsgi_subscription_algo_p2c(struct uwsgi_subscribe_slot *current_slot, struct uwsgi_subscription_client *client) {
+	return uwsgi_subscription_p2c(current_slot, 0);
+}
+
+static struct uwsgi_subscribe_node *uwsgi_subscription_algo_ewma(struct uwsgi_subscribe_slot *current_slot, struct uwsgi_subscription_client *client) {
+	return uwsgi_subscription_p2c(current_slot, 1);
+}
+
+static struct uwsgi_subscription_algo {
+	char *name;
+	struct uwsgi_subscribe_node *(*func) (struct uwsgi_subscribe_slot *, struct uwsgi_subscription_client *);
+} uwsgi_subscription_algos[] = {
+	{"wrr", uwsgi_subscription_algo_wrr},
+	{"lrc", uwsgi_subscription_algo_lrc},
+	{"wlrc", uwsgi_subscription_algo_wlrc},
+	{"ketama", uwsgi_subscription_algo_ketama},
+	{"p2c", uwsgi_subscription_algo_p2c},
+	{"ewma", uwsgi_subscription_algo_ewma},
+	{NULL, NULL},
+};
+
+static struct uwsgi_subscription_algo *uwsgi_subscription_algo_get(char *name, size_t len) {
+	struct uwsgi_subscription_algo *usa = uwsgi_subscription_algos;
+	while (usa->name) {
+		if (!uwsgi_strncmp(usa->name, strlen(usa->name), name, len)) {
+			return usa;
+		}
+		usa++;
+	}
+	return NULL;
+}
+
+void uwsgi_subscription_set_algo(char *algo) {
+
+	if (!algo)
+		goto wrr;
+
+	struct uwsgi_subscription_algo *usa = uwsgi_subscription_algo_get(algo, strlen(algo));
+	if (usa) {
+		uwsgi.subscription_algo = usa->func;
 		return;
 	}
 
+	uwsgi_log("unknown subscription algorithm \"%s\", falling back to wrr\n", algo);
+
 wrr:
 	uwsgi.subscription_algo = uwsgi_subscription_algo_wrr;
 }
 
-struct uwsgi_subscribe_node *uwsgi_get_subscribe_node(struct uwsgi_subscribe_slot **slot, char *key, uint16_t keylen) {
+// set the per-key algorithm (if any) of a slot
+static void uwsgi_subscription_slot_algo(struct uwsgi_subscribe_slot *current_slot, struct uwsgi_subscribe_req *usr) {
+	if (!usr->algo_len)
+		return;
+	struct uwsgi_subscription_algo *usa = uwsgi_subscription_algo_get(usr->algo, usr->algo_len);
+	if (!usa) {
+		uwsgi_log("[uwsgi-subscription for pid %d] %.*s => unknown algorithm \"%.*s\"\n", (int) uwsgi.mypid, usr->keylen, usr->key, usr->algo_len, usr->algo);
+		return;
+	}
+	current_slot->algo = usa->func;
+}
 
-	if (keylen > 0xff)
-		return NULL;
+struct uwsgi_subscribe_node *uwsgi_get_subscribe_node(struct uwsgi_subscriptions *ht, char *key, uint16_t keylen, struct uwsgi_subscription_client *client) {
 
-	struct uwsgi_subscribe_slot *current_slot = uwsgi_get_subscribe_slot(slot, key, keylen);
+	struct uwsgi_subscribe_slot *current_slot = uwsgi_get_subscribe_slot(ht, key, keylen);
 	if (!current_slot)
 		return NULL;
 
-	// slot found, move up in the list increasing hits
 	current_slot->hits++;
 	time_t now = uwsgi_now();
-	struct uwsgi_subscribe_node *node = current_slot->nodes;
-	while (node) {
-		// is the node alive ?
-		if (now - node->last_check > uwsgi.subscription_tolerance) {
-			if (node->death_mark == 0)
-				uwsgi_log("[uwsgi-subscription for pid %d] %.*s => marking %.*s as failed (no announce received in %d seconds)\n", (int) uwsgi.mypid, (int) keylen, key, (int) node->len, node->name, uwsgi.subscription_tolerance);
-			node->failcnt++;
-			node->death_mark = 1;
-		}
-		// do i need to remove the node ?
-		if (node->death_mark && node->reference == 0) {
-			// remove the node and move to next
-			struct uwsgi_subscribe_node *dead_node = node;
-			node = node->next;
-			// if the slot has been removed, return NULL;
-			if (uwsgi_remove_subscribe_node(slot, dead_node) == 1) {
-				return NULL;
+	// check for dead nodes (at most once per second, so O(1) algorithms do not walk the list on every pick)
+	if (current_slot->last_sweep != now) {
+		current_slot->last_sweep = now;
+		struct uwsgi_subscribe_node *node = current_slot->nodes;
+		while (node) {
+			// is the node alive ?
+			if (now - node->last_check > uwsgi.subscription_tolerance) {
+				if (node->death_mark == 0)
+					uwsgi_log("[uwsgi-subscription for pid %d] %.*s => marking %.*s as failed (no announce received in %d seconds)\n", (int) uwsgi.mypid, (int) keylen, key, (int) node->len, node->name, uwsgi.subscription_tolerance);
+				node->failcnt++;
+				node->death_mark = 1;
 			}
-			continue;
+			// do i need to remove the node ?
+			if (node->death_mark && node->reference == 0) {
+				// remove the node and move to next
+				struct uwsgi_subscribe_node *dead_node = node;
+				node = node->next;
+				// if the slot has been removed, return NULL;
+				if (uwsgi_remove_subscribe_node(ht, dead_node) == 1) {
+					return NULL;
+				}
+				continue;
+			}
+			node = node->next;
 		}
+	}
 
-		struct uwsgi_subscribe_node *choosen_node = uwsgi.subscription_algo(current_slot, node);
-		if (choosen_node)
-			return choosen_node;
-
-		node = node->next;
+	struct uwsgi_subscribe_node *(*algo) (struct uwsgi_subscribe_slot *, struct uwsgi_subscription_client *) = uwsgi.subscription_algo;
+	if (current_slot->algo) {
+		algo = current_slot->algo;
 	}
 
-	return uwsgi.subscription_algo(current_slot, node);
+	struct uwsgi_subscribe_node *choosen_node = algo(current_slot, client);
+	// slow start: a re-admitted node only gets a growing share of the requests
+	if (choosen_node && choosen_node->readmitted) {
+		time_t elapsed = now - choosen_node->readmitted;
+		if (elapsed < 0 || (uint64_t) elapsed >= choosen_node->slow_start) {
+			choosen_node->readmitted = 0;
+		}
+		else if ((uwsgi_subscription_random() % choosen_node->slow_start) > (uint64_t) elapsed) {
+			struct uwsgi_subscribe_node *other_node = algo(current_slot, client);
+			if (other_node) {
+				choosen_node->reference--;
+				choosen_node = other_node;
+			}
+		}
+	}
+	return choosen_node;
 }
 
-struct uwsgi_subscribe_node *uwsgi_get_subscribe_node_by_name(struct uwsgi_subscribe_slot **slot, char *key, uint16_t keylen, char *val, uint16_t vallen) {
+struct uwsgi_subscribe_node *uwsgi_get_subscribe_node_by_name(struct uwsgi_subscriptions *ht, char *key, uint16_t keylen, char *val, uint16_t vallen) {
 
-	if (keylen > 0xff)
-		return NULL;
-	struct uwsgi_subscribe_slot *current_slot = uwsgi_get_subscribe_slot(slot, key, keylen);
+	struct uwsgi_subscribe_slot *current_slot = uwsgi_get_subscribe_slot(ht, key, keylen);
 	if (current_slot) {
 		struct uwsgi_subscribe_node *node = current_slot->nodes;
 		while (node) {
@@ -264,16 +491,10 @@ struct uwsgi_subscribe_node *uwsgi_get_subscribe_node_by_name(struct uwsgi_subsc
 	return NULL;
 }
 
-int uwsgi_remove_subscribe_node(struct uwsgi_subscribe_slot **slot, struct uwsgi_subscribe_node *node) {
-
-	int ret = 0;
+int uwsgi_remove_subscribe_node(struct uwsgi_subscriptions *ht, struct uwsgi_subscribe_node *node) {
 
 	struct uwsgi_subscribe_node *a_node;
 	struct uwsgi_subscribe_slot *node_slot = node->slot;
-	struct uwsgi_subscribe_slot *prev_slot = node_slot->prev;
-	struct uwsgi_subscribe_slot *next_slot = node_slot->next;
-
-	int hash_key = node_slot->hash;
 
 	// over-engineering to avoid race conditions
 	node->len = 0;
@@ -293,56 +514,44 @@ int uwsgi_remove_subscribe_node(struct uwsgi_subscribe_slot **slot, struct uwsgi
 	}
 
 	free(node);
-	// no more nodes, remove the slot too
-	if (node_slot->nodes == NULL) {
-
-		ret = 1;
-
-		// first check if i am the only node
-		if ((!prev_slot && !next_slot) || next_slot == node_slot) {
-#ifdef UWSGI_SSL
-			if (uwsgi.subscriptions_sign_check_dir) {
-				EVP_PKEY_free(node_slot->sign_public_key);
-				EVP_MD_CTX_destroy(node_slot->sign_ctx);
-			}
-#endif
-			free(node_slot);
-			slot[hash_key] = NULL;
-			goto end;
-		}
+	node_slot->dirty = 1;
+	ht->generation++;
 
-		// if i am the main entry point, set the next value
-		if (node_slot == slot[hash_key]) {
-			slot[hash_key] = next_slot;
-		}
+	if (node_slot->nodes)
+		return 0;
 
-		if (prev_slot) {
-			prev_slot->next = next_slot;
-		}
-		if (next_slot) {
-			next_slot->prev = prev_slot;
-		}
+	// no more nodes, remove the slot too
+	if (node_slot->prev) {
+		node_slot->prev->next = node_slot->next;
+	}
+	else {
+		ht->buckets[node_slot->hash & (ht->size - 1)] = node_slot->next;
+	}
+	if (node_slot->next) {
+		node_slot->next->prev = node_slot->prev;
+	}
+	ht->count--;
 
 #ifdef UWSGI_SSL
-		if (uwsgi.subscriptions_sign_check_dir) {
-			EVP_PKEY_free(node_slot->sign_public_key);
-			EVP_MD_CTX_destroy(node_slot->sign_ctx);
-		}
-#endif
-		free(node_slot);
+	if (uwsgi.subscriptions_sign_check_dir) {
+		EVP_PKEY_free(node_slot->sign_public_key);
+		EVP_MD_CTX_destroy(node_slot->sign_ctx);
 	}
+#endif
+	free(node_slot->index);
+	free(node_slot->ring);
+	free(node_slot->key);
+	free(node_slot);
 
-end:
-
-	return ret;
+	return 1;
 }
 
-struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscribe_slot **slot, struct uwsgi_subscribe_req *usr) {
+struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscriptions *ht, struct uwsgi_subscribe_req *usr) {
 
-	struct uwsgi_subscribe_slot *current_slot = uwsgi_get_subscribe_slot(slot, usr->key, usr->keylen), *old_slot = NULL, *a_slot;
+	struct uwsgi_subscribe_slot *current_slot = uwsgi_get_subscribe_slot(ht, usr->key, usr->keylen);
 	struct uwsgi_subscribe_node *node, *old_node = NULL;
 
-	if (usr->address_len > 0xff || usr->address_len == 0)
+	if (usr->address_len > 0xff || usr->address_len == 0 || usr->keylen == 0)
 		return NULL;
 
 #ifdef UWSGI_SSL
@@ -373,10 +582,14 @@ struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscribe_slo
 				node->last_check = uwsgi_now();
 				node->cores = usr->cores;
 				node->load = usr->load;
-				node->weight = usr->weight;
-				if (!node->weight)
-					node->weight = 1;
+				if (!usr->weight)
+					usr->weight = 1;
+				if (node->weight != usr->weight) {
+					node->weight = usr->weight;
+					current_slot->dirty = 1;
+				}
 				node->last_requests = 0;
+				uwsgi_subscription_slot_algo(current_slot, usr);
 				return node;
 			}
 			old_node = node;
@@ -407,6 +620,12 @@ struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscribe_slo
 		if (!node->weight)
 			node->weight = 1;
 		node->wrr = 0;
+		node->ewma = 0;
+		node->ewma_last = 0;
+		node->ejected = 0;
+		node->consecutive_errors = 0;
+		node->readmitted = 0;
+		node->slow_start = 0;
 		node->last_check = uwsgi_now();
 		node->slot = current_slot;
 		memcpy(node->name, usr->address, usr->address_len);
@@ -414,7 +633,11 @@ struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscribe_slo
 			old_node->next = node;
 		}
 		node->next = NULL;
-		uwsgi_log("[uwsgi-subscription for pid %d] %.*s => new node: %.*s\n", (int) uwsgi.mypid, usr->keylen, usr->key, usr->address_len, usr->address);
+		current_slot->dirty = 1;
+		ht->generation++;
+		uwsgi_subscription_slot_algo(current_slot, usr);
+		if (uwsgi_subscriptions_verbose)
+			uwsgi_log("[uwsgi-subscription for pid %d] %.*s => new node: %.*s\n", (int) uwsgi.mypid, usr->keylen, usr->key, usr->address_len, usr->address);
 		return node;
 	}
 	else {
@@ -434,9 +657,7 @@ struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscribe_slo
 		}
 #endif
 		current_slot = uwsgi_malloc(sizeof(struct uwsgi_subscribe_slot));
-		uint32_t hash = djb33x_hash(usr->key, usr->keylen);
-		int hash_key = hash % 0xffff;
-		current_slot->hash = hash_key;
+		current_slot->hash = murmur3_hash(usr->key, usr->keylen, ht->seed);
 #ifdef UWSGI_SSL
 		if (uwsgi.subscriptions_sign_check_dir) {
 			current_slot->sign_public_key = PEM_read_PUBKEY(kf, NULL, NULL, NULL);
@@ -463,9 +684,16 @@ struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscribe_slo
 		}
 #endif
 		current_slot->keylen = usr->keylen;
-		memcpy(current_slot->key, usr->key, usr->keylen);
-		current_slot->key[usr->keylen] = 0;
+		current_slot->key = uwsgi_concat2n(usr->key, usr->keylen, "", 0);
 		current_slot->hits = 0;
+		current_slot->algo = NULL;
+		current_slot->last_sweep = 0;
+		current_slot->dirty = 1;
+		current_slot->index = NULL;
+		current_slot->index_len = 0;
+		current_slot->ring = NULL;
+		current_slot->ring_len = 0;
+		uwsgi_subscription_slot_algo(current_slot, usr);
 
 		current_slot->nodes = uwsgi_malloc(sizeof(struct uwsgi_subscribe_node));
 		current_slot->nodes->slot = current_slot;
@@ -485,39 +713,42 @@ struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscribe_slo
 		if (!current_slot->nodes->weight)
 			current_slot->nodes->weight = 1;
 		current_slot->nodes->wrr = 0;
+		current_slot->nodes->ewma = 0;
+		current_slot->nodes->ewma_last = 0;
+		current_slot->nodes->ejected = 0;
+		current_slot->nodes->consecutive_errors = 0;
+		current_slot->nodes->readmitted = 0;
+		current_slot->nodes->slow_start = 0;
 		memcpy(current_slot->nodes->name, usr->address, usr->address_len);
 		current_slot->nodes->last_check = uwsgi_now();
 
 		current_slot->nodes->next = NULL;
 
-		a_slot = slot[hash_key];
-		while (a_slot) {
-			old_slot = a_slot;
-			a_slot = a_slot->next;
+		// keep the load factor under 1
+		if (ht->count >= ht->size) {
+			uwsgi_subscriptions_resize(ht, ht->size * 2);
 		}
 
-
-		if (old_slot) {
-			old_slot->next = current_slot;
-		}
-
-		current_slot->prev = old_slot;
-		current_slot->next = NULL;
-
-
-		if (!slot[hash_key] || current_slot->prev == NULL) {
-			slot[hash_key] = current_slot;
+		uint64_t pos = current_slot->hash & (ht->size - 1);
+		current_slot->prev = NULL;
+		current_slot->next = ht->buckets[pos];
+		if (ht->buckets[pos])
+			ht->buckets[pos]->prev = current_slot;
+		ht->buckets[pos] = current_slot;
+		ht->count++;
+		ht->generation++;
+
+		if (uwsgi_subscriptions_verbose) {
+			uwsgi_log("[uwsgi-subscription for pid %d] new pool: %.*s (hash key: %u)\n", (int) uwsgi.mypid, usr->keylen, usr->key, current_slot->hash);
+			uwsgi_log("[uwsgi-subscription for pid %d] %.*s => new node: %.*s\n", (int) uwsgi.mypid, usr->keylen, usr->key, usr->address_len, usr->address);
 		}
-
-		uwsgi_log("[uwsgi-subscription for pid %d] new pool: %.*s (hash key: %d)\n", (int) uwsgi.mypid, usr->keylen, usr->key, current_slot->hash);
-		uwsgi_log("[uwsgi-subscription for pid %d] %.*s => new node: %.*s\n", (int) uwsgi.mypid, usr->keylen, usr->key, usr->address_len, usr->address);
 		return current_slot->nodes;
 	}
 
 }
 
 
-void uwsgi_send_subscription(char *udp_address, char *key, size_t keysize, uint8_t modifier1, uint8_t modifier2, uint8_t cmd, char *socket_name, char *sign) {
+void uwsgi_send_subscription(char *udp_address, char *key, size_t keysize, uint8_t modifier1, uint8_t modifier2, uint8_t cmd, char *socket_name, char *sign, char *algo) {
 
 	if (socket_name == NULL && !uwsgi.sockets)
 		return;
@@ -544,6 +775,10 @@ void uwsgi_send_subscription(char *udp_address, char *key, size_t keysize, uint8
 		if (uwsgi_buffer_append_keynum(ub, "weight", 6, uwsgi.weight )) goto end;
 	}
 
+	if (algo) {
+		if (uwsgi_buffer_append_keyval(ub, "algo", 4, algo, strlen(algo))) goto end;
+	}
+
 #ifdef UWSGI_SSL
 	if (sign) {
 		if (uwsgi_buffer_append_keynum(ub, "unix", 4, (uwsgi_now() + (time_t) cmd) )) goto end;
@@ -592,20 +827,221 @@ int uwsgi_subscription_sign_check(struct uwsgi_subscribe_slot *slot, struct uwsg
 }
 #endif
 
-int uwsgi_no_subscriptions(struct uwsgi_subscribe_slot **slot) {
-	int i;
-	for (i = 0; i < UMAX16; i++) {
-		if (slot[i])
-			return 0;
-	}
-	return 1;
+int uwsgi_no_subscriptions(struct uwsgi_subscriptions *ht) {
+	return ht->count == 0;
 }
 
-struct uwsgi_subscribe_slot **uwsgi_subscription_init_ht() {
+struct uwsgi_subscriptions *uwsgi_subscription_init_ht() {
 	if (!uwsgi.subscription_algo) {
 		uwsgi_subscription_set_algo(NULL);
 	}
-	return uwsgi_calloc(sizeof(struct uwsgi_subscription_slot *) * UMAX16);
+	struct uwsgi_subscriptions *ht = uwsgi_calloc(sizeof(struct uwsgi_subscriptions));
+	ht->size = 1024;
+	ht->buckets = uwsgi_calloc(sizeof(struct uwsgi_subscribe_slot *) * ht->size);
+	// a random seed avoids crafted keys colliding in the same bucket
+	ht->seed = (uint32_t) uwsgi_micros() ^ ((uint32_t) getpid() << 16);
+	return ht;
+}
+
+// iterate over all of the slots (pass NULL to get the first one)
+struct uwsgi_subscribe_slot *uwsgi_subscriptions_next(struct uwsgi_subscriptions *ht, struct uwsgi_subscribe_slot *current_slot) {
+	uint64_t i = 0;
+	if (current_slot) {
+		if (current_slot->next)
+			return current_slot->next;
+		i = (current_slot->hash & (ht->size - 1)) + 1;
+	}
+	for (; i < ht->size; i++) {
+		if (ht->buckets[i])
+			return ht->buckets[i];
+	}
+	return NULL;
+}
+
+/*
+	subscriptions are dumped as a stream of uwsgi subscription packets (modifier1 224)
+	the file is written atomically (tmp file + rename)
+*/
+int uwsgi_subscriptions_dump(struct uwsgi_subscriptions *ht, char *filename) {
+	int ret = -1;
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
+	struct uwsgi_buffer *packet = uwsgi_buffer_new(uwsgi.page_size);
+	char *tmp_filename = uwsgi_concat2(filename, ".tmp");
+	int fd = -1;
+
+	struct uwsgi_subscribe_slot *current_slot = uwsgi_subscriptions_next(ht, NULL);
+	while (current_slot) {
+		char *algo = NULL;
+		struct uwsgi_subscription_algo *usa = uwsgi_subscription_algos;
+		while (usa->name) {
+			if (usa->func == current_slot->algo) {
+				algo = usa->name;
+				break;
+			}
+			usa++;
+		}
+		struct uwsgi_subscribe_node *node = current_slot->nodes;
+		while (node) {
+			if (uwsgi_subscription_node_down(node) || !node->len)
+				goto next;
+			packet->pos = 4;
+			if (uwsgi_buffer_append_keyval(packet, "key", 3, current_slot->key, current_slot->keylen)) goto end;
+			if (uwsgi_buffer_append_keyval(packet, "address", 7, node->name, node->len)) goto end;
+			if (uwsgi_buffer_append_keynum(packet, "modifier1", 9, node->modifier1)) goto end;
+			if (uwsgi_buffer_append_keynum(packet, "modifier2", 9, node->modifier2)) goto end;
+			if (uwsgi_buffer_append_keynum(packet, "cores", 5, node->cores)) goto end;
+			if (uwsgi_buffer_append_keynum(packet, "load", 4, node->load)) goto end;
+			if (uwsgi_buffer_append_keynum(packet, "weight", 6, node->weight)) goto end;
+			if (algo) {
+				if (uwsgi_buffer_append_keyval(packet, "algo", 4, algo, strlen(algo))) goto end;
+			}
+			if (uwsgi_buffer_set_uh(packet, 224, 0)) goto end;
+			if (uwsgi_buffer_append(ub, packet->buf, packet->pos)) goto end;
+next:
+			node = node->next;
+		}
+		current_slot = uwsgi_subscriptions_next(ht, current_slot);
+	}
+
+	fd = open(tmp_filename, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0) {
+		uwsgi_error_open(tmp_filename);
+		goto end;
+	}
+
+	size_t written = 0;
+	while (written < ub->pos) {
+		ssize_t wlen = write(fd, ub->buf + written, ub->pos - written);
+		if (wlen <= 0) {
+			uwsgi_error("uwsgi_subscriptions_dump()/write()");
+			goto end;
+		}
+		written += wlen;
+	}
+
+	if (rename(tmp_filename, filename)) {
+		uwsgi_error("uwsgi_subscriptions_dump()/rename()");
+		goto end;
+	}
+	ret = 0;
+end:
+	if (fd >= 0) {
+		close(fd);
+		if (ret)
+			unlink(tmp_filename);
+	}
+	free(tmp_filename);
+	uwsgi_buffer_destroy(packet);
+	uwsgi_buffer_destroy(ub);
+	return ret;
+}
+
+static void uwsgi_subscriptions_load_item(char *key, uint16_t keylen, char *val, uint16_t vallen, void *data) {
+	struct uwsgi_subscribe_req *usr = (struct uwsgi_subscribe_req *) data;
+	if (!uwsgi_strncmp("key", 3, key, keylen)) {
+		usr->key = val;
+		usr->keylen = vallen;
+	}
+	else if (!uwsgi_strncmp("address", 7, key, keylen)) {
+		usr->address = val;
+		usr->address_len = vallen;
+	}
+	else if (!uwsgi_strncmp("modifier1", 9, key, keylen)) {
+		usr->modifier1 = uwsgi_str_num(val, vallen);
+	}
+	else if (!uwsgi_strncmp("modifier2", 9, key, keylen)) {
+		usr->modifier2 = uwsgi_str_num(val, vallen);
+	}
+	else if (!uwsgi_strncmp("cores", 5, key, keylen)) {
+		usr->cores = uwsgi_str_num(val, vallen);
+	}
+	else if (!uwsgi_strncmp("load", 4, key, keylen)) {
+		usr->load = uwsgi_str_num(val, vallen);
+	}
+	else if (!uwsgi_strncmp("weight", 6, key, keylen)) {
+		usr->weight = uwsgi_str_num(val, vallen);
+	}
+	else if (!uwsgi_strncmp("algo", 4, key, keylen)) {
+		usr->algo = val;
+		usr->algo_len = vallen;
+	}
+}
+
+// load a subscriptions dump, returns the number of nodes added (or -1 on error)
+int uwsgi_subscriptions_load(struct uwsgi_subscriptions *ht, char *filename) {
+
+#ifdef UWSGI_SSL
+	// signatures cannot be replayed
+	if (uwsgi.subscriptions_sign_check_dir) {
+		uwsgi_log("[uwsgi-subscription for pid %d] unable to load %s: signed subscriptions are enabled\n", (int) uwsgi.mypid, filename);
+		return -1;
+	}
+#endif
+
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return 0;
+		uwsgi_error_open(filename);
+		return -1;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st)) {
+		uwsgi_error("uwsgi_subscriptions_load()/fstat()");
+		close(fd);
+		return -1;
+	}
+
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+	char *buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED) {
+		uwsgi_error("uwsgi_subscriptions_load()/mmap()");
+		return -1;
+	}
+
+	// count the packets to size the table in one shot
+	uint64_t items = 0;
+	size_t pos = 0;
+	while (pos + 4 <= (size_t) st.st_size) {
+		uint16_t pktsize = (uint8_t) buf[pos + 1] | ((uint8_t) buf[pos + 2] << 8);
+		pos += 4 + pktsize;
+		items++;
+	}
+
+	uint64_t size = ht->size;
+	while (size < ht->count + items)
+		size *= 2;
+	uwsgi_subscriptions_resize(ht, size);
+
+	int loaded = 0;
+	uwsgi_subscriptions_verbose = 0;
+	pos = 0;
+	while (pos + 4 <= (size_t) st.st_size) {
+		uint16_t pktsize = (uint8_t) buf[pos + 1] | ((uint8_t) buf[pos + 2] << 8);
+		if (buf[pos] != (char) 224 || pos + 4 + pktsize > (size_t) st.st_size) {
+			uwsgi_log("[uwsgi-subscription for pid %d] invalid subscriptions dump %s at offset %llu\n", (int) uwsgi.mypid, filename, (unsigned long long) pos);
+			break;
+		}
+		struct uwsgi_subscribe_req usr;
+		memset(&usr, 0, sizeof(struct uwsgi_subscribe_req));
+		if (!uwsgi_hooked_parse(buf + pos + 4, pktsize, uwsgi_subscriptions_load_item, &usr)) {
+			if (usr.keylen > 0 && uwsgi_add_subscribe_node(ht, &usr)) {
+				loaded++;
+			}
+		}
+		pos += 4 + pktsize;
+	}
+	uwsgi_subscriptions_verbose = 1;
+
+	munmap(buf, st.st_size);
+	uwsgi_log("[uwsgi-subscription for pid %d] loaded %d nodes (%llu pools) from %s\n", (int) uwsgi.mypid, loaded, (unsigned long long) ht->count, filename);
+	return loaded;
 }
 
 void uwsgi_subscribe(char *subscription, uint8_t cmd) {
@@ -679,7 +1115,7 @@ void uwsgi_subscribe(char *subscription, uint8_t cmd) {
                                                                 modifier1_len = strlen(modifier1);
                                                                 keysize = strlen(key);
                                                         }
-                                                        uwsgi_send_subscription(udp_address, key, keysize, uwsgi_str_num(modifier1, modifier1_len), 0, cmd, socket_name, sign);
+                                                        uwsgi_send_subscription(udp_address, key, keysize, uwsgi_str_num(modifier1, modifier1_len), 0, cmd, socket_name, sign, NULL);
                                                         modifier1 = NULL;
                                                         modifier1_len = 0;
                                                 }
@@ -697,7 +1133,7 @@ void uwsgi_subscribe(char *subscription, uint8_t cmd) {
                                                                 modifier1_len = strlen(modifier1);
                                                                 keysize = strlen(key);
                                                         }
-                                                        uwsgi_send_subscription(udp_address, key, keysize, uwsgi_str_num(modifier1, modifier1_len), 0, cmd, socket_name, sign);
+                                                        uwsgi_send_subscription(udp_address, key, keysize, uwsgi_str_num(modifier1, modifier1_len), 0, cmd, socket_name, sign, NULL);
                                                         modifier1 = NULL;
                                                         modifier1_len = 0;
                                                         lines[i] = '\n';
@@ -727,7 +1163,7 @@ void uwsgi_subscribe(char *subscription, uint8_t cmd) {
                         modifier1_len = strlen(modifier1);
                 }
 
-                uwsgi_send_subscription(udp_address, subscription_key + 1, strlen(subscription_key + 1), uwsgi_str_num(modifier1, modifier1_len), 0, cmd, socket_name, sign);
+                uwsgi_send_subscription(udp_address, subscription_key + 1, strlen(subscription_key + 1), uwsgi_str_num(modifier1, modifier1_len), 0, cmd, socket_name, sign, NULL);
                 if (modifier1)
                         modifier1[-1] = ',';
                 if (sign)
@@ -752,6 +1188,7 @@ void uwsgi_subscribe2(char *arg, uint8_t cmd) {
 	char *s2_modifier1 = NULL;
 	char *s2_modifier2 = NULL;
 	char *s2_check = NULL;
+	char *s2_algo = NULL;
 
 	if (uwsgi_kvlist_parse(arg, strlen(arg), ',', '=',
                         "server", &s2_server,
@@ -763,6 +1200,7 @@ void uwsgi_subscribe2(char *arg, uint8_t cmd) {
                         "modifier2", &s2_modifier2,
                         "sign", &s2_sign,
                         "check", &s2_check,
+                        "algo", &s2_algo,
 		NULL)) {
 		return;
 	}
@@ -798,7 +1236,7 @@ void uwsgi_subscribe2(char *arg, uint8_t cmd) {
 		modifier2 = atoi(s2_modifier2);
 	}
 
-	uwsgi_send_subscription(s2_server, s2_key, strlen(s2_key), modifier1, modifier2, cmd, s2_addr, s2_sign);
+	uwsgi_send_subscription(s2_server, s2_key, strlen(s2_key), modifier1, modifier2, cmd, s2_addr, s2_sign, s2_algo);
 end:
 	if (s2_server) free(s2_server);
 	if (s2_key) free(s2_key);
@@ -809,6 +1247,7 @@ end:
 	if (s2_modifier2) free(s2_modifier2);
 	if (s2_sign) free(s2_sign);
 	if (s2_check) free(s2_check);
+	if (s2_algo) free(s2_algo);
 }
 
 void uwsgi_subscribe_all(uint8_t cmd, int verbose) {
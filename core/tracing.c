@@ -0,0 +1,139 @@
+#include "uwsgi.h"
+
+extern struct uwsgi_server uwsgi;
+
+/*
+	per-request tracing spans (--trace-spans)
+
+	the time spent by each request in the phases of the pipeline (accept, read, vars parsing, routing,
+	app, transformations, write and offload hand-over) is accumulated in wsgi_req->spans.
+
+	The clock is the monotonic one (served by the vDSO on Linux, so no syscalls are involved): the
+	coarse variant has a resolution of some milliseconds (too big for phases lasting microseconds) and
+	the TSC would require calibration and would break on cores with unsynchronized counters.
+
+	The spans are exposed as logvars (%(span_read), %(span_app)... in microseconds), accounted in
+	the span.<phase> histograms (when the metrics subsystem is enabled) and exported, for one request
+	every --trace-spans-sample, as a json trace record. The record is sent to --trace-spans-socket (udp)
+	or, when no socket is configured, written in the logs (prefixed by [uwsgi-trace], so it can be
+	routed with --log-route).
+*/
+
+char *uwsgi_span_names[] = {
+	"accept",
+	"read",
+	"vars",
+	"routing",
+	"app",
+	"transform",
+	"write",
+	"offload",
+};
+
+static struct sockaddr_in uwsgi_trace_spans_addr;
+static socklen_t uwsgi_trace_spans_addr_len;
+static uint64_t uwsgi_trace_spans_counter;
+
+uint64_t uwsgi_span_now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+// called by uwsgi_setup_metrics() before the histograms are allocated
+void uwsgi_spans_register_histograms() {
+	char buf[64];
+	int i;
+	if (!uwsgi.trace_spans) return;
+	for(i=0;i<UWSGI_SPAN_MAX;i++) {
+		snprintf(buf, 64, "span.%s", uwsgi_span_names[i]);
+		uwsgi.histogram_spans[i] = uwsgi_histogram_register(buf);
+	}
+}
+
+void uwsgi_spans_init() {
+	uwsgi.trace_spans_fd = -1;
+	if (uwsgi.trace_spans_sample || uwsgi.trace_spans_socket) uwsgi.trace_spans = 1;
+	if (!uwsgi.trace_spans) return;
+
+	if (!uwsgi.trace_spans_sample) uwsgi.trace_spans_sample = 100;
+
+	if (!uwsgi.trace_spans_socket) return;
+
+	char *port = strchr(uwsgi.trace_spans_socket, ':');
+	if (!port) {
+		uwsgi_log("invalid udp address for --trace-spans-socket: %s\n", uwsgi.trace_spans_socket);
+		exit(1);
+	}
+	uwsgi_trace_spans_addr_len = socket_to_in_addr(uwsgi.trace_spans_socket, port, 0, &uwsgi_trace_spans_addr);
+
+	uwsgi.trace_spans_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (uwsgi.trace_spans_fd < 0) {
+		uwsgi_error("uwsgi_spans_init()/socket()");
+		exit(1);
+	}
+	uwsgi_socket_nb(uwsgi.trace_spans_fd);
+	uwsgi_log("tracing spans of 1 request every %llu to udp://%s\n", (unsigned long long) uwsgi.trace_spans_sample, uwsgi.trace_spans_socket);
+}
+
+static struct uwsgi_buffer *uwsgi_spans_record(struct wsgi_request *wsgi_req) {
+	int i;
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
+	if (uwsgi_buffer_append(ub, "{\"worker\":", 10)) goto error;
+	if (uwsgi_buffer_num64(ub, uwsgi.mywid)) goto error;
+	if (uwsgi_buffer_append(ub, ",\"core\":", 8)) goto error;
+	if (uwsgi_buffer_num64(ub, wsgi_req->async_id)) goto error;
+	if (uwsgi_buffer_append(ub, ",\"start\":", 9)) goto error;
+	if (uwsgi_buffer_num64(ub, wsgi_req->start_of_request)) goto error;
+	if (uwsgi_buffer_append(ub, ",\"method\":\"", 11)) goto error;
+	if (uwsgi_buffer_append_json(ub, wsgi_req->method, wsgi_req->method_len)) goto error;
+	if (uwsgi_buffer_append(ub, "\",\"uri\":\"", 9)) goto error;
+	if (uwsgi_buffer_append_json(ub, wsgi_req->uri, wsgi_req->uri_len)) goto error;
+	if (uwsgi_buffer_append(ub, "\",\"status\":", 11)) goto error;
+	if (uwsgi_buffer_num64(ub, wsgi_req->status)) goto error;
+	if (uwsgi_buffer_append(ub, ",\"total\":", 9)) goto error;
+	if (uwsgi_buffer_num64(ub, wsgi_req->end_of_request - wsgi_req->start_of_request)) goto error;
+	for(i=0;i<UWSGI_SPAN_MAX;i++) {
+		if (uwsgi_buffer_append(ub, ",\"", 2)) goto error;
+		if (uwsgi_buffer_append(ub, uwsgi_span_names[i], strlen(uwsgi_span_names[i]))) goto error;
+		if (uwsgi_buffer_append(ub, "\":", 2)) goto error;
+		if (uwsgi_buffer_num64(ub, wsgi_req->spans[i] / 1000)) goto error;
+	}
+	if (uwsgi_buffer_append(ub, "}", 1)) goto error;
+	return ub;
+error:
+	uwsgi_buffer_destroy(ub);
+	return NULL;
+}
+
+// called by uwsgi_close_request() (values are in microseconds, like the other latency histograms)
+void uwsgi_spans_account(struct wsgi_request *wsgi_req) {
+	int i;
+
+	if (!uwsgi.trace_spans) return;
+
+	if (uwsgi.histogram_slots) {
+		for(i=0;i<UWSGI_SPAN_MAX;i++) {
+			uwsgi_histogram_add(uwsgi.histogram_spans[i], wsgi_req, wsgi_req->spans[i] / 1000);
+		}
+	}
+
+	// the counter is shared by the threads of the worker
+	if (__sync_add_and_fetch(&uwsgi_trace_spans_counter, 1) % uwsgi.trace_spans_sample) return;
+
+	struct uwsgi_buffer *ub = uwsgi_spans_record(wsgi_req);
+	if (!ub) return;
+
+	if (uwsgi.trace_spans_fd > -1) {
+		// the record is lost if the socket buffer is full
+		if (sendto(uwsgi.trace_spans_fd, ub->buf, ub->pos, 0, (struct sockaddr *) &uwsgi_trace_spans_addr, uwsgi_trace_spans_addr_len) < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				uwsgi_error("uwsgi_spans_account()/sendto()");
+			}
+		}
+	}
+	else {
+		uwsgi_log("[uwsgi-trace] %.*s\n", (int) ub->pos, ub->buf);
+	}
+	uwsgi_buffer_destroy(ub);
+}
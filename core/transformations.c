@@ -12,43 +12,78 @@
 
 	Transformations (if required) could completely swallow already set headers
 
+	A streaming transformation can hold the chunk (returning 1 from its func): the chain is stopped
+	and nothing is sent to the client until a following chunk (or the final chain) goes on.
+
+	The chunk is copied only once (when it enters the chain) in wsgi_req->transformation_chunk,
+	then the buffer itself is moved from a transformation to the next one (ut->chunk is valid only during
+	the func call). A buffering transformation takes ownership of the first chunk and appends the following ones.
+
 */
 
 extern struct uwsgi_server uwsgi;
 
+// move the chunk to the transformation, run it and get the (new) chunk back
+static int uwsgi_transformation_run(struct wsgi_request *wsgi_req, struct uwsgi_transformation *ut) {
+	ut->chunk = wsgi_req->transformation_chunk;
+	wsgi_req->transformation_chunk = NULL;
+	ut->bytes_in += ut->chunk->pos;
+	ut->round++;
+	uint64_t start = uwsgi_micros();
+	// on error the chunk is left in the transformation and freed with the chain
+	int ret = ut->func(wsgi_req, ut);
+	ut->usecs += uwsgi_micros() - start;
+	if (ret < 0) return -1;
+	ut->bytes_out += ut->chunk->pos;
+	wsgi_req->transformation_chunk = ut->chunk;
+	ut->chunk = NULL;
+	return ret;
+}
+
 // -1 error, 0 = no buffer, send the body, 1 = buffer
 int uwsgi_apply_transformations(struct wsgi_request *wsgi_req, char *buf, size_t len) {
 	wsgi_req->transformed_chunk = NULL;
 	wsgi_req->transformed_chunk_len = 0;
 	struct uwsgi_transformation *ut = wsgi_req->transformations;
-	char *t_buf = buf;
-	size_t t_len = len;
 	uint8_t flushed = 0;
+
+	// the memory of the previous chunk is reused
+	if (!wsgi_req->transformation_chunk) {
+		wsgi_req->transformation_chunk = uwsgi_buffer_new(len);
+	}
+	wsgi_req->transformation_chunk->pos = 0;
+	if (uwsgi_buffer_append(wsgi_req->transformation_chunk, buf, len)) {
+		return -1;
+	}
+
 	while(ut) {
-		// allocate the buffer (if needed)
-		if (!ut->chunk) {
-			ut->chunk = uwsgi_buffer_new(t_len);
-		}
-		// skip final transformations before appending data
+		// skip final transformations
 		if (ut->is_final) goto next;
-		if (uwsgi_buffer_append(ut->chunk, t_buf, t_len)) {
-			return -1;
-		}
 
 		// if the transformation cannot stream, continue buffering (the func will be called at the end)
-		if (!ut->can_stream) return 1;
-		
-		ut->round++;
-		if (ut->func(wsgi_req, ut)) {
+		if (!ut->can_stream) {
+			struct uwsgi_buffer *ub = wsgi_req->transformation_chunk;
+			if (!ut->chunk) {
+				ut->chunk = ub;
+				wsgi_req->transformation_chunk = NULL;
+				return 1;
+			}
+			if (uwsgi_buffer_append(ut->chunk, ub->buf, ub->pos)) {
+				return -1;
+			}
+			return 1;
+		}
+
+		int ret = uwsgi_transformation_run(wsgi_req, ut);
+		if (ret < 0) {
 			return -1;
 		}
+		// the transformation is holding the chunk
+		if (ret > 0) {
+			return 1;
+		}
 
 		if (ut->flushed) flushed = 1;
-
-		t_buf = ut->chunk->buf;
-		t_len = ut->chunk->pos;
-		// we reset the buffer, so we do not waste memory
-		ut->chunk->pos = 0;
 next:
 		ut = ut->next;
 	}
@@ -56,8 +91,8 @@ next:
 	// if we are here we can tell the writer to send the body to the client
 	// no buffering please
 	if (!flushed) {
-		wsgi_req->transformed_chunk = t_buf;
-		wsgi_req->transformed_chunk_len = t_len;
+		wsgi_req->transformed_chunk = wsgi_req->transformation_chunk->buf;
+		wsgi_req->transformed_chunk_len = wsgi_req->transformation_chunk->pos;
 	}
 	return 0;
 
@@ -72,65 +107,94 @@ int uwsgi_apply_final_transformations(struct wsgi_request *wsgi_req) {
 	struct uwsgi_transformation *ut = wsgi_req->transformations;
 	wsgi_req->transformed_chunk = NULL;
         wsgi_req->transformed_chunk_len = 0;
-	char *t_buf = NULL;
-	size_t t_len = 0;
 	uint8_t flushed = 0;
 	int found_nostream = 0;
 	while(ut) {
 		if (!found_nostream) {
-			if (!ut->can_stream) {
-				found_nostream = 1;
-			}
-			else {
+			if (ut->can_stream) {
 				// stop the chain if no chunk is available
-				if (!ut->chunk) return 0;
-				t_buf = ut->chunk->buf;
-                		t_len = ut->chunk->pos;
+				if (!ut->round) return 0;
 				goto next;
 			}
-		}
-
-		if (!ut->chunk) {
-			if (t_len > 0) {
-				ut->chunk = uwsgi_buffer_new(t_len);
+			found_nostream = 1;
+			// the streamed chunks have been already sent
+			if (wsgi_req->transformation_chunk) {
+				wsgi_req->transformation_chunk->pos = 0;
 			}
 			else {
-				ut->chunk = uwsgi_buffer_new(uwsgi.page_size);
+				wsgi_req->transformation_chunk = uwsgi_buffer_new(uwsgi.page_size);
 			}
 		}
-		
-		if (t_len > 0) {
-			if (uwsgi_buffer_append(ut->chunk, t_buf, t_len)) {
-				return -1;
-                	}
+
+		// the buffered body becomes the chunk
+		if (ut->chunk) {
+			struct uwsgi_buffer *ub = wsgi_req->transformation_chunk;
+			if (ub->pos > 0) {
+				if (uwsgi_buffer_append(ut->chunk, ub->buf, ub->pos)) {
+					return -1;
+				}
+			}
+			uwsgi_buffer_destroy(ub);
+			wsgi_req->transformation_chunk = ut->chunk;
+			ut->chunk = NULL;
 		}
-		
+
 		// run the transformation
-		ut->round++;
-		if (ut->func(wsgi_req, ut)) {
+		if (uwsgi_transformation_run(wsgi_req, ut) < 0) {
 			return -1;
                 }
 
 		if (ut->flushed) flushed = 1;
-
-		t_buf = ut->chunk->buf;
-		t_len = ut->chunk->pos;
 next:
 		ut = ut->next;
 	}
 
 	// if we are here, all of the transformations are applied
-	if (!flushed) {
-		wsgi_req->transformed_chunk = t_buf;
-        	wsgi_req->transformed_chunk_len = t_len;
+	if (!flushed && found_nostream) {
+		wsgi_req->transformed_chunk = wsgi_req->transformation_chunk->buf;
+        	wsgi_req->transformed_chunk_len = wsgi_req->transformation_chunk->pos;
 	}
         return 0;
 }
 
+// report the cost of every transformation of the chain
+static void uwsgi_log_transformations(struct wsgi_request *wsgi_req) {
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
+	if (uwsgi_buffer_append(ub, "[transformations] ", 18)) goto end;
+	if (uwsgi_buffer_append(ub, wsgi_req->method, wsgi_req->method_len)) goto end;
+	if (uwsgi_buffer_append(ub, " ", 1)) goto end;
+	if (uwsgi_buffer_append(ub, wsgi_req->uri, wsgi_req->uri_len)) goto end;
+	struct uwsgi_transformation *ut = wsgi_req->transformations;
+	while(ut) {
+		if (ut->round) {
+			char buf[256];
+			int ret = snprintf(buf, 256, " => %s%s %llu/%llu bytes in %llu usecs", ut->name ? ut->name : "?", ut->is_final ? " (final)" : "",
+				(unsigned long long) ut->bytes_in, (unsigned long long) ut->bytes_out, (unsigned long long) ut->usecs);
+			if (ret <= 0 || ret >= 256) goto end;
+			if (uwsgi_buffer_append(ub, buf, ret)) goto end;
+		}
+		ut = ut->next;
+	}
+	if (uwsgi_buffer_append(ub, "\n\0", 2)) goto end;
+	uwsgi_log("%s", ub->buf);
+end:
+	uwsgi_buffer_destroy(ub);
+}
+
 void uwsgi_free_transformations(struct wsgi_request *wsgi_req) {
+	if (uwsgi.log_transformations) {
+		uwsgi_log_transformations(wsgi_req);
+	}
+	if (wsgi_req->transformation_chunk) {
+		uwsgi_buffer_destroy(wsgi_req->transformation_chunk);
+		wsgi_req->transformation_chunk = NULL;
+	}
 	struct uwsgi_transformation *ut = wsgi_req->transformations;
 	while(ut) {
 		struct uwsgi_transformation *current_ut = ut;
+		if (current_ut->free) {
+			current_ut->free(current_ut);
+		}
 		if (current_ut->chunk) {
 			uwsgi_buffer_destroy(current_ut->chunk);
 		}
@@ -1002,7 +1002,10 @@ void uwsgi_close_request(struct wsgi_request *wsgi_req) {
 
 	// apply transformations
 	if (wsgi_req->transformations) {
-		if (uwsgi_apply_final_transformations(wsgi_req) == 0) {
+		uint64_t span = uwsgi_span_begin();
+		int t_ret = uwsgi_apply_final_transformations(wsgi_req);
+		uwsgi_span_end(wsgi_req, UWSGI_SPAN_TRANSFORM, span);
+		if (t_ret == 0) {
 			if (wsgi_req->transformed_chunk && wsgi_req->transformed_chunk_len > 0) {
 				uwsgi_response_write_body_do(wsgi_req, wsgi_req->transformed_chunk, wsgi_req->transformed_chunk_len);
 			}
@@ -1040,6 +1043,8 @@ void uwsgi_close_request(struct wsgi_request *wsgi_req) {
 		uwsgi.workers[uwsgi.mywid].cores[wsgi_req->async_id].write_errors += wsgi_req->write_errors;
 		// this is used for MAX_REQUESTS
 		uwsgi.workers[uwsgi.mywid].delta_requests++;
+		uwsgi_histograms_account(wsgi_req);
+		uwsgi_spans_account(wsgi_req);
 	}
 
 #ifdef UWSGI_ROUTING
@@ -1353,6 +1358,7 @@ int wsgi_req_recv(int queue, struct wsgi_request *wsgi_req) {
 	wsgi_req->start_of_request = uwsgi_micros();
 	wsgi_req->start_of_request_in_sec = wsgi_req->start_of_request / 1000000;
 
+	uint64_t span = uwsgi_span_begin();
 	// edge triggered sockets get the whole request during accept() phase
 	if (!wsgi_req->socket->edge_trigger) {
 		for (;;) {
@@ -1368,6 +1374,7 @@ int wsgi_req_recv(int queue, struct wsgi_request *wsgi_req) {
 			return -1;
 		}
 	}
+	uwsgi_span_end(wsgi_req, UWSGI_SPAN_READ, span);
 
 	// enter harakiri mode
 	if (uwsgi.shared->options[UWSGI_OPTION_HARAKIRI] > 0) {
@@ -1379,7 +1386,10 @@ int wsgi_req_recv(int queue, struct wsgi_request *wsgi_req) {
 		return 0;
 #endif
 
+	if (uwsgi.histogram_slots) wsgi_req->app_start = uwsgi_micros();
+	span = uwsgi_span_begin();
 	wsgi_req->async_status = uwsgi.p[wsgi_req->uh->modifier1]->request(wsgi_req);
+	uwsgi_span_end(wsgi_req, UWSGI_SPAN_APP, span);
 
 	return 0;
 }
@@ -1466,6 +1476,9 @@ int wsgi_req_accept(int queue, struct wsgi_request *wsgi_req) {
 		return -1;
 	}
 
+	// the accept span goes from the wakeup to the end of accept()
+	uint64_t span = uwsgi_span_begin();
+
 	// check for heartbeat
 	if (timeout > 0) {
 		uwsgi_heartbeat();
@@ -1507,6 +1520,7 @@ int wsgi_req_accept(int queue, struct wsgi_request *wsgi_req) {
 				uwsgi_post_accept(wsgi_req);
 			}
 
+			uwsgi_span_end(wsgi_req, UWSGI_SPAN_ACCEPT, span);
 			return 0;
 		}
 
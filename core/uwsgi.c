@@ -471,6 +471,7 @@ static struct uwsgi_option uwsgi_base_options[] = {
 #endif
 #ifdef UWSGI_PCRE
 	{"pcre-jit", no_argument, 0, "enable pcre jit (if available)", uwsgi_opt_pcre_jit, NULL, UWSGI_OPT_IMMEDIATE},
+	{"pcre-no-jit", no_argument, 0, "disable pcre jit (it is enabled by default with pcre2)", uwsgi_opt_true, &uwsgi.pcre_no_jit, UWSGI_OPT_IMMEDIATE},
 #endif
 	{"never-swap", no_argument, 0, "lock all memory pages avoiding swapping", uwsgi_opt_true, &uwsgi.never_swap, 0},
 	{"touch-reload", required_argument, 0, "reload uWSGI if the specified file is modified/touched", uwsgi_opt_add_string_list, &uwsgi.touch_reload, UWSGI_OPT_MASTER},
@@ -516,6 +517,9 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"metric-alarm", required_argument, 0, "add a metric threshold/alarm", uwsgi_opt_add_string_list, &uwsgi.metrics_threshold, UWSGI_OPT_METRICS|UWSGI_OPT_MASTER},
 	{"metrics-dir", required_argument, 0, "exports metrics as text files in the specified directory", uwsgi_opt_set_str, &uwsgi.metrics_dir, UWSGI_OPT_METRICS|UWSGI_OPT_MASTER},
 	{"metrics-dir-restore", no_argument, 0, "restore last value taken from the metrics dir", uwsgi_opt_true, &uwsgi.metrics_dir_restore, UWSGI_OPT_METRICS|UWSGI_OPT_MASTER},
+	{"trace-spans", no_argument, 0, "time the phases of each request (exposed as span_* logvars and span.* histograms)", uwsgi_opt_true, &uwsgi.trace_spans, 0},
+	{"trace-spans-sample", required_argument, 0, "export the trace record of 1 request every N (default 100)", uwsgi_opt_set_64bit, &uwsgi.trace_spans_sample, 0},
+	{"trace-spans-socket", required_argument, 0, "send the trace records to the specified udp address instead of the logs", uwsgi_opt_set_str, &uwsgi.trace_spans_socket, 0},
 	{"metric-dir", required_argument, 0, "exports metrics as text files in the specified directory", uwsgi_opt_set_str, &uwsgi.metrics_dir, UWSGI_OPT_METRICS|UWSGI_OPT_MASTER},
 	{"metric-dir-restore", no_argument, 0, "restore last value taken from the metrics dir", uwsgi_opt_true, &uwsgi.metrics_dir_restore, UWSGI_OPT_METRICS|UWSGI_OPT_MASTER},
 
@@ -528,11 +532,16 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"stats-push", required_argument, 0, "push the stats json to the specified destination", uwsgi_opt_add_string_list, &uwsgi.requested_stats_pushers, UWSGI_OPT_MASTER|UWSGI_OPT_METRICS},
 	{"stats-pusher-default-freq", required_argument, 0, "set the default frequency of stats pushers", uwsgi_opt_set_int, &uwsgi.stats_pusher_default_freq, UWSGI_OPT_MASTER},
 	{"stats-pushers-default-freq", required_argument, 0, "set the default frequency of stats pushers", uwsgi_opt_set_int, &uwsgi.stats_pusher_default_freq, UWSGI_OPT_MASTER},
+	{"stats-pusher-refresh", required_argument, 0, "force the delta stats pushers to send all of the metrics every N seconds (default 60, 0 to disable)", uwsgi_opt_set_int, &uwsgi.stats_pusher_refresh, UWSGI_OPT_MASTER},
 	{"multicast", required_argument, 0, "subscribe to specified multicast group", uwsgi_opt_set_str, &uwsgi.multicast_group, UWSGI_OPT_MASTER},
 	{"multicast-ttl", required_argument, 0, "set multicast ttl", uwsgi_opt_set_int, &uwsgi.multicast_ttl, 0},
 	{"multicast-loop", required_argument, 0, "set multicast loop (default 1)", uwsgi_opt_set_int, &uwsgi.multicast_loop, 0},
 
 	{"master-fifo", required_argument, 0, "enable the master fifo", uwsgi_opt_add_string_list, &uwsgi.master_fifo, UWSGI_OPT_MASTER},
+	{"sampling-profiler", no_argument, 0, "enable the native sampling profiler (started and stopped with the master fifo 'x' and 'X' commands)", uwsgi_opt_true, &uwsgi.sampling_profiler, UWSGI_OPT_MASTER},
+	{"sampling-profiler-hz", required_argument, 0, "set the sampling frequency of the native profiler (default 99)", uwsgi_opt_set_int, &uwsgi.sampling_profiler_hz, UWSGI_OPT_MASTER},
+	{"sampling-profiler-samples", required_argument, 0, "set the size of the shared ring of stack samples (default 16384)", uwsgi_opt_set_64bit, &uwsgi.sampling_profiler_samples, UWSGI_OPT_MASTER},
+	{"sampling-profiler-output", required_argument, 0, "write the folded stacks to the specified file (default a new /tmp/uwsgi-profile-<pid>-XXXXXX file)", uwsgi_opt_set_str, &uwsgi.sampling_profiler_output, UWSGI_OPT_MASTER},
 
 #ifdef UWSGI_SSL
 	{"legion", required_argument, 0, "became a member of a legion", uwsgi_opt_legion, NULL, UWSGI_OPT_MASTER},
@@ -555,7 +564,7 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"subscriptions-sign-check", required_argument, 0, "set digest algorithm and certificate directory for secured subscription system", uwsgi_opt_scd, NULL, UWSGI_OPT_MASTER},
 	{"subscriptions-sign-check-tolerance", required_argument, 0, "set the maximum tolerance (in seconds) of clock skew for secured subscription system", uwsgi_opt_set_int, &uwsgi.subscriptions_sign_check_tolerance, UWSGI_OPT_MASTER},
 #endif
-	{"subscription-algo", required_argument, 0, "set load balancing algorithm for the subscription system", uwsgi_opt_ssa, NULL, 0},
+	{"subscription-algo", required_argument, 0, "set load balancing algorithm for the subscription system (wrr, lrc, wlrc, ketama, p2c, ewma)", uwsgi_opt_ssa, NULL, 0},
 	{"subscription-dotsplit", no_argument, 0, "try to fallback to the next part (dot based) in subscription key", uwsgi_opt_true, &uwsgi.subscription_dotsplit, 0},
 	{"subscribe-to", required_argument, 0, "subscribe to the specified subscription server", uwsgi_opt_add_string_list, &uwsgi.subscriptions, UWSGI_OPT_MASTER},
 	{"st", required_argument, 0, "subscribe to the specified subscription server", uwsgi_opt_add_string_list, &uwsgi.subscriptions, UWSGI_OPT_MASTER},
@@ -593,8 +602,14 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"logto2", required_argument, 0, "log to specified file or udp address after privileges drop", uwsgi_opt_set_str, &uwsgi.logto2, 0},
 	{"log-format", required_argument, 0, "set advanced format for request logging", uwsgi_opt_set_str, &uwsgi.logformat, 0},
 	{"logformat", required_argument, 0, "set advanced format for request logging", uwsgi_opt_set_str, &uwsgi.logformat, 0},
-	{"logformat-strftime", no_argument, 0, "apply strftime to logformat output", uwsgi_opt_true, &uwsgi.logformat_strftime, 0},
-	{"log-format-strftime", no_argument, 0, "apply strftime to logformat output", uwsgi_opt_true, &uwsgi.logformat_strftime, 0},
+	{"logformat-strftime", no_argument, 0, "apply strftime to the raw strings of logformat output", uwsgi_opt_true, &uwsgi.logformat_strftime, 0},
+	{"log-format-strftime", no_argument, 0, "apply strftime to the raw strings of logformat output", uwsgi_opt_true, &uwsgi.logformat_strftime, 0},
+	{"logformat-json", no_argument, 0, "escape the logformat variables for inclusion in JSON strings", uwsgi_opt_true, &uwsgi.logformat_json, 0},
+	{"log-format-json", no_argument, 0, "escape the logformat variables for inclusion in JSON strings", uwsgi_opt_true, &uwsgi.logformat_json, 0},
+	{"logformat-binary", no_argument, 0, "log requests as compact binary records (the logformat variables are appended to the fixed fields)", uwsgi_opt_true, &uwsgi.logformat_binary, 0},
+	{"log-format-binary", no_argument, 0, "log requests as compact binary records (the logformat variables are appended to the fixed fields)", uwsgi_opt_true, &uwsgi.logformat_binary, 0},
+	{"logformat-bufsize", required_argument, 0, "set the size of the per-core logformat buffer (default 4096, longer lines are truncated)", uwsgi_opt_set_64bit, &uwsgi.logformat_bufsize, 0},
+	{"log-format-bufsize", required_argument, 0, "set the size of the per-core logformat buffer (default 4096, longer lines are truncated)", uwsgi_opt_set_64bit, &uwsgi.logformat_bufsize, 0},
 	{"logfile-chown", no_argument, 0, "chown logfiles", uwsgi_opt_true, &uwsgi.logfile_chown, 0},
 	{"logfile-chmod", required_argument, 0, "chmod logfiles", uwsgi_opt_logfile_chmod, NULL, 0},
 	{"log-syslog", optional_argument, 0, "log to syslog", uwsgi_opt_set_logger, "syslog", UWSGI_OPT_MASTER | UWSGI_OPT_LOG_MASTER},
@@ -640,6 +655,11 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"log-master", no_argument, 0, "delegate logging to master process", uwsgi_opt_true, &uwsgi.log_master, UWSGI_OPT_MASTER},
 	{"log-master-bufsize", required_argument, 0, "set the buffer size for the master logger. bigger log messages will be truncated", uwsgi_opt_set_64bit, &uwsgi.log_master_bufsize, 0},
 	{"log-master-stream", no_argument, 0, "create the master logpipe as SOCK_STREAM", uwsgi_opt_true, &uwsgi.log_master_stream, 0},
+	{"logger-queue", required_argument, 0, "deliver logs to the loggers supporting it (socket, rsyslog, redislog, graylog2) in batches from a background thread, using a queue of the specified number of messages", uwsgi_opt_set_64bit, &uwsgi.log_queue_size, 0},
+	{"logger-queue-block", no_argument, 0, "block instead of dropping messages when a logger queue is full", uwsgi_opt_true, &uwsgi.log_queue_block, 0},
+	{"logger-queue-batch", required_argument, 0, "max number of messages sent at once by a logger queue (default 64)", uwsgi_opt_set_int, &uwsgi.log_queue_batch, 0},
+	{"logger-queue-delay", required_argument, 0, "wait up to the specified number of milliseconds for a logger batch to fill (default 0)", uwsgi_opt_set_int, &uwsgi.log_queue_delay, 0},
+	{"log-master-ring", required_argument, 0, "send request logs to the master via per-core shared memory rings of the specified size (lines are dropped when a ring is full)", uwsgi_opt_set_64bit, &uwsgi.log_master_ring, UWSGI_OPT_MASTER | UWSGI_OPT_LOG_MASTER},
 	{"log-master-req-stream", no_argument, 0, "create the master requests logpipe as SOCK_STREAM", uwsgi_opt_true, &uwsgi.log_master_req_stream, 0},
 	{"log-reopen", no_argument, 0, "reopen log after reload", uwsgi_opt_true, &uwsgi.log_reopen, 0},
 	{"log-truncate", no_argument, 0, "truncate log on startup", uwsgi_opt_true, &uwsgi.log_truncate, 0},
@@ -706,6 +726,8 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"route-if", required_argument, 0, "add a route based on condition", uwsgi_opt_add_route, "if", 0},
 	{"route-if-not", required_argument, 0, "add a route based on condition (negate version)", uwsgi_opt_add_route, "if-not", 0},
 	{"route-run", required_argument, 0, "always run the specified route action", uwsgi_opt_add_route, "run", 0},
+	{"route-no-compile", no_argument, 0, "do not compile routing tables (evaluate every rule regexp in order)", uwsgi_opt_true, &uwsgi.route_no_compile, 0},
+	{"log-transformations", no_argument, 0, "log bytes and time spent in every transformation of the chain", uwsgi_opt_true, &uwsgi.log_transformations, 0},
 
 
 
@@ -775,6 +797,9 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"add-header", required_argument, 0, "automatically add HTTP headers to response", uwsgi_opt_add_string_list, &uwsgi.additional_headers, 0},
 	{"rem-header", required_argument, 0, "automatically remove specified HTTP header from the response", uwsgi_opt_add_string_list, &uwsgi.remove_headers, 0},
 	{"del-header", required_argument, 0, "automatically remove specified HTTP header from the response", uwsgi_opt_add_string_list, &uwsgi.remove_headers, 0},
+	{"add-date-header", no_argument, 0, "add the Date header to every response (formatted once per second)", uwsgi_opt_true, &uwsgi.add_date_header, 0},
+	{"header-template", required_argument, 0, "define a pre-serialized response status for the header-template route action and plugins (syntax: name status)", uwsgi_opt_add_string_list, &uwsgi.header_templates_list, 0},
+	{"header-template-header", required_argument, 0, "add a fixed header to a header template (syntax: name header)", uwsgi_opt_add_string_list, &uwsgi.header_templates_headers, 0},
 	{"collect-header", required_argument, 0, "store the specified response header in a request var (syntax: header var)", uwsgi_opt_add_string_list, &uwsgi.collect_headers, 0},
 	{"response-header-collect", required_argument, 0, "store the specified response header in a request var (syntax: header var)", uwsgi_opt_add_string_list, &uwsgi.collect_headers, 0},
 
@@ -788,6 +813,9 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"static-safe", required_argument, 0, "skip security checks if the file is under the specified path", uwsgi_opt_add_string_list, &uwsgi.static_safe, UWSGI_OPT_MIME},
 	{"static-cache-paths", required_argument, 0, "put resolved paths in the uWSGI cache for the specified amount of seconds", uwsgi_opt_set_int, &uwsgi.use_static_cache_paths, UWSGI_OPT_MIME|UWSGI_OPT_MASTER},
 	{"static-cache-paths-name", required_argument, 0, "use the specified cache for static paths", uwsgi_opt_set_str, &uwsgi.static_cache_paths_name, UWSGI_OPT_MIME|UWSGI_OPT_MASTER},
+	{"static-cache-fds", required_argument, 0, "keep the specified number of resolved and opened static files in a per-worker cache", uwsgi_opt_set_64bit, &uwsgi.static_cache_fds, UWSGI_OPT_MIME},
+	{"static-cache-fds-ttl", required_argument, 0, "expire items in the static files cache after the specified amount of seconds (default 10)", uwsgi_opt_set_int, &uwsgi.static_cache_fds_ttl, UWSGI_OPT_MIME},
+	{"static-cache-fds-monitor", required_argument, 0, "clear the static files cache whenever the specified directory is modified", uwsgi_opt_add_string_list, &uwsgi.static_cache_fds_monitor, UWSGI_OPT_MIME|UWSGI_OPT_MASTER},
 #ifdef __APPLE__
 	{"mimefile", required_argument, 0, "set mime types file path (default /etc/apache2/mime.types)", uwsgi_opt_add_string_list, &uwsgi.mime_file, UWSGI_OPT_MIME},
 	{"mime-file", required_argument, 0, "set mime types file path (default /etc/apache2/mime.types)", uwsgi_opt_add_string_list, &uwsgi.mime_file, UWSGI_OPT_MIME},
@@ -810,6 +838,11 @@ static struct uwsgi_option uwsgi_base_options[] = {
 	{"static-expires-path-info-mtime", required_argument, 0, "set the Expires header based on PATH_INFO regexp and file mtime", uwsgi_opt_add_regexp_dyn_dict, &uwsgi.static_expires_path_info_mtime, UWSGI_OPT_MIME},
 	{"static-gzip", required_argument, 0, "if the supplied regexp matches the static file translation it will search for a gzip version", uwsgi_opt_add_regexp_list, &uwsgi.static_gzip, UWSGI_OPT_MIME},
 #endif
+	{"static-encoding", required_argument, 0, "negotiate the specified content-coding (br, zstd or gzip) for static files matching the static-gzip rules (can be specified multiple times, in order of preference, default: gzip)", uwsgi_opt_add_string_list, &uwsgi.static_encodings_list, UWSGI_OPT_MIME},
+	{"static-compress-store", required_argument, 0, "compress static files lacking a precompressed variant once, storing the result in the specified directory", uwsgi_opt_set_str, &uwsgi.static_compress_store, UWSGI_OPT_MIME},
+	{"static-compress-store-size", required_argument, 0, "set the maximum size (in bytes) of the static compressed variants store (default 128M)", uwsgi_opt_set_64bit, &uwsgi.static_compress_store_size, UWSGI_OPT_MIME},
+	{"static-compress-min-size", required_argument, 0, "do not compress static files smaller than the specified size (default 256)", uwsgi_opt_set_64bit, &uwsgi.static_compress_min_size, UWSGI_OPT_MIME},
+	{"static-compress-max-size", required_argument, 0, "do not compress static files bigger than the specified size (default 16M)", uwsgi_opt_set_64bit, &uwsgi.static_compress_max_size, UWSGI_OPT_MIME},
 	{"static-gzip-all", no_argument, 0, "check for a gzip version of all requested static files", uwsgi_opt_true, &uwsgi.static_gzip_all, UWSGI_OPT_MIME},
 	{"static-gzip-dir", required_argument, 0, "check for a gzip version of all requested static files in the specified dir/prefix", uwsgi_opt_add_string_list, &uwsgi.static_gzip_dir, UWSGI_OPT_MIME},
 	{"static-gzip-prefix", required_argument, 0, "check for a gzip version of all requested static files in the specified dir/prefix", uwsgi_opt_add_string_list, &uwsgi.static_gzip_dir, UWSGI_OPT_MIME},
@@ -1762,6 +1795,17 @@ check:
 			break;
 		}
 	}
+
+	// the threaded logger drains the rings too, they have a single consumer at a time
+	if (uwsgi.threaded_logger) {
+		pthread_mutex_lock(&uwsgi.threaded_logger_lock);
+		uwsgi_log_rings_drain(0);
+		pthread_mutex_unlock(&uwsgi.threaded_logger_lock);
+	}
+	else {
+		uwsgi_log_rings_drain(0);
+	}
+	uwsgi_logger_queues_flush();
 }
 
 static void plugins_list(void) {
@@ -2241,8 +2285,12 @@ int main(int argc, char *argv[], char *envp[]) {
 
 	uwsgi_log_initial("clock source: %s\n", uwsgi.clock->name);
 #ifdef UWSGI_PCRE
-	if (uwsgi.pcre_jit) {
+	if (uwsgi_regexp_jit()) {
+#ifdef UWSGI_PCRE2
+		uwsgi_log_initial("pcre2 jit enabled\n");
+#else
 		uwsgi_log_initial("pcre jit enabled\n");
+#endif
 	}
 	else {
 		uwsgi_log_initial("pcre jit disabled\n");
@@ -2371,7 +2419,7 @@ int main(int argc, char *argv[], char *envp[]) {
 
 int uwsgi_start(void *v_argv) {
 
-	int i, j;
+	int i;
 
 #ifdef __linux__
 	uwsgi_set_cgroup();
@@ -2540,6 +2588,7 @@ int uwsgi_start(void *v_argv) {
 			}
 			umd = umd->next;
 		}
+		uwsgi_mime_table_build();
 	}
 
 	if (uwsgi.async > 1) {
@@ -2623,6 +2672,14 @@ int uwsgi_start(void *v_argv) {
 		}
         }
 
+	if (uwsgi.static_cache_fds && !uwsgi.static_cache_fds_ttl) {
+		uwsgi.static_cache_fds_ttl = 10;
+	}
+
+	uwsgi_static_encodings_init();
+
+	uwsgi_header_templates_init();
+
         // initialize the alarm subsystem
         uwsgi_alarms_init();
 
@@ -2820,6 +2877,12 @@ unsafe:
 	// initialize workers/master shared memory segments
 	uwsgi_setup_workers();
 
+	uwsgi_log_rings_init();
+
+	uwsgi_spans_init();
+
+	uwsgi_profiler_init();
+
 	// create signal pipes if master is enabled
 	if (uwsgi.master_process) {
 		for (i = 1; i <= uwsgi.numproc; i++) {
@@ -2871,18 +2934,15 @@ unsafe:
 	uwsgi_setup_metrics();
 
 	// cores are allocated, lets allocate logformat (if required)
-	if (uwsgi.logformat) {
-		uwsgi_build_log_format(uwsgi.logformat);
-		uwsgi.logit = uwsgi_logit_lf;
-		if (uwsgi.logformat_strftime) {
-			uwsgi.logit = uwsgi_logit_lf_strftime;
+	if (uwsgi.logformat || uwsgi.logformat_binary) {
+		if (uwsgi.logformat) {
+			uwsgi_build_log_format(uwsgi.logformat);
 		}
-		uwsgi.logvectors = uwsgi_malloc(sizeof(struct iovec *) * uwsgi.cores);
-		for (j = 0; j < uwsgi.cores; j++) {
-			uwsgi.logvectors[j] = uwsgi_malloc(sizeof(struct iovec) * uwsgi.logformat_vectors);
-			uwsgi.logvectors[j][uwsgi.logformat_vectors - 1].iov_base = "\n";
-			uwsgi.logvectors[j][uwsgi.logformat_vectors - 1].iov_len = 1;
+		uwsgi.logit = uwsgi_logit_lf;
+		if (uwsgi.logformat_binary) {
+			uwsgi.logit = uwsgi_logit_lf_binary;
 		}
+		uwsgi_compile_log_format();
 	}
 
 	// initialize locks and socket as soon as possible, as the master could enqueue tasks
@@ -3227,6 +3287,8 @@ void uwsgi_worker_run() {
 		signal(SIGPIPE, (void *) &warn_pipe);
 	}
 
+	uwsgi_profiler_worker_init();
+
 	// worker initialization done
 
 	// run fixup handler
@@ -12,10 +12,55 @@ int uwsgi_response_add_content_length(struct wsgi_request *wsgi_req, uint64_t cl
 	return uwsgi_response_add_header(wsgi_req, "Content-Length", 14, buf, ret); 
 }
 
+/*
+	formatted HTTP dates are cached (per-process) by second: Date, Expires and Last-Modified headers
+	of the same second (or of the same file) are generated with a memcpy.
+
+	Every slot is protected by a sequence counter (odd while a thread is updating it), readers
+	never block and simply format the date by themselves on conflicts.
+*/
+#define UWSGI_HTTP_DATE_CACHE 64
+
+struct uwsgi_http_date_slot {
+	volatile uint32_t seq;
+	time_t t;
+	int len;
+	char date[31];
+};
+
+static struct uwsgi_http_date_slot uwsgi_http_date_slots[UWSGI_HTTP_DATE_CACHE];
+
+int uwsgi_http_date_cached(time_t t, char *dst) {
+	struct uwsgi_http_date_slot *slot = &uwsgi_http_date_slots[(uint64_t) t % UWSGI_HTTP_DATE_CACHE];
+
+	uint32_t seq = slot->seq;
+	// the slot fields cannot be read before the sequence
+	__sync_synchronize();
+	if (!(seq & 1) && slot->len > 0 && slot->t == t) {
+		int len = slot->len;
+		memcpy(dst, slot->date, 31);
+		// and the sequence cannot be checked again before the fields have been read
+		__sync_synchronize();
+		if (slot->seq == seq) return len;
+	}
+
+	int len = uwsgi_http_date(t, dst);
+	if (!len) return 0;
+
+	// another thread is updating the slot, do not wait for it
+	if (seq & 1 || !__sync_bool_compare_and_swap(&slot->seq, seq, seq + 1)) return len;
+	slot->t = t;
+	slot->len = len;
+	memcpy(slot->date, dst, 31);
+	__sync_synchronize();
+	slot->seq = seq + 2;
+	return len;
+}
+
 int uwsgi_response_add_expires(struct wsgi_request *wsgi_req, uint64_t t) {
 	// 30+1
         char expires[31];
-	int len = uwsgi_http_date((time_t) t, expires);
+	int len = uwsgi_http_date_cached((time_t) t, expires);
 	if (!len) {
 		wsgi_req->write_errors++;
                 return -1;
@@ -26,7 +71,7 @@ int uwsgi_response_add_expires(struct wsgi_request *wsgi_req, uint64_t t) {
 int uwsgi_response_add_date(struct wsgi_request *wsgi_req, char *hkey, uint16_t hlen, uint64_t t) {
         // 30+1
         char d[31];
-        int len = uwsgi_http_date((time_t) t, d);
+        int len = uwsgi_http_date_cached((time_t) t, d);
         if (!len) {
                 wsgi_req->write_errors++;
                 return -1;
@@ -37,7 +82,7 @@ int uwsgi_response_add_date(struct wsgi_request *wsgi_req, char *hkey, uint16_t
 int uwsgi_response_add_last_modified(struct wsgi_request *wsgi_req, uint64_t t) {
         // 30+1
         char lm[31];
-        int len = uwsgi_http_date((time_t) t, lm);
+        int len = uwsgi_http_date_cached((time_t) t, lm);
         if (!len) {
                 wsgi_req->write_errors++;
                 return -1;
@@ -64,11 +109,8 @@ int uwsgi_response_prepare_headers_int(struct wsgi_request *wsgi_req, int status
 	return uwsgi_response_prepare_headers(wsgi_req, status_str, 3);
 }
 
-// status could be NNN or NNN message
-int uwsgi_response_prepare_headers(struct wsgi_request *wsgi_req, char *status, uint16_t status_len) {
-
-	if (wsgi_req->headers_sent || wsgi_req->headers_size || wsgi_req->response_size || status_len < 3 || wsgi_req->write_errors) return -1;
-
+// reset the headers buffer and apply the error routes
+static int uwsgi_response_prepare_reset(struct wsgi_request *wsgi_req, int status) {
 	if (!wsgi_req->headers) {
 		wsgi_req->headers = uwsgi_buffer_new(uwsgi.page_size);
 		wsgi_req->headers->limit = UMAX16;
@@ -78,8 +120,7 @@ int uwsgi_response_prepare_headers(struct wsgi_request *wsgi_req, char *status,
 	wsgi_req->headers->pos = 0;
 	// reset headers count
 	wsgi_req->header_cnt = 0;
-	struct uwsgi_buffer *hh = NULL;
-	wsgi_req->status = uwsgi_str3_num(status);
+	wsgi_req->status = status;
 #ifdef UWSGI_ROUTING
 	// apply error routes
 	if (uwsgi_apply_error_routes(wsgi_req) == UWSGI_ROUTE_BREAK) {
@@ -89,6 +130,16 @@ int uwsgi_response_prepare_headers(struct wsgi_request *wsgi_req, char *status,
 	}
 	wsgi_req->is_error_routing = 0;
 #endif
+	return 0;
+}
+
+// status could be NNN or NNN message
+int uwsgi_response_prepare_headers(struct wsgi_request *wsgi_req, char *status, uint16_t status_len) {
+
+	if (wsgi_req->headers_sent || wsgi_req->headers_size || wsgi_req->response_size || status_len < 3 || wsgi_req->write_errors) return -1;
+
+	if (uwsgi_response_prepare_reset(wsgi_req, uwsgi_str3_num(status))) return -1;
+	struct uwsgi_buffer *hh = NULL;
 	if (status_len <= 4) {
 		char *new_sc = NULL;
 		size_t new_sc_len = 0;
@@ -172,6 +223,46 @@ int uwsgi_response_add_header(struct wsgi_request *wsgi_req, char *key, uint16_t
 	return uwsgi_response_add_header_do(wsgi_req, key, key_len, value, value_len);
 }
 
+/*
+	like uwsgi_response_add_header() but the caller supplies the already serialized line ("key: value\r\n"),
+	directly used (without further allocations) when the socket uses the base header generator
+*/
+int uwsgi_response_add_header_line(struct wsgi_request *wsgi_req, char *key, uint16_t key_len, char *value, uint16_t value_len, char *line, uint16_t line_len) {
+
+	if (!line || wsgi_req->socket->proto_add_header != uwsgi_proto_base_add_header || uwsgi.collect_headers) {
+		return uwsgi_response_add_header(wsgi_req, key, key_len, value, value_len);
+	}
+
+	if (wsgi_req->headers_sent || wsgi_req->headers_size || wsgi_req->response_size || wsgi_req->write_errors) return -1;
+
+	struct uwsgi_string_list *rh = uwsgi.remove_headers;
+	while(rh) {
+		if (!uwsgi_strnicmp(key, key_len, rh->value, rh->len)) {
+			return 0;
+		}
+		rh = rh->next;
+	}
+	rh = wsgi_req->remove_headers;
+	while(rh) {
+		if (!uwsgi_strnicmp(key, key_len, rh->value, rh->len)) {
+			return 0;
+		}
+		rh = rh->next;
+	}
+
+	if (!wsgi_req->headers) {
+		wsgi_req->headers = uwsgi_buffer_new(uwsgi.page_size);
+		wsgi_req->headers->limit = UMAX16;
+	}
+
+	if (uwsgi_buffer_append(wsgi_req->headers, line, line_len)) {
+		wsgi_req->write_errors++;
+		return -1;
+	}
+	wsgi_req->header_cnt++;
+	return 0;
+}
+
 int uwsgi_response_add_header_force(struct wsgi_request *wsgi_req, char *key, uint16_t key_len, char *value, uint16_t value_len) {
 
         if (wsgi_req->headers_sent || wsgi_req->headers_size || wsgi_req->response_size || wsgi_req->write_errors) return -1;
@@ -179,6 +270,145 @@ int uwsgi_response_add_header_force(struct wsgi_request *wsgi_req, char *key, ui
         return uwsgi_response_add_header_do(wsgi_req, key, key_len, value, value_len);
 }
 
+/*
+	header templates
+
+	a template is a status with a set of fixed headers (--header-template and --header-template-header,
+	or uwsgi_header_template_new() from plugins). The status line and the headers are serialized once,
+	so preparing a response from a template is a single memcpy (after the protocol string) when the socket
+	uses the base header generator and no header needs to be removed or collected.
+
+	Templates are immutable after startup and are shared by all of the cores.
+*/
+struct uwsgi_header_template *uwsgi_header_template_new(char *name, char *status, uint16_t status_len) {
+	if (status_len < 3) return NULL;
+
+	struct uwsgi_header_template *uht = uwsgi_calloc(sizeof(struct uwsgi_header_template));
+	uht->name = name;
+	if (status_len <= 4) {
+		uint16_t sc_len = 0;
+		const char *sc = uwsgi_http_status_msg(status, &sc_len);
+		if (!sc) {
+			sc = "Unknown";
+			sc_len = 7;
+		}
+		uht->status = uwsgi_concat3n(status, 3, " ", 1, (char *) sc, sc_len);
+		uht->status_len = 4 + sc_len;
+	}
+	else {
+		uht->status = uwsgi_strncopy(status, status_len);
+		uht->status_len = status_len;
+	}
+
+	uht->serialized = uwsgi_buffer_new(uwsgi.page_size);
+	if (uwsgi_buffer_append(uht->serialized, " ", 1)) goto error;
+	if (uwsgi_buffer_append(uht->serialized, uht->status, uht->status_len)) goto error;
+	if (uwsgi_buffer_append(uht->serialized, "\r\n", 2)) goto error;
+
+	struct uwsgi_header_template *templates = uwsgi.header_templates;
+	if (!templates) {
+		uwsgi.header_templates = uht;
+	}
+	else {
+		while(templates->next) templates = templates->next;
+		templates->next = uht;
+	}
+	return uht;
+error:
+	uwsgi_buffer_destroy(uht->serialized);
+	free(uht->status);
+	free(uht);
+	return NULL;
+}
+
+// add a "key: value" header to the template
+int uwsgi_header_template_add(struct uwsgi_header_template *uht, char *line, uint16_t len) {
+	if (!memchr(line, ':', len)) return -1;
+	if (uwsgi_buffer_append(uht->serialized, line, len)) return -1;
+	if (uwsgi_buffer_append(uht->serialized, "\r\n", 2)) return -1;
+	uwsgi_string_new_list(&uht->headers, uwsgi_strncopy(line, len));
+	uht->header_cnt++;
+	return 0;
+}
+
+struct uwsgi_header_template *uwsgi_header_template_get(char *name) {
+	struct uwsgi_header_template *uht = uwsgi.header_templates;
+	while(uht) {
+		if (!strcmp(uht->name, name)) return uht;
+		uht = uht->next;
+	}
+	return NULL;
+}
+
+void uwsgi_header_templates_init() {
+	struct uwsgi_string_list *usl = NULL;
+	uwsgi_foreach(usl, uwsgi.header_templates_list) {
+		char *space = strchr(usl->value, ' ');
+		if (!space) {
+			uwsgi_log("invalid header template syntax: %s (must be: name status)\n", usl->value);
+			exit(1);
+		}
+		char *name = uwsgi_concat2n(usl->value, space - usl->value, "", 0);
+		if (uwsgi_header_template_get(name) || !uwsgi_header_template_new(name, space + 1, strlen(space + 1))) {
+			uwsgi_log("unable to create header template: %s\n", usl->value);
+			exit(1);
+		}
+	}
+
+	uwsgi_foreach(usl, uwsgi.header_templates_headers) {
+		char *space = strchr(usl->value, ' ');
+		if (!space) {
+			uwsgi_log("invalid header template header syntax: %s (must be: name header)\n", usl->value);
+			exit(1);
+		}
+		*space = 0;
+		struct uwsgi_header_template *uht = uwsgi_header_template_get(usl->value);
+		*space = ' ';
+		if (!uht) {
+			uwsgi_log("unknown header template: %s\n", usl->value);
+			exit(1);
+		}
+		if (uwsgi_header_template_add(uht, space + 1, strlen(space + 1))) {
+			uwsgi_log("invalid header for template: %s\n", usl->value);
+			exit(1);
+		}
+	}
+}
+
+// prepare the response headers from a template (other headers can be added after this call)
+int uwsgi_response_prepare_template(struct wsgi_request *wsgi_req, struct uwsgi_header_template *uht) {
+
+	if (wsgi_req->socket->proto_prepare_headers != uwsgi_proto_base_prepare_headers || wsgi_req->socket->proto_add_header != uwsgi_proto_base_add_header ||
+		uwsgi.shared->options[UWSGI_OPTION_CGI_MODE] || uwsgi.remove_headers || wsgi_req->remove_headers || uwsgi.collect_headers) {
+		struct uwsgi_string_list *usl = NULL;
+		if (uwsgi_response_prepare_headers(wsgi_req, uht->status, uht->status_len)) return -1;
+		uwsgi_foreach(usl, uht->headers) {
+			char *colon = memchr(usl->value, ':', usl->len);
+			char *value = colon + 1;
+			while(value < usl->value + usl->len && *value == ' ') value++;
+			if (uwsgi_response_add_header(wsgi_req, usl->value, colon - usl->value, value, (usl->value + usl->len) - value)) return -1;
+		}
+		return 0;
+	}
+
+	if (wsgi_req->headers_sent || wsgi_req->headers_size || wsgi_req->response_size || wsgi_req->write_errors) return -1;
+
+	if (uwsgi_response_prepare_reset(wsgi_req, uwsgi_str3_num(uht->status))) return -1;
+
+	if (wsgi_req->protocol_len) {
+		if (uwsgi_buffer_append(wsgi_req->headers, wsgi_req->protocol, wsgi_req->protocol_len)) goto error;
+	}
+	else {
+		if (uwsgi_buffer_append(wsgi_req->headers, "HTTP/1.0", 8)) goto error;
+	}
+	if (uwsgi_buffer_append(wsgi_req->headers, uht->serialized->buf, uht->serialized->pos)) goto error;
+	wsgi_req->header_cnt += uht->header_cnt;
+	return 0;
+error:
+	wsgi_req->write_errors++;
+	return -1;
+}
+
 int uwsgi_response_write_headers_do(struct wsgi_request *wsgi_req) {
 	if (wsgi_req->headers_sent || !wsgi_req->headers || wsgi_req->response_size || wsgi_req->write_errors) {
 		return UWSGI_OK;
@@ -194,6 +424,10 @@ int uwsgi_response_write_headers_do(struct wsgi_request *wsgi_req) {
         wsgi_req->is_response_routing = 0;
 #endif
 
+	if (uwsgi.add_date_header) {
+		if (uwsgi_response_add_date(wsgi_req, "Date", 4, uwsgi_now())) return -1;
+	}
+
 	struct uwsgi_string_list *ah = uwsgi.additional_headers;
 	while(ah) {
 		if (uwsgi_response_add_header(wsgi_req, NULL, 0, ah->value, ah->len)) return -1;
@@ -209,26 +443,26 @@ int uwsgi_response_write_headers_do(struct wsgi_request *wsgi_req) {
 
 	if (wsgi_req->socket->proto_fix_headers(wsgi_req)) { wsgi_req->write_errors++ ; return -1;}
 
+	uint64_t span = uwsgi_span_begin();
 	for(;;) {
                 int ret = wsgi_req->socket->proto_write_headers(wsgi_req, wsgi_req->headers->buf, wsgi_req->headers->pos);
                 if (ret < 0) {
                         if (!uwsgi.ignore_write_errors) {
                                 uwsgi_error("uwsgi_response_write_headers_do()");
                         }
-			wsgi_req->write_errors++;
-                        return -1;
+			goto error;
                 }
                 if (ret == UWSGI_OK) {
                         break;
                 }
                 ret = uwsgi_wait_write_req(wsgi_req);
-                if (ret < 0) { wsgi_req->write_errors++; return -1;}
+                if (ret < 0) goto error;
                 if (ret == 0) {
 			uwsgi_log("uwsgi_response_write_headers_do() TIMEOUT !!!\n");
-			wsgi_req->write_errors++;
-			return -1;
+			goto error;
 		}
         }
+	uwsgi_span_end(wsgi_req, UWSGI_SPAN_WRITE, span);
 
         wsgi_req->headers_size += wsgi_req->write_pos;
 	// reset for the next write
@@ -236,6 +470,11 @@ int uwsgi_response_write_headers_do(struct wsgi_request *wsgi_req) {
 	wsgi_req->headers_sent = 1;
 
         return UWSGI_OK;
+
+error:
+	uwsgi_span_end(wsgi_req, UWSGI_SPAN_WRITE, span);
+	wsgi_req->write_errors++;
+	return -1;
 }
 
 // this is the function called by all request plugins to send chunks to the client
@@ -259,7 +498,9 @@ int uwsgi_response_write_body_do(struct wsgi_request *wsgi_req, char *buf, size_
 
 	// if the transformation chain returns 1, we are in buffering mode
 	if (wsgi_req->transformed_chunk_len == 0 && wsgi_req->transformations) {
+		uint64_t span = uwsgi_span_begin();
 		int t_ret = uwsgi_apply_transformations(wsgi_req, buf, len);
+		uwsgi_span_end(wsgi_req, UWSGI_SPAN_TRANSFORM, span);
 		if (t_ret == 0) {
 			buf = wsgi_req->transformed_chunk;
 			len = wsgi_req->transformed_chunk_len;
@@ -289,32 +530,38 @@ sendbody:
 
 	if (len == 0) return UWSGI_OK;
 	
+	uint64_t span = uwsgi_span_begin();
 	for(;;) {
 		int ret = wsgi_req->socket->proto_write(wsgi_req, buf, len);
 		if (ret < 0) {
 			if (!uwsgi.ignore_write_errors) {
 				uwsgi_error("uwsgi_response_write_body_do()");
 			}
-			wsgi_req->write_errors++;
-			return -1;
+			goto error;
 		}
 		if (ret == UWSGI_OK) {
 			break;
 		}
 		ret = uwsgi_wait_write_req(wsgi_req);			
-		if (ret < 0) { wsgi_req->write_errors++; return -1;}
+		if (ret < 0) goto error;
                 if (ret == 0) {
                         uwsgi_log("uwsgi_response_write_body_do() TIMEOUT !!!\n");
-                        wsgi_req->write_errors++;
-                        return -1;
+                        goto error;
                 }
 	}
+	uwsgi_span_end(wsgi_req, UWSGI_SPAN_WRITE, span);
 
 	wsgi_req->response_size += wsgi_req->write_pos;
 	// reset for the next write
         wsgi_req->write_pos = 0;
 
 	return UWSGI_OK;	
+
+error:
+	// slow clients are the most interesting case for the write span
+	uwsgi_span_end(wsgi_req, UWSGI_SPAN_WRITE, span);
+	wsgi_req->write_errors++;
+	return -1;
 }
 
 int uwsgi_response_sendfile_do(struct wsgi_request *wsgi_req, int fd, size_t pos, size_t len) {
@@ -387,32 +634,26 @@ sendfile:
 
         wsgi_req->via = UWSGI_VIA_SENDFILE;
 
+	uint64_t span = uwsgi_span_begin();
         for(;;) {
                 int ret = wsgi_req->socket->proto_sendfile(wsgi_req, fd, pos, len);
                 if (ret < 0) {
                         if (!uwsgi.ignore_write_errors) {
                                 uwsgi_error("uwsgi_response_sendfile_do()");
                         }
-			wsgi_req->write_errors++;
-			if (can_close) close(fd);
-                        return -1;
+			goto error;
                 }
                 if (ret == UWSGI_OK) {
                         break;
                 }
                 ret = uwsgi_wait_write_req(wsgi_req);
-                if (ret < 0) {
-			wsgi_req->write_errors++;
-			if (can_close) close(fd);
-			return -1;
-		}
+                if (ret < 0) goto error;
 		if (ret == 0) {
                         uwsgi_log("uwsgi_response_sendfile_do() TIMEOUT !!!\n");
-                        wsgi_req->write_errors++;
-			if (can_close) close(fd);
-                        return -1;
+			goto error;
                 }	
         }
+	uwsgi_span_end(wsgi_req, UWSGI_SPAN_WRITE, span);
 
         wsgi_req->response_size += wsgi_req->write_pos;
 	// reset for the next write
@@ -420,6 +661,12 @@ sendfile:
 	// close the file descriptor
 	if (can_close) close(fd);
         return UWSGI_OK;
+
+error:
+	uwsgi_span_end(wsgi_req, UWSGI_SPAN_WRITE, span);
+	wsgi_req->write_errors++;
+	if (can_close) close(fd);
+	return -1;
 }
 
 
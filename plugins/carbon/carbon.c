@@ -163,7 +163,20 @@ static void carbon_post_init() {
 	uspi->raw=1;
 }
 
-static int carbon_write(int fd, char *fmt,...) {
+// lines are accumulated and written in big chunks (instead of a syscall for each metric)
+#define CARBON_BUFFER_SIZE 32768
+
+static int carbon_flush(int fd, struct uwsgi_buffer *ub) {
+	if (ub->pos == 0) return 1;
+	if (uwsgi_write_nb(fd, ub->buf, ub->pos, u_carbon.timeout)) {
+		uwsgi_error("carbon_flush()");
+		return 0;
+	}
+	ub->pos = 0;
+	return 1;
+}
+
+static int carbon_write(int fd, struct uwsgi_buffer *ub, char *fmt,...) {
 	va_list ap;
 	va_start(ap, fmt);
 
@@ -174,12 +187,14 @@ static int carbon_write(int fd, char *fmt,...) {
 	va_end(ap);
 
 	if (rlen < 1) return 0;
+	if (rlen > 4095) rlen = 4095;
 
-	if (uwsgi_write_nb(fd, ptr, rlen, u_carbon.timeout)) {
-		uwsgi_error("carbon_write()");
-		return 0;
+	if (ub->pos + rlen > CARBON_BUFFER_SIZE) {
+		if (!carbon_flush(fd, ub)) return 0;
 	}
 
+	if (uwsgi_buffer_append(ub, ptr, rlen)) return 0;
+
 	return 1;
 }
 
@@ -192,6 +207,7 @@ static int carbon_push_stats(int retry_cycle, time_t now) {
 	char *ip;
 	char *carbon_address = NULL;
 	int needs_retry;
+	struct uwsgi_buffer *ub = NULL;
 
 	for (i = 0; i < uwsgi.numproc; i++) {
 		u_carbon.current_busyness_values[i] = uwsgi.workers[i+1].running_time - u_carbon.last_busyness_values[i];
@@ -237,6 +253,11 @@ static int carbon_push_stats(int retry_cycle, time_t now) {
 		// put the socket in non-blocking mode
 		uwsgi_socket_nb(fd);
 
+		if (!ub) {
+			ub = uwsgi_buffer_new(CARBON_BUFFER_SIZE);
+		}
+		ub->pos = 0;
+
 		if (u_carbon.use_metrics) goto metrics_loop;
 
 		unsigned long long total_rss = 0;
@@ -252,7 +273,7 @@ static int carbon_push_stats(int retry_cycle, time_t now) {
 
 		int do_avg_push;
 
-		wok = carbon_write(fd, "%s%s.%s.requests %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) uwsgi.workers[0].requests, (unsigned long long) now);
+		wok = carbon_write(fd, ub, "%s%s.%s.requests %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) uwsgi.workers[0].requests, (unsigned long long) now);
 		if (!wok) goto clear;
 
 		for(i=1;i<=uwsgi.numproc;i++) {
@@ -291,14 +312,14 @@ static int carbon_push_stats(int retry_cycle, time_t now) {
 			//skip per worker metrics when disabled
 			if (u_carbon.no_workers) continue;
 
-			wok = carbon_write(fd, "%s%s.%s.worker%d.requests %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) uwsgi.workers[i].requests, (unsigned long long) now);
+			wok = carbon_write(fd, ub, "%s%s.%s.worker%d.requests %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) uwsgi.workers[i].requests, (unsigned long long) now);
 			if (!wok) goto clear;
 
 			if (uwsgi.shared->options[UWSGI_OPTION_MEMORY_DEBUG] == 1 || uwsgi.force_get_memusage) {
-				wok = carbon_write(fd, "%s%s.%s.worker%d.rss_size %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) uwsgi.workers[i].rss_size, (unsigned long long) now);
+				wok = carbon_write(fd, ub, "%s%s.%s.worker%d.rss_size %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) uwsgi.workers[i].rss_size, (unsigned long long) now);
 				if (!wok) goto clear;
 
-				wok = carbon_write(fd, "%s%s.%s.worker%d.vsz_size %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) uwsgi.workers[i].vsz_size, (unsigned long long) now);
+				wok = carbon_write(fd, ub, "%s%s.%s.worker%d.vsz_size %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) uwsgi.workers[i].vsz_size, (unsigned long long) now);
 				if (!wok) goto clear;
 			}
 
@@ -312,26 +333,26 @@ static int carbon_push_stats(int retry_cycle, time_t now) {
 				}
 			}
 			if (do_avg_push) {
-				wok = carbon_write(fd, "%s%s.%s.worker%d.avg_rt %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) avg_rt, (unsigned long long) now);
+				wok = carbon_write(fd, ub, "%s%s.%s.worker%d.avg_rt %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) avg_rt, (unsigned long long) now);
 				if (!wok) goto clear;
 			}
 
-			wok = carbon_write(fd, "%s%s.%s.worker%d.tx %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) uwsgi.workers[i].tx, (unsigned long long) now);
+			wok = carbon_write(fd, ub, "%s%s.%s.worker%d.tx %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) uwsgi.workers[i].tx, (unsigned long long) now);
 			if (!wok) goto clear;
 
-			wok = carbon_write(fd, "%s%s.%s.worker%d.busyness %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) worker_busyness, (unsigned long long) now);
+			wok = carbon_write(fd, ub, "%s%s.%s.worker%d.busyness %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) worker_busyness, (unsigned long long) now);
 			if (!wok) goto clear;
 
-			wok = carbon_write(fd, "%s%s.%s.worker%d.harakiri %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) uwsgi.workers[i].harakiri_count, (unsigned long long) now);
+			wok = carbon_write(fd, ub, "%s%s.%s.worker%d.harakiri %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, i, (unsigned long long) uwsgi.workers[i].harakiri_count, (unsigned long long) now);
 			if (!wok) goto clear;
 
 		}
 
 		if (uwsgi.shared->options[UWSGI_OPTION_MEMORY_DEBUG] == 1 || uwsgi.force_get_memusage) {
-			wok = carbon_write(fd, "%s%s.%s.rss_size %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_rss, (unsigned long long) now);
+			wok = carbon_write(fd, ub, "%s%s.%s.rss_size %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_rss, (unsigned long long) now);
 			if (!wok) goto clear;
 
-			wok = carbon_write(fd, "%s%s.%s.vsz_size %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_vsz, (unsigned long long) now);
+			wok = carbon_write(fd, ub, "%s%s.%s.vsz_size %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_vsz, (unsigned long long) now);
 			if (!wok) goto clear;
 		}
 
@@ -346,11 +367,11 @@ static int carbon_push_stats(int retry_cycle, time_t now) {
 			}
 		}
 		if (do_avg_push) {
-			wok = carbon_write(fd, "%s%s.%s.avg_rt %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) c_total_avg_rt, (unsigned long long) now);
+			wok = carbon_write(fd, ub, "%s%s.%s.avg_rt %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) c_total_avg_rt, (unsigned long long) now);
 			if (!wok) goto clear;
 		}
 
-		wok = carbon_write(fd, "%s%s.%s.tx %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_tx, (unsigned long long) now);
+		wok = carbon_write(fd, ub, "%s%s.%s.tx %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_tx, (unsigned long long) now);
 		if (!wok) goto clear;
 
 		if (active_workers > 0) {
@@ -359,32 +380,32 @@ static int carbon_push_stats(int retry_cycle, time_t now) {
 		} else {
 			total_avg_busyness = 0;
 		}
-		wok = carbon_write(fd, "%s%s.%s.busyness %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_avg_busyness, (unsigned long long) now);
+		wok = carbon_write(fd, ub, "%s%s.%s.busyness %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_avg_busyness, (unsigned long long) now);
 		if (!wok) goto clear;
 
-		wok = carbon_write(fd, "%s%s.%s.active_workers %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) active_workers, (unsigned long long) now);
+		wok = carbon_write(fd, ub, "%s%s.%s.active_workers %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) active_workers, (unsigned long long) now);
 		if (!wok) goto clear;
 
 		if (uwsgi.cheaper) {
-			wok = carbon_write(fd, "%s%s.%s.cheaped_workers %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) uwsgi.numproc - active_workers, (unsigned long long) now);
+			wok = carbon_write(fd, ub, "%s%s.%s.cheaped_workers %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) uwsgi.numproc - active_workers, (unsigned long long) now);
 			if (!wok) goto clear;
 		}
 
-		wok = carbon_write(fd, "%s%s.%s.harakiri %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_harakiri, (unsigned long long) now);
+		wok = carbon_write(fd, ub, "%s%s.%s.harakiri %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, (unsigned long long) total_harakiri, (unsigned long long) now);
 		if (!wok) goto clear;
 
 metrics_loop:
 		if (u_carbon.use_metrics) {
 			struct uwsgi_metric *um = uwsgi.metrics;
 			while(um) {
-				uwsgi_rlock(uwsgi.metrics_lock);
-				wok = carbon_write(fd, "%s%s.%s.%.*s %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, um->name_len, um->name, (unsigned long long) *um->value, (unsigned long long) now);
-				uwsgi_rwunlock(uwsgi.metrics_lock);
+				wok = carbon_write(fd, ub, "%s%s.%s.%.*s %llu %llu\n", u_carbon.root_node, u_carbon.hostname, u_carbon.id, um->name_len, um->name, (unsigned long long) uwsgi_metric_get_handle(um), (unsigned long long) now);
 				if (!wok) goto clear;
 				um = um->next;
 			}
 		}
 
+		if (!carbon_flush(fd, ub)) goto clear;
+
 		usl->healthy = 1;
 		usl->errors = 0;
 
@@ -396,6 +417,7 @@ nxt:
 		usl = usl->next;
 	}
 
+	if (ub) uwsgi_buffer_destroy(ub);
 	return needs_retry;
 }
 
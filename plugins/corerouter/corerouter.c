@@ -40,6 +40,7 @@ struct corerouter_peer *uwsgi_cr_peer_add(struct corerouter_session *cs) {
 	peers = uwsgi_calloc(sizeof(struct corerouter_peer));
 	peers->session = cs;
 	peers->fd = -1;
+	peers->body_fd = -1;
 	// create input buffer
 	peers->in = uwsgi_buffer_new(uwsgi.page_size);
 	// add timeout
@@ -99,6 +100,10 @@ void uwsgi_cr_peer_del(struct corerouter_peer *peer) {
 
 	uwsgi_cr_peer_reset(peer);
 
+	if (peer->body_fd >= 0) {
+		close(peer->body_fd);
+	}
+
 	if (peer->in) {
 		uwsgi_buffer_destroy(peer->in);
 	}
@@ -107,6 +112,13 @@ void uwsgi_cr_peer_del(struct corerouter_peer *peer) {
 	if (peer->out && peer->out_need_free) {
 		uwsgi_buffer_destroy(peer->out);
 	}
+
+	if (peer->key_need_free) {
+		free(peer->key);
+	}
+	if (peer->hash_key) {
+		free(peer->hash_key);
+	}
 	free(peer);
 }
 
@@ -228,7 +240,8 @@ void uwsgi_opt_corerouter_ss(char *opt, char *value, void *cr) {
         ucr->has_subscription_sockets++;
 
 	// this is the subscription hash table
-	ucr->subscriptions = uwsgi_subscription_init_ht();
+	if (!ucr->subscriptions)
+		ucr->subscriptions = uwsgi_subscription_init_ht();
 
 	ucr->has_backends++;
 
@@ -271,6 +284,10 @@ void corerouter_manage_subscription(char *key, uint16_t keylen, char *val, uint1
 		usr->sign = val;
                 usr->sign_len = vallen;
 	}
+	else if (!uwsgi_strncmp("algo", 4, key, keylen)) {
+		usr->algo = val;
+		usr->algo_len = vallen;
+	}
 }
 
 void corerouter_close_peer(struct uwsgi_corerouter *ucr, struct corerouter_peer *peer) {
@@ -287,6 +304,14 @@ void corerouter_close_peer(struct uwsgi_corerouter *ucr, struct corerouter_peer
 #ifdef UWSGI_DEBUG
                uwsgi_log("[2] node %.*s refcnt: %llu\n", peer->un->len, peer->un->name, peer->un->reference);
 #endif
+		// feed the response time to the load balancing algorithm
+		if (!peer->failed && peer->un_start) {
+			uwsgi_subscribe_node_rtt(peer->un, uwsgi_micros() - peer->un_start);
+		}
+		// a request only resets the error count, ejected nodes are re-admitted by the active checks
+		if (!peer->failed && ucr->health_check_type && !peer->un->ejected) {
+			peer->un->consecutive_errors = 0;
+		}
         }
 
 	if (peer->failed) {
@@ -304,6 +329,10 @@ void corerouter_close_peer(struct uwsgi_corerouter *ucr, struct corerouter_peer
                         }
                 }
 
+                // with active health checks, failures count for outlier ejection too
+                if (ucr->health_check_type && ucr->subscriptions && peer->un && peer->un->len > 0) {
+			uwsgi_cr_health_error(ucr, peer->un);
+		}
                 // now check for dead nodes
                 if (ucr->subscriptions && peer->un && peer->un->len > 0) {
 
@@ -364,6 +393,10 @@ void corerouter_close_peer(struct uwsgi_corerouter *ucr, struct corerouter_peer
 	}
 
 end:
+	// give multiplexed protocols a chance to notify the client
+	if (peer != cs->main_peer && cs->close_peer) {
+		cs->close_peer(peer);
+	}
 	uwsgi_cr_peer_del(peer);
 
 	if (peer == cs->main_peer) {
@@ -377,6 +410,130 @@ end:
 	}
 }
 
+static void cr_get_hash_key(char *key, uint16_t keylen, char *val, uint16_t vallen, void *data) {
+	struct corerouter_peer *peer = (struct corerouter_peer *) data;
+	struct uwsgi_corerouter *ucr = peer->session->corerouter;
+	if (peer->hash_key) return;
+	if (!uwsgi_strncmp(ucr->hash_var, ucr->hash_var_len, key, keylen)) {
+		peer->hash_key = uwsgi_concat2n(val, vallen, "", 0);
+		peer->hash_key_len = vallen;
+	}
+}
+
+// extract the consistent hashing key of a peer from a uwsgi packet
+int uwsgi_cr_peer_hash_key(struct corerouter_peer *peer, char *buf, uint16_t len) {
+	struct uwsgi_corerouter *ucr = peer->session->corerouter;
+	if (!ucr->hash_var) return 0;
+	if (!ucr->hash_var_len) ucr->hash_var_len = strlen(ucr->hash_var);
+	if (peer->hash_key) {
+		free(peer->hash_key);
+		peer->hash_key = NULL;
+		peer->hash_key_len = 0;
+	}
+	return uwsgi_hooked_parse(buf, len, cr_get_hash_key, (void *) peer);
+}
+
+/*
+
+	post-buffering memory accounting
+
+	bodies are buffered in memory until the per-session threshold (post_buffering) is reached,
+	then they are moved to a temp file. The memory used by all of the sessions of a router process
+	is bounded by pb_memory_limit: when it is exhausted new bodies are not read (the client is paused)
+	until another session releases its memory.
+
+	Responses are not part of the budget as they are never buffered: reads from a backend are
+	suspended while the client is being written (cr_write_to_main), so a session holds at most one read
+	buffer per peer (HTTP/2 streams keep reading, but only what the client window allows is queued and
+	streams blocked by flow control are suspended, their number is capped by SETTINGS_MAX_CONCURRENT_STREAMS).
+
+*/
+
+// get an anonymous temp file in pb_base_dir
+int uwsgi_cr_pb_tmpfd(struct uwsgi_corerouter *ucr) {
+	int fd = -1;
+#ifdef O_TMPFILE
+	fd = open(ucr->pb_base_dir, O_TMPFILE | O_RDWR, S_IRUSR | S_IWUSR);
+	if (fd >= 0) return fd;
+	// fallback to old style
+#endif
+	char *template = uwsgi_concat2(ucr->pb_base_dir, "/uwsgiXXXXXX");
+	fd = mkstemp(template);
+	if (fd < 0) {
+		uwsgi_error("uwsgi_cr_pb_tmpfd()/mkstemp()");
+	}
+	else {
+		unlink(template);
+	}
+	free(template);
+	return fd;
+}
+
+int uwsgi_cr_pb_full(struct uwsgi_corerouter *ucr) {
+	if (!ucr->pb_memory_limit) return 0;
+	return ucr->pb_memory >= ucr->pb_memory_limit;
+}
+
+void uwsgi_cr_pb_acquire(struct corerouter_session *cs, size_t len) {
+	cs->pb_memory += len;
+	cs->corerouter->pb_memory += len;
+}
+
+static void uwsgi_cr_pb_unlink(struct corerouter_session *cs) {
+	struct uwsgi_corerouter *ucr = cs->corerouter;
+	if (!cs->pb_waiting) return;
+	if (cs->pb_prev) {
+		cs->pb_prev->pb_next = cs->pb_next;
+	}
+	else {
+		ucr->pb_waiting = cs->pb_next;
+	}
+	if (cs->pb_next) {
+		cs->pb_next->pb_prev = cs->pb_prev;
+	}
+	else {
+		ucr->pb_waiting_tail = cs->pb_prev;
+	}
+	cs->pb_prev = NULL;
+	cs->pb_next = NULL;
+	cs->pb_waiting = 0;
+}
+
+// pause the client of a session until some buffering memory is available
+int uwsgi_cr_pb_wait(struct corerouter_session *cs) {
+	struct uwsgi_corerouter *ucr = cs->corerouter;
+	if (uwsgi_cr_set_hooks(cs->main_peer, NULL, NULL)) return -1;
+	if (cs->pb_waiting) return 0;
+	cs->pb_waiting = 1;
+	cs->pb_prev = ucr->pb_waiting_tail;
+	cs->pb_next = NULL;
+	if (ucr->pb_waiting_tail) {
+		ucr->pb_waiting_tail->pb_next = cs;
+	}
+	else {
+		ucr->pb_waiting = cs;
+	}
+	ucr->pb_waiting_tail = cs;
+	return 0;
+}
+
+// give back the memory of a session and resume the waiting ones (in FIFO order)
+void uwsgi_cr_pb_release(struct corerouter_session *cs) {
+	struct uwsgi_corerouter *ucr = cs->corerouter;
+	uwsgi_cr_pb_unlink(cs);
+	if (cs->pb_memory == 0) return;
+	ucr->pb_memory -= cs->pb_memory;
+	cs->pb_memory = 0;
+
+	while(ucr->pb_waiting && !uwsgi_cr_pb_full(ucr)) {
+		struct corerouter_session *waiting = ucr->pb_waiting;
+		uwsgi_cr_pb_unlink(waiting);
+		if (waiting->pb_resume && waiting->pb_resume(waiting)) {
+			corerouter_close_session(ucr, waiting);
+		}
+	}
+}
+
 // destroy a session
 void corerouter_close_session(struct uwsgi_corerouter *ucr, struct corerouter_session *cr_session) {
 
@@ -401,6 +558,8 @@ void corerouter_close_session(struct uwsgi_corerouter *ucr, struct corerouter_se
 	if (cr_session->close)
 		cr_session->close(cr_session);
 
+	uwsgi_cr_pb_release(cr_session);
+
 	free(cr_session);
 
 	if (ucr->active_sessions == 0) {
@@ -605,6 +764,18 @@ struct corerouter_session *corerouter_alloc_session(struct uwsgi_corerouter *ucr
 	return cs;
 }
 
+// dump the subscriptions when they change (at most every 10 seconds)
+static void corerouter_subscriptions_dump(struct uwsgi_corerouter *ucr, time_t now) {
+	if (ucr->subscriptions->generation == ucr->subscriptions_dump_generation) return;
+	if (now - ucr->subscriptions_dump_last < 10) return;
+	ucr->subscriptions_dump_last = now;
+	if (uwsgi_subscriptions_dump(ucr->subscriptions, ucr->subscriptions_dump)) {
+		uwsgi_log("[uwsgi-%s] unable to dump subscriptions to %s\n", ucr->short_name, ucr->subscriptions_dump);
+		return;
+	}
+	ucr->subscriptions_dump_generation = ucr->subscriptions->generation;
+}
+
 void uwsgi_corerouter_loop(int id, void *data) {
 
 	int i;
@@ -669,6 +840,17 @@ void uwsgi_corerouter_loop(int id, void *data) {
 		}
 	}
 
+	uwsgi_cr_health_init(ucr);
+
+	if (ucr->subscriptions_dump && ucr->subscriptions) {
+		uwsgi_subscriptions_load(ucr->subscriptions, ucr->subscriptions_dump);
+		ucr->subscriptions_dump_generation = ucr->subscriptions->generation;
+		ucr->subscriptions_dump_last = uwsgi_now();
+	}
+	else {
+		ucr->subscriptions_dump = NULL;
+	}
+
 	if (!ucr->pb_base_dir) {
 		ucr->pb_base_dir = getenv("TMPDIR");
 		if (!ucr->pb_base_dir)
@@ -742,6 +924,11 @@ void uwsgi_corerouter_loop(int id, void *data) {
 			}
 		}
 
+		// wake up at least every second to run the health checks
+		if (ucr->health_check_type && (delta < 0 || delta > 1)) {
+			delta = 1;
+		}
+
 		if (uwsgi.master_process && ucr->harakiri > 0) {
 			ushared->gateways_harakiri[id] = 0;
 		}
@@ -817,6 +1004,10 @@ void uwsgi_corerouter_loop(int id, void *data) {
 			else if (ucr->interesting_fd == ucr->cr_stats_server) {
 				corerouter_send_stats(ucr);
 			}
+			// manage a health check
+			else if (ucr->hc_table && ucr->hc_table[ucr->interesting_fd]) {
+				uwsgi_cr_health_event(ucr, ucr->hc_table[ucr->interesting_fd]);
+			}
 			else {
 				struct corerouter_peer *peer = ucr->cr_table[ucr->interesting_fd];
 
@@ -864,6 +1055,13 @@ void uwsgi_corerouter_loop(int id, void *data) {
 				
 			}
 		}
+
+		uwsgi_cr_health_run(ucr, now);
+
+		// persist the subscriptions (only the first process of the router writes them)
+		if (ucr->subscriptions_dump && i_am_the_first) {
+			corerouter_subscriptions_dump(ucr, now);
+		}
 	}
 
 }
@@ -963,6 +1161,7 @@ void corerouter_send_stats(struct uwsgi_corerouter *ucr) {
         if (uwsgi_stats_keyval_comma(us, "cwd", cwd)) goto end0;
 
         if (uwsgi_stats_keylong_comma(us, "active_sessions", (unsigned long long) ucr->active_sessions)) goto end0;
+        if (uwsgi_stats_keylong_comma(us, "post_buffering_memory", (unsigned long long) ucr->pb_memory)) goto end0;
 
 	if (uwsgi_stats_key(us , ucr->short_name)) goto end0;
         if (uwsgi_stats_list_open(us)) goto end0;
@@ -1007,60 +1206,51 @@ void corerouter_send_stats(struct uwsgi_corerouter *ucr) {
 		if (uwsgi_stats_key(us , "subscriptions")) goto end0;
 		if (uwsgi_stats_list_open(us)) goto end0;
 
-		int i;
-		int first_processed = 0;
-		for(i=0;i<UMAX16;i++) {
-			struct uwsgi_subscribe_slot *s_slot = ucr->subscriptions[i];
-			if (s_slot && first_processed) {
-				if (uwsgi_stats_comma(us)) goto end0;
-			}
-			while (s_slot) {
-				first_processed = 1;
+		struct uwsgi_subscribe_slot *s_slot = uwsgi_subscriptions_next(ucr->subscriptions, NULL);
+		while (s_slot) {
+			if (uwsgi_stats_object_open(us)) goto end0;
+			if (uwsgi_stats_keyvaln_comma(us, "key", s_slot->key, s_slot->keylen)) goto end0;
+			if (uwsgi_stats_keylong_comma(us, "hash", (unsigned long long) s_slot->hash)) goto end0;
+			if (uwsgi_stats_keylong_comma(us, "hits", (unsigned long long) s_slot->hits)) goto end0;
+
+			if (uwsgi_stats_key(us , "nodes")) goto end0;
+			if (uwsgi_stats_list_open(us)) goto end0;
+
+			struct uwsgi_subscribe_node *s_node = s_slot->nodes;
+			while (s_node) {
 				if (uwsgi_stats_object_open(us)) goto end0;
-				if (uwsgi_stats_keyvaln_comma(us, "key", s_slot->key, s_slot->keylen)) goto end0;
-				if (uwsgi_stats_keylong_comma(us, "hash", (unsigned long long) s_slot->hash)) goto end0;
-				if (uwsgi_stats_keylong_comma(us, "hits", (unsigned long long) s_slot->hits)) goto end0;
-
-				if (uwsgi_stats_key(us , "nodes")) goto end0;
-				if (uwsgi_stats_list_open(us)) goto end0;
-
-				struct uwsgi_subscribe_node *s_node = s_slot->nodes;
-				while (s_node) {
-					if (uwsgi_stats_object_open(us)) goto end0;
-
-					if (uwsgi_stats_keyvaln_comma(us, "name", s_node->name, s_node->len)) goto end0;
-
-					if (uwsgi_stats_keylong_comma(us, "modifier1", (unsigned long long) s_node->modifier1)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "modifier2", (unsigned long long) s_node->modifier2)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "last_check", (unsigned long long) s_node->last_check)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "requests", (unsigned long long) s_node->requests)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "last_requests", (unsigned long long) s_node->last_requests)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "tx", (unsigned long long) s_node->transferred)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "cores", (unsigned long long) s_node->cores)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "load", (unsigned long long) s_node->load)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "weight", (unsigned long long) s_node->weight)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "wrr", (unsigned long long) s_node->wrr)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "ref", (unsigned long long) s_node->reference)) goto end0;
-					if (uwsgi_stats_keylong_comma(us, "failcnt", (unsigned long long) s_node->failcnt)) goto end0;
-					if (uwsgi_stats_keylong(us, "death_mark", (unsigned long long) s_node->death_mark)) goto end0;
-
-					if (uwsgi_stats_object_close(us)) goto end0;
-					if (s_node->next) {
-						if (uwsgi_stats_comma(us)) goto end0;
-					}
-					s_node = s_node->next;
-				}
 
-				if (uwsgi_stats_list_close(us)) goto end0;
+				if (uwsgi_stats_keyvaln_comma(us, "name", s_node->name, s_node->len)) goto end0;
+
+				if (uwsgi_stats_keylong_comma(us, "modifier1", (unsigned long long) s_node->modifier1)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "modifier2", (unsigned long long) s_node->modifier2)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "last_check", (unsigned long long) s_node->last_check)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "requests", (unsigned long long) s_node->requests)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "last_requests", (unsigned long long) s_node->last_requests)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "tx", (unsigned long long) s_node->transferred)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "cores", (unsigned long long) s_node->cores)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "load", (unsigned long long) s_node->load)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "weight", (unsigned long long) s_node->weight)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "ewma", (unsigned long long) s_node->ewma)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "wrr", (unsigned long long) s_node->wrr)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "ref", (unsigned long long) s_node->reference)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "failcnt", (unsigned long long) s_node->failcnt)) goto end0;
+				if (uwsgi_stats_keylong_comma(us, "ejected", (unsigned long long) s_node->ejected)) goto end0;
+				if (uwsgi_stats_keylong(us, "death_mark", (unsigned long long) s_node->death_mark)) goto end0;
+
 				if (uwsgi_stats_object_close(us)) goto end0;
-				if (s_slot->next) {
+				if (s_node->next) {
 					if (uwsgi_stats_comma(us)) goto end0;
 				}
+				s_node = s_node->next;
+			}
 
-				s_slot = s_slot->next;
-				// check for loopy optimization
-				if (s_slot == ucr->subscriptions[i])
-					break;
+			if (uwsgi_stats_list_close(us)) goto end0;
+			if (uwsgi_stats_object_close(us)) goto end0;
+
+			s_slot = uwsgi_subscriptions_next(ucr->subscriptions, s_slot);
+			if (s_slot) {
+				if (uwsgi_stats_comma(us)) goto end0;
 			}
 		}
 
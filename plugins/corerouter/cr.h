@@ -155,6 +155,11 @@ struct corerouter_peer {
 	// backend info
         struct uwsgi_subscribe_node *un;
         struct uwsgi_string_list *static_node;
+	// when the backend node has been choosen (used for response time tracking)
+	uint64_t un_start;
+	// key used by consistent hashing algorithms
+	char *hash_key;
+	uint16_t hash_key_len;
 
 	// incoming data 
         struct uwsgi_buffer *in;
@@ -178,6 +183,19 @@ struct corerouter_peer {
 	// parsed key
         char *key;
         uint16_t key_len;
+	int key_need_free;
+
+	// flow control window (used by multiplexed protocols)
+	int64_t window;
+	// received data not yet written to the backend (its window is given back after the write)
+	uint32_t window_pending;
+	// chunked response decoding (used by multiplexed protocols)
+	int chunked;
+	uint64_t chunk_left;
+	// request body stored in a temp file (used by multiplexed protocols)
+	int body_fd;
+	uint64_t body_size;
+	uint64_t body_pos;
 
 	uint8_t modifier1;
 	uint8_t modifier2;
@@ -186,6 +204,34 @@ struct corerouter_peer {
 	struct corerouter_peer *next;
 };
 
+// an in-flight active health check
+struct corerouter_health_check {
+	int fd;
+	// the checked backend (a subscription node or a static node)
+	struct uwsgi_subscribe_node *node;
+	struct uwsgi_string_list *static_node;
+	char *address;
+	uint16_t address_len;
+	char *key;
+	uint16_t key_len;
+
+	struct uwsgi_buffer *out;
+	size_t out_pos;
+	char buf[32];
+	size_t buf_pos;
+
+	int connecting;
+	uint64_t started;
+	time_t deadline;
+
+	struct corerouter_health_check *prev;
+	struct corerouter_health_check *next;
+};
+
+#define UWSGI_CR_HEALTH_TCP	1
+#define UWSGI_CR_HEALTH_PING	2
+#define UWSGI_CR_HEALTH_HTTP	3
+
 struct uwsgi_corerouter {
 
 	char *name;
@@ -222,6 +268,12 @@ struct uwsgi_corerouter {
 
         size_t post_buffering;
         char *pb_base_dir;
+	// memory budget (shared by all of the sessions) for buffered bodies
+	uint64_t pb_memory_limit;
+	uint64_t pb_memory;
+	// sessions waiting for buffering memory
+	struct corerouter_session *pb_waiting;
+	struct corerouter_session *pb_waiting_tail;
 
         struct uwsgi_string_list *static_nodes;
         struct uwsgi_string_list *current_static_node;
@@ -234,7 +286,14 @@ struct uwsgi_corerouter {
         int socket_num;
         struct uwsgi_socket *to_socket;
 
-        struct uwsgi_subscribe_slot **subscriptions;
+        struct uwsgi_subscriptions *subscriptions;
+	// subscriptions are loaded from (and periodically dumped to) this file
+	char *subscriptions_dump;
+	uint64_t subscriptions_dump_generation;
+	time_t subscriptions_dump_last;
+	// request var used as consistent hashing key
+	char *hash_var;
+	size_t hash_var_len;
 
         struct uwsgi_string_list *fallback;
 
@@ -246,6 +305,20 @@ struct uwsgi_corerouter {
 
         struct uwsgi_rb_timer *subscriptions_check;
 
+	// active health checks and outlier ejection
+	char *health_check;
+	int health_check_type;
+	char *health_check_path;
+	int health_check_interval;
+	int health_check_timeout;
+	int outlier_errors;
+	int outlier_latency;
+	int slow_start;
+	// last second of the schedule already processed
+	time_t health_check_last;
+	struct corerouter_health_check *health_checks;
+	struct corerouter_health_check **hc_table;
+
         int cheap;
         int i_am_cheap;
 
@@ -277,6 +350,8 @@ struct corerouter_session {
 
 	void (*close)(struct corerouter_session *);
 	int (*retry)(struct corerouter_peer *);
+	// called when a backend peer is destroyed without closing the session
+	void (*close_peer)(struct corerouter_peer *);
 
 	// leave the main peer alive
 	int can_keepalive;
@@ -291,6 +366,14 @@ struct corerouter_session {
 	// connect after the next successfull write
 	struct corerouter_peer *connect_peer_after_write;
 
+	// memory used by buffered bodies
+	size_t pb_memory;
+	// called when the session can start buffering again
+	int (*pb_resume)(struct corerouter_session *);
+	int pb_waiting;
+	struct corerouter_session *pb_prev;
+	struct corerouter_session *pb_next;
+
 	union uwsgi_sockaddr client_sockaddr;
 #ifdef AF_INET6
 	char client_address[INET6_ADDRSTRLEN];
@@ -340,4 +423,17 @@ int uwsgi_cr_set_hooks(struct corerouter_peer *, ssize_t (*)(struct corerouter_p
 struct corerouter_peer *uwsgi_cr_peer_add(struct corerouter_session *);
 struct corerouter_peer *uwsgi_cr_peer_find_by_sid(struct corerouter_session *, uint32_t);
 void corerouter_close_peer(struct uwsgi_corerouter *, struct corerouter_peer *);
+
+void uwsgi_cr_health_init(struct uwsgi_corerouter *);
+void uwsgi_cr_health_run(struct uwsgi_corerouter *, time_t);
+void uwsgi_cr_health_event(struct uwsgi_corerouter *, struct corerouter_health_check *);
+void uwsgi_cr_health_error(struct uwsgi_corerouter *, struct uwsgi_subscribe_node *);
+void uwsgi_cr_health_success(struct uwsgi_corerouter *, struct uwsgi_subscribe_node *);
+
+int uwsgi_cr_peer_hash_key(struct corerouter_peer *, char *, uint16_t);
+int uwsgi_cr_pb_tmpfd(struct uwsgi_corerouter *);
+int uwsgi_cr_pb_full(struct uwsgi_corerouter *);
+void uwsgi_cr_pb_acquire(struct corerouter_session *, size_t);
+void uwsgi_cr_pb_release(struct corerouter_session *);
+int uwsgi_cr_pb_wait(struct corerouter_session *);
 struct uwsgi_rb_timer *corerouter_reset_timeout(struct uwsgi_corerouter *, struct corerouter_peer *);
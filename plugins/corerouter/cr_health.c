@@ -0,0 +1,351 @@
+/*
+
+active health checks for corerouter backends
+
+every --<router>-health-check-interval seconds all of the subscription nodes and the static nodes
+are checked (tcp connect, uwsgi ping or a GET request) in the router event loop. The checks are
+spread over the interval: each node is checked in the second given by the hash of its address,
+so a big pool does not open all of its connections in the same tick.
+
+checks failing for local reasons (file descriptors or memory exhausted) are skipped and do not
+count as node errors.
+
+subscription nodes failing --<router>-outlier-errors consecutive checks (or requests) are ejected
+from load balancing until a check succeeds again, then they are gradually re-admitted (slow start).
+Only the checks re-admit nodes: successful requests just reset the error count, and connection errors
+still mark the node as dead as they do without health checks.
+Static nodes are marked as failed (the same way the router does on connection errors).
+
+*/
+
+#include "../../uwsgi.h"
+
+extern struct uwsgi_server uwsgi;
+
+#include "cr.h"
+
+void uwsgi_cr_health_init(struct uwsgi_corerouter *ucr) {
+	if (!ucr->health_check)
+		return;
+
+	if (!strcmp(ucr->health_check, "tcp")) {
+		ucr->health_check_type = UWSGI_CR_HEALTH_TCP;
+	}
+	else if (!strcmp(ucr->health_check, "ping")) {
+		ucr->health_check_type = UWSGI_CR_HEALTH_PING;
+	}
+	else if (!strcmp(ucr->health_check, "http")) {
+		ucr->health_check_type = UWSGI_CR_HEALTH_HTTP;
+		ucr->health_check_path = "/";
+	}
+	else if (!uwsgi_starts_with(ucr->health_check, strlen(ucr->health_check), "http:", 5)) {
+		ucr->health_check_type = UWSGI_CR_HEALTH_HTTP;
+		ucr->health_check_path = ucr->health_check + 5;
+	}
+	else {
+		uwsgi_log("[uwsgi-%s] unknown health check \"%s\" (tcp, ping, http[:path] are supported)\n", ucr->short_name, ucr->health_check);
+		exit(1);
+	}
+
+	if (!ucr->health_check_interval)
+		ucr->health_check_interval = 5;
+	if (!ucr->health_check_timeout)
+		ucr->health_check_timeout = 3;
+	if (!ucr->outlier_errors)
+		ucr->outlier_errors = 3;
+	// a node is checked again after an interval, its previous check must be expired by then
+	if (ucr->health_check_timeout > ucr->health_check_interval)
+		ucr->health_check_timeout = ucr->health_check_interval;
+
+	ucr->hc_table = uwsgi_calloc(sizeof(struct corerouter_health_check *) * uwsgi.max_fd);
+
+	uwsgi_log("[uwsgi-%s] %s health checks every %d seconds\n", ucr->short_name, ucr->health_check, ucr->health_check_interval);
+}
+
+// a backend request (or check) failed
+void uwsgi_cr_health_error(struct uwsgi_corerouter *ucr, struct uwsgi_subscribe_node *node) {
+	node->consecutive_errors++;
+	node->failcnt++;
+	if (!node->ejected && node->consecutive_errors >= (uint64_t) ucr->outlier_errors) {
+		node->ejected = 1;
+		node->readmitted = 0;
+		node->slot->dirty = 1;
+		uwsgi_log("[uwsgi-%s] %.*s => ejecting %.*s (%llu consecutive errors)\n", ucr->short_name, (int) node->slot->keylen, node->slot->key, (int) node->len, node->name, (unsigned long long) node->consecutive_errors);
+	}
+}
+
+// a backend request (or check) succeeded
+void uwsgi_cr_health_success(struct uwsgi_corerouter *ucr, struct uwsgi_subscribe_node *node) {
+	node->consecutive_errors = 0;
+	if (node->ejected) {
+		node->ejected = 0;
+		node->slot->dirty = 1;
+		if (ucr->slow_start > 0) {
+			node->readmitted = uwsgi_now();
+			node->slow_start = ucr->slow_start;
+		}
+		uwsgi_log("[uwsgi-%s] %.*s => re-admitting %.*s\n", ucr->short_name, (int) node->slot->keylen, node->slot->key, (int) node->len, node->name);
+	}
+}
+
+// ok: 1 healthy, 0 unhealthy, -1 skipped (the check could not be run)
+static void cr_health_done(struct uwsgi_corerouter *ucr, struct corerouter_health_check *hc, int ok) {
+
+	uint64_t rtt = uwsgi_micros() - hc->started;
+	if (ok < 0) {
+		if (!ucr->quiet)
+			uwsgi_log("[uwsgi-%s] health check of %.*s skipped\n", ucr->short_name, (int) hc->address_len, hc->address);
+	}
+	else if (ok && ucr->outlier_latency > 0 && rtt > (uint64_t) ucr->outlier_latency * 1000) {
+		if (!ucr->quiet)
+			uwsgi_log("[uwsgi-%s] health check of %.*s took %llu ms\n", ucr->short_name, (int) hc->address_len, hc->address, (unsigned long long) (rtt / 1000));
+		ok = 0;
+	}
+
+	if (hc->node) {
+		if (ok > 0) {
+			uwsgi_cr_health_success(ucr, hc->node);
+		}
+		else if (ok == 0) {
+			uwsgi_cr_health_error(ucr, hc->node);
+		}
+		hc->node->reference--;
+	}
+	else if (hc->static_node && ok >= 0) {
+		if (ok) {
+			if (hc->static_node->custom > 0) {
+				uwsgi_log("[uwsgi-%s] re-admitting %.*s\n", ucr->short_name, (int) hc->address_len, hc->address);
+			}
+			hc->static_node->custom = 0;
+		}
+		else {
+			if (hc->static_node->custom == 0) {
+				uwsgi_log("[uwsgi-%s] health check failed, marking %.*s as failed\n", ucr->short_name, (int) hc->address_len, hc->address);
+			}
+			hc->static_node->custom = uwsgi_now();
+		}
+	}
+
+	if (hc->fd >= 0) {
+		ucr->hc_table[hc->fd] = NULL;
+		close(hc->fd);
+	}
+
+	if (hc->prev) {
+		hc->prev->next = hc->next;
+	}
+	else if (ucr->health_checks == hc) {
+		ucr->health_checks = hc->next;
+	}
+	if (hc->next) {
+		hc->next->prev = hc->prev;
+	}
+
+	if (hc->out)
+		uwsgi_buffer_destroy(hc->out);
+	free(hc);
+}
+
+static struct uwsgi_buffer *cr_health_request(struct uwsgi_corerouter *ucr, struct corerouter_health_check *hc) {
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
+	ub->pos = 4;
+	if (ucr->health_check_type == UWSGI_CR_HEALTH_PING) {
+		if (uwsgi_buffer_set_uh(ub, UWSGI_MODIFIER_PING, 0)) goto error;
+		return ub;
+	}
+
+	char *host = hc->key;
+	uint16_t host_len = hc->key_len;
+	if (!host) {
+		host = "localhost";
+		host_len = 9;
+	}
+	size_t path_len = strlen(ucr->health_check_path);
+	if (uwsgi_buffer_append_keyval(ub, "REQUEST_METHOD", 14, "GET", 3)) goto error;
+	if (uwsgi_buffer_append_keyval(ub, "REQUEST_URI", 11, ucr->health_check_path, path_len)) goto error;
+	if (uwsgi_buffer_append_keyval(ub, "PATH_INFO", 9, ucr->health_check_path, path_len)) goto error;
+	if (uwsgi_buffer_append_keyval(ub, "QUERY_STRING", 12, "", 0)) goto error;
+	if (uwsgi_buffer_append_keyval(ub, "SERVER_PROTOCOL", 15, "HTTP/1.0", 8)) goto error;
+	if (uwsgi_buffer_append_keyval(ub, "SERVER_NAME", 11, host, host_len)) goto error;
+	if (uwsgi_buffer_append_keyval(ub, "SERVER_PORT", 11, "80", 2)) goto error;
+	if (uwsgi_buffer_append_keyval(ub, "REMOTE_ADDR", 11, "127.0.0.1", 9)) goto error;
+	if (uwsgi_buffer_append_keyval(ub, "HTTP_HOST", 9, host, host_len)) goto error;
+	if (uwsgi_buffer_append_keyval(ub, "HTTP_USER_AGENT", 15, "uWSGI health check", 18)) goto error;
+	if (uwsgi_buffer_set_uh(ub, 0, 0)) goto error;
+	return ub;
+error:
+	uwsgi_buffer_destroy(ub);
+	return NULL;
+}
+
+static void cr_health_start(struct uwsgi_corerouter *ucr, struct uwsgi_subscribe_node *node, struct uwsgi_string_list *static_node, char *address, uint16_t address_len, char *key, uint16_t key_len) {
+
+	struct corerouter_health_check *hc = uwsgi_calloc(sizeof(struct corerouter_health_check));
+	hc->node = node;
+	hc->static_node = static_node;
+	hc->address = address;
+	hc->address_len = address_len;
+	hc->key = key;
+	hc->key_len = key_len;
+	hc->started = uwsgi_micros();
+	hc->deadline = uwsgi_now() + ucr->health_check_timeout;
+	hc->fd = -1;
+
+	// the reference count protects the node from being removed during the check
+	if (node)
+		node->reference++;
+
+	hc->next = ucr->health_checks;
+	if (ucr->health_checks)
+		ucr->health_checks->prev = hc;
+	ucr->health_checks = hc;
+
+	if (ucr->health_check_type != UWSGI_CR_HEALTH_TCP) {
+		hc->out = cr_health_request(ucr, hc);
+		if (!hc->out) goto skip;
+	}
+
+	hc->fd = uwsgi_connectn(address, address_len, 0, 1);
+	if (hc->fd < 0) {
+		// socket() failures are our problem, not the node's one
+		if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM || errno == EADDRNOTAVAIL) goto skip;
+		goto error;
+	}
+
+	if (hc->fd >= (int) uwsgi.max_fd) {
+		close(hc->fd);
+		hc->fd = -1;
+		goto skip;
+	}
+
+	ucr->hc_table[hc->fd] = hc;
+	hc->connecting = 1;
+	if (event_queue_add_fd_write(ucr->queue, hc->fd)) goto skip;
+	return;
+
+error:
+	cr_health_done(ucr, hc, 0);
+	return;
+skip:
+	cr_health_done(ucr, hc, -1);
+}
+
+// is the (hashed) second of a node in the range of seconds being processed ?
+static int cr_health_due(struct uwsgi_corerouter *ucr, char *address, uint16_t address_len, time_t from, time_t to) {
+	time_t interval = ucr->health_check_interval;
+	time_t slot = djb33x_hash(address, address_len) % interval;
+	return ((slot - (from % interval) + interval) % interval) <= to - from;
+}
+
+// 1 healthy, 0 unhealthy, -1 more data needed
+static int cr_health_parse(struct uwsgi_corerouter *ucr, struct corerouter_health_check *hc) {
+	if (ucr->health_check_type == UWSGI_CR_HEALTH_PING) {
+		if (hc->buf_pos < 4)
+			return -1;
+		// a ping response with a body is a warning from the node
+		return hc->buf[0] == UWSGI_MODIFIER_PING && hc->buf[1] == 0 && hc->buf[2] == 0;
+	}
+	// HTTP/1.x 2xx or 3xx
+	if (hc->buf_pos < 12)
+		return -1;
+	if (memcmp(hc->buf, "HTTP/", 5))
+		return 0;
+	return hc->buf[9] == '2' || hc->buf[9] == '3';
+}
+
+void uwsgi_cr_health_event(struct uwsgi_corerouter *ucr, struct corerouter_health_check *hc) {
+
+	if (hc->connecting) {
+		int soopt = 0;
+		socklen_t solen = sizeof(int);
+		if (getsockopt(hc->fd, SOL_SOCKET, SO_ERROR, (void *) (&soopt), &solen) < 0 || soopt) {
+			cr_health_done(ucr, hc, 0);
+			return;
+		}
+		hc->connecting = 0;
+		if (ucr->health_check_type == UWSGI_CR_HEALTH_TCP) {
+			cr_health_done(ucr, hc, 1);
+			return;
+		}
+	}
+
+	// send the request
+	if (hc->out_pos < hc->out->pos) {
+		ssize_t wlen = write(hc->fd, hc->out->buf + hc->out_pos, hc->out->pos - hc->out_pos);
+		if (wlen < 0 && uwsgi_is_again())
+			return;
+		if (wlen <= 0) {
+			cr_health_done(ucr, hc, 0);
+			return;
+		}
+		hc->out_pos += wlen;
+		if (hc->out_pos == hc->out->pos) {
+			if (event_queue_fd_write_to_read(ucr->queue, hc->fd)) {
+				cr_health_done(ucr, hc, 0);
+			}
+		}
+		return;
+	}
+
+	// read the response
+	ssize_t rlen = read(hc->fd, hc->buf + hc->buf_pos, sizeof(hc->buf) - hc->buf_pos);
+	if (rlen < 0 && uwsgi_is_again())
+		return;
+	if (rlen <= 0) {
+		cr_health_done(ucr, hc, cr_health_parse(ucr, hc) == 1);
+		return;
+	}
+	hc->buf_pos += rlen;
+	int ret = cr_health_parse(ucr, hc);
+	if (ret >= 0) {
+		cr_health_done(ucr, hc, ret);
+	}
+}
+
+// expire timed out checks and start a new round when needed
+void uwsgi_cr_health_run(struct uwsgi_corerouter *ucr, time_t now) {
+	if (!ucr->health_check_type)
+		return;
+
+	struct corerouter_health_check *hc = ucr->health_checks;
+	while (hc) {
+		struct corerouter_health_check *next_hc = hc->next;
+		if (now >= hc->deadline) {
+			if (!ucr->quiet)
+				uwsgi_log("[uwsgi-%s] health check of %.*s timed out\n", ucr->short_name, (int) hc->address_len, hc->address);
+			cr_health_done(ucr, hc, 0);
+		}
+		hc = next_hc;
+	}
+
+	// process the seconds elapsed since the last call (at most a whole interval)
+	if (!ucr->health_check_last)
+		ucr->health_check_last = now - 1;
+	if (now <= ucr->health_check_last)
+		return;
+	time_t from = ucr->health_check_last + 1;
+	if (now - from >= ucr->health_check_interval)
+		from = now - ucr->health_check_interval + 1;
+	ucr->health_check_last = now;
+
+	if (ucr->subscriptions) {
+		struct uwsgi_subscribe_slot *current_slot = uwsgi_subscriptions_next(ucr->subscriptions, NULL);
+		while (current_slot) {
+			struct uwsgi_subscribe_node *node = current_slot->nodes;
+			while (node) {
+				if (!node->death_mark && node->len > 0 && cr_health_due(ucr, node->name, node->len, from, now)) {
+					cr_health_start(ucr, node, NULL, node->name, node->len, current_slot->key, current_slot->keylen);
+				}
+				node = node->next;
+			}
+			current_slot = uwsgi_subscriptions_next(ucr->subscriptions, current_slot);
+		}
+	}
+
+	struct uwsgi_string_list *usl = ucr->static_nodes;
+	while (usl) {
+		if (cr_health_due(ucr, usl->value, usl->len, from, now))
+			cr_health_start(ucr, NULL, usl, usl->value, usl->len, NULL, 0);
+		usl = usl->next;
+	}
+}
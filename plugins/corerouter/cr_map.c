@@ -46,9 +46,24 @@ int uwsgi_cr_map_use_pattern(struct uwsgi_corerouter *ucr, struct corerouter_pee
 }
 
 
+// the client attributes used by the load balancing algorithms (consistent hashing defaults to the client address)
+static void cr_subscription_client(struct corerouter_peer *peer, struct uwsgi_subscription_client *client) {
+	if (peer->hash_key_len) {
+		client->hash_key = peer->hash_key;
+		client->hash_key_len = peer->hash_key_len;
+	}
+	else {
+		client->hash_key = peer->session->client_address;
+		client->hash_key_len = strlen(peer->session->client_address);
+	}
+}
+
 int uwsgi_cr_map_use_subscription(struct uwsgi_corerouter *ucr, struct corerouter_peer *peer) {
 
-	peer->un = uwsgi_get_subscribe_node(ucr->subscriptions, peer->key, peer->key_len);
+	struct uwsgi_subscription_client client;
+	cr_subscription_client(peer, &client);
+	peer->un = uwsgi_get_subscribe_node(ucr->subscriptions, peer->key, peer->key_len, &client);
+	peer->un_start = uwsgi_micros();
 	if (peer->un && peer->un->len) {
 		peer->instance_address = peer->un->name;
 		peer->instance_address_len = peer->un->len;
@@ -65,12 +80,14 @@ int uwsgi_cr_map_use_subscription_dotsplit(struct uwsgi_corerouter *ucr, struct
 
 	char *name = peer->key;
 	uint16_t name_len = peer->key_len;
+	struct uwsgi_subscription_client client;
+	cr_subscription_client(peer, &client);
 
 split:
 #ifdef UWSGI_DEBUG
 	uwsgi_log("trying with %.*s\n", name_len, name);
 #endif
-        peer->un = uwsgi_get_subscribe_node(ucr->subscriptions, name, name_len);
+        peer->un = uwsgi_get_subscribe_node(ucr->subscriptions, name, name_len, &client);
 	if (!peer->un) {
 		char *next = memchr(name+1, '.', name_len-1);
 		if (next) {
@@ -84,6 +101,7 @@ split:
                 peer->instance_address = peer->un->name;
                 peer->instance_address_len = peer->un->len;
                 peer->modifier1 = peer->un->modifier1;
+                peer->un_start = uwsgi_micros();
         }
         else if (ucr->cheap && !ucr->i_am_cheap && uwsgi_no_subscriptions(ucr->subscriptions)) {
                 uwsgi_gateway_go_cheap(ucr->name, ucr->queue, &ucr->i_am_cheap);
@@ -38,6 +38,14 @@ static struct uwsgi_option fastrouter_options[] = {
 	{"fastrouter-quiet", required_argument, 0, "do not report failed connections to instances", uwsgi_opt_true, &ufr.cr.quiet, 0},
 	{"fastrouter-cheap", no_argument, 0, "run the fastrouter in cheap mode", uwsgi_opt_true, &ufr.cr.cheap, 0},
 	{"fastrouter-subscription-server", required_argument, 0, "run the fastrouter subscription server on the spcified address", uwsgi_opt_corerouter_ss, &ufr, 0},
+	{"fastrouter-health-check", required_argument, 0, "actively check backends health (tcp, ping or http[:path])", uwsgi_opt_set_str, &ufr.cr.health_check, 0},
+	{"fastrouter-health-check-interval", required_argument, 0, "set the interval (in seconds) of health checks (default 5)", uwsgi_opt_set_int, &ufr.cr.health_check_interval, 0},
+	{"fastrouter-health-check-timeout", required_argument, 0, "set the timeout (in seconds) of health checks (default 3)", uwsgi_opt_set_int, &ufr.cr.health_check_timeout, 0},
+	{"fastrouter-outlier-errors", required_argument, 0, "eject a subscription node after the specified number of consecutive errors (default 3)", uwsgi_opt_set_int, &ufr.cr.outlier_errors, 0},
+	{"fastrouter-outlier-latency", required_argument, 0, "consider health checks slower than the specified number of milliseconds as errors", uwsgi_opt_set_int, &ufr.cr.outlier_latency, 0},
+	{"fastrouter-slow-start", required_argument, 0, "gradually send requests to re-admitted nodes in the specified number of seconds", uwsgi_opt_set_int, &ufr.cr.slow_start, 0},
+	{"fastrouter-subscription-dump", required_argument, 0, "load subscriptions from the specified file at startup and dump them to it when they change", uwsgi_opt_set_str, &ufr.cr.subscriptions_dump, 0},
+	{"fastrouter-subscription-hash-var", required_argument, 0, "use the specified request var as key for consistent hashing subscription algorithms (default: client address)", uwsgi_opt_set_str, &ufr.cr.hash_var, 0},
 	{"fastrouter-subscription-slot", required_argument, 0, "*** deprecated ***", uwsgi_opt_deprecated, (void *) "useless thanks to the new implementation", 0},
 
 	{"fastrouter-timeout", required_argument, 0, "set fastrouter timeout", uwsgi_opt_set_int, &ufr.cr.socket_timeout, 0},
@@ -214,6 +222,8 @@ static ssize_t fr_recv_uwsgi_vars(struct corerouter_peer *main_peer) {
 		if (new_peer->key_len == 0)
 			return -1;
 
+		if (uwsgi_cr_peer_hash_key(new_peer, main_peer->in->buf+4, pktsize)) return -1;
+
 		// find an instance using the key
 		if (ucr->mapper(ucr, new_peer))
 			return -1;
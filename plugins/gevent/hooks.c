@@ -98,3 +98,16 @@ int uwsgi_gevent_wait_read_hook(int fd, int timeout) {
         return 1;
 }
 
+
+int uwsgi_gevent_wait_milliseconds_hook(int timeout) {
+	PyObject *gevent_sleep_args = PyTuple_New(1);
+	PyTuple_SetItem(gevent_sleep_args, 0, PyFloat_FromDouble((double) timeout / 1000.0));
+	PyObject *gswitch = PyEval_CallObject(ugevent.greenlet_switch, gevent_sleep_args);
+	Py_DECREF(gevent_sleep_args);
+	if (!gswitch) {
+		if (PyErr_Occurred()) PyErr_Clear();
+		return -1;
+	}
+	Py_DECREF(gswitch);
+	return 0;
+}
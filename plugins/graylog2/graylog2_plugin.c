@@ -5,95 +5,103 @@ extern struct uwsgi_server uwsgi;
 
 #define MAX_GELF 8192
 
+// every logger has its own buffers (the loggers of different queues run in different threads)
 struct graylog2_config {
 	char *host;
 	char json_buf[MAX_GELF];
 	char escaped_buf[MAX_GELF];
 	size_t escaped_len;
-} g2c;
+	// compressed messages waiting to be sent (used by the batch logger)
+	char *batch_buf;
+};
 
-ssize_t uwsgi_graylog2_logger(struct uwsgi_logger *ul, char *message, size_t len) {
+// number of compressed messages that fit in the batch buffer
+#define GELF_BATCH 16
 
-	size_t i;
+static void uwsgi_graylog2_logger_setup(struct uwsgi_logger *ul) {
 
-	if (!ul->configured) {
+	if (!ul->arg) {
+		uwsgi_log_safe("invalid graylog2 syntax\n");
+		exit(1);
+	}
 
-		if (!ul->arg) {
-			uwsgi_log_safe("invalid graylog2 syntax\n");
-			exit(1);
-		}
+	ul->fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (ul->fd < 0) {
+		uwsgi_error_safe("socket()");
+		exit(1);
+	}
 
-		ul->fd = socket(AF_INET, SOCK_DGRAM, 0);
-		if (ul->fd < 0) {
-			uwsgi_error_safe("socket()");
-			exit(1);
-		}
+	uwsgi_socket_nb(ul->fd);
 
-		uwsgi_socket_nb(ul->fd);
+	char *comma = strchr(ul->arg, ',');
+	if (!comma) {
+		uwsgi_log_safe("invalid graylog2 syntax\n");
+		exit(1);
+	}
 
-		char *comma = strchr(ul->arg, ',');
-		if (!comma) {
-			uwsgi_log_safe("invalid graylog2 syntax\n");
-                        exit(1);
-		}
+	struct graylog2_config *g2c = uwsgi_calloc(sizeof(struct graylog2_config));
+	g2c->host = comma + 1;
+	ul->data = g2c;
 
-		g2c.host = comma + 1;
+	*comma = 0;
 
-		*comma = 0;
+	char *colon = strchr(ul->arg, ':');
+	if (!colon) {
+		uwsgi_log_safe("invalid graylog2 syntax\n");
+		exit(1);
+	}
 
-		char *colon = strchr(ul->arg, ':');
-		if (!colon) {
-			uwsgi_log_safe("invalid graylog2 syntax\n");
-                        exit(1);
-		}
+	ul->addr_len = socket_to_in_addr(ul->arg, colon, 0, &ul->addr.sa_in);
 
-		ul->addr_len = socket_to_in_addr(ul->arg, colon, 0, &ul->addr.sa_in);
+	*comma = ',';
 
-		*comma = ',';
+	ul->buf = uwsgi_malloc(MAX_GELF);
 
-		ul->buf = uwsgi_malloc(MAX_GELF);
+	ul->configured = 1;
+}
 
-		ul->configured = 1;
-	}
+// build the compressed GELF message in dst (destLen is the size of dst)
+static int uwsgi_graylog2_encode(struct graylog2_config *g2c, char *message, size_t len, char *dst, uLongf *destLen) {
+
+	size_t i;
 
-	g2c.escaped_len = 0;
+	g2c->escaped_len = 0;
 
 	int truncated = 0;
-	char *ptr = g2c.escaped_buf;
-	uLongf destLen = MAX_GELF;
+	char *ptr = g2c->escaped_buf;
 
 	for(i=0;i<len;i++) {
 		if (message[i] == '\\') {
 			*ptr ++= '\\';
-			g2c.escaped_len++;
+			g2c->escaped_len++;
 		}
 		else if (message[i] == '"') {
 			*ptr ++= '\\';
-			g2c.escaped_len++;
+			g2c->escaped_len++;
 		}
 		*ptr ++= message[i];
-		g2c.escaped_len++;
+		g2c->escaped_len++;
 
 		if (!truncated) {
-			if (g2c.escaped_len == 128) {
+			if (g2c->escaped_len == 128) {
 				truncated = 1;
 			}
-			else if (g2c.escaped_len > 128) {
+			else if (g2c->escaped_len > 128) {
 				truncated = 2;
 			}
 		}
 	}
 
 	if (truncated) truncated = 128 - (truncated-1);
-	else (truncated = g2c.escaped_len);
+	else (truncated = g2c->escaped_len);
 
-	int rlen = snprintf(g2c.json_buf, MAX_GELF, "{ \"version\": \"1.0\", \"host\": \"%s\", \"short_message\": \"%.*s\", \"full_message\": \"%.*s\", \"timestamp\": %d, \"level\": 5, \"facility\": \"uWSGI-%s\" }",
-		g2c.host, truncated, g2c.escaped_buf, (int)g2c.escaped_len, g2c.escaped_buf, (int) uwsgi_now(), UWSGI_VERSION);
+	int rlen = snprintf(g2c->json_buf, MAX_GELF, "{ \"version\": \"1.0\", \"host\": \"%s\", \"short_message\": \"%.*s\", \"full_message\": \"%.*s\", \"timestamp\": %d, \"level\": 5, \"facility\": \"uWSGI-%s\" }",
+		g2c->host, truncated, g2c->escaped_buf, (int)g2c->escaped_len, g2c->escaped_buf, (int) uwsgi_now(), UWSGI_VERSION);
 
 	if (rlen > 0) {
 		if (compressBound((uLong) rlen) <= MAX_GELF) {
-			if (compress((Bytef *) ul->buf, &destLen, (Bytef *) g2c.json_buf, (uLong) rlen) == Z_OK) {
-				return sendto(ul->fd, ul->buf, destLen, 0, (const struct sockaddr *) &ul->addr, ul->addr_len);
+			if (compress((Bytef *) dst, destLen, (Bytef *) g2c->json_buf, (uLong) rlen) == Z_OK) {
+				return 0;
 			}
 		}
 
@@ -102,9 +110,73 @@ ssize_t uwsgi_graylog2_logger(struct uwsgi_logger *ul, char *message, size_t len
 
 }
 
+ssize_t uwsgi_graylog2_logger(struct uwsgi_logger *ul, char *message, size_t len) {
+
+	uLongf destLen = MAX_GELF;
+
+	if (!ul->configured) {
+		uwsgi_graylog2_logger_setup(ul);
+	}
+
+	if (uwsgi_graylog2_encode((struct graylog2_config *) ul->data, message, len, ul->buf, &destLen)) return -1;
+
+	return sendto(ul->fd, ul->buf, destLen, 0, (const struct sockaddr *) &ul->addr, ul->addr_len);
+
+}
+
+/*
+	GELF has no way to put multiple messages in the same datagram,
+	so every message is a datagram and they are sent GELF_BATCH at a time
+*/
+ssize_t uwsgi_graylog2_logger_batch(struct uwsgi_logger *ul, struct iovec *messages, int n) {
+
+	struct msghdr msgs[GELF_BATCH];
+	struct iovec iov[GELF_BATCH];
+	int i, count = 0;
+	ssize_t sent = 0;
+
+	if (!ul->configured) {
+		uwsgi_graylog2_logger_setup(ul);
+	}
+
+	struct graylog2_config *g2c = (struct graylog2_config *) ul->data;
+	if (!g2c->batch_buf) {
+		g2c->batch_buf = uwsgi_malloc(MAX_GELF * GELF_BATCH);
+	}
+
+	memset(msgs, 0, sizeof(msgs));
+
+	for(i=0;i<n;i++) {
+		uLongf destLen = MAX_GELF;
+		char *dst = g2c->batch_buf + (count * MAX_GELF);
+		if (uwsgi_graylog2_encode(g2c, messages[i].iov_base, messages[i].iov_len, dst, &destLen)) continue;
+		iov[count].iov_base = dst;
+		iov[count].iov_len = destLen;
+		msgs[count].msg_name = &ul->addr;
+		msgs[count].msg_namelen = ul->addr_len;
+		msgs[count].msg_iov = &iov[count];
+		msgs[count].msg_iovlen = 1;
+		count++;
+		if (count == GELF_BATCH) {
+			int ret = uwsgi_logger_send_datagrams(ul->fd, msgs, count);
+			if (ret < 0) return -1;
+			sent += ret;
+			count = 0;
+		}
+	}
+
+	if (count > 0) {
+		int ret = uwsgi_logger_send_datagrams(ul->fd, msgs, count);
+		if (ret < 0) return -1;
+		sent += ret;
+	}
+
+	return sent;
+}
+
 
 void uwsgi_graylog2_register() {
-	uwsgi_register_logger("graylog2", uwsgi_graylog2_logger);
+	uwsgi_register_logger_batch("graylog2", uwsgi_graylog2_logger, uwsgi_graylog2_logger_batch);
 }
 
 struct uwsgi_plugin graylog2_plugin = {
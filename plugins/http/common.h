@@ -12,6 +12,12 @@ extern struct uwsgi_server uwsgi;
 #endif
 #endif
 
+#ifdef UWSGI_SSL
+#ifdef TLSEXT_TYPE_application_layer_protocol_negotiation
+#define UWSGI_HTTP2_ALPN
+#endif
+#endif
+
 struct uwsgi_http {
 
         struct uwsgi_corerouter cr;
@@ -34,6 +40,8 @@ struct uwsgi_http {
 
         struct uwsgi_string_list *stud_prefix;
 
+	int http2;
+
 #ifdef UWSGI_SPDY
         int spdy_index;
 	struct uwsgi_buffer *spdy3_settings;
@@ -108,6 +116,32 @@ struct http_session {
         ssize_t (*spdy_hook)(struct corerouter_peer *);
 #endif
 
+	// post-buffering
+	int post_buffering;
+	size_t pb_header_size;
+	int pb_fd;
+	size_t pb_size;
+	size_t pb_pos;
+
+	int http2;
+	int http2_initialized;
+	int http2_error;
+	uint32_t http2_last_sid;
+	// connection-level send window
+	int64_t http2_window;
+	// settings announced by the client
+	int64_t http2_initial_window;
+	uint32_t http2_max_frame;
+	// all of the frames for the client are queued here
+	struct uwsgi_buffer *http2_out;
+	// the frames being written to the client
+	struct uwsgi_buffer *http2_wbuf;
+	// HEADERS + CONTINUATION accumulator
+	struct uwsgi_buffer *http2_headers;
+	uint32_t http2_headers_sid;
+	uint8_t http2_headers_flags;
+	struct http2_hpack *http2_hpack;
+
 #ifdef UWSGI_ZLIB
 	int can_gzip;
 	int has_gzip;
@@ -165,6 +199,15 @@ ssize_t spdy_parse(struct corerouter_peer *);
 void spdy_window_update(char *, uint32_t, uint32_t);
 #endif
 
+ssize_t http2_parse(struct corerouter_peer *);
+void http2_close_peer(struct corerouter_peer *);
+int http2_stream_written(struct corerouter_peer *);
+int http2_backend_connect(struct corerouter_peer *);
+void http2_session_close(struct http_session *);
+#ifdef UWSGI_HTTP2_ALPN
+int http2_alpn_select(SSL *, const unsigned char **, unsigned char *, const unsigned char *, unsigned int, void *);
+#endif
+
 ssize_t hs_http_manage(struct corerouter_peer *, ssize_t);
 
 ssize_t hr_instance_connected(struct corerouter_peer *);
@@ -31,6 +31,14 @@ struct uwsgi_option http_options[] = {
 	{"http-use-base", required_argument, 0, "use the specified base for mapping requests to unix sockets", uwsgi_opt_corerouter_use_base, &uhttp, 0},
 	{"http-events", required_argument, 0, "set the number of concurrent http async events", uwsgi_opt_set_int, &uhttp.cr.nevents, 0},
 	{"http-subscription-server", required_argument, 0, "enable the subscription server", uwsgi_opt_corerouter_ss, &uhttp, 0},
+	{"http-health-check", required_argument, 0, "actively check backends health (tcp, ping or http[:path])", uwsgi_opt_set_str, &uhttp.cr.health_check, 0},
+	{"http-health-check-interval", required_argument, 0, "set the interval (in seconds) of health checks (default 5)", uwsgi_opt_set_int, &uhttp.cr.health_check_interval, 0},
+	{"http-health-check-timeout", required_argument, 0, "set the timeout (in seconds) of health checks (default 3)", uwsgi_opt_set_int, &uhttp.cr.health_check_timeout, 0},
+	{"http-outlier-errors", required_argument, 0, "eject a subscription node after the specified number of consecutive errors (default 3)", uwsgi_opt_set_int, &uhttp.cr.outlier_errors, 0},
+	{"http-outlier-latency", required_argument, 0, "consider health checks slower than the specified number of milliseconds as errors", uwsgi_opt_set_int, &uhttp.cr.outlier_latency, 0},
+	{"http-slow-start", required_argument, 0, "gradually send requests to re-admitted nodes in the specified number of seconds", uwsgi_opt_set_int, &uhttp.cr.slow_start, 0},
+	{"http-subscription-dump", required_argument, 0, "load subscriptions from the specified file at startup and dump them to it when they change", uwsgi_opt_set_str, &uhttp.cr.subscriptions_dump, 0},
+	{"http-subscription-hash-var", required_argument, 0, "use the specified request var as key for consistent hashing subscription algorithms (default: client address)", uwsgi_opt_set_str, &uhttp.cr.hash_var, 0},
 	{"http-timeout", required_argument, 0, "set internal http socket timeout", uwsgi_opt_set_int, &uhttp.cr.socket_timeout, 0},
 	{"http-manage-expect", optional_argument, 0, "manage the Expect HTTP request header (optionally checking for Content-Length)", uwsgi_opt_set_64bit, &uhttp.manage_expect, 0},
 	{"http-keepalive", optional_argument, 0, "HTTP 1.1 keepalive support (non-pipelined) requests", uwsgi_opt_set_int, &uhttp.keepalive, 0},
@@ -41,6 +49,10 @@ struct uwsgi_option http_options[] = {
 
 	{"http-raw-body", no_argument, 0, "blindly send HTTP body to backends (required for WebSockets and Icecast support in backends)", uwsgi_opt_true, &uhttp.raw_body, 0},
 	{"http-websockets", no_argument, 0, "automatically detect websockets connections and put the session in raw mode", uwsgi_opt_true, &uhttp.websockets, 0},
+	{"http-post-buffering", required_argument, 0, "buffer request bodies before connecting to the backend (bodies bigger than the specified size are stored in a temp file)", uwsgi_opt_set_64bit, &uhttp.cr.post_buffering, 0},
+	{"http-post-buffering-dir", required_argument, 0, "put http router buffered bodies in the specified directory", uwsgi_opt_set_str, &uhttp.cr.pb_base_dir, 0},
+	{"http-post-buffering-memory", required_argument, 0, "limit the memory used by the http router for buffered bodies (clients are paused when it is exhausted)", uwsgi_opt_set_64bit, &uhttp.cr.pb_memory_limit, 0},
+	{"http2", no_argument, 0, "enable HTTP/2 support (h2c with prior knowledge on plain sockets, h2 via ALPN on https ones)", uwsgi_opt_true, &uhttp.http2, 0},
 
 	{"http-use-code-string", required_argument, 0, "use code string as hostname->server mapper for the http router", uwsgi_opt_corerouter_cs, &uhttp, 0},
         {"http-use-socket", optional_argument, 0, "forward request to the specified uwsgi socket", uwsgi_opt_corerouter_use_socket, &uhttp, 0},
@@ -382,6 +394,27 @@ ready:
 }
 
 
+// send the buffered body stored in the temp file
+static ssize_t hr_instance_sendfile(struct corerouter_peer *peer) {
+	struct http_session *hr = (struct http_session *) peer->session;
+	ssize_t len = uwsgi_sendfile_do(peer->fd, hr->pb_fd, hr->pb_pos, hr->pb_size - hr->pb_pos);
+	if (len < 0) {
+		cr_try_again;
+		uwsgi_cr_error(peer, "hr_instance_sendfile()");
+		return -1;
+	}
+	// the file has been truncated ?
+	if (!len) return 0;
+
+	hr->pb_pos += len;
+	if (hr->pb_pos == hr->pb_size) {
+		close(hr->pb_fd);
+		hr->pb_fd = -1;
+		cr_reset_hooks(peer);
+	}
+	return len;
+}
+
 ssize_t hr_instance_write(struct corerouter_peer *peer) {
 	ssize_t len = cr_write(peer, "hr_instance_write()");
         // end on empty write
@@ -389,6 +422,7 @@ ssize_t hr_instance_write(struct corerouter_peer *peer) {
 
         // the chunk has been sent, start (again) reading from client and instances
         if (cr_write_complete(peer)) {
+		struct http_session *hr = (struct http_session *) peer->session;
 		// destroy the buffer used for the uwsgi packet
 		if (peer->out_need_free == 1) {
 			uwsgi_buffer_destroy(peer->out);
@@ -396,14 +430,25 @@ ssize_t hr_instance_write(struct corerouter_peer *peer) {
 			peer->out = NULL;
 			// reset the main_peer input stream
 			peer->session->main_peer->in->pos = 0;
+			// the buffered body (if any) has been sent
+			uwsgi_cr_pb_release(peer->session);
+			// the rest of the body is in the temp file
+			if (hr->pb_fd >= 0) {
+				cr_write_to_backend(peer, hr_instance_sendfile);
+				return len;
+			}
 		}
 		// reset the stream (main_peer->in = peer->out)
 		else {
 			peer->out->pos = 0;
 		}
+		// HTTP/2 streams are written without suspending the client and the other streams
+		if (hr->http2) {
+			if (http2_stream_written(peer)) return -1;
+			return len;
+		}
                 cr_reset_hooks(peer);
 #ifdef UWSGI_SPDY
-		struct http_session *hr = (struct http_session *) peer->session;
 		if (hr->spdy) {
 			if (hr->spdy_update_window) {
 				if (uwsgi_buffer_fix(peer->in, 16)) return -1;
@@ -443,6 +488,12 @@ ssize_t hr_write(struct corerouter_peer *main_peer) {
 			main_peer->session->connect_peer_after_write = NULL;
 			return len;
 		}
+		struct http_session *hr = (struct http_session *) main_peer->session;
+		// the backends are not suspended while HTTP/2 frames are written
+		if (hr->http2) {
+			if (uwsgi_cr_set_hooks(main_peer, main_peer->disabled ? NULL : main_peer->last_hook_read, NULL)) return -1;
+			return http2_parse(main_peer);
+		}
                 cr_reset_hooks(main_peer);
         }
 
@@ -511,6 +562,7 @@ ssize_t hr_instance_read(struct corerouter_peer *peer) {
 		if (hr->session.can_keepalive) {
 			peer->session->main_peer->disabled = 0;
 			hr->rnrn = 0;
+			hr->post_buffering = 0;
 #ifdef UWSGI_ZLIB
 			hr->can_gzip = 0;
 			hr->has_gzip = 0;
@@ -610,12 +662,122 @@ ssize_t hr_instance_read(struct corerouter_peer *peer) {
 
 
 
+// move the body buffered in memory to a temp file
+static int hr_post_buffering_spill(struct corerouter_peer *peer) {
+	struct corerouter_session *cs = peer->session;
+	struct http_session *hr = (struct http_session *) cs;
+
+	hr->pb_fd = uwsgi_cr_pb_tmpfd(cs->corerouter);
+	if (hr->pb_fd < 0) return -1;
+	hr->pb_size = 0;
+	hr->pb_pos = 0;
+
+	char *buf = peer->out->buf + hr->pb_header_size;
+	size_t len = peer->out->pos - hr->pb_header_size;
+	while(len > 0) {
+		ssize_t wlen = write(hr->pb_fd, buf, len);
+		if (wlen <= 0) {
+			uwsgi_cr_error(peer, "hr_post_buffering_spill()/write()");
+			return -1;
+		}
+		buf += wlen;
+		len -= wlen;
+		hr->pb_size += wlen;
+	}
+
+	// shrink the uwsgi packet to the header (the body buffer could be huge)
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(hr->pb_header_size);
+	if (uwsgi_buffer_append(ub, peer->out->buf, hr->pb_header_size)) {
+		uwsgi_buffer_destroy(ub);
+		return -1;
+	}
+	uwsgi_buffer_destroy(peer->out);
+	peer->out = ub;
+
+	uwsgi_cr_pb_release(cs);
+	return 0;
+}
+
+// store a chunk of the request body (in memory or in the temp file), connect to the backend when done
+static ssize_t hr_post_buffering(struct corerouter_peer *main_peer) {
+	struct corerouter_session *cs = main_peer->session;
+	struct http_session *hr = (struct http_session *) cs;
+	struct uwsgi_corerouter *ucr = cs->corerouter;
+	struct corerouter_peer *peer = cs->peers;
+
+	char *buf = main_peer->in->buf;
+	size_t len = main_peer->in->pos;
+
+	// over the session threshold or the global budget, go to disk
+	if (hr->pb_fd < 0 && (cs->pb_memory + len > ucr->post_buffering || uwsgi_cr_pb_full(ucr))) {
+		if (hr_post_buffering_spill(peer)) return -1;
+	}
+
+	if (hr->pb_fd >= 0) {
+		while(len > 0) {
+			ssize_t wlen = write(hr->pb_fd, buf, len);
+			if (wlen <= 0) {
+				uwsgi_cr_error(main_peer, "hr_post_buffering()/write()");
+				return -1;
+			}
+			buf += wlen;
+			len -= wlen;
+			hr->pb_size += wlen;
+		}
+	}
+	else {
+		peer->out->limit = 0;
+		if (uwsgi_buffer_append(peer->out, buf, len)) return -1;
+		uwsgi_cr_pb_acquire(cs, len);
+	}
+
+	main_peer->in->pos = 0;
+
+	if (hr->content_length > 0) return 1;
+
+	// the whole body is here, stop reading from the client
+	main_peer->disabled = 1;
+	if (uwsgi_cr_set_hooks(main_peer, NULL, NULL)) return -1;
+	cr_connect(peer, hr_instance_connected);
+	return 1;
+}
+
+// memory is available again, manage the data received in the meantime
+static int hr_post_buffering_resume(struct corerouter_session *cs) {
+	struct corerouter_peer *main_peer = cs->main_peer;
+	if (uwsgi_cr_set_hooks(main_peer, main_peer->last_hook_read, NULL)) return -1;
+	if (main_peer->in->pos > 0) {
+		if (http_parse(main_peer) < 0) return -1;
+	}
+	return 0;
+}
+
 ssize_t http_parse(struct corerouter_peer *main_peer) {
 	struct corerouter_session *cs = main_peer->session;
 	struct http_session *hr = (struct http_session *) cs;
 
+	if (hr->http2) {
+		return http2_parse(main_peer);
+	}
+
+	// HTTP/2 connection preface (prior knowledge)
+	if (uhttp.http2 && hr->rnrn == 0 && main_peer->in->pos > 0 && main_peer->in->buf[0] == 'P') {
+		size_t preface_len = UMIN(main_peer->in->pos, 24);
+		if (!memcmp(main_peer->in->buf, "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n", preface_len)) {
+			// wait for the whole preface
+			if (preface_len < 24) return 1;
+			hr->http2 = 1;
+			return http2_parse(main_peer);
+		}
+	}
+
 	// is it http body ?
 	if (hr->rnrn == 4) {
+		// no memory left for buffering a new body, wait for it
+		if (hr->post_buffering && hr->pb_fd < 0 && cs->pb_memory == 0 && uwsgi_cr_pb_full(cs->corerouter)) {
+			if (uwsgi_cr_pb_wait(cs)) return -1;
+			return 1;
+		}
 		if (hr->content_length == 0 && !hr->raw_body) {
 			// ignore data...
 			main_peer->in->pos = 0;
@@ -639,6 +801,9 @@ ssize_t http_parse(struct corerouter_peer *main_peer) {
 				}
 			}
 		}
+		if (hr->post_buffering) {
+			return hr_post_buffering(main_peer);
+		}
 		main_peer->session->peers->out = main_peer->in;
 		main_peer->session->peers->out_pos = 0;
 		cr_write_to_backend(main_peer->session->peers, hr_instance_write);
@@ -690,6 +855,8 @@ ssize_t http_parse(struct corerouter_peer *main_peer) {
 				break;
 			}
 #endif
+			if (uwsgi_cr_peer_hash_key(new_peer, new_peer->out->buf + 4, new_peer->out->pos - 4)) return -1;
+
 			// find an instance using the key
                 	if (ucr->mapper(ucr, new_peer))
                         	return -1;
@@ -706,6 +873,18 @@ ssize_t http_parse(struct corerouter_peer *main_peer) {
         		new_peer->out->buf[1] = (uint8_t) (pktsize & 0xff);
         		new_peer->out->buf[2] = (uint8_t) ((pktsize >> 8) & 0xff);
 
+			// buffer the whole body before connecting to the backend
+			if (ucr->post_buffering && hr->content_length > 0 && !hr->send_expect_100) {
+				hr->post_buffering = 1;
+				hr->pb_header_size = new_peer->out->pos;
+				// the client buffer will be reused for the body
+				new_peer->key = uwsgi_concat2n(new_peer->key, new_peer->key_len, "", 0);
+				new_peer->key_need_free = 1;
+				new_peer->can_retry = 1;
+				if (uwsgi_buffer_decapitate(main_peer->in, hr->headers_size + 1)) return -1;
+				return http_parse(main_peer);
+			}
+
 			if (hr->remains > 0) {
 				if (hr->content_length < hr->remains) { 
 					hr->remains = hr->content_length;
@@ -768,6 +947,12 @@ void hr_session_close(struct corerouter_session *cs) {
 		uwsgi_buffer_destroy(hr->last_chunked);
 	}
 
+	http2_session_close(hr);
+
+	if (hr->pb_fd >= 0) {
+		close(hr->pb_fd);
+	}
+
 #ifdef UWSGI_ZLIB
 	if (hr->z.next_in) {
 		deflateEnd(&hr->z);
@@ -819,6 +1004,9 @@ static int hr_retry(struct corerouter_peer *peer) {
         }
 
 retry:
+	if (((struct http_session *) peer->session)->http2) {
+		return http2_backend_connect(peer);
+	}
         // start async connect (again)
         cr_connect(peer, hr_instance_connected);
         return 0;
@@ -844,6 +1032,9 @@ int http_alloc_session(struct uwsgi_corerouter *ucr, struct uwsgi_gateway_socket
 	}
 	hr->func_write = hr_write;
 
+	hr->pb_fd = -1;
+	cs->pb_resume = hr_post_buffering_resume;
+
 	// be sure buffer does not grow over 64k
         cs->main_peer->in->limit = UMAX16;
 
@@ -894,6 +1085,18 @@ int http_init() {
 		uhttp.cr.use_socket = 1;
 		uhttp.cr.socket_num = 0;
 	}
+#ifdef UWSGI_HTTP2_ALPN
+	// announce h2 on https sockets
+	if (uhttp.http2) {
+		struct uwsgi_gateway_socket *ugs = uwsgi.gateway_sockets;
+		while(ugs) {
+			if (!strcmp(ugs->owner, uhttp.cr.name) && ugs->mode == UWSGI_HTTP_SSL && ugs->ctx) {
+				SSL_CTX_set_alpn_select_cb(ugs->ctx, http2_alpn_select, NULL);
+			}
+			ugs = ugs->next;
+		}
+	}
+#endif
 	uwsgi_corerouter_init((struct uwsgi_corerouter *) &uhttp);
 
 	return 0;
@@ -0,0 +1,1275 @@
+/*
+
+   uWSGI HTTP/2 router
+
+   HTTP/2 is enabled with --http2: plain sockets accept h2c (prior knowledge)
+   connections, https ones announce h2 via ALPN.
+
+   Every stream is mapped to a backend peer (peer->sid is the stream id),
+   requests are translated to uwsgi packets and HTTP/1.x responses are
+   translated back to HEADERS/DATA frames.
+
+   All of the frames directed to the client are queued in hr->http2_out,
+   a write is started only when no other peer of the session is writing
+   (the same invariant used by the corerouter hooks).
+
+*/
+
+#include "common.h"
+
+extern struct uwsgi_http uhttp;
+
+#include "http2.h"
+
+#define HTTP2_PREFACE "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n"
+#define HTTP2_PREFACE_LEN 24
+
+#define HTTP2_DATA		0x0
+#define HTTP2_HEADERS		0x1
+#define HTTP2_PRIORITY		0x2
+#define HTTP2_RST_STREAM	0x3
+#define HTTP2_SETTINGS		0x4
+#define HTTP2_PUSH_PROMISE	0x5
+#define HTTP2_PING		0x6
+#define HTTP2_GOAWAY		0x7
+#define HTTP2_WINDOW_UPDATE	0x8
+#define HTTP2_CONTINUATION	0x9
+
+#define HTTP2_FLAG_END_STREAM	0x1
+#define HTTP2_FLAG_ACK		0x1
+#define HTTP2_FLAG_END_HEADERS	0x4
+#define HTTP2_FLAG_PADDED	0x8
+#define HTTP2_FLAG_PRIORITY	0x20
+
+#define HTTP2_INTERNAL_ERROR	0x2
+#define HTTP2_REFUSED_STREAM	0x7
+
+#define HTTP2_DEFAULT_WINDOW	65535
+#define HTTP2_MAX_WINDOW	0x7fffffff
+#define HTTP2_DEFAULT_FRAME	16384
+#define HTTP2_MAX_FRAME		16777215
+#define HTTP2_MAX_STREAMS	128
+
+#define HPACK_TABLE_SIZE	4096
+
+// stream states (stored in peer->r_parser_status)
+#define HTTP2_STREAM_HEADERS	0
+#define HTTP2_STREAM_DATA	1
+#define HTTP2_STREAM_EOF	2
+#define HTTP2_STREAM_CLOSED	3
+#define HTTP2_STREAM_BODY	4
+
+// chunked response decoder states (stored in peer->chunked)
+#define HTTP2_CHUNK_SIZE	1
+#define HTTP2_CHUNK_EXT		2
+#define HTTP2_CHUNK_DATA	3
+#define HTTP2_CHUNK_DATA_END	4
+#define HTTP2_CHUNK_TRAILER	5
+#define HTTP2_CHUNK_TRAILER_LINE	6
+#define HTTP2_CHUNK_DONE	7
+
+struct http2_hpack_entry {
+	char *name;
+	uint16_t name_len;
+	char *value;
+	uint16_t value_len;
+};
+
+// the HPACK dynamic table (newest entry first)
+struct http2_hpack {
+	struct http2_hpack_entry entries[HPACK_TABLE_SIZE / 32];
+	size_t count;
+	size_t size;
+	size_t max_size;
+};
+
+// state used while translating a request header block to a uwsgi packet
+struct http2_request {
+	struct corerouter_peer *peer;
+	int has_method;
+	int has_path;
+	int has_content_length;
+	size_t host_pos;
+	uint16_t host_len;
+	struct uwsgi_buffer *cookies;
+};
+
+static int16_t hpack_huffman_tree[256][2];
+static int hpack_huffman_nodes;
+
+static void hpack_huffman_init() {
+	int i, j;
+	hpack_huffman_nodes = 1;
+	for(i=0;i<257;i++) {
+		uint32_t code = hpack_huffman_codes[i];
+		int node = 0;
+		for(j=hpack_huffman_lens[i]-1;j>=0;j--) {
+			int bit = (code >> j) & 1;
+			if (j == 0) {
+				hpack_huffman_tree[node][bit] = -(i+1);
+				break;
+			}
+			if (!hpack_huffman_tree[node][bit]) {
+				hpack_huffman_tree[node][bit] = hpack_huffman_nodes++;
+			}
+			node = hpack_huffman_tree[node][bit];
+		}
+	}
+}
+
+static int hpack_huffman_decode(struct uwsgi_buffer *ub, uint8_t *buf, size_t len) {
+	size_t i;
+	int node = 0;
+	int bits = 0;
+	int ones = 1;
+	for(i=0;i<len;i++) {
+		int j;
+		for(j=7;j>=0;j--) {
+			int bit = (buf[i] >> j) & 1;
+			node = hpack_huffman_tree[node][bit];
+			if (node < 0) {
+				int sym = -node - 1;
+				// EOS is not allowed in strings
+				if (sym == 256) return -1;
+				if (uwsgi_buffer_u8(ub, sym)) return -1;
+				node = 0;
+				bits = 0;
+				ones = 1;
+				continue;
+			}
+			if (node == 0) return -1;
+			bits++;
+			if (!bit) ones = 0;
+		}
+	}
+	// padding must be the most significant bits of EOS
+	if (bits > 7 || !ones) return -1;
+	return 0;
+}
+
+static int hpack_int(uint8_t **ptr, uint8_t *watermark, uint8_t prefix, uint32_t *n) {
+	uint8_t mask = (1 << prefix) - 1;
+	uint8_t *p = *ptr;
+	uint32_t m = 0;
+	if (p >= watermark) return -1;
+	*n = *p & mask;
+	p++;
+	if (*n < mask) goto done;
+	while(p < watermark) {
+		uint8_t b = *p++;
+		if (m > 21) return -1;
+		*n += (b & 0x7f) << m;
+		m += 7;
+		if (!(b & 0x80)) goto done;
+	}
+	return -1;
+done:
+	*ptr = p;
+	return 0;
+}
+
+static int hpack_string(uint8_t **ptr, uint8_t *watermark, struct uwsgi_buffer *ub) {
+	uint32_t len = 0;
+	if (*ptr >= watermark) return -1;
+	int huffman = **ptr & 0x80;
+	if (hpack_int(ptr, watermark, 7, &len)) return -1;
+	if (*ptr + len > watermark) return -1;
+	if (huffman) {
+		if (hpack_huffman_decode(ub, *ptr, len)) return -1;
+	}
+	else {
+		if (uwsgi_buffer_append(ub, (char *) *ptr, len)) return -1;
+	}
+	*ptr += len;
+	return 0;
+}
+
+static void hpack_evict(struct http2_hpack *hp, size_t needed) {
+	while(hp->count > 0 && hp->size + needed > hp->max_size) {
+		struct http2_hpack_entry *he = &hp->entries[hp->count-1];
+		hp->size -= he->name_len + he->value_len + 32;
+		free(he->name);
+		hp->count--;
+	}
+}
+
+static void hpack_add(struct http2_hpack *hp, char *name, uint16_t name_len, char *value, uint16_t value_len) {
+	size_t needed = name_len + value_len + 32;
+	hpack_evict(hp, needed);
+	// an entry larger than the table simply empties it
+	if (needed > hp->max_size) return;
+	memmove(&hp->entries[1], &hp->entries[0], sizeof(struct http2_hpack_entry) * hp->count);
+	struct http2_hpack_entry *he = &hp->entries[0];
+	he->name = uwsgi_malloc(name_len + value_len + 1);
+	memcpy(he->name, name, name_len);
+	he->name_len = name_len;
+	he->value = he->name + name_len;
+	memcpy(he->value, value, value_len);
+	he->value_len = value_len;
+	hp->count++;
+	hp->size += needed;
+}
+
+static int hpack_get(struct http2_hpack *hp, uint32_t index, char **name, uint16_t *name_len, char **value, uint16_t *value_len) {
+	if (index == 0) return -1;
+	if (index <= HPACK_STATIC_TABLE_SIZE) {
+		*name = hpack_static_table[index].name;
+		*name_len = hpack_static_table[index].name_len;
+		*value = hpack_static_table[index].value;
+		*value_len = hpack_static_table[index].value_len;
+		return 0;
+	}
+	index -= HPACK_STATIC_TABLE_SIZE + 1;
+	if (index >= hp->count) return -1;
+	*name = hp->entries[index].name;
+	*name_len = hp->entries[index].name_len;
+	*value = hp->entries[index].value;
+	*value_len = hp->entries[index].value_len;
+	return 0;
+}
+
+static int hpack_encode_int(struct uwsgi_buffer *ub, uint8_t first, uint8_t prefix, uint32_t n) {
+	uint8_t mask = (1 << prefix) - 1;
+	if (n < mask) return uwsgi_buffer_u8(ub, first | n);
+	if (uwsgi_buffer_u8(ub, first | mask)) return -1;
+	n -= mask;
+	while(n >= 128) {
+		if (uwsgi_buffer_u8(ub, (n & 0x7f) | 0x80)) return -1;
+		n >>= 7;
+	}
+	return uwsgi_buffer_u8(ub, n);
+}
+
+static int hpack_encode_string(struct uwsgi_buffer *ub, char *buf, size_t len) {
+	if (hpack_encode_int(ub, 0, 7, len)) return -1;
+	return uwsgi_buffer_append(ub, buf, len);
+}
+
+// literal header field without indexing (we never populate the client's table)
+static int hpack_encode_header(struct uwsgi_buffer *ub, char *name, size_t name_len, char *value, size_t value_len) {
+	uint32_t i;
+	for(i=1;i<=HPACK_STATIC_TABLE_SIZE;i++) {
+		if (!uwsgi_strncmp(hpack_static_table[i].name, hpack_static_table[i].name_len, name, name_len)) {
+			if (hpack_encode_int(ub, 0, 4, i)) return -1;
+			return hpack_encode_string(ub, value, value_len);
+		}
+	}
+	if (uwsgi_buffer_u8(ub, 0)) return -1;
+	if (hpack_encode_string(ub, name, name_len)) return -1;
+	return hpack_encode_string(ub, value, value_len);
+}
+
+static int hpack_encode_status(struct uwsgi_buffer *ub, char *status) {
+	uint32_t i;
+	for(i=8;i<=14;i++) {
+		if (!memcmp(hpack_static_table[i].value, status, 3)) {
+			return uwsgi_buffer_u8(ub, 0x80 | i);
+		}
+	}
+	if (hpack_encode_int(ub, 0, 4, 8)) return -1;
+	return hpack_encode_string(ub, status, 3);
+}
+
+static int http2_frame_header(struct uwsgi_buffer *ub, uint32_t len, uint8_t type, uint8_t flags, uint32_t sid) {
+	if (uwsgi_buffer_u24be(ub, len)) return -1;
+	if (uwsgi_buffer_u8(ub, type)) return -1;
+	if (uwsgi_buffer_u8(ub, flags)) return -1;
+	return uwsgi_buffer_u32be(ub, sid & 0x7fffffff);
+}
+
+static int http2_window_update(struct http_session *hr, uint32_t sid, uint32_t increment) {
+	if (http2_frame_header(hr->http2_out, 4, HTTP2_WINDOW_UPDATE, 0, sid)) return -1;
+	return uwsgi_buffer_u32be(hr->http2_out, increment);
+}
+
+static int http2_rst_stream(struct http_session *hr, uint32_t sid, uint32_t code) {
+	if (http2_frame_header(hr->http2_out, 4, HTTP2_RST_STREAM, 0, sid)) return -1;
+	return uwsgi_buffer_u32be(hr->http2_out, code);
+}
+
+// called when the request body has been written to the backend (or the backend is gone)
+static int http2_window_release(struct corerouter_peer *peer) {
+	struct http_session *hr = (struct http_session *) peer->session;
+	uint32_t pending = peer->window_pending;
+	if (!pending) return 0;
+	peer->window_pending = 0;
+	if (http2_window_update(hr, 0, pending)) return -1;
+	if (peer->r_parser_status == HTTP2_STREAM_HEADERS || peer->r_parser_status == HTTP2_STREAM_DATA) {
+		if (http2_window_update(hr, peer->sid, pending)) return -1;
+	}
+	return 0;
+}
+
+/*
+	start sending queued frames (if the client is not already being written)
+
+	The queue is swapped with the write buffer, so new frames can be queued while the
+	previous ones are being sent (SSL_write() needs the same buffer when retrying).
+	Only the client hooks are changed, the backends are never suspended.
+*/
+static int http2_send(struct http_session *hr) {
+	struct corerouter_peer *main_peer = hr->session.main_peer;
+	if (hr->http2_out->pos == 0) return 0;
+	// the frames will be sent as soon as the current write is over
+	if (hr->http2_wbuf->pos > 0) return 0;
+	struct uwsgi_buffer *ub = hr->http2_wbuf;
+	hr->http2_wbuf = hr->http2_out;
+	hr->http2_out = ub;
+	main_peer->out = hr->http2_wbuf;
+	main_peer->out_pos = 0;
+	return uwsgi_cr_set_hooks(main_peer, NULL, hr->func_write);
+}
+
+// stop reading from the backend (a write of the request body could still be in progress)
+static int http2_stream_pause(struct corerouter_peer *peer) {
+	peer->last_hook_read = NULL;
+	return uwsgi_cr_set_hooks(peer, NULL, peer->hook_write);
+}
+
+// translate a request header to uwsgi vars
+static int http2_request_header(struct http2_request *h2r, char *name, uint16_t name_len, char *value, uint16_t value_len) {
+	struct uwsgi_buffer *out = h2r->peer->out;
+	uint16_t i;
+
+	if (name_len > 0 && name[0] == ':') {
+		if (!uwsgi_strncmp(name, name_len, ":method", 7)) {
+			h2r->has_method = 1;
+			return uwsgi_buffer_append_keyval(out, "REQUEST_METHOD", 14, value, value_len);
+		}
+		if (!uwsgi_strncmp(name, name_len, ":path", 5)) {
+			h2r->has_path = 1;
+			if (uwsgi_buffer_append_keyval(out, "REQUEST_URI", 11, value, value_len)) return -1;
+			uint16_t path_info_len = value_len;
+			char *query_string = memchr(value, '?', value_len);
+			if (query_string) {
+				path_info_len = query_string - value;
+				query_string++;
+				if (uwsgi_buffer_append_keyval(out, "QUERY_STRING", 12, query_string, value_len - (path_info_len + 1))) return -1;
+			}
+			else {
+				if (uwsgi_buffer_append_keyval(out, "QUERY_STRING", 12, "", 0)) return -1;
+			}
+			// PATH_INFO must be url-decoded
+			char *path_info = uwsgi_malloc(path_info_len + 1);
+			http_url_decode(value, &path_info_len, path_info);
+			int ret = uwsgi_buffer_append_keyval(out, "PATH_INFO", 9, path_info, path_info_len);
+			free(path_info);
+			return ret;
+		}
+		if (!uwsgi_strncmp(name, name_len, ":authority", 10)) {
+			goto host;
+		}
+		if (!uwsgi_strncmp(name, name_len, ":scheme", 7)) {
+			return uwsgi_buffer_append_keyval(out, "UWSGI_SCHEME", 12, value, value_len);
+		}
+		// unknown pseudo headers are malformed
+		return -1;
+	}
+
+	if (!uwsgi_strncmp(name, name_len, "host", 4)) {
+		// :authority has precedence
+		if (h2r->host_len) return 0;
+		goto host;
+	}
+
+	if (!uwsgi_strncmp(name, name_len, "content-length", 14)) {
+		h2r->has_content_length = 1;
+		return uwsgi_buffer_append_keyval(out, "CONTENT_LENGTH", 14, value, value_len);
+	}
+
+	if (!uwsgi_strncmp(name, name_len, "content-type", 12)) {
+		return uwsgi_buffer_append_keyval(out, "CONTENT_TYPE", 12, value, value_len);
+	}
+
+	// cookies can be splitted in multiple headers
+	if (!uwsgi_strncmp(name, name_len, "cookie", 6)) {
+		if (!h2r->cookies) {
+			h2r->cookies = uwsgi_buffer_new(value_len + 2);
+		}
+		else {
+			if (uwsgi_buffer_append(h2r->cookies, "; ", 2)) return -1;
+		}
+		return uwsgi_buffer_append(h2r->cookies, value, value_len);
+	}
+
+	if (uwsgi_buffer_u16le(out, name_len + 5)) return -1;
+	if (uwsgi_buffer_append(out, "HTTP_", 5)) return -1;
+	if (uwsgi_buffer_ensure(out, name_len)) return -1;
+	for(i=0;i<name_len;i++) {
+		if (name[i] == '-') {
+			out->buf[out->pos+i] = '_';
+		}
+		else {
+			out->buf[out->pos+i] = toupper((int) name[i]);
+		}
+	}
+	out->pos += name_len;
+	if (uwsgi_buffer_u16le(out, value_len)) return -1;
+	return uwsgi_buffer_append(out, value, value_len);
+
+host:
+	if (uwsgi_buffer_append_keyval(out, "HTTP_HOST", 9, value, value_len)) return -1;
+	// buffer could be reallocated, store the offset
+	h2r->host_pos = out->pos - value_len;
+	h2r->host_len = value_len;
+	return 0;
+}
+
+// decode a header block, if h2r is NULL the headers are discarded
+static int http2_hpack_decode(struct http_session *hr, uint8_t *buf, size_t len, struct http2_request *h2r) {
+	struct http2_hpack *hp = hr->http2_hpack;
+	uint8_t *ptr = buf;
+	uint8_t *watermark = buf + len;
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
+	int ret = -1;
+
+	while(ptr < watermark) {
+		uint32_t index = 0;
+		char *name = NULL, *value = NULL;
+		uint16_t name_len = 0, value_len = 0;
+		int add_to_table = 0;
+		ub->pos = 0;
+
+		// indexed header field
+		if (*ptr & 0x80) {
+			if (hpack_int(&ptr, watermark, 7, &index)) goto end;
+			if (hpack_get(hp, index, &name, &name_len, &value, &value_len)) goto end;
+			goto header;
+		}
+
+		// dynamic table size update
+		if ((*ptr & 0xe0) == 0x20) {
+			if (hpack_int(&ptr, watermark, 5, &index)) goto end;
+			if (index > HPACK_TABLE_SIZE) goto end;
+			hp->max_size = index;
+			hpack_evict(hp, 0);
+			continue;
+		}
+
+		// literal header field (with incremental indexing, without indexing or never indexed)
+		if (*ptr & 0x40) {
+			add_to_table = 1;
+			if (hpack_int(&ptr, watermark, 6, &index)) goto end;
+		}
+		else {
+			if (hpack_int(&ptr, watermark, 4, &index)) goto end;
+		}
+
+		if (index) {
+			char *ignored = NULL;
+			uint16_t ignored_len = 0;
+			if (hpack_get(hp, index, &name, &name_len, &ignored, &ignored_len)) goto end;
+			if (uwsgi_buffer_append(ub, name, name_len)) goto end;
+		}
+		else {
+			if (hpack_string(&ptr, watermark, ub)) goto end;
+		}
+		size_t value_pos = ub->pos;
+		if (hpack_string(&ptr, watermark, ub)) goto end;
+		if (value_pos > UMAX16-1 || ub->pos - value_pos > UMAX16-1) goto end;
+		name = ub->buf;
+		name_len = value_pos;
+		value = ub->buf + value_pos;
+		value_len = ub->pos - value_pos;
+
+		if (add_to_table) {
+			hpack_add(hp, name, name_len, value, value_len);
+		}
+header:
+		if (h2r && !h2r->peer->failed) {
+			// a malformed request will be refused, but we still need to decode the whole block
+			if (http2_request_header(h2r, name, name_len, value, value_len)) {
+				h2r->peer->failed = 1;
+			}
+		}
+	}
+	ret = 0;
+end:
+	uwsgi_buffer_destroy(ub);
+	return ret;
+}
+
+// build the HEADERS (and CONTINUATION) frames for a backend response
+static int http2_response_headers(struct http_session *hr, struct corerouter_peer *peer, char *buf, size_t len) {
+	char *watermark = buf + len;
+	char *ptr = memchr(buf, ' ', len);
+	if (!ptr || ptr + 4 > watermark) return -1;
+	ptr++;
+
+	struct uwsgi_buffer *hb = uwsgi_buffer_new(uwsgi.page_size);
+	if (hpack_encode_status(hb, ptr)) goto error;
+
+	// skip the status line
+	ptr = memchr(ptr, '\n', watermark - ptr);
+	if (!ptr) goto error;
+	ptr++;
+
+	while(ptr < watermark) {
+		char *eol = memchr(ptr, '\n', watermark - ptr);
+		if (!eol) eol = watermark;
+		char *line_end = eol;
+		if (line_end > ptr && *(line_end-1) == '\r') line_end--;
+		// empty and folded lines are ignored
+		if (line_end == ptr || *ptr == ' ' || *ptr == '\t') goto next;
+		char *colon = memchr(ptr, ':', line_end - ptr);
+		if (!colon) goto next;
+		size_t name_len = colon - ptr;
+		char *value = colon + 1;
+		while(value < line_end && (*value == ' ' || *value == '\t')) value++;
+		size_t i;
+		for(i=0;i<name_len;i++) {
+			ptr[i] = tolower((int) ptr[i]);
+		}
+		// the body will be de-chunked before being framed
+		if (!uwsgi_strncmp(ptr, name_len, "transfer-encoding", 17)) {
+			if (uwsgi_contains_n(value, line_end - value, "chunked", 7)) {
+				peer->chunked = HTTP2_CHUNK_SIZE;
+				peer->chunk_left = 0;
+			}
+			goto next;
+		}
+		// connection-specific headers are not allowed in HTTP/2
+		if (!uwsgi_strncmp(ptr, name_len, "connection", 10) ||
+			!uwsgi_strncmp(ptr, name_len, "keep-alive", 10) ||
+			!uwsgi_strncmp(ptr, name_len, "proxy-connection", 16) ||
+			!uwsgi_strncmp(ptr, name_len, "upgrade", 7)) {
+			goto next;
+		}
+		if (hpack_encode_header(hb, ptr, name_len, value, line_end - value)) goto error;
+next:
+		ptr = eol + 1;
+	}
+
+	size_t pos = 0;
+	uint8_t type = HTTP2_HEADERS;
+	do {
+		size_t chunk = UMIN(hb->pos - pos, hr->http2_max_frame);
+		uint8_t flags = 0;
+		if (pos + chunk == hb->pos) flags = HTTP2_FLAG_END_HEADERS;
+		if (http2_frame_header(hr->http2_out, chunk, type, flags, peer->sid)) goto error;
+		if (uwsgi_buffer_append(hr->http2_out, hb->buf + pos, chunk)) goto error;
+		pos += chunk;
+		type = HTTP2_CONTINUATION;
+	} while(pos < hb->pos);
+
+	uwsgi_buffer_destroy(hb);
+	return 0;
+error:
+	uwsgi_buffer_destroy(hb);
+	return -1;
+}
+
+// queue DATA frames for the response body (honouring flow control)
+static int http2_stream_flush(struct http_session *hr, struct corerouter_peer *peer) {
+	while(peer->in->pos > 0) {
+		int64_t avail = UMIN(peer->window, hr->http2_window);
+		if (avail <= 0) return 0;
+		size_t chunk = UMIN(peer->in->pos, (size_t) avail);
+		chunk = UMIN(chunk, hr->http2_max_frame);
+		if (http2_frame_header(hr->http2_out, chunk, HTTP2_DATA, 0, peer->sid)) return -1;
+		if (uwsgi_buffer_append(hr->http2_out, peer->in->buf, chunk)) return -1;
+		if (uwsgi_buffer_decapitate(peer->in, chunk)) return -1;
+		peer->window -= chunk;
+		hr->http2_window -= chunk;
+	}
+	if (peer->r_parser_status == HTTP2_STREAM_EOF) {
+		if (http2_frame_header(hr->http2_out, 0, HTTP2_DATA, HTTP2_FLAG_END_STREAM, peer->sid)) return -1;
+		peer->r_parser_status = HTTP2_STREAM_CLOSED;
+	}
+	return 0;
+}
+
+/*
+	decode (in place) a chunked response body, the state is kept in the peer
+	so the chunk boundaries can be splitted between reads.
+	Chunk extensions and trailers are discarded.
+*/
+static int http2_dechunk(struct corerouter_peer *peer) {
+	char *src = peer->in->buf;
+	char *dst = peer->in->buf;
+	char *end = peer->in->buf + peer->in->pos;
+
+	while(src < end) {
+		char c = *src;
+		size_t n;
+		switch(peer->chunked) {
+			case HTTP2_CHUNK_SIZE:
+				src++;
+				if (c == '\r') break;
+				if (c == ';') {
+					peer->chunked = HTTP2_CHUNK_EXT;
+					break;
+				}
+				if (c == '\n') goto size_done;
+				if (!isxdigit((int) c)) return -1;
+				// avoid overflows
+				if (peer->chunk_left >> 60) return -1;
+				peer->chunk_left = (peer->chunk_left << 4) | (isdigit((int) c) ? c - '0' : tolower((int) c) - 'a' + 10);
+				break;
+			case HTTP2_CHUNK_EXT:
+				src++;
+				if (c == '\n') goto size_done;
+				break;
+			case HTTP2_CHUNK_DATA:
+				n = UMIN((uint64_t) (end - src), peer->chunk_left);
+				memmove(dst, src, n);
+				dst += n;
+				src += n;
+				peer->chunk_left -= n;
+				if (!peer->chunk_left) peer->chunked = HTTP2_CHUNK_DATA_END;
+				break;
+			case HTTP2_CHUNK_DATA_END:
+				src++;
+				if (c == '\n') {
+					peer->chunked = HTTP2_CHUNK_SIZE;
+				}
+				else if (c != '\r') {
+					return -1;
+				}
+				break;
+			case HTTP2_CHUNK_TRAILER:
+				src++;
+				if (c == '\n') {
+					peer->chunked = HTTP2_CHUNK_DONE;
+				}
+				else if (c != '\r') {
+					peer->chunked = HTTP2_CHUNK_TRAILER_LINE;
+				}
+				break;
+			case HTTP2_CHUNK_TRAILER_LINE:
+				src++;
+				if (c == '\n') peer->chunked = HTTP2_CHUNK_TRAILER;
+				break;
+			// anything after the last chunk is ignored
+			default:
+				src = end;
+				break;
+		}
+		continue;
+size_done:
+		peer->chunked = peer->chunk_left ? HTTP2_CHUNK_DATA : HTTP2_CHUNK_TRAILER;
+	}
+
+	peer->in->pos = dst - peer->in->buf;
+	return 0;
+}
+
+// the response body is complete, end the stream as soon as the queued data has been sent
+static ssize_t http2_stream_eof(struct http_session *hr, struct corerouter_peer *peer) {
+	peer->r_parser_status = HTTP2_STREAM_EOF;
+	if (http2_stream_flush(hr, peer)) return -1;
+	if (http2_send(hr)) return -1;
+	if (peer->r_parser_status == HTTP2_STREAM_CLOSED) return 0;
+	// body still queued, the peer will be closed after the last DATA frame
+	if (http2_stream_pause(peer)) return -1;
+	return 1;
+}
+
+// data from a backend
+static ssize_t hr_instance_read_to_http2(struct corerouter_peer *peer) {
+	struct http_session *hr = (struct http_session *) peer->session;
+
+	// blocked by flow control
+	if (peer->in->pos > 0 && peer->r_parser_status == HTTP2_STREAM_DATA) {
+		if (http2_stream_pause(peer)) return -1;
+		return 1;
+	}
+
+	peer->in->limit = UMAX16;
+	if (uwsgi_buffer_ensure(peer->in, uwsgi.page_size)) return -1;
+	ssize_t len = cr_read(peer, "hr_instance_read_to_http2()");
+	if (!len) {
+		// the backend closed the connection without a valid response
+		if (peer->r_parser_status == HTTP2_STREAM_HEADERS) return 0;
+		// truncated chunked body, the stream will be reset
+		if (peer->chunked && peer->chunked != HTTP2_CHUNK_DONE) return 0;
+		return http2_stream_eof(hr, peer);
+	}
+
+	if (peer->r_parser_status == HTTP2_STREAM_HEADERS) {
+		char *rnrn = NULL;
+		size_t i;
+		for(i=3;i<peer->in->pos;i++) {
+			if (!memcmp(peer->in->buf + i - 3, "\r\n\r\n", 4)) {
+				rnrn = peer->in->buf + i + 1;
+				break;
+			}
+		}
+		// need more data
+		if (!rnrn) return 1;
+		if (http2_response_headers(hr, peer, peer->in->buf, rnrn - peer->in->buf)) return -1;
+		if (uwsgi_buffer_decapitate(peer->in, rnrn - peer->in->buf)) return -1;
+		peer->r_parser_status = HTTP2_STREAM_DATA;
+	}
+
+	if (peer->chunked) {
+		if (http2_dechunk(peer)) return -1;
+		if (peer->chunked == HTTP2_CHUNK_DONE) {
+			return http2_stream_eof(hr, peer);
+		}
+	}
+
+	if (http2_stream_flush(hr, peer)) return -1;
+	if (http2_send(hr)) return -1;
+	return 1;
+}
+
+// flush the streams after a window change
+static int http2_flush_streams(struct http_session *hr) {
+	struct corerouter_peer *peer = hr->session.peers;
+	while(peer) {
+		struct corerouter_peer *next = peer->next;
+		if (peer->r_parser_status == HTTP2_STREAM_DATA || peer->r_parser_status == HTTP2_STREAM_EOF) {
+			int was_blocked = peer->in->pos > 0;
+			if (http2_stream_flush(hr, peer)) return -1;
+			if (peer->r_parser_status == HTTP2_STREAM_CLOSED) {
+				corerouter_close_peer(hr->session.corerouter, peer);
+			}
+			else if (was_blocked && peer->in->pos == 0 && peer->r_parser_status == HTTP2_STREAM_DATA) {
+				// resume reading from the backend
+				if (uwsgi_cr_set_hooks(peer, hr_instance_read_to_http2, peer->hook_write)) return -1;
+			}
+		}
+		peer = next;
+	}
+	return 0;
+}
+
+// the backend peer is going away
+void http2_close_peer(struct corerouter_peer *peer) {
+	struct http_session *hr = (struct http_session *) peer->session;
+	if (!hr->http2) return;
+	// give back the connection window held by the stream
+	if (peer->window_pending) {
+		if (http2_window_update(hr, 0, peer->window_pending)) return;
+		peer->window_pending = 0;
+	}
+	// a stream failure does not invalidate the whole connection
+	if (!hr->http2_error) {
+		hr->session.can_keepalive = 1;
+	}
+	if (peer->r_parser_status == HTTP2_STREAM_CLOSED) return;
+	if (peer->r_parser_status == HTTP2_STREAM_HEADERS) {
+		// response not started, generate a 502
+		if (http2_frame_header(hr->http2_out, 5, HTTP2_HEADERS, HTTP2_FLAG_END_HEADERS|HTTP2_FLAG_END_STREAM, peer->sid)) return;
+		// literal :status 502 without indexing
+		if (uwsgi_buffer_append(hr->http2_out, "\x08\x03" "502", 5)) return;
+	}
+	else {
+		if (http2_rst_stream(hr, peer->sid, HTTP2_INTERNAL_ERROR)) return;
+	}
+	peer->r_parser_status = HTTP2_STREAM_CLOSED;
+	http2_send(hr);
+}
+
+// (re)connect a stream to its backend, only the hooks of the stream are changed
+int http2_backend_connect(struct corerouter_peer *peer) {
+	peer->fd = uwsgi_connectn(peer->instance_address, peer->instance_address_len, 0, 1);
+	if (peer->fd < 0) {
+		peer->failed = 1;
+		peer->soopt = errno;
+		return -1;
+	}
+	peer->session->corerouter->cr_table[peer->fd] = peer;
+	peer->connecting = 1;
+	return uwsgi_cr_set_hooks(peer, NULL, hr_instance_connected);
+}
+
+// build the uwsgi header and connect to the backend
+static int http2_stream_connect(struct http_session *hr, struct corerouter_peer *peer, struct uwsgi_buffer *body) {
+	struct uwsgi_corerouter *ucr = hr->session.corerouter;
+
+	if (body) {
+		uint64_t body_len = peer->body_fd >= 0 ? peer->body_size : body->pos;
+		if (uwsgi_buffer_append_keynum(peer->out, "CONTENT_LENGTH", 14, body_len)) return -1;
+	}
+
+	uint16_t pktsize = peer->out->pos - 4;
+	peer->out->buf[0] = hr->session.main_peer->modifier1;
+	peer->out->buf[1] = (uint8_t) (pktsize & 0xff);
+	peer->out->buf[2] = (uint8_t) ((pktsize >> 8) & 0xff);
+	peer->out->buf[3] = hr->session.main_peer->modifier2;
+
+	if (body && body->pos > 0) {
+		peer->out->limit = 0;
+		if (uwsgi_buffer_append(peer->out, body->buf, body->pos)) return -1;
+		body->pos = 0;
+	}
+
+	peer->r_parser_status = HTTP2_STREAM_HEADERS;
+
+	// find the backend node
+	if (uwsgi_cr_peer_hash_key(peer, peer->out->buf + 4, pktsize)) return -1;
+	if (ucr->mapper(ucr, peer)) return -1;
+	if (peer->instance_address_len == 0) {
+		corerouter_close_peer(ucr, peer);
+		return 0;
+	}
+
+	peer->last_hook_read = hr_instance_read_to_http2;
+	peer->can_retry = 1;
+	if (http2_backend_connect(peer)) {
+		if (!peer->failed) return -1;
+		corerouter_close_peer(ucr, peer);
+	}
+	return 0;
+}
+
+// send the part of the request body stored in the temp file
+static ssize_t http2_stream_sendfile(struct corerouter_peer *peer) {
+	ssize_t len = uwsgi_sendfile_do(peer->fd, peer->body_fd, peer->body_pos, peer->body_size - peer->body_pos);
+	if (len < 0) {
+		cr_try_again;
+		uwsgi_cr_error(peer, "http2_stream_sendfile()");
+		return -1;
+	}
+	// the file has been truncated ?
+	if (!len) return 0;
+
+	peer->body_pos += len;
+	if (peer->body_pos == peer->body_size) {
+		close(peer->body_fd);
+		peer->body_fd = -1;
+		if (uwsgi_cr_set_hooks(peer, peer->last_hook_read, NULL)) return -1;
+	}
+	return len;
+}
+
+// the queued request data has been written to the backend
+int http2_stream_written(struct corerouter_peer *peer) {
+	struct http_session *hr = (struct http_session *) peer->session;
+	// the uwsgi packet is followed by the body stored in the temp file
+	if (peer->body_fd >= 0) {
+		return uwsgi_cr_set_hooks(peer, NULL, http2_stream_sendfile);
+	}
+	if (uwsgi_cr_set_hooks(peer, peer->last_hook_read, NULL)) return -1;
+	if (http2_window_release(peer)) return -1;
+	return http2_send(hr);
+}
+
+static int http2_body_write(struct corerouter_peer *peer, char *buf, size_t len) {
+	while(len > 0) {
+		ssize_t wlen = write(peer->body_fd, buf, len);
+		if (wlen <= 0) {
+			uwsgi_cr_error(peer, "http2_body_write()/write()");
+			return -1;
+		}
+		buf += wlen;
+		len -= wlen;
+		peer->body_size += wlen;
+	}
+	return 0;
+}
+
+// buffer a request body without content length, the bigger ones are moved to a temp file
+static int http2_body_store(struct corerouter_peer *peer, char *buf, size_t len) {
+	struct uwsgi_buffer *ub = peer->in;
+	if (peer->body_fd < 0) {
+		// in memory up to the buffer limit (UMAX16)
+		if (!uwsgi_buffer_append(ub, buf, len)) return 0;
+		peer->body_fd = uwsgi_cr_pb_tmpfd(peer->session->corerouter);
+		if (peer->body_fd < 0) return -1;
+		if (http2_body_write(peer, ub->buf, ub->pos)) return -1;
+		ub->pos = 0;
+	}
+	return http2_body_write(peer, buf, len);
+}
+
+static int http2_headers_block(struct http_session *hr, uint32_t sid, uint8_t flags, uint8_t *buf, size_t len) {
+	struct uwsgi_corerouter *ucr = hr->session.corerouter;
+	struct corerouter_peer *peer = uwsgi_cr_peer_find_by_sid(&hr->session, sid);
+
+	// trailers (or a block for an already closed stream), decode it to keep the hpack state in sync
+	if (peer || sid <= hr->http2_last_sid) {
+		if (http2_hpack_decode(hr, buf, len, NULL)) return -1;
+		if (peer && peer->r_parser_status == HTTP2_STREAM_BODY && (flags & HTTP2_FLAG_END_STREAM)) {
+			struct uwsgi_buffer *body = peer->in;
+			int ret = http2_stream_connect(hr, peer, body);
+			return ret;
+		}
+		return 0;
+	}
+
+	// streams initiated by the client are odd
+	if (!(sid & 1)) return -1;
+	hr->http2_last_sid = sid;
+
+	int streams = 0;
+	struct corerouter_peer *peers = hr->session.peers;
+	while(peers) {
+		streams++;
+		peers = peers->next;
+	}
+	if (streams >= HTTP2_MAX_STREAMS) {
+		if (http2_hpack_decode(hr, buf, len, NULL)) return -1;
+		return http2_rst_stream(hr, sid, HTTP2_REFUSED_STREAM);
+	}
+
+	peer = uwsgi_cr_peer_add(&hr->session);
+	peer->sid = sid;
+	peer->window = hr->http2_initial_window;
+	peer->r_parser_status = HTTP2_STREAM_BODY;
+	peer->out = uwsgi_buffer_new(uwsgi.page_size);
+	peer->out->limit = UMAX16;
+	// the buffer will be reused for the request body
+	peer->out_need_free = 2;
+	// leave space for the uwsgi header
+	peer->out->pos = 4;
+
+	struct http2_request h2r;
+	memset(&h2r, 0, sizeof(struct http2_request));
+	h2r.peer = peer;
+
+	if (http2_hpack_decode(hr, buf, len, &h2r)) {
+		if (h2r.cookies) uwsgi_buffer_destroy(h2r.cookies);
+		return -1;
+	}
+
+	struct uwsgi_buffer *out = peer->out;
+	if (h2r.cookies) {
+		if (!peer->failed) {
+			if (uwsgi_buffer_append_keyval(out, "HTTP_COOKIE", 11, h2r.cookies->buf, h2r.cookies->pos)) peer->failed = 1;
+		}
+		uwsgi_buffer_destroy(h2r.cookies);
+	}
+
+	// malformed request
+	if (peer->failed || !h2r.has_method || !h2r.has_path || !h2r.host_len) goto refuse;
+
+	if (uwsgi_buffer_append_keyval(out, "SERVER_PROTOCOL", 15, "HTTP/2.0", 8)) goto refuse;
+	if (uwsgi_buffer_append_keyval(out, "SCRIPT_NAME", 11, "", 0)) goto refuse;
+	if (uwsgi_buffer_append_keyval(out, "SERVER_NAME", 11, uwsgi.hostname, uwsgi.hostname_len)) goto refuse;
+	if (uwsgi_buffer_append_keyval(out, "SERVER_PORT", 11, hr->port, hr->port_len)) goto refuse;
+	if (uwsgi_buffer_append_keyval(out, "UWSGI_ROUTER", 12, "http", 4)) goto refuse;
+#ifdef UWSGI_SSL
+	if (hr->ssl) {
+		if (uwsgi_buffer_append_keyval(out, "HTTPS", 5, "on", 2)) goto refuse;
+	}
+#endif
+	if (uwsgi_buffer_append_keyval(out, "REMOTE_ADDR", 11, hr->session.client_address, strlen(hr->session.client_address))) goto refuse;
+	if (uwsgi_buffer_append_keyval(out, "REMOTE_PORT", 11, hr->session.client_port, strlen(hr->session.client_port))) goto refuse;
+
+	struct uwsgi_string_list *hv = uhttp.http_vars;
+	while (hv) {
+		char *equal = strchr(hv->value, '=');
+		if (equal) {
+			if (uwsgi_buffer_append_keyval(out, hv->value, equal - hv->value, equal + 1, strlen(equal + 1))) goto refuse;
+		}
+		hv = hv->next;
+	}
+
+	// the output buffer will be reused, so we need a copy of the key
+	peer->key = uwsgi_concat2n(out->buf + h2r.host_pos, h2r.host_len, "", 0);
+	peer->key_len = h2r.host_len;
+	peer->key_need_free = 1;
+
+	// without a content length we need to buffer the whole body
+	if (!(flags & HTTP2_FLAG_END_STREAM) && !h2r.has_content_length) {
+		peer->in->limit = UMAX16;
+		return 0;
+	}
+
+	return http2_stream_connect(hr, peer, NULL);
+
+refuse:
+	peer->r_parser_status = HTTP2_STREAM_CLOSED;
+	peer->failed = 0;
+	corerouter_close_peer(ucr, peer);
+	return http2_rst_stream(hr, sid, 0x1);
+}
+
+static int http2_manage_data(struct http_session *hr, uint32_t sid, uint8_t flags, uint8_t *buf, uint32_t len) {
+	uint32_t frame_len = len;
+	if (flags & HTTP2_FLAG_PADDED) {
+		if (len < 1 || buf[0] >= len) return -1;
+		len -= buf[0] + 1;
+		buf++;
+	}
+
+	struct corerouter_peer *peer = uwsgi_cr_peer_find_by_sid(&hr->session, sid);
+	if (!peer) {
+		if (sid > hr->http2_last_sid) return -1;
+		// discarded data does not consume the connection window
+		if (frame_len > 0) return http2_window_update(hr, 0, frame_len);
+		return 0;
+	}
+
+	if (peer->r_parser_status == HTTP2_STREAM_BODY) {
+		if (http2_body_store(peer, (char *) buf, len)) {
+			peer->r_parser_status = HTTP2_STREAM_CLOSED;
+			corerouter_close_peer(hr->session.corerouter, peer);
+			if (frame_len > 0 && http2_window_update(hr, 0, frame_len)) return -1;
+			return http2_rst_stream(hr, sid, HTTP2_REFUSED_STREAM);
+		}
+		// the body is stored (in memory or in the temp file), so it is already consumed
+		if (frame_len > 0) {
+			if (http2_window_update(hr, 0, frame_len)) return -1;
+			if (!(flags & HTTP2_FLAG_END_STREAM)) {
+				if (http2_window_update(hr, sid, frame_len)) return -1;
+			}
+		}
+		if (flags & HTTP2_FLAG_END_STREAM) {
+			return http2_stream_connect(hr, peer, peer->in);
+		}
+		return 0;
+	}
+
+	// the backend is gone (or the response is already completed)
+	if (peer->r_parser_status != HTTP2_STREAM_HEADERS && peer->r_parser_status != HTTP2_STREAM_DATA) {
+		if (frame_len > 0) return http2_window_update(hr, 0, frame_len);
+		return 0;
+	}
+
+	// the window will be given back when the data has been written to the backend,
+	// so the client cannot queue more than the window we announced
+	if (peer->window_pending + frame_len > HTTP2_DEFAULT_WINDOW) return -1;
+	peer->window_pending += frame_len;
+
+	// the backend is connecting (or a previous chunk is being written), queue the data
+	if (peer->hook_write) {
+		peer->out->limit = 0;
+		return uwsgi_buffer_append(peer->out, (char *) buf, len);
+	}
+
+	if (len == 0) return http2_window_release(peer);
+
+	peer->out->pos = 0;
+	peer->out->limit = 0;
+	if (uwsgi_buffer_append(peer->out, (char *) buf, len)) return -1;
+	peer->out_pos = 0;
+	return uwsgi_cr_set_hooks(peer, peer->hook_read, hr_instance_write);
+}
+
+static int http2_manage_settings(struct http_session *hr, uint32_t sid, uint8_t flags, uint8_t *buf, uint32_t len) {
+	uint32_t i;
+	if (sid != 0) return -1;
+	if (flags & HTTP2_FLAG_ACK) return 0;
+	if (len % 6) return -1;
+	for(i=0;i<len;i+=6) {
+		uint16_t id = uwsgi_be16((char *) buf + i);
+		uint32_t value = uwsgi_be32((char *) buf + i + 2);
+		// SETTINGS_INITIAL_WINDOW_SIZE
+		if (id == 0x4) {
+			if (value > HTTP2_MAX_WINDOW) return -1;
+			int64_t delta = (int64_t) value - hr->http2_initial_window;
+			struct corerouter_peer *peer = hr->session.peers;
+			while(peer) {
+				peer->window += delta;
+				peer = peer->next;
+			}
+			hr->http2_initial_window = value;
+		}
+		// SETTINGS_MAX_FRAME_SIZE
+		else if (id == 0x5) {
+			if (value < HTTP2_DEFAULT_FRAME || value > HTTP2_MAX_FRAME) return -1;
+			hr->http2_max_frame = value;
+		}
+	}
+	if (http2_frame_header(hr->http2_out, 0, HTTP2_SETTINGS, HTTP2_FLAG_ACK, 0)) return -1;
+	return http2_flush_streams(hr);
+}
+
+static int http2_manage_window_update(struct http_session *hr, uint32_t sid, uint8_t *buf, uint32_t len) {
+	if (len != 4) return -1;
+	uint32_t increment = uwsgi_be32((char *) buf) & 0x7fffffff;
+	if (increment == 0) return -1;
+	if (sid == 0) {
+		hr->http2_window += increment;
+		if (hr->http2_window > HTTP2_MAX_WINDOW) return -1;
+	}
+	else {
+		struct corerouter_peer *peer = uwsgi_cr_peer_find_by_sid(&hr->session, sid);
+		if (!peer) return 0;
+		peer->window += increment;
+		if (peer->window > HTTP2_MAX_WINDOW) {
+			peer->r_parser_status = HTTP2_STREAM_CLOSED;
+			corerouter_close_peer(hr->session.corerouter, peer);
+			return http2_rst_stream(hr, sid, 0x3);
+		}
+	}
+	return http2_flush_streams(hr);
+}
+
+static int http2_manage_frame(struct http_session *hr, uint8_t type, uint8_t flags, uint32_t sid, uint8_t *buf, uint32_t len) {
+	struct corerouter_peer *peer = NULL;
+
+	// only CONTINUATION frames are allowed in the middle of a header block
+	if (hr->http2_headers_sid && type != HTTP2_CONTINUATION) return -1;
+
+	switch(type) {
+		case HTTP2_DATA:
+			if (sid == 0) return -1;
+			return http2_manage_data(hr, sid, flags, buf, len);
+		case HTTP2_HEADERS:
+			if (sid == 0) return -1;
+			if (flags & HTTP2_FLAG_PADDED) {
+				if (len < 1 || buf[0] >= len) return -1;
+				len -= buf[0] + 1;
+				buf++;
+			}
+			if (flags & HTTP2_FLAG_PRIORITY) {
+				if (len < 5) return -1;
+				len -= 5;
+				buf += 5;
+			}
+			if (!(flags & HTTP2_FLAG_END_HEADERS)) {
+				hr->http2_headers->pos = 0;
+				if (uwsgi_buffer_append(hr->http2_headers, (char *) buf, len)) return -1;
+				hr->http2_headers_sid = sid;
+				hr->http2_headers_flags = flags;
+				return 0;
+			}
+			return http2_headers_block(hr, sid, flags, buf, len);
+		case HTTP2_CONTINUATION:
+			if (!hr->http2_headers_sid || sid != hr->http2_headers_sid) return -1;
+			if (uwsgi_buffer_append(hr->http2_headers, (char *) buf, len)) return -1;
+			if (flags & HTTP2_FLAG_END_HEADERS) {
+				hr->http2_headers_sid = 0;
+				return http2_headers_block(hr, sid, hr->http2_headers_flags, (uint8_t *) hr->http2_headers->buf, hr->http2_headers->pos);
+			}
+			return 0;
+		case HTTP2_RST_STREAM:
+			if (len != 4 || sid == 0) return -1;
+			peer = uwsgi_cr_peer_find_by_sid(&hr->session, sid);
+			if (peer) {
+				peer->r_parser_status = HTTP2_STREAM_CLOSED;
+				corerouter_close_peer(hr->session.corerouter, peer);
+			}
+			return 0;
+		case HTTP2_SETTINGS:
+			return http2_manage_settings(hr, sid, flags, buf, len);
+		case HTTP2_PING:
+			if (len != 8 || sid != 0) return -1;
+			if (flags & HTTP2_FLAG_ACK) return 0;
+			if (http2_frame_header(hr->http2_out, 8, HTTP2_PING, HTTP2_FLAG_ACK, 0)) return -1;
+			return uwsgi_buffer_append(hr->http2_out, (char *) buf, 8);
+		case HTTP2_WINDOW_UPDATE:
+			return http2_manage_window_update(hr, sid, buf, len);
+		case HTTP2_PUSH_PROMISE:
+			// clients cannot push
+			return -1;
+		case HTTP2_PRIORITY:
+		case HTTP2_GOAWAY:
+		default:
+			break;
+	}
+	return 0;
+}
+
+static int http2_init(struct corerouter_peer *main_peer) {
+	struct http_session *hr = (struct http_session *) main_peer->session;
+
+	if (main_peer->in->pos < HTTP2_PREFACE_LEN) return 0;
+	if (memcmp(main_peer->in->buf, HTTP2_PREFACE, HTTP2_PREFACE_LEN)) return -1;
+	if (uwsgi_buffer_decapitate(main_peer->in, HTTP2_PREFACE_LEN)) return -1;
+
+	if (!hpack_huffman_nodes) {
+		hpack_huffman_init();
+	}
+
+	hr->http2_hpack = uwsgi_calloc(sizeof(struct http2_hpack));
+	hr->http2_hpack->max_size = HPACK_TABLE_SIZE;
+	hr->http2_out = uwsgi_buffer_new(uwsgi.page_size);
+	hr->http2_wbuf = uwsgi_buffer_new(uwsgi.page_size);
+	hr->http2_headers = uwsgi_buffer_new(uwsgi.page_size);
+	hr->http2_headers->limit = UMAX16;
+	hr->http2_window = HTTP2_DEFAULT_WINDOW;
+	hr->http2_initial_window = HTTP2_DEFAULT_WINDOW;
+	hr->http2_max_frame = HTTP2_DEFAULT_FRAME;
+
+	hr->session.can_keepalive = 1;
+	hr->session.close_peer = http2_close_peer;
+
+	// SETTINGS_MAX_CONCURRENT_STREAMS
+	if (http2_frame_header(hr->http2_out, 6, HTTP2_SETTINGS, 0, 0)) return -1;
+	if (uwsgi_buffer_u16be(hr->http2_out, 0x3)) return -1;
+	if (uwsgi_buffer_u32be(hr->http2_out, HTTP2_MAX_STREAMS)) return -1;
+
+	hr->http2_initialized = 1;
+	return 0;
+}
+
+/*
+
+	parse frames from the client.
+
+	All of the buffered frames are parsed: request data is queued in the streams and
+	the frames for the client in hr->http2_out. The client is not read while it is being written.
+
+*/
+ssize_t http2_parse(struct corerouter_peer *main_peer) {
+	struct http_session *hr = (struct http_session *) main_peer->session;
+
+	if (!hr->http2_initialized) {
+		if (http2_init(main_peer)) goto error;
+		if (!hr->http2_initialized) return 1;
+	}
+
+	while(main_peer->in->pos >= 9) {
+		uint8_t *buf = (uint8_t *) main_peer->in->buf;
+		uint32_t len = (buf[0] << 16) | (buf[1] << 8) | buf[2];
+		uint8_t type = buf[3];
+		uint8_t flags = buf[4];
+		uint32_t sid = uwsgi_be32((char *) buf + 5) & 0x7fffffff;
+
+		// we always announce the default max frame size
+		if (len > HTTP2_DEFAULT_FRAME) goto error;
+		if (main_peer->in->pos < 9 + len) break;
+
+		if (http2_manage_frame(hr, type, flags, sid, buf + 9, len)) goto error;
+		if (uwsgi_buffer_decapitate(main_peer->in, 9 + len)) goto error;
+	}
+
+	if (http2_send(hr)) goto error;
+	return 1;
+
+error:
+	hr->http2_error = 1;
+	return -1;
+}
+
+void http2_session_close(struct http_session *hr) {
+	if (hr->http2_hpack) {
+		size_t i;
+		for(i=0;i<hr->http2_hpack->count;i++) {
+			free(hr->http2_hpack->entries[i].name);
+		}
+		free(hr->http2_hpack);
+	}
+	if (hr->http2_out) {
+		uwsgi_buffer_destroy(hr->http2_out);
+	}
+	if (hr->http2_wbuf) {
+		uwsgi_buffer_destroy(hr->http2_wbuf);
+	}
+	if (hr->http2_headers) {
+		uwsgi_buffer_destroy(hr->http2_headers);
+	}
+}
+
+#ifdef UWSGI_HTTP2_ALPN
+// prefer h2, fallback to http/1.1
+int http2_alpn_select(SSL *ssl, const unsigned char **out, unsigned char *outlen, const unsigned char *in, unsigned int inlen, void *arg) {
+	unsigned int i = 0;
+	const unsigned char *http11 = NULL;
+	while(i < inlen) {
+		uint8_t len = in[i];
+		if (i + 1 + len > inlen) break;
+		if (len == 2 && !memcmp(in + i + 1, "h2", 2)) {
+			*out = in + i + 1;
+			*outlen = 2;
+			return SSL_TLSEXT_ERR_OK;
+		}
+		if (len == 8 && !memcmp(in + i + 1, "http/1.1", 8)) {
+			http11 = in + i + 1;
+		}
+		i += 1 + len;
+	}
+	if (http11) {
+		*out = http11;
+		*outlen = 8;
+		return SSL_TLSEXT_ERR_OK;
+	}
+	return SSL_TLSEXT_ERR_NOACK;
+}
+#endif
@@ -278,6 +278,10 @@ ssize_t hr_ssl_write(struct corerouter_peer *main_peer) {
                         	main_peer->session->connect_peer_after_write = NULL;
                         	return ret;
                 	}
+			if (hr->http2) {
+				if (uwsgi_cr_set_hooks(main_peer, main_peer->disabled ? NULL : main_peer->last_hook_read, NULL)) return -1;
+				return http2_parse(main_peer);
+			}
                         cr_reset_hooks(main_peer);
 #ifdef UWSGI_SPDY
 			if (hr->spdy) {
@@ -290,6 +294,19 @@ ssize_t hr_ssl_write(struct corerouter_peer *main_peer) {
         if (ret == 0) return 0;
         int err = SSL_get_error(hr->ssl, ret);
 
+        // HTTP/2 streams must not be suspended, only the client hooks are changed
+        if (hr->http2) {
+                if (err == SSL_ERROR_WANT_READ) {
+                        if (uwsgi_cr_set_hooks(main_peer, hr_ssl_write, NULL)) return -1;
+                        main_peer->last_hook_read = hr_ssl_read;
+                        return 1;
+                }
+                if (err == SSL_ERROR_WANT_WRITE) {
+                        if (uwsgi_cr_set_hooks(main_peer, NULL, hr_ssl_write)) return -1;
+                        return 1;
+                }
+        }
+
         if (err == SSL_ERROR_WANT_READ) {
                 cr_reset_hooks_and_read(main_peer, hr_ssl_write);
                 return 1;
@@ -335,6 +352,10 @@ ssize_t hr_ssl_read(struct corerouter_peer *main_peer) {
                         // fix the buffer
                         main_peer->in->pos += ret2;
                 }
+                // the read was waiting for the socket to be writable
+                if (hr->http2 && main_peer->hook_write == hr_ssl_read) {
+                        if (uwsgi_cr_set_hooks(main_peer, hr_ssl_read, NULL)) return -1;
+                }
 #ifdef UWSGI_SPDY
                 if (hr->spdy) {
                         //uwsgi_log("RUNNING THE SPDY PARSER FOR %d bytes\n", main_peer->in->pos);
@@ -346,6 +367,17 @@ ssize_t hr_ssl_read(struct corerouter_peer *main_peer) {
         if (ret == 0) return 0;
         int err = SSL_get_error(hr->ssl, ret);
 
+        if (hr->http2) {
+                if (err == SSL_ERROR_WANT_READ) {
+                        if (uwsgi_cr_set_hooks(main_peer, hr_ssl_read, NULL)) return -1;
+                        return 1;
+                }
+                if (err == SSL_ERROR_WANT_WRITE) {
+                        if (uwsgi_cr_set_hooks(main_peer, NULL, hr_ssl_read)) return -1;
+                        return 1;
+                }
+        }
+
         if (err == SSL_ERROR_WANT_READ) {
                 cr_reset_hooks_and_read(main_peer, hr_ssl_read);
                 return 1;
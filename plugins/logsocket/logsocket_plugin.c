@@ -2,57 +2,60 @@
 
 extern struct uwsgi_server uwsgi;
 
-ssize_t uwsgi_socket_logger(struct uwsgi_logger *ul, char *message, size_t len) {
+static void uwsgi_socket_logger_setup(struct uwsgi_logger *ul) {
 
 	int family = AF_UNIX;
 
-	if (!ul->configured) {
+	char *comma = strchr(ul->arg, ',');
+	if (comma) {
+		ul->data = comma+1;
+		*comma = 0;
+	}
 
-		char *comma = strchr(ul->arg, ',');
-		if (comma) {
-			ul->data = comma+1;
-			*comma = 0;
-		}
+	char *colon = strchr(ul->arg, ':');
+	if (colon) {
+		family = AF_INET;
+		ul->addr_len = socket_to_in_addr(ul->arg, colon, 0, &ul->addr.sa_in);
+	}
+	else {
+		ul->addr_len = socket_to_un_addr(ul->arg, &ul->addr.sa_un);
+	}
 
-        	char *colon = strchr(ul->arg, ':');
-        	if (colon) {
-                	family = AF_INET;
-                	ul->addr_len = socket_to_in_addr(ul->arg, colon, 0, &ul->addr.sa_in);
-        	}
-        	else {
-                	ul->addr_len = socket_to_un_addr(ul->arg, &ul->addr.sa_un);
-        	}
-
-        	ul->fd = socket(family, SOCK_DGRAM, 0);
-        	if (ul->fd < 0) {
-                	uwsgi_error_safe("socket()");
-			exit(1);
-        	}
-
-		memset(&ul->msg, 0, sizeof(struct msghdr));
-
-		ul->msg.msg_name = &ul->addr;
-		ul->msg.msg_namelen = ul->addr_len;
-		if (ul->data) {
-			ul->msg.msg_iov = uwsgi_malloc(sizeof(struct iovec) * 2);
-			ul->msg.msg_iov[0].iov_base = ul->data;
-			ul->msg.msg_iov[0].iov_len = strlen(ul->data);
-			ul->msg.msg_iovlen = 2;
-			ul->count = 1;
-		}
-		else {
-			ul->msg.msg_iov = uwsgi_malloc(sizeof(struct iovec));
-			ul->msg.msg_iovlen = 1;
-		}
+	ul->fd = socket(family, SOCK_DGRAM, 0);
+	if (ul->fd < 0) {
+		uwsgi_error_safe("socket()");
+		exit(1);
+	}
 
-		if (comma) {
-			*comma = ',' ;
-		}
+	memset(&ul->msg, 0, sizeof(struct msghdr));
+
+	ul->msg.msg_name = &ul->addr;
+	ul->msg.msg_namelen = ul->addr_len;
+	if (ul->data) {
+		ul->msg.msg_iov = uwsgi_malloc(sizeof(struct iovec) * 2);
+		ul->msg.msg_iov[0].iov_base = ul->data;
+		ul->msg.msg_iov[0].iov_len = strlen(ul->data);
+		ul->msg.msg_iovlen = 2;
+		ul->count = 1;
+	}
+	else {
+		ul->msg.msg_iov = uwsgi_malloc(sizeof(struct iovec));
+		ul->msg.msg_iovlen = 1;
+	}
 
-		ul->configured = 1;
+	if (comma) {
+		*comma = ',' ;
+	}
+
+	ul->configured = 1;
+}
+
+ssize_t uwsgi_socket_logger(struct uwsgi_logger *ul, char *message, size_t len) {
+
+	if (!ul->configured) {
+		uwsgi_socket_logger_setup(ul);
 	}
 
-	
 	ul->msg.msg_iov[ul->count].iov_base = message;
 	ul->msg.msg_iov[ul->count].iov_len = len;
 
@@ -60,8 +63,33 @@ ssize_t uwsgi_socket_logger(struct uwsgi_logger *ul, char *message, size_t len)
 
 }
 
+// one datagram for each message, sent with a single syscall when possible
+ssize_t uwsgi_socket_logger_batch(struct uwsgi_logger *ul, struct iovec *messages, int n) {
+
+	struct msghdr msgs[UWSGI_LOGGER_BATCH_MAX];
+	struct iovec iov[UWSGI_LOGGER_BATCH_MAX * 2];
+	int i;
+
+	if (!ul->configured) {
+		uwsgi_socket_logger_setup(ul);
+	}
+
+	if (n > UWSGI_LOGGER_BATCH_MAX) n = UWSGI_LOGGER_BATCH_MAX;
+
+	for(i=0;i<n;i++) {
+		msgs[i] = ul->msg;
+		msgs[i].msg_iov = &iov[i*2];
+		if (ul->count) {
+			iov[i*2] = ul->msg.msg_iov[0];
+		}
+		iov[(i*2) + ul->count] = messages[i];
+	}
+
+	return uwsgi_logger_send_datagrams(ul->fd, msgs, n);
+}
+
 void uwsgi_logsocket_register() {
-	uwsgi_register_logger("socket", uwsgi_socket_logger);
+	uwsgi_register_logger_batch("socket", uwsgi_socket_logger, uwsgi_socket_logger_batch);
 }
 
 struct uwsgi_plugin logsocket_plugin = {
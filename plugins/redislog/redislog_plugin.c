@@ -50,70 +50,76 @@ static char *uwsgi_redis_logger_build_command(char *src) {
 	return orig_dst;
 }
 
-ssize_t uwsgi_redis_logger(struct uwsgi_logger *ul, char *message, size_t len) {
+static void uwsgi_redis_logger_setup(struct uwsgi_logger *ul) {
 
-	ssize_t ret,ret2;
 	struct uwsgi_redislog_state *uredislog = NULL;
 
-	if (!ul->configured) {
-
-		if (!ul->data) {
-			ul->data = uwsgi_calloc(sizeof(struct uwsgi_redislog_state));
-			uredislog = (struct uwsgi_redislog_state *) ul->data;
-		}
+	if (!ul->data) {
+		ul->data = uwsgi_calloc(sizeof(struct uwsgi_redislog_state));
+		uredislog = (struct uwsgi_redislog_state *) ul->data;
+	}
 
-        	if (ul->arg != NULL) {
-			char *logarg = uwsgi_str(ul->arg);
-			char *comma1 = strchr(logarg, ',');
-			if (!comma1) {
-				uredislog->address = logarg;
-				goto done;
-			}
-			*comma1 = 0;
+	if (ul->arg != NULL) {
+		char *logarg = uwsgi_str(ul->arg);
+		char *comma1 = strchr(logarg, ',');
+		if (!comma1) {
 			uredislog->address = logarg;
-			comma1++;
-			if (*comma1 == 0) goto done;
-
-			char *comma2 = strchr(comma1,',');
-			if (!comma2) {
-				uredislog->command = uwsgi_redis_logger_build_command(comma1);
-				goto done;
-			}
+			goto done;
+		}
+		*comma1 = 0;
+		uredislog->address = logarg;
+		comma1++;
+		if (*comma1 == 0) goto done;
 
-			*comma2 = 0;
+		char *comma2 = strchr(comma1,',');
+		if (!comma2) {
 			uredislog->command = uwsgi_redis_logger_build_command(comma1);
-			comma2++;
-			if (*comma2 == 0) goto done;
-
-			uredislog->prefix = comma2;
-			
+			goto done;
 		}
 
+		*comma2 = 0;
+		uredislog->command = uwsgi_redis_logger_build_command(comma1);
+		comma2++;
+		if (*comma2 == 0) goto done;
+
+		uredislog->prefix = comma2;
+		
+	}
+
 done:
 
-		if (!uredislog->address) uredislog->address = uwsgi_str("127.0.0.1:6379");
-		if (!uredislog->command) uredislog->command = "*3\r\n$7\r\npublish\r\n$5\r\nuwsgi\r\n";
-		if (!uredislog->prefix) uredislog->prefix = "";
+	if (!uredislog->address) uredislog->address = uwsgi_str("127.0.0.1:6379");
+	if (!uredislog->command) uredislog->command = "*3\r\n$7\r\npublish\r\n$5\r\nuwsgi\r\n";
+	if (!uredislog->prefix) uredislog->prefix = "";
 
-		uredislog->fd = -1;
+	uredislog->fd = -1;
+
+	uredislog->iovec[0].iov_base = uredislog->command;
+	uredislog->iovec[0].iov_len = strlen(uredislog->command);
+	uredislog->iovec[1].iov_base = "$";
+	uredislog->iovec[1].iov_len = 1;
 
-		uredislog->iovec[0].iov_base = uredislog->command;
-		uredislog->iovec[0].iov_len = strlen(uredislog->command);
-		uredislog->iovec[1].iov_base = "$";
-		uredislog->iovec[1].iov_len = 1;
+	uredislog->iovec[2].iov_base = uredislog->msgsize;
 
-		uredislog->iovec[2].iov_base = uredislog->msgsize;
+	uredislog->iovec[3].iov_base = "\r\n";
+	uredislog->iovec[3].iov_len = 2;
 
-		uredislog->iovec[3].iov_base = "\r\n";
-		uredislog->iovec[3].iov_len = 2;
+	uredislog->iovec[4].iov_base = uredislog->prefix;
+	uredislog->iovec[4].iov_len = strlen(uredislog->prefix);
 
-		uredislog->iovec[4].iov_base = uredislog->prefix;
-		uredislog->iovec[4].iov_len = strlen(uredislog->prefix);
+	uredislog->iovec[6].iov_base = "\r\n";
+	uredislog->iovec[6].iov_len = 2;
 
-		uredislog->iovec[6].iov_base = "\r\n";
-		uredislog->iovec[6].iov_len = 2;
+	ul->configured = 1;
+}
+
+ssize_t uwsgi_redis_logger(struct uwsgi_logger *ul, char *message, size_t len) {
+
+	ssize_t ret,ret2;
+	struct uwsgi_redislog_state *uredislog = NULL;
 
-		ul->configured = 1;
+	if (!ul->configured) {
+		uwsgi_redis_logger_setup(ul);
 	}
 
 	uredislog = (struct uwsgi_redislog_state *) ul->data;
@@ -156,8 +162,82 @@ again:
 
 }
 
+// max number of commands in a single writev() (7 iovecs for each of them)
+#define REDISLOG_PIPELINE 128
+
+/*
+	pipelining: the commands of the batch are written with a single writev()
+	and then all of the replies (one line each) are consumed
+*/
+ssize_t uwsgi_redis_logger_batch(struct uwsgi_logger *ul, struct iovec *messages, int n) {
+
+	struct iovec iov[REDISLOG_PIPELINE * 7];
+	char msgsize[REDISLOG_PIPELINE][11];
+	char response[4096];
+	ssize_t sent = 0;
+	int i, j;
+
+	if (!ul->configured) {
+		uwsgi_redis_logger_setup(ul);
+	}
+
+	struct uwsgi_redislog_state *uredislog = (struct uwsgi_redislog_state *) ul->data;
+
+	for(i=0;i<n;i+=REDISLOG_PIPELINE) {
+		int cmds = n - i > REDISLOG_PIPELINE ? REDISLOG_PIPELINE : n - i;
+		size_t total = 0;
+
+		if (uredislog->fd == -1) {
+			uredislog->fd = uwsgi_connect(uredislog->address, uwsgi.shared->options[UWSGI_OPTION_SOCKET_TIMEOUT], 0);
+		}
+		if (uredislog->fd == -1) return -1;
+
+		for(j=0;j<cmds;j++) {
+			char *message = messages[i+j].iov_base;
+			size_t len = messages[i+j].iov_len;
+			// drop newline
+			if (len > 0 && message[len-1] == '\n') len--;
+			struct iovec *cmd = &iov[j*7];
+			memcpy(cmd, uredislog->iovec, sizeof(struct iovec) * 7);
+			uwsgi_num2str2(len + uredislog->iovec[4].iov_len, msgsize[j]);
+			cmd[2].iov_base = msgsize[j];
+			cmd[2].iov_len = strlen(msgsize[j]);
+			cmd[5].iov_base = message;
+			cmd[5].iov_len = len;
+			int k;
+			for(k=0;k<7;k++) total += cmd[k].iov_len;
+		}
+
+		ssize_t ret = writev(uredislog->fd, iov, cmds * 7);
+		if (ret <= 0 || (size_t) ret < total) {
+			close(uredislog->fd);
+			uredislog->fd = -1;
+			return -1;
+		}
+		sent += ret;
+
+		// every reply is a single line
+		int replies = 0;
+		while(replies < cmds) {
+			ssize_t rlen = read(uredislog->fd, response, 4096);
+			if (rlen <= 0) {
+				close(uredislog->fd);
+				uredislog->fd = -1;
+				return -1;
+			}
+			char *ptr = response;
+			while((ptr = memchr(ptr, '\n', rlen - (ptr - response)))) {
+				replies++;
+				ptr++;
+			}
+		}
+	}
+
+	return sent;
+}
+
 void uwsgi_redislog_register() {
-	uwsgi_register_logger("redislog", uwsgi_redis_logger);
+	uwsgi_register_logger_batch("redislog", uwsgi_redis_logger, uwsgi_redis_logger_batch);
 }
 
 struct uwsgi_plugin redislog_plugin = {
@@ -12,6 +12,17 @@ extern struct uwsgi_server uwsgi;
 
 	route = /^foobar1(.*)/ cache:key=foo$1poo,content_type=text/html,name=foobar
 
+	full response caching (status, headers and body):
+
+	route = ^/news/ cache-response:key=${HTTP_HOST}${REQUEST_URI},name=pages,expires=60,stale=30,stale_if_error=300
+
+	concurrent misses for the same key are collapsed: only one core goes to the app, the others
+	wait (up to "wait" seconds) for the response to be stored, or get the stale copy in the "stale" window.
+	When the app fails (5xx) the stale copy is sent in the "stale_if_error" window.
+
+	Cache-Control (no-store, no-cache, private, max-age, s-maxage, stale-while-revalidate, stale-if-error)
+	and Vary in the app response override the route values.
+
 */
 
 struct uwsgi_router_cache_conf {
@@ -59,6 +70,14 @@ struct uwsgi_router_cache_conf {
 	char *no_offload;
 
 	char *no_cl;
+
+	// cache-response
+	char *stale_str;
+	uint64_t stale;
+	char *stale_if_error_str;
+	uint64_t stale_if_error;
+	char *wait_str;
+	uint64_t wait;
 };
 
 // this is allocated for each transformation
@@ -164,6 +183,8 @@ static int uwsgi_routing_func_cache(struct wsgi_request *wsgi_req, struct uwsgi_
 	char *mime_type = NULL;
 	size_t mime_type_len = 0;
 	struct uwsgi_router_cache_conf *urcc = (struct uwsgi_router_cache_conf *) ur->data2;
+	struct uwsgi_ranges ranges;
+	ranges.parts = NULL;
 
 	char **subject = (char **) (((char *)(wsgi_req))+ur->subject);
         uint16_t *subject_len = (uint16_t *)  (((char *)(wsgi_req))+ur->subject_len);
@@ -178,12 +199,12 @@ static int uwsgi_routing_func_cache(struct wsgi_request *wsgi_req, struct uwsgi_
 	}
 	uwsgi_buffer_destroy(ub);
 	if (value) {
-		if (uwsgi_response_prepare_headers(wsgi_req, "200 OK", 6)) goto error;
+		uwsgi_ranges_parse(wsgi_req, valsize, NULL, 0, &ranges);
 		if (mime_type) {
-                        uwsgi_response_add_content_type(wsgi_req, mime_type, mime_type_len);
+			if (uwsgi_response_prepare_ranges(wsgi_req, &ranges, mime_type, mime_type_len, !urcc->no_cl)) goto error;
 		}
 		else {
-			if (uwsgi_response_add_content_type(wsgi_req, urcc->content_type, urcc->content_type_len)) goto error;
+			if (uwsgi_response_prepare_ranges(wsgi_req, &ranges, urcc->content_type, urcc->content_type_len, !urcc->no_cl)) goto error;
 		}
 		if (urcc->content_encoding_len) {
 			if (uwsgi_response_add_header(wsgi_req, "Content-Encoding", 16, urcc->content_encoding, urcc->content_encoding_len)) goto error;	
@@ -191,17 +212,20 @@ static int uwsgi_routing_func_cache(struct wsgi_request *wsgi_req, struct uwsgi_
 		if (expires) {
 			if (uwsgi_response_add_expires(wsgi_req, expires)) goto error;	
 		}
-		if (!urcc->no_cl) {
-			if (uwsgi_response_add_content_length(wsgi_req, valsize)) goto error;
+		if (uwsgi.honour_range) {
+			if (uwsgi_response_add_header(wsgi_req, "Accept-Ranges", 13, "bytes", 5)) goto error;
 		}
-		if (wsgi_req->socket->can_offload && !ur->custom && !urcc->no_offload) {
-                	if (!uwsgi_offload_request_memory_do(wsgi_req, value, valsize)) {
+		if (wsgi_req->socket->can_offload && !ur->custom && !urcc->no_offload && ranges.n >= 0) {
+			// the offload thread only sends the body
+			if (uwsgi_response_write_headers_do(wsgi_req)) goto error;
+                	if (!uwsgi_offload_request_memory_ranges_do(wsgi_req, value, &ranges)) {
                         	wsgi_req->via = UWSGI_VIA_OFFLOAD;
                         	return UWSGI_ROUTE_BREAK;
                 	}
 		}
 
-		uwsgi_response_write_body_do(wsgi_req, value, valsize);
+		uwsgi_response_write_ranges(wsgi_req, value, &ranges);
+		uwsgi_ranges_free(&ranges);
 		free(value);
 		if (ur->custom)
 			return UWSGI_ROUTE_NEXT;
@@ -210,6 +234,7 @@ static int uwsgi_routing_func_cache(struct wsgi_request *wsgi_req, struct uwsgi_
 	
 	return UWSGI_ROUTE_NEXT;
 error:
+	uwsgi_ranges_free(&ranges);
 	free(value);
 	return UWSGI_ROUTE_BREAK;
 }
@@ -310,6 +335,549 @@ static int uwsgi_routing_func_cachemath(struct wsgi_request *wsgi_req, struct uw
 
 
 
+/*
+	cache-response entries: a fixed header, the response headers ("key: value\r\n" lines) and the body.
+
+	a VARY entry only holds the Vary header of the response: the real one is stored in a key
+	built appending the values of those request headers.
+	a PASS entry marks a key whose responses cannot be cached (no coalescing for it).
+*/
+
+#define UWSGI_CACHE_RESPONSE 1
+#define UWSGI_CACHE_RESPONSE_VARY 2
+#define UWSGI_CACHE_RESPONSE_PASS 3
+
+// milliseconds between checks while waiting for the in-flight request
+#define UWSGI_CACHE_RESPONSE_POLL 10
+// ttl (in seconds) of the refresh lock when waiting is disabled (wait=0)
+#define UWSGI_CACHE_RESPONSE_LOCK_TTL 30
+
+struct uwsgi_cache_response_header {
+	uint8_t type;
+	uint16_t status;
+	uint32_t headers_len;
+	uint64_t stored;
+	uint64_t fresh_until;
+	uint64_t stale_until;
+	uint64_t stale_if_error_until;
+};
+
+struct uwsgi_cache_response {
+	struct uwsgi_cache_response_header h;
+	char *headers;
+	char *body;
+	uint64_t body_len;
+	// the memory returned by the cache
+	char *value;
+};
+
+// what the app response allows
+struct uwsgi_cache_response_policy {
+	int no_store;
+	int64_t max_age;
+	int64_t s_maxage;
+	int64_t stale;
+	int64_t stale_if_error;
+	char *vary;
+	size_t vary_len;
+	struct uwsgi_buffer *headers;
+};
+
+// this is allocated for each transformation
+struct uwsgi_transformation_cache_response {
+	struct uwsgi_router_cache_conf *urcc;
+	struct uwsgi_buffer *key;
+	// set only if this core is refreshing the entry
+	struct uwsgi_buffer *lock;
+	struct uwsgi_cache_response *stale;
+};
+
+static void cache_response_free(struct uwsgi_cache_response *ucr) {
+	free(ucr->value);
+	free(ucr);
+}
+
+static struct uwsgi_cache_response *cache_response_get(char *key, size_t key_len, char *name) {
+	uint64_t valsize = 0;
+	char *value = uwsgi_cache_magic_get(key, key_len, &valsize, NULL, name);
+	if (!value) return NULL;
+	struct uwsgi_cache_response *ucr = uwsgi_calloc(sizeof(struct uwsgi_cache_response));
+	ucr->value = value;
+	if (valsize < sizeof(struct uwsgi_cache_response_header)) goto error;
+	memcpy(&ucr->h, value, sizeof(struct uwsgi_cache_response_header));
+	if (ucr->h.type < UWSGI_CACHE_RESPONSE || ucr->h.type > UWSGI_CACHE_RESPONSE_PASS) goto error;
+	if (valsize - sizeof(struct uwsgi_cache_response_header) < ucr->h.headers_len) goto error;
+	ucr->headers = value + sizeof(struct uwsgi_cache_response_header);
+	ucr->body = ucr->headers + ucr->h.headers_len;
+	ucr->body_len = valsize - sizeof(struct uwsgi_cache_response_header) - ucr->h.headers_len;
+	return ucr;
+error:
+	cache_response_free(ucr);
+	return NULL;
+}
+
+static int cache_response_set(struct uwsgi_router_cache_conf *urcc, char *key, size_t key_len, struct uwsgi_cache_response_header *h, char *headers, char *body, uint64_t body_len, uint64_t expires) {
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(sizeof(struct uwsgi_cache_response_header) + h->headers_len + body_len);
+	int ret = -1;
+	if (uwsgi_buffer_append(ub, (char *) h, sizeof(struct uwsgi_cache_response_header))) goto end;
+	if (uwsgi_buffer_append(ub, headers, h->headers_len)) goto end;
+	if (uwsgi_buffer_append(ub, body, body_len)) goto end;
+	ret = uwsgi_cache_magic_set(key, key_len, ub->buf, ub->pos, expires, UWSGI_CACHE_FLAG_UPDATE, urcc->name);
+end:
+	uwsgi_buffer_destroy(ub);
+	return ret;
+}
+
+// append the values of the request headers listed in vary to the key
+static struct uwsgi_buffer *cache_response_variant_key(struct wsgi_request *wsgi_req, struct uwsgi_buffer *key, char *vary, size_t vary_len) {
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(key->pos + 64);
+	if (uwsgi_buffer_append(ub, key->buf, key->pos)) goto error;
+	char *ptr = vary;
+	char *end = vary + vary_len;
+	while(ptr < end) {
+		char *comma = memchr(ptr, ',', end - ptr);
+		if (!comma) comma = end;
+		char *name = ptr;
+		size_t name_len = comma - ptr;
+		ptr = comma + 1;
+		while(name_len > 0 && isspace((int) *name)) { name++; name_len--; }
+		while(name_len > 0 && isspace((int) name[name_len-1])) name_len--;
+		if (!name_len || name_len > 64) continue;
+		char var[5 + 64];
+		memcpy(var, "HTTP_", 5);
+		size_t i;
+		for(i=0;i<name_len;i++) {
+			var[5+i] = name[i] == '-' ? '_' : toupper((int) name[i]);
+		}
+		uint16_t value_len = 0;
+		char *value = uwsgi_get_var(wsgi_req, var, 5 + name_len, &value_len);
+		// a zero byte cannot be part of request headers
+		if (uwsgi_buffer_append(ub, "\0", 1)) goto error;
+		if (value && uwsgi_buffer_append(ub, value, value_len)) goto error;
+	}
+	if (ub->pos > UMAX16) goto error;
+	return ub;
+error:
+	uwsgi_buffer_destroy(ub);
+	return NULL;
+}
+
+// get the entry for the request (following the Vary map), the key of the entry is returned in ekey
+static struct uwsgi_cache_response *cache_response_lookup(struct wsgi_request *wsgi_req, struct uwsgi_router_cache_conf *urcc, struct uwsgi_buffer *key, struct uwsgi_buffer **ekey) {
+	struct uwsgi_cache_response *ucr = cache_response_get(key->buf, key->pos, urcc->name);
+	if (!ucr || ucr->h.type != UWSGI_CACHE_RESPONSE_VARY) return ucr;
+	struct uwsgi_buffer *vkey = cache_response_variant_key(wsgi_req, key, ucr->headers, ucr->h.headers_len);
+	cache_response_free(ucr);
+	if (!vkey) return NULL;
+	ucr = cache_response_get(vkey->buf, vkey->pos, urcc->name);
+	if (ucr && ucr->h.type != UWSGI_CACHE_RESPONSE) {
+		cache_response_free(ucr);
+		ucr = NULL;
+	}
+	if (ekey) {
+		*ekey = vkey;
+	}
+	else {
+		uwsgi_buffer_destroy(vkey);
+	}
+	return ucr;
+}
+
+// 0 if the lock has been acquired, -1 if another core holds it, -2 if it cannot be stored (cache full)
+static int cache_response_lock(struct uwsgi_router_cache_conf *urcc, struct uwsgi_buffer *lock) {
+	pid_t pid = getpid();
+	// the lock expires even if its owner dies
+	uint64_t ttl = urcc->wait ? urcc->wait : UWSGI_CACHE_RESPONSE_LOCK_TTL;
+	if (!uwsgi_cache_magic_set(lock->buf, lock->pos, (char *) &pid, sizeof(pid_t), ttl, 0, urcc->name)) return 0;
+	uint64_t valsize = 0;
+	uint64_t expires = 0;
+	char *value = uwsgi_cache_magic_get(lock->buf, lock->pos, &valsize, &expires, urcc->name);
+	if (value) {
+		free(value);
+		// the sweeper did not remove it yet
+		if (!expires || expires >= (uint64_t) uwsgi_now()) return -1;
+		uwsgi_cache_magic_del(lock->buf, lock->pos, urcc->name);
+		if (!uwsgi_cache_magic_set(lock->buf, lock->pos, (char *) &pid, sizeof(pid_t), ttl, 0, urcc->name)) return 0;
+		return -1;
+	}
+	// no lock in place, the item could not be stored at all
+	return -2;
+}
+
+// the validator (a strong ETag or the Last-Modified date) and the Content-Type of a stored response
+static void cache_response_range_headers(struct uwsgi_cache_response *ucr, char **validator, uint16_t *validator_len, char **ct, uint16_t *ct_len) {
+	char *etag = NULL, *lm = NULL;
+	uint16_t etag_len = 0, lm_len = 0;
+	char *ptr = ucr->headers;
+	char *end = ucr->headers + ucr->h.headers_len;
+	while(ptr < end) {
+		char *crlf = memchr(ptr, '\r', end - ptr);
+		if (!crlf) break;
+		char *colon = memchr(ptr, ':', crlf - ptr);
+		if (colon) {
+			char *value = colon + 1;
+			while(value < crlf && *value == ' ') value++;
+			if (!uwsgi_strnicmp(ptr, colon - ptr, "ETag", 4)) {
+				// weak validators cannot be used for ranges
+				if (crlf - value < 2 || strncmp(value, "W/", 2)) {
+					etag = value;
+					etag_len = crlf - value;
+				}
+			}
+			else if (!uwsgi_strnicmp(ptr, colon - ptr, "Last-Modified", 13)) {
+				lm = value;
+				lm_len = crlf - value;
+			}
+			else if (!uwsgi_strnicmp(ptr, colon - ptr, "Content-Type", 12)) {
+				*ct = value;
+				*ct_len = crlf - value;
+			}
+		}
+		ptr = crlf + 2;
+	}
+	if (etag) {
+		*validator = etag;
+		*validator_len = etag_len;
+	}
+	else {
+		*validator = lm;
+		*validator_len = lm_len;
+	}
+}
+
+// ranges (if not NULL) are honoured only for 200 responses
+static int cache_response_headers(struct wsgi_request *wsgi_req, struct uwsgi_cache_response *ucr, struct uwsgi_ranges *ranges) {
+	char *ct = NULL;
+	uint16_t ct_len = 0;
+	if (ranges) {
+		memset(ranges, 0, sizeof(struct uwsgi_ranges));
+		ranges->size = ucr->body_len;
+		if (ucr->h.status == 200 && wsgi_req->range_len) {
+			char *validator = NULL;
+			uint16_t validator_len = 0;
+			cache_response_range_headers(ucr, &validator, &validator_len, &ct, &ct_len);
+			uwsgi_ranges_parse(wsgi_req, ucr->body_len, validator, validator_len, ranges);
+		}
+	}
+
+	if (ranges && ranges->n != 0) {
+		// status, Content-Type, Content-Range and Content-Length
+		if (uwsgi_response_prepare_ranges(wsgi_req, ranges, ct, ct_len, 1)) return -1;
+	}
+	else {
+		if (uwsgi_response_prepare_headers_int(wsgi_req, ucr->h.status)) return -1;
+	}
+
+	char *ptr = ucr->headers;
+	char *end = ucr->headers + ucr->h.headers_len;
+	while(ptr < end) {
+		char *crlf = memchr(ptr, '\r', end - ptr);
+		if (!crlf) break;
+		char *colon = memchr(ptr, ':', crlf - ptr);
+		if (colon) {
+			char *value = colon + 1;
+			while(value < crlf && *value == ' ') value++;
+			if (ranges && ranges->n != 0 && !uwsgi_strnicmp(ptr, colon - ptr, "Content-Type", 12)) {
+				ptr = crlf + 2;
+				continue;
+			}
+			if (uwsgi_response_add_header(wsgi_req, ptr, colon - ptr, value, crlf - value)) return -1;
+		}
+		ptr = crlf + 2;
+	}
+	char age[sizeof(UMAX64_STR)+1];
+	uint64_t now = uwsgi_now();
+	int ret = snprintf(age, sizeof(UMAX64_STR)+1, "%llu", (unsigned long long) (now > ucr->h.stored ? now - ucr->h.stored : 0));
+	if (ret <= 0 || ret > (int) (sizeof(UMAX64_STR)+1)) return -1;
+	if (uwsgi_response_add_header(wsgi_req, "Age", 3, age, ret)) return -1;
+	if (ranges && ranges->n != 0) return 0;
+	if (uwsgi.honour_range && ucr->h.status == 200) {
+		if (uwsgi_response_add_header(wsgi_req, "Accept-Ranges", 13, "bytes", 5)) return -1;
+	}
+	return uwsgi_response_add_content_length(wsgi_req, ucr->body_len);
+}
+
+static int64_t cache_control_num(char *d, size_t d_len, char *name, size_t name_len) {
+	if (d_len <= name_len + 1 || strncasecmp(d, name, name_len) || d[name_len] != '=') return -1;
+	return uwsgi_str_num(d + name_len + 1, d_len - (name_len + 1));
+}
+
+static void cache_response_cache_control(struct uwsgi_cache_response_policy *ucrp, char *value, size_t value_len) {
+	char *ptr = value;
+	char *end = value + value_len;
+	while(ptr < end) {
+		char *comma = memchr(ptr, ',', end - ptr);
+		if (!comma) comma = end;
+		char *d = ptr;
+		size_t d_len = comma - ptr;
+		ptr = comma + 1;
+		while(d_len > 0 && isspace((int) *d)) { d++; d_len--; }
+		while(d_len > 0 && isspace((int) d[d_len-1])) d_len--;
+		int64_t n;
+		if (!uwsgi_strnicmp(d, d_len, "no-store", 8) || (d_len >= 8 && !strncasecmp(d, "no-cache", 8)) || (d_len >= 7 && !strncasecmp(d, "private", 7))) {
+			ucrp->no_store = 1;
+		}
+		else if ((n = cache_control_num(d, d_len, "s-maxage", 8)) > -1) ucrp->s_maxage = n;
+		else if ((n = cache_control_num(d, d_len, "max-age", 7)) > -1) ucrp->max_age = n;
+		else if ((n = cache_control_num(d, d_len, "stale-while-revalidate", 22)) > -1) ucrp->stale = n;
+		else if ((n = cache_control_num(d, d_len, "stale-if-error", 14)) > -1) ucrp->stale_if_error = n;
+	}
+}
+
+static int cache_response_policy_line(struct uwsgi_cache_response_policy *ucrp, char *line, size_t len, int store) {
+	char *colon = memchr(line, ':', len);
+	if (!colon) return 0;
+	char *key = line;
+	size_t key_len = colon - line;
+	char *value = colon + 1;
+	size_t value_len = len - (key_len + 1);
+	while(value_len > 0 && *value == ' ') { value++; value_len--; }
+
+	if (!uwsgi_strnicmp(key, key_len, "Cache-Control", 13)) {
+		cache_response_cache_control(ucrp, value, value_len);
+	}
+	else if (!uwsgi_strnicmp(key, key_len, "Vary", 4)) {
+		if (memchr(value, '*', value_len)) ucrp->no_store = 1;
+		ucrp->vary = value;
+		ucrp->vary_len = value_len;
+	}
+	else if (!uwsgi_strnicmp(key, key_len, "Set-Cookie", 10)) {
+		ucrp->no_store = 1;
+	}
+	// regenerated (or meaningless) when serving the entry
+	else if (!uwsgi_strnicmp(key, key_len, "Content-Length", 14) || !uwsgi_strnicmp(key, key_len, "Transfer-Encoding", 17) ||
+		!uwsgi_strnicmp(key, key_len, "Connection", 10) || !uwsgi_strnicmp(key, key_len, "Keep-Alive", 10) || !uwsgi_strnicmp(key, key_len, "Age", 3)) {
+		return 0;
+	}
+
+	if (!store) return 0;
+	if (uwsgi_buffer_append(ucrp->headers, line, len)) return -1;
+	return uwsgi_buffer_append(ucrp->headers, "\r\n", 2);
+}
+
+static int cache_response_policy(struct wsgi_request *wsgi_req, struct uwsgi_cache_response_policy *ucrp) {
+	ucrp->max_age = -1;
+	ucrp->s_maxage = -1;
+	ucrp->stale = -1;
+	ucrp->stale_if_error = -1;
+	ucrp->headers = uwsgi_buffer_new(uwsgi.page_size);
+
+	if (wsgi_req->headers) {
+		char *ptr = wsgi_req->headers->buf;
+		char *end = ptr + wsgi_req->headers->pos;
+		// skip the status line
+		int first = 1;
+		while(ptr < end) {
+			char *crlf = memchr(ptr, '\r', end - ptr);
+			if (!crlf) crlf = end;
+			if (!first && crlf > ptr) {
+				if (cache_response_policy_line(ucrp, ptr, crlf - ptr, 1)) return -1;
+			}
+			first = 0;
+			ptr = crlf + 2;
+		}
+	}
+
+	// headers added by routes are checked but not stored (the routes will add them again)
+	struct uwsgi_string_list *ah = wsgi_req->additional_headers;
+	while(ah) {
+		if (cache_response_policy_line(ucrp, ah->value, ah->len, 0)) return -1;
+		ah = ah->next;
+	}
+	return 0;
+}
+
+static int transform_cache_response(struct wsgi_request *wsgi_req, struct uwsgi_transformation *ut) {
+	struct uwsgi_transformation_cache_response *utcr = (struct uwsgi_transformation_cache_response *) ut->data;
+	struct uwsgi_router_cache_conf *urcc = utcr->urcc;
+	struct uwsgi_buffer *ub = ut->chunk;
+	uint64_t now = uwsgi_now();
+
+	if (wsgi_req->write_errors) return 0;
+
+	// the app failed, send the stale copy (if allowed)
+	if (wsgi_req->status >= 500) {
+		if (utcr->stale && now < utcr->stale->h.stale_if_error_until) {
+			if (cache_response_headers(wsgi_req, utcr->stale, NULL)) return -1;
+			ub->pos = 0;
+			if (uwsgi_buffer_append(ub, utcr->stale->body, utcr->stale->body_len)) return -1;
+		}
+		return 0;
+	}
+
+	if (wsgi_req->status != 200 && (!urcc->status || wsgi_req->status != urcc->status)) return 0;
+
+	struct uwsgi_cache_response_policy ucrp;
+	memset(&ucrp, 0, sizeof(struct uwsgi_cache_response_policy));
+	if (cache_response_policy(wsgi_req, &ucrp)) goto end;
+
+	struct uwsgi_cache_response_header h;
+	memset(&h, 0, sizeof(struct uwsgi_cache_response_header));
+	h.stored = now;
+
+	uint64_t fresh = urcc->expires;
+	if (ucrp.s_maxage > -1) fresh = ucrp.s_maxage;
+	else if (ucrp.max_age > -1) fresh = ucrp.max_age;
+
+	// do not coalesce requests for this key for a while
+	if (ucrp.no_store || !fresh) {
+		h.type = UWSGI_CACHE_RESPONSE_PASS;
+		h.fresh_until = now + urcc->expires;
+		cache_response_set(urcc, utcr->key->buf, utcr->key->pos, &h, NULL, NULL, 0, urcc->expires);
+		goto end;
+	}
+
+	uint64_t stale = ucrp.stale > -1 ? (uint64_t) ucrp.stale : urcc->stale;
+	uint64_t stale_if_error = ucrp.stale_if_error > -1 ? (uint64_t) ucrp.stale_if_error : urcc->stale_if_error;
+	uint64_t expires = fresh + (stale > stale_if_error ? stale : stale_if_error);
+
+	h.fresh_until = now + fresh;
+
+	if (ucrp.vary) {
+		h.type = UWSGI_CACHE_RESPONSE_VARY;
+		h.headers_len = ucrp.vary_len;
+		if (cache_response_set(urcc, utcr->key->buf, utcr->key->pos, &h, ucrp.vary, NULL, 0, expires)) goto end;
+	}
+
+	h.type = UWSGI_CACHE_RESPONSE;
+	h.status = wsgi_req->status;
+	h.headers_len = ucrp.headers->pos;
+	h.stale_until = h.fresh_until + stale;
+	h.stale_if_error_until = h.fresh_until + stale_if_error;
+
+	if (ucrp.vary) {
+		struct uwsgi_buffer *vkey = cache_response_variant_key(wsgi_req, utcr->key, ucrp.vary, ucrp.vary_len);
+		if (!vkey) goto end;
+		cache_response_set(urcc, vkey->buf, vkey->pos, &h, ucrp.headers->buf, ub->buf, ub->pos, expires);
+		uwsgi_buffer_destroy(vkey);
+	}
+	else {
+		cache_response_set(urcc, utcr->key->buf, utcr->key->pos, &h, ucrp.headers->buf, ub->buf, ub->pos, expires);
+	}
+
+end:
+	if (ucrp.headers) uwsgi_buffer_destroy(ucrp.headers);
+	return 0;
+}
+
+static void transform_cache_response_free(struct uwsgi_transformation *ut) {
+	struct uwsgi_transformation_cache_response *utcr = (struct uwsgi_transformation_cache_response *) ut->data;
+	// wake up the waiting cores
+	if (utcr->lock) {
+		uwsgi_cache_magic_del(utcr->lock->buf, utcr->lock->pos, utcr->urcc->name);
+		uwsgi_buffer_destroy(utcr->lock);
+	}
+	uwsgi_buffer_destroy(utcr->key);
+	if (utcr->stale) cache_response_free(utcr->stale);
+	free(utcr);
+}
+
+static int uwsgi_routing_func_cache_response(struct wsgi_request *wsgi_req, struct uwsgi_route *ur) {
+	struct uwsgi_router_cache_conf *urcc = (struct uwsgi_router_cache_conf *) ur->data2;
+	struct uwsgi_ranges ranges;
+
+	// only GET responses are cached
+	if (uwsgi_strncmp(wsgi_req->method, wsgi_req->method_len, "GET", 3)) return UWSGI_ROUTE_NEXT;
+
+	char **subject = (char **) (((char *)(wsgi_req))+ur->subject);
+	uint16_t *subject_len = (uint16_t *)  (((char *)(wsgi_req))+ur->subject_len);
+
+	struct uwsgi_buffer *key = uwsgi_routing_translate(wsgi_req, ur, *subject, *subject_len, urcc->key, urcc->key_len);
+	if (!key) return UWSGI_ROUTE_NEXT;
+
+	struct uwsgi_buffer *ekey = NULL;
+	struct uwsgi_buffer *lock = NULL;
+	int ret = UWSGI_ROUTE_BREAK;
+	uint64_t now = uwsgi_now();
+	struct uwsgi_cache_response *ucr = cache_response_lookup(wsgi_req, urcc, key, &ekey);
+	if (ucr) {
+		if (now < ucr->h.fresh_until) {
+			if (ucr->h.type == UWSGI_CACHE_RESPONSE_PASS) {
+				ret = UWSGI_ROUTE_NEXT;
+				goto end;
+			}
+			goto serve;
+		}
+		if (now >= ucr->h.stale_until && now >= ucr->h.stale_if_error_until) {
+			cache_response_free(ucr);
+			ucr = NULL;
+		}
+	}
+
+	// the lock is on the real key of the entry (different variants are refreshed in parallel)
+	struct uwsgi_buffer *lkey = ekey ? ekey : key;
+	lock = uwsgi_buffer_new(lkey->pos + 5);
+	if (uwsgi_buffer_append(lock, lkey->buf, lkey->pos)) goto error;
+	if (uwsgi_buffer_append(lock, "\0lock", 5)) goto error;
+
+	uint64_t wait_start = uwsgi_micros();
+	int locked;
+	while((locked = cache_response_lock(urcc, lock))) {
+		// the cache is full, nobody can hold the lock so there is nothing to wait for
+		if (locked == -2) {
+			uwsgi_buffer_destroy(lock);
+			lock = NULL;
+			break;
+		}
+		// another core is refreshing the entry, the stale copy is good enough
+		if (ucr && now < ucr->h.stale_until) goto serve;
+		if (uwsgi_micros() - wait_start >= urcc->wait * 1000000) {
+			// give up waiting, the app will be called without holding the lock
+			uwsgi_buffer_destroy(lock);
+			lock = NULL;
+			break;
+		}
+		// do not block the other cores (async modes)
+		uwsgi.wait_milliseconds_hook(UWSGI_CACHE_RESPONSE_POLL);
+		struct uwsgi_cache_response *fresh = cache_response_lookup(wsgi_req, urcc, key, NULL);
+		if (fresh) {
+			now = uwsgi_now();
+			if (now < fresh->h.fresh_until) {
+				if (ucr) cache_response_free(ucr);
+				ucr = fresh;
+				if (ucr->h.type == UWSGI_CACHE_RESPONSE_PASS) {
+					ret = UWSGI_ROUTE_NEXT;
+					goto end;
+				}
+				goto serve;
+			}
+			cache_response_free(fresh);
+		}
+	}
+
+	// call the app and store its response
+	struct uwsgi_transformation_cache_response *utcr = uwsgi_calloc(sizeof(struct uwsgi_transformation_cache_response));
+	utcr->urcc = urcc;
+	utcr->key = key;
+	utcr->lock = lock;
+	if (ucr && ucr->h.type == UWSGI_CACHE_RESPONSE && now < ucr->h.stale_if_error_until) {
+		utcr->stale = ucr;
+	}
+	else if (ucr) {
+		cache_response_free(ucr);
+	}
+	struct uwsgi_transformation *ut = uwsgi_add_transformation(wsgi_req, transform_cache_response, utcr);
+	ut->free = transform_cache_response_free;
+	if (ekey) uwsgi_buffer_destroy(ekey);
+	return UWSGI_ROUTE_NEXT;
+
+serve:
+	if (!cache_response_headers(wsgi_req, ucr, &ranges)) {
+		uwsgi_response_write_ranges(wsgi_req, ucr->body, &ranges);
+	}
+	uwsgi_ranges_free(&ranges);
+	goto end;
+error:
+	ret = UWSGI_ROUTE_NEXT;
+end:
+	if (ucr) cache_response_free(ucr);
+	if (lock) uwsgi_buffer_destroy(lock);
+	if (ekey) uwsgi_buffer_destroy(ekey);
+	uwsgi_buffer_destroy(key);
+	return ret;
+}
+
+
 static int uwsgi_router_cache_store(struct uwsgi_route *ur, char *args) {
 	ur->func = uwsgi_routing_func_cache_store;
 	ur->data = args;
@@ -577,6 +1145,69 @@ static int uwsgi_router_cachevar(struct uwsgi_route *ur, char *args) {
         return 0;
 }
 
+static int uwsgi_router_cache_response(struct uwsgi_route *ur, char *args) {
+	ur->func = uwsgi_routing_func_cache_response;
+	ur->data = args;
+	ur->data_len = strlen(args);
+	struct uwsgi_router_cache_conf *urcc = uwsgi_calloc(sizeof(struct uwsgi_router_cache_conf));
+	if (uwsgi_kvlist_parse(ur->data, ur->data_len, ',', '=',
+			"key", &urcc->key,
+			"name", &urcc->name,
+			"expires", &urcc->expires_str,
+			"stale", &urcc->stale_str,
+			"stale_while_revalidate", &urcc->stale_str,
+			"stale_if_error", &urcc->stale_if_error_str,
+			"wait", &urcc->wait_str,
+			"status", &urcc->status_str,
+			"code", &urcc->status_str,
+			NULL)) {
+		uwsgi_log("invalid cache-response route syntax: %s\n", args);
+		goto error;
+	}
+
+	if (!urcc->key) {
+		uwsgi_log("invalid cache-response route syntax: you need to specify a cache key\n");
+		goto error;
+	}
+	urcc->key_len = strlen(urcc->key);
+
+	if (urcc->name) {
+		urcc->name_len = strlen(urcc->name);
+	}
+
+	// used when the app does not specify max-age
+	urcc->expires = 60;
+	if (urcc->expires_str) {
+		urcc->expires = strtoul(urcc->expires_str, NULL, 10);
+	}
+
+	if (urcc->stale_str) {
+		urcc->stale = strtoul(urcc->stale_str, NULL, 10);
+	}
+
+	if (urcc->stale_if_error_str) {
+		urcc->stale_if_error = strtoul(urcc->stale_if_error_str, NULL, 10);
+	}
+
+	urcc->wait = 5;
+	if (urcc->wait_str) {
+		urcc->wait = strtoul(urcc->wait_str, NULL, 10);
+	}
+
+	if (urcc->status_str) {
+		urcc->status = atoi(urcc->status_str);
+	}
+
+	ur->data2 = urcc;
+	return 0;
+error:
+	if (urcc->key) free(urcc->key);
+	if (urcc->name) free(urcc->name);
+	if (urcc->expires_str) free(urcc->expires_str);
+	free(urcc);
+	return -1;
+}
+
 static int uwsgi_route_condition_incache(struct wsgi_request *wsgi_req, struct uwsgi_route *ur) {
 	int ret = 0;
 	char *key = NULL;
@@ -612,6 +1243,8 @@ static void router_cache_register() {
 	uwsgi_register_router("cacheset", uwsgi_router_cacheset);
 	uwsgi_register_router("cachestore", uwsgi_router_cache_store);
 	uwsgi_register_router("cache-store", uwsgi_router_cache_store);
+	uwsgi_register_router("cacheresponse", uwsgi_router_cache_response);
+	uwsgi_register_router("cache-response", uwsgi_router_cache_response);
 	uwsgi_register_route_condition("incache", uwsgi_route_condition_incache);
 
 	uwsgi_register_router("cacheinc", uwsgi_router_cacheinc);
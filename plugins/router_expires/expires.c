@@ -68,7 +68,7 @@ static int uwsgi_routing_func_expires(struct wsgi_request *wsgi_req, struct uwsg
 	}
 
 	char expires_str[7 + 2 + 31];
-        int len = uwsgi_http_date((time_t) expires, expires_str + 9);
+        int len = uwsgi_http_date_cached((time_t) expires, expires_str + 9);
         if (!len) return UWSGI_ROUTE_BREAK;
 
 	memcpy(expires_str, "Expires: ", 9);
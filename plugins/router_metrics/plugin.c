@@ -104,6 +104,21 @@ static int uwsgi_router_metricset(struct uwsgi_route *ur, char *args) {
         return 0;
 }
 
+// histogram:<name> (the request time is accounted to the histogram at the end of the request)
+static int uwsgi_routing_func_histogram(struct wsgi_request *wsgi_req, struct uwsgi_route *ur) {
+	wsgi_req->histogram = (struct uwsgi_histogram *) ur->data2;
+	return UWSGI_ROUTE_NEXT;
+}
+
+static int uwsgi_router_histogram(struct uwsgi_route *ur, char *args) {
+	ur->func = uwsgi_routing_func_histogram;
+	ur->data = args;
+	ur->data_len = strlen(args);
+	ur->data2 = uwsgi_histogram_register(args);
+	if (!ur->data2) return -1;
+	return 0;
+}
+
 static char *uwsgi_route_var_metric(struct wsgi_request *wsgi_req, char *key, uint16_t keylen, uint16_t *vallen) {
         int64_t metric = uwsgi_metric_getn(key, keylen, NULL, 0);
         char *ret = uwsgi_64bit2str(metric);
@@ -117,6 +132,7 @@ static void router_metrics_register() {
 	uwsgi_register_router("metricmul", uwsgi_router_metricmul);
 	uwsgi_register_router("metricdiv", uwsgi_router_metricdiv);
 	uwsgi_register_router("metricset", uwsgi_router_metricset);
+	uwsgi_register_router("histogram", uwsgi_router_histogram);
 
         struct uwsgi_route_var *urv = uwsgi_register_route_var("metric", uwsgi_route_var_metric);
         urv->need_free = 1;
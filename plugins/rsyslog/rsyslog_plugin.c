@@ -17,81 +17,94 @@ struct uwsgi_option rsyslog_options[] = {
 };
 
 
-ssize_t uwsgi_rsyslog_logger(struct uwsgi_logger *ul, char *message, size_t len) {
+static void uwsgi_rsyslog_logger_setup(struct uwsgi_logger *ul) {
 
-	char ctime_storage[26];
-	time_t current_time;
 	int portn = 514;
-	int rlen;
 
-	if (!ul->configured) {
-
-                if (!ul->arg) {
-			uwsgi_log_safe("invalid rsyslog syntax\n");
-			exit(1);
-		}
+	if (!ul->arg) {
+		uwsgi_log_safe("invalid rsyslog syntax\n");
+		exit(1);
+	}
 
-                ul->fd = socket(AF_INET, SOCK_DGRAM, 0);
-                if (ul->fd < 0) {
-			uwsgi_error_safe("socket()");
-			exit(1);
-		}
+	ul->fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (ul->fd < 0) {
+		uwsgi_error_safe("socket()");
+		exit(1);
+	}
 
-		uwsgi_socket_nb(ul->fd);
+	uwsgi_socket_nb(ul->fd);
 
-		ul->count = 29;
+	ul->count = 29;
 
-                char *comma = strchr(ul->arg, ',');
-		if (comma) {
-			ul->data = comma+1;
-                	*comma = 0;
-			char *prisev = strchr(ul->data, ',');
-			if (prisev) {
-				*prisev = 0;
-				ul->count = atoi(prisev+1);
-			}
-		}
-		else {
-			ul->data = uwsgi_concat2(uwsgi.hostname," uwsgi");
+	char *comma = strchr(ul->arg, ',');
+	if (comma) {
+		ul->data = comma+1;
+		*comma = 0;
+		char *prisev = strchr(ul->data, ',');
+		if (prisev) {
+			*prisev = 0;
+			ul->count = atoi(prisev+1);
 		}
+	}
+	else {
+		ul->data = uwsgi_concat2(uwsgi.hostname," uwsgi");
+	}
 
 
-                char *port = strchr(ul->arg, ':');
-                if (port) {
-			portn = atoi(port+1);
-			*port = 0;
-		}
-
-		ul->addr_len = socket_to_in_addr(ul->arg, NULL, portn, &ul->addr.sa_in);
+	char *port = strchr(ul->arg, ':');
+	if (port) {
+		portn = atoi(port+1);
+		*port = 0;
+	}
 
-		if (port) *port = ':';
-		if (comma) *comma = ',';
+	ul->addr_len = socket_to_in_addr(ul->arg, NULL, portn, &ul->addr.sa_in);
 
-		if (!u_rsyslog.packet_size) u_rsyslog.packet_size = 1024;
-		if (!u_rsyslog.msg_size) u_rsyslog.msg_size = u_rsyslog.packet_size - 30;
+	if (port) *port = ':';
+	if (comma) *comma = ',';
 
-		ul->buf = uwsgi_malloc(uwsgi.log_master_bufsize);
+	if (!u_rsyslog.packet_size) u_rsyslog.packet_size = 1024;
+	if (!u_rsyslog.msg_size) u_rsyslog.msg_size = u_rsyslog.packet_size - 30;
 
-                ul->configured = 1;
-        }
+	ul->buf = uwsgi_malloc(uwsgi.log_master_bufsize);
 
+	ul->configured = 1;
+}
 
-	current_time = uwsgi_now();
+// format a packet (a chunk of the message) in buf
+static int uwsgi_rsyslog_packet(struct uwsgi_logger *ul, char *buf, char *ctime_storage, char *message, int msg_len) {
+	int rlen = snprintf(buf, u_rsyslog.packet_size, "<%d>%.*s %s: %.*s", ul->count, 15, ctime_storage+4, (char *) ul->data, msg_len, message);
+	if (rlen > 0 && rlen <= u_rsyslog.packet_size) return rlen;
+	return -1;
+}
 
-	// drop newline
-	if (message[len-1] == '\n') len--;
+static void uwsgi_rsyslog_ctime(char *ctime_storage) {
+	time_t current_time = uwsgi_now();
 #if defined(__sun__) && !defined(__clang__)
 	ctime_r(&current_time, ctime_storage, 26);
 #else
 	ctime_r(&current_time, ctime_storage);
 #endif
+}
+
+ssize_t uwsgi_rsyslog_logger(struct uwsgi_logger *ul, char *message, size_t len) {
+
+	char ctime_storage[26];
+	int rlen;
+
+	if (!ul->configured) {
+		uwsgi_rsyslog_logger_setup(ul);
+	}
+
+	// drop newline
+	if (message[len-1] == '\n') len--;
+	uwsgi_rsyslog_ctime(ctime_storage);
 
 	int pos, msg_len, ret;
 	for (pos=0 ; pos < (int) len ;) {
 		if (pos > 0 && !u_rsyslog.split_msg) return pos;
 		msg_len = ( ((int)len)-pos > u_rsyslog.msg_size ? u_rsyslog.msg_size : ((int)len)-pos);
-		rlen = snprintf(ul->buf, u_rsyslog.packet_size, "<%d>%.*s %s: %.*s", ul->count, 15, ctime_storage+4, (char *) ul->data, msg_len, &message[pos]);
-		if (rlen > 0 && rlen <= u_rsyslog.packet_size) {
+		rlen = uwsgi_rsyslog_packet(ul, ul->buf, ctime_storage, &message[pos], msg_len);
+		if (rlen > 0) {
 			ret = sendto(ul->fd, ul->buf, rlen, 0, (const struct sockaddr *) &ul->addr, ul->addr_len);
 			if (ret <= 0) return ret;
 			pos += msg_len;
@@ -103,8 +116,67 @@ ssize_t uwsgi_rsyslog_logger(struct uwsgi_logger *ul, char *message, size_t len)
 
 }
 
+/*
+	the packets are formatted one after the other in the logger buffer
+	and sent with a single syscall when the buffer (or the batch) is full
+*/
+ssize_t uwsgi_rsyslog_logger_batch(struct uwsgi_logger *ul, struct iovec *messages, int n) {
+
+	char ctime_storage[26];
+	struct msghdr msgs[UWSGI_LOGGER_BATCH_MAX];
+	struct iovec iov[UWSGI_LOGGER_BATCH_MAX];
+	int i, packets = 0;
+	size_t used = 0;
+	ssize_t sent = 0;
+
+	if (!ul->configured) {
+		uwsgi_rsyslog_logger_setup(ul);
+	}
+
+	uwsgi_rsyslog_ctime(ctime_storage);
+
+	memset(msgs, 0, sizeof(msgs));
+
+	for(i=0;i<n;i++) {
+		char *message = messages[i].iov_base;
+		int len = messages[i].iov_len;
+		if (len > 0 && message[len-1] == '\n') len--;
+		int pos = 0;
+		while(pos < len) {
+			if (pos > 0 && !u_rsyslog.split_msg) break;
+			if (packets == UWSGI_LOGGER_BATCH_MAX || (used > 0 && uwsgi.log_master_bufsize - used < (size_t) u_rsyslog.packet_size)) {
+				int ret = uwsgi_logger_send_datagrams(ul->fd, msgs, packets);
+				if (ret < 0) return -1;
+				sent += ret;
+				packets = 0;
+				used = 0;
+			}
+			int msg_len = (len - pos > u_rsyslog.msg_size ? u_rsyslog.msg_size : len - pos);
+			int rlen = uwsgi_rsyslog_packet(ul, ul->buf + used, ctime_storage, message + pos, msg_len);
+			if (rlen < 0) break;
+			iov[packets].iov_base = ul->buf + used;
+			iov[packets].iov_len = rlen;
+			msgs[packets].msg_name = &ul->addr;
+			msgs[packets].msg_namelen = ul->addr_len;
+			msgs[packets].msg_iov = &iov[packets];
+			msgs[packets].msg_iovlen = 1;
+			packets++;
+			used += rlen;
+			pos += msg_len;
+		}
+	}
+
+	if (packets > 0) {
+		int ret = uwsgi_logger_send_datagrams(ul->fd, msgs, packets);
+		if (ret < 0) return -1;
+		sent += ret;
+	}
+
+	return sent;
+}
+
 void uwsgi_rsyslog_register() {
-	uwsgi_register_logger("rsyslog", uwsgi_rsyslog_logger);
+	uwsgi_register_logger_batch("rsyslog", uwsgi_rsyslog_logger, uwsgi_rsyslog_logger_batch);
 }
 
 struct uwsgi_plugin rsyslog_plugin = {
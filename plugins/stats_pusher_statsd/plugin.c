@@ -12,10 +12,16 @@ example:
 
 it exports values exposed by the metric subsystem
 
+only the metrics changed since the last push are sent (all of them every --stats-pusher-refresh seconds),
+packing multiple metrics (one per line) in each datagram
+
 */
 
 extern struct uwsgi_server uwsgi;
 
+// stay below the common MTU
+#define STATSD_MAX_DATAGRAM 1432
+
 // configuration of a statsd node
 struct statsd_node {
 	int fd;
@@ -25,20 +31,38 @@ struct statsd_node {
 	uint16_t prefix_len;
 };
 
+static int statsd_flush(struct uwsgi_buffer *ub, struct uwsgi_stats_pusher_instance *uspi) {
+	struct statsd_node *sn = (struct statsd_node *) uspi->data;
+	if (ub->pos == 0) return 0;
+	// remove the trailing newline
+	if (sendto(sn->fd, ub->buf, ub->pos - 1, 0, (struct sockaddr *) &sn->addr.sa_in, sn->addr_len) < 0) {
+		uwsgi_error("statsd_flush()/sendto()");
+		ub->pos = 0;
+		return -1;
+	}
+	ub->pos = 0;
+	return 0;
+}
+
 static int statsd_send_metric(struct uwsgi_buffer *ub, struct uwsgi_stats_pusher_instance *uspi, char *metric, size_t metric_len, int64_t value, char type[2]) {
 	struct statsd_node *sn = (struct statsd_node *) uspi->data;
-	// reset the buffer
-        ub->pos = 0;
+	char num[sizeof(UMAX64_STR)+2];
+	int num_len = snprintf(num, sizeof(num), "%lld", (long long) value);
+	if (num_len <= 0 || num_len >= (int) sizeof(num)) return -1;
+
+	// the line does not fit in the current datagram
+	size_t line_len = sn->prefix_len + 1 + metric_len + 1 + num_len + 2 + 1;
+	if (ub->pos + line_len > STATSD_MAX_DATAGRAM) {
+		if (statsd_flush(ub, uspi)) return -1;
+	}
+
 	if (uwsgi_buffer_append(ub, sn->prefix, sn->prefix_len)) return -1;	
 	if (uwsgi_buffer_append(ub, ".", 1)) return -1;
 	if (uwsgi_buffer_append(ub, metric, metric_len)) return -1;
 	if (uwsgi_buffer_append(ub, ":", 1)) return -1;
-        if (uwsgi_buffer_num64(ub, value)) return -1;
+	if (uwsgi_buffer_append(ub, num, num_len)) return -1;
 	if (uwsgi_buffer_append(ub, type, 2)) return -1;
-
-        if (sendto(sn->fd, ub->buf, ub->pos, 0, (struct sockaddr *) &sn->addr.sa_in, sn->addr_len) < 0) {
-                uwsgi_error("statsd_send_metric()/sendto()");
-        }
+	if (uwsgi_buffer_append(ub, "\n", 1)) return -1;
 
         return 0;
 
@@ -82,22 +106,33 @@ static void stats_pusher_statsd(struct uwsgi_stats_pusher_instance *uspi, time_t
 		uspi->configured = 1;
 	}
 
+	if (!uwsgi.stats_pusher_snapshot) return;
+
 	// we use the same buffer for all of the packets
-	struct uwsgi_buffer *ub = uwsgi_buffer_new(uwsgi.page_size);
+	struct uwsgi_buffer *ub = uwsgi_buffer_new(STATSD_MAX_DATAGRAM);
 	struct uwsgi_metric *um = uwsgi.metrics;
-	while(um) {
-		uwsgi_rlock(uwsgi.metrics_lock);
-		// ignore return value
-		if (um->type == UWSGI_METRIC_GAUGE) {
-			statsd_send_metric(ub, uspi, um->name, um->name_len, *um->value, "|g");
+	uint64_t pos = 0;
+	int errors = 0;
+	while(um && pos < uwsgi.metrics_cnt) {
+		if (uwsgi_stats_pusher_changed(uspi, pos)) {
+			int64_t value = uwsgi.stats_pusher_snapshot[pos];
+			if (um->type == UWSGI_METRIC_GAUGE) {
+				if (statsd_send_metric(ub, uspi, um->name, um->name_len, value, "|g")) errors++;
+			}
+			else {
+				if (statsd_send_metric(ub, uspi, um->name, um->name_len, value, "|m")) errors++;
+			}
 		}
-		else {
-			statsd_send_metric(ub, uspi, um->name, um->name_len, *um->value, "|m");
-		}
-		uwsgi_rwunlock(uwsgi.metrics_lock);
+		pos++;
 		um = um->next;
 	}
+	if (statsd_flush(ub, uspi)) errors++;
 	uwsgi_buffer_destroy(ub);
+
+	// on errors the changes will be sent again at the next push
+	if (!errors) {
+		uwsgi_stats_pusher_commit(uspi);
+	}
 }
 
 static void stats_pusher_statsd_init(void) {
@@ -8,66 +8,309 @@
 
 	remember to fix the content_length (or use chunked encoding) !!!
 
+	syntax: gzip:[level=N,strategy=default|filtered|huffman|rle|fixed,window=N,memlevel=N,min_size=N]
+
+	deflate contexts are pooled per-core and reset with deflateReset(), so the zlib state
+	is not allocated and initialized for every response.
+
+	responses smaller than min_size (default 256 bytes) are sent uncompressed: the first bytes are held
+	until the threshold is reached (or the response ends). Use min_size=0 to compress everything.
+
 */
 
-struct uwsgi_transformation_gzip {
+extern struct uwsgi_server uwsgi;
+extern char gzheader[];
+
+// max number of idle contexts for each core
+#define UWSGI_GZIP_POOL 4
+
+struct uwsgi_gzip_conf {
+	int level;
+	int strategy;
+	int window;
+	int memlevel;
+	size_t min_size;
+};
+
+struct uwsgi_gzip_context {
 	z_stream z;
+	int level;
+	int strategy;
+	int window;
+	int memlevel;
+	struct uwsgi_gzip_context *next;
+};
+
+// one list of idle contexts for each core
+static struct uwsgi_gzip_context **gzip_pool;
+
+struct uwsgi_transformation_gzip {
+	struct uwsgi_gzip_conf *conf;
+	struct uwsgi_gzip_context *ctx;
+	int core;
 	uint32_t crc32;
 	size_t len;
 	uint8_t header;
+	uint8_t compressing;
+	// the first bytes (waiting for min_size)
+	struct uwsgi_buffer *held;
+	// compressed output (swapped with the chunk)
+	struct uwsgi_buffer *out;
 };
 
-extern char gzheader[];
+static struct uwsgi_gzip_context *gzip_context_get(int core, struct uwsgi_gzip_conf *ugc) {
+	struct uwsgi_gzip_context *ctx = NULL, *prev = NULL;
+	if (gzip_pool) {
+		ctx = gzip_pool[core];
+		while(ctx) {
+			// window and memlevel cannot be changed without reinitializing the stream
+			if (ctx->window == ugc->window && ctx->memlevel == ugc->memlevel) break;
+			prev = ctx;
+			ctx = ctx->next;
+		}
+	}
+
+	if (ctx) {
+		if (prev) {
+			prev->next = ctx->next;
+		}
+		else {
+			gzip_pool[core] = ctx->next;
+		}
+		ctx->next = NULL;
+		if (ctx->level != ugc->level || ctx->strategy != ugc->strategy) {
+			if (deflateParams(&ctx->z, ugc->level, ugc->strategy) != Z_OK) {
+				deflateEnd(&ctx->z);
+				free(ctx);
+				return NULL;
+			}
+			ctx->level = ugc->level;
+			ctx->strategy = ugc->strategy;
+		}
+		return ctx;
+	}
+
+	ctx = uwsgi_calloc(sizeof(struct uwsgi_gzip_context));
+	// raw deflate, gzip header and trailer are managed by the transformation
+	if (deflateInit2(&ctx->z, ugc->level, Z_DEFLATED, -ugc->window, ugc->memlevel, ugc->strategy) != Z_OK) {
+		free(ctx);
+		return NULL;
+	}
+	ctx->level = ugc->level;
+	ctx->strategy = ugc->strategy;
+	ctx->window = ugc->window;
+	ctx->memlevel = ugc->memlevel;
+	return ctx;
+}
+
+static void gzip_context_put(int core, struct uwsgi_gzip_context *ctx) {
+	if (gzip_pool && deflateReset(&ctx->z) == Z_OK) {
+		int n = 0;
+		struct uwsgi_gzip_context *pooled = gzip_pool[core];
+		while(pooled) {
+			n++;
+			pooled = pooled->next;
+		}
+		if (n < UWSGI_GZIP_POOL) {
+			ctx->next = gzip_pool[core];
+			gzip_pool[core] = ctx;
+			return;
+		}
+	}
+	deflateEnd(&ctx->z);
+	free(ctx);
+}
+
+// compress buf appending the result to the output buffer
+static int gzip_deflate(z_stream *z, char *buf, size_t len, int flush, struct uwsgi_buffer *out) {
+	z->next_in = (Bytef *) buf;
+	z->avail_in = len;
+	for(;;) {
+		if (uwsgi_buffer_ensure(out, (len/2) + 64)) return -1;
+		z->next_out = (Bytef *) out->buf + out->pos;
+		z->avail_out = out->len - out->pos;
+		int ret = deflate(z, flush);
+		out->pos = out->len - z->avail_out;
+		if (ret == Z_STREAM_ERROR) return -1;
+		if (flush == Z_FINISH) {
+			if (ret == Z_STREAM_END) return 0;
+		}
+		// all of the input has been consumed and flushed
+		else if (z->avail_out > 0) {
+			return 0;
+		}
+	}
+}
+
+static void gzip_buffer_swap(struct uwsgi_buffer *a, struct uwsgi_buffer *b) {
+	char *buf = a->buf;
+	size_t len = a->len;
+	size_t pos = a->pos;
+	a->buf = b->buf;
+	a->len = b->len;
+	a->pos = b->pos;
+	b->buf = buf;
+	b->len = len;
+	b->pos = pos;
+}
+
+static int transform_gzip_final(struct wsgi_request *wsgi_req, struct uwsgi_transformation *ut) {
+	struct uwsgi_transformation_gzip *utgz = (struct uwsgi_transformation_gzip *) ut->data;
+	struct uwsgi_buffer *ub = ut->chunk;
+
+	// the response is smaller than min_size, send it as is
+	if (!utgz->compressing) {
+		if (utgz->held && utgz->held->pos > 0) {
+			if (uwsgi_buffer_append(ub, utgz->held->buf, utgz->held->pos)) return -1;
+		}
+		return 0;
+	}
+
+	if (!utgz->ctx) return 0;
+
+	utgz->out->pos = 0;
+	if (gzip_deflate(&utgz->ctx->z, NULL, 0, Z_FINISH, utgz->out)) return -1;
+	if (uwsgi_buffer_append(ub, utgz->out->buf, utgz->out->pos)) return -1;
+	if (uwsgi_buffer_u32le(ub, utgz->crc32)) return -1;
+	if (uwsgi_buffer_u32le(ub, utgz->len)) return -1;
+	return 0;
+}
 
 static int transform_gzip(struct wsgi_request *wsgi_req, struct uwsgi_transformation *ut) {
 	struct uwsgi_transformation_gzip *utgz = (struct uwsgi_transformation_gzip *) ut->data;
 	struct uwsgi_buffer *ub = ut->chunk;
 
 	if (ut->is_final) {
-		if (uwsgi_gzip_fix(&utgz->z, utgz->crc32, ub, utgz->len)) {
-			free(utgz);
-			return -1;
+		return transform_gzip_final(wsgi_req, ut);
+	}
+
+	if (!utgz->compressing) {
+		if (utgz->conf->min_size > 0) {
+			if (!utgz->held) {
+				utgz->held = uwsgi_buffer_new(utgz->conf->min_size);
+			}
+			if (uwsgi_buffer_append(utgz->held, ub->buf, ub->pos)) return -1;
+			ub->pos = 0;
+			// hold the chunk
+			if (utgz->held->pos < utgz->conf->min_size) return 1;
+			// now the chunk is the whole held body
+			gzip_buffer_swap(ub, utgz->held);
 		}
-		free(utgz);
-		return 0;
+		utgz->compressing = 1;
 	}
 
-	size_t dlen = 0;
-	char *gzipped = uwsgi_gzip_chunk(&utgz->z, &utgz->crc32, ub->buf, ub->pos, &dlen);
-	if (!gzipped) return -1;
-	utgz->len += ub->pos;
-	uwsgi_buffer_map(ub, gzipped, dlen);
+	if (!utgz->ctx) {
+		utgz->ctx = gzip_context_get(utgz->core, utgz->conf);
+		if (!utgz->ctx) return -1;
+		uwsgi_crc32(&utgz->crc32, NULL, 0);
+		utgz->out = uwsgi_buffer_new(ub->pos + 64);
+	}
+
+	utgz->out->pos = 0;
 	if (!utgz->header) {
 		// do not check for errors !!!
         	uwsgi_response_add_header(wsgi_req, "Content-Encoding", 16, "gzip", 4);
 		utgz->header = 1;
-		if (uwsgi_buffer_insert(ub, 0, gzheader, 10)) {
-			return -1;
-		}
+		if (uwsgi_buffer_append(utgz->out, gzheader, 10)) return -1;
 	}
 
+	uwsgi_crc32(&utgz->crc32, ub->buf, ub->pos);
+	utgz->len += ub->pos;
+	if (gzip_deflate(&utgz->ctx->z, ub->buf, ub->pos, Z_SYNC_FLUSH, utgz->out)) return -1;
+	// the compressed data becomes the chunk, the memory of the old one is reused for the next output
+	gzip_buffer_swap(ub, utgz->out);
 	return 0;
 }
 
+static void transform_gzip_free(struct uwsgi_transformation *ut) {
+	struct uwsgi_transformation_gzip *utgz = (struct uwsgi_transformation_gzip *) ut->data;
+	if (utgz->ctx) {
+		gzip_context_put(utgz->core, utgz->ctx);
+	}
+	if (utgz->held) uwsgi_buffer_destroy(utgz->held);
+	if (utgz->out) uwsgi_buffer_destroy(utgz->out);
+	free(utgz);
+}
+
 static int uwsgi_routing_func_gzip(struct wsgi_request *wsgi_req, struct uwsgi_route *ur) {
 	struct uwsgi_transformation_gzip *utgz = uwsgi_calloc(sizeof(struct uwsgi_transformation_gzip));
-	if (uwsgi_gzip_prepare(&utgz->z, NULL, 0, &utgz->crc32)) {
-		free(utgz);
-		return UWSGI_ROUTE_BREAK;
-	}
+	utgz->conf = (struct uwsgi_gzip_conf *) ur->data2;
+	utgz->core = wsgi_req->async_id;
 	struct uwsgi_transformation *ut = uwsgi_add_transformation(wsgi_req, transform_gzip, utgz);
 	ut->can_stream = 1;
 	// this is the trasformation clearing the memory
 	ut = uwsgi_add_transformation(wsgi_req, transform_gzip, utgz);
         ut->is_final = 1;
+	ut->free = transform_gzip_free;
 	return UWSGI_ROUTE_NEXT;
 }
 
 static int uwsgi_router_gzip(struct uwsgi_route *ur, char *args) {
+	char *level = NULL, *strategy = NULL, *window = NULL, *memlevel = NULL, *min_size = NULL;
+	if (uwsgi_kvlist_parse(args, strlen(args), ',', '=',
+			"level", &level,
+			"strategy", &strategy,
+			"window", &window,
+			"memlevel", &memlevel,
+			"min_size", &min_size,
+			NULL)) {
+		uwsgi_log("invalid gzip route syntax: %s\n", args);
+		return -1;
+	}
+
+	struct uwsgi_gzip_conf *ugc = uwsgi_calloc(sizeof(struct uwsgi_gzip_conf));
+	ugc->level = Z_DEFAULT_COMPRESSION;
+	ugc->strategy = Z_DEFAULT_STRATEGY;
+	ugc->window = 15;
+	ugc->memlevel = 9;
+	ugc->min_size = 256;
+
+	if (level) {
+		ugc->level = atoi(level);
+		free(level);
+	}
+	if (window) {
+		ugc->window = atoi(window);
+		free(window);
+	}
+	if (memlevel) {
+		ugc->memlevel = atoi(memlevel);
+		free(memlevel);
+	}
+	if (min_size) {
+		ugc->min_size = uwsgi_n64(min_size);
+		free(min_size);
+	}
+	if (strategy) {
+		if (!strcmp(strategy, "default")) ugc->strategy = Z_DEFAULT_STRATEGY;
+		else if (!strcmp(strategy, "filtered")) ugc->strategy = Z_FILTERED;
+		else if (!strcmp(strategy, "huffman")) ugc->strategy = Z_HUFFMAN_ONLY;
+		else if (!strcmp(strategy, "rle")) ugc->strategy = Z_RLE;
+		else if (!strcmp(strategy, "fixed")) ugc->strategy = Z_FIXED;
+		else {
+			uwsgi_log("invalid gzip strategy: %s\n", strategy);
+			free(strategy);
+			free(ugc);
+			return -1;
+		}
+		free(strategy);
+	}
+
+	if (ugc->level < -1 || ugc->level > 9 || ugc->window < 9 || ugc->window > 15 || ugc->memlevel < 1 || ugc->memlevel > 9) {
+		uwsgi_log("invalid gzip route options: %s\n", args);
+		free(ugc);
+		return -1;
+	}
+
 	ur->func = uwsgi_routing_func_gzip;
+	ur->data2 = ugc;
 	return 0;
 }
 
+static void router_gzip_post_fork(void) {
+	gzip_pool = uwsgi_calloc(sizeof(struct uwsgi_gzip_context *) * uwsgi.cores);
+}
+
 static void router_gzip_register(void) {
 	uwsgi_register_router("gzip", uwsgi_router_gzip);
 }
@@ -75,6 +318,7 @@ static void router_gzip_register(void) {
 struct uwsgi_plugin transformation_gzip_plugin = {
 	.name = "transformation_gzip",
 	.on_load = router_gzip_register,
+	.post_fork = router_gzip_post_fork,
 };
 #else
 struct uwsgi_plugin transformation_gzip_plugin = {
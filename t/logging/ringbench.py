@@ -0,0 +1,90 @@
+#!/usr/bin/env python3
+# request logging transport benchmark: log pipe vs per-core shared memory rings
+#
+# usage: ringbench.py [uwsgi binary] [requests] [concurrency]
+#
+# spawns an http-socket instance (master, 2 processes, 4 threads each) logging every request
+# to a file through the master, and measures the request rate with the classic log pipe and
+# with --log-master-ring. Lines written to the log file (and lines reported as dropped) are
+# counted too, as a slow logger should never block the workers when the rings are in use.
+#
+# request lines are logged by the after_request hook of the request plugin, so the cgi plugin
+# (modifier1 9) must be available (the requests are answered by a route, no script is run)
+
+import os
+import re
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+UWSGI = sys.argv[1] if len(sys.argv) > 1 else './uwsgi'
+REQUESTS = int(sys.argv[2]) if len(sys.argv) > 2 else 20000
+CONCURRENCY = int(sys.argv[3]) if len(sys.argv) > 3 else 8
+PORT = 9099
+
+
+def request():
+    s = socket.create_connection(('127.0.0.1', PORT))
+    s.sendall(b'GET /bench HTTP/1.0\r\nHost: localhost\r\n\r\n')
+    response = b''
+    while True:
+        chunk = s.recv(4096)
+        if not chunk:
+            break
+        response += chunk
+    s.close()
+    if not response.startswith(b'HTTP/1.0 200') and not response.startswith(b'HTTP/1.1 200'):
+        raise Exception('unexpected response: %r' % response[:64])
+
+
+def client(n):
+    for i in range(n):
+        request()
+
+
+def bench(*args):
+    logfile = tempfile.mktemp(suffix='.log')
+    reqlogfile = tempfile.mktemp(suffix='.log')
+    p = subprocess.Popen([UWSGI, '--plugin', 'cgi', '--http-socket', '127.0.0.1:%d' % PORT, '--http-socket-modifier1', '9', '--master', '--processes', '2', '--threads', '4',
+                          '--logto', logfile, '--req-logger', 'file:%s' % reqlogfile,
+                          '--route', '^/bench break:200 OK'] + list(args), stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    try:
+        for i in range(50):
+            try:
+                request()
+                break
+            except Exception:
+                time.sleep(0.1)
+        threads = [threading.Thread(target=client, args=(REQUESTS // CONCURRENCY,)) for i in range(CONCURRENCY)]
+        start = time.time()
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        rate = (REQUESTS // CONCURRENCY) * CONCURRENCY / (time.time() - start)
+        # give the master the time to drain everything
+        time.sleep(2)
+    finally:
+        p.kill()
+        p.wait()
+    with open(reqlogfile) as f:
+        lines = sum(1 for line in f if 'GET /bench' in line)
+    dropped = 0
+    with open(logfile) as f:
+        for line in f:
+            m = re.search(r'is full: (\d+) lines dropped', line)
+            if m:
+                dropped += int(m.group(1))
+    os.unlink(logfile)
+    os.unlink(reqlogfile)
+    return rate, lines, dropped
+
+total = (REQUESTS // CONCURRENCY) * CONCURRENCY + 1
+pipe = bench()
+ring = bench('--log-master-ring', '65536')
+print('%d requests, %d concurrent clients' % (total, CONCURRENCY))
+print('log pipe:  %.0f req/s, %d/%d lines logged' % (pipe[0], pipe[1], total))
+print('log rings: %.0f req/s, %d/%d lines logged, %d dropped' % (ring[0], ring[1], total, ring[2]))
@@ -0,0 +1,78 @@
+#!/usr/bin/env python3
+# routing engine benchmark with large rule sets
+#
+# usage: bench.py [uwsgi binary] [rules] [requests]
+#
+# spawns an http-socket instance with <rules> routes (mostly anchored prefixes, plus some
+# unanchored regexps and conditions) and measures the request rate of a path matching
+# only the last rule, with and without the compiled routing table (--route-no-compile)
+
+import os
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+UWSGI = sys.argv[1] if len(sys.argv) > 1 else './uwsgi'
+RULES = int(sys.argv[2]) if len(sys.argv) > 2 else 300
+REQUESTS = int(sys.argv[3]) if len(sys.argv) > 3 else 5000
+PORT = 9099
+
+
+def config():
+    lines = ['[uwsgi]', 'http-socket = 127.0.0.1:%d' % PORT, 'disable-logging = true']
+    for i in range(RULES):
+        if i % 10 == 9:
+            lines.append('route = \\.section%d$ break:403 Forbidden' % i)
+        elif i % 10 == 5:
+            lines.append('route-if = equal:${REQUEST_METHOD};PUT%d break:405 Method Not Allowed' % i)
+        else:
+            lines.append('route = ^/section%d/item[0-9]+$ addheader:X-Section: %d' % (i, i))
+    lines.append('route-label = last')
+    lines.append('route = ^/target/ break:200 OK')
+    return '\n'.join(lines) + '\n'
+
+
+def request():
+    s = socket.create_connection(('127.0.0.1', PORT))
+    s.sendall(b'GET /target/item HTTP/1.0\r\nHost: localhost\r\n\r\n')
+    response = b''
+    while True:
+        chunk = s.recv(4096)
+        if not chunk:
+            break
+        response += chunk
+    s.close()
+    if not response.startswith(b'HTTP/1.0 200') and not response.startswith(b'HTTP/1.1 200'):
+        raise Exception('unexpected response: %r' % response[:64])
+
+
+def bench(ini, *args):
+    p = subprocess.Popen([UWSGI, '--ini', ini] + list(args), stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    try:
+        for i in range(50):
+            try:
+                request()
+                break
+            except Exception:
+                time.sleep(0.1)
+        start = time.time()
+        for i in range(REQUESTS):
+            request()
+        return REQUESTS / (time.time() - start)
+    finally:
+        p.kill()
+        p.wait()
+
+with tempfile.NamedTemporaryFile('w', suffix='.ini', delete=False) as f:
+    f.write(config())
+
+try:
+    plain = bench(f.name, '--route-no-compile')
+    compiled = bench(f.name)
+    print('%d rules, %d requests' % (RULES, REQUESTS))
+    print('plain list walk: %.0f req/s' % plain)
+    print('compiled table:  %.0f req/s' % compiled)
+finally:
+    os.unlink(f.name)
@@ -0,0 +1,100 @@
+#!/usr/bin/env python3
+# compiled routing table consistency check
+#
+# usage: compiled.py [uwsgi binary]
+#
+# runs the same route sets with the compiled routing table (the default) and with
+# --route-no-compile, and checks every request gets the same response from both
+
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+UWSGI = sys.argv[1] if len(sys.argv) > 1 else './uwsgi'
+PORT = 9098
+
+ROUTE_SETS = [
+    # actions changing the subject of the following routes
+    ('rewrite', [
+        'route = ^/old/(.*) rewrite:/new/$1',
+        'route = ^/new/ break:200 NEW',
+        'route = ^/moved/ setpathinfo:/new/moved',
+        'route = ^/new/moved break:201 MOVED',
+        'route-uri = ^/u/ seturi:/v/x',
+        'route-uri = ^/v/ break:202 URI',
+        'route-run = break:404 NOPE',
+    ], ['/old/x', '/new/y', '/moved/z', '/u/a', '/other']),
+    # goto and labels
+    ('goto', [
+        'route = ^/g/ goto:skip',
+        'route = ^/ break:500 SKIPPED',
+        'route-label = skip',
+        'route = ^/g/x break:200 GX',
+        'route = ^/g/ break:201 G',
+        'route-run = break:404 NOPE',
+    ], ['/g/x', '/g/y', '/h']),
+    # mixed subjects, unanchored regexps and conditions
+    ('mixed', [
+        'route-host = ^www\\. break:200 WWW',
+        'route-uri = ^/q\\?a=1 break:201 QUERY',
+        'route = \\.php$ break:403 PHP',
+        'route-if = startswith:${PATH_INFO};/c break:202 COND',
+        'route = ^/abc addheader:X-Abc: 1',
+        'route = ^/ab break:203 AB',
+        'route = ^/a break:204 A',
+        'route-run = break:404 NOPE',
+    ], ['/q?a=1', '/q?a=2', '/x.php', '/c/1', '/abc', '/ab', '/a', '/z', 'www.example.com/']),
+]
+
+
+def request(path):
+    host = 'localhost'
+    if not path.startswith('/'):
+        host, path = path.split('/', 1)
+        path = '/' + path
+    s = socket.create_connection(('127.0.0.1', PORT))
+    s.sendall(('GET %s HTTP/1.0\r\nHost: %s\r\n\r\n' % (path, host)).encode())
+    response = b''
+    while True:
+        chunk = s.recv(4096)
+        if not chunk:
+            break
+        response += chunk
+    s.close()
+    headers, _, body = response.partition(b'\r\n\r\n')
+    return headers.split(b'\r\n')[0], body
+
+
+def run(rules, paths, *args):
+    with tempfile.NamedTemporaryFile('w', suffix='.ini') as f:
+        f.write('\n'.join(['[uwsgi]', 'http-socket = 127.0.0.1:%d' % PORT, 'disable-logging = true'] + rules) + '\n')
+        f.flush()
+        p = subprocess.Popen([UWSGI, '--ini', f.name] + list(args), stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        try:
+            for i in range(50):
+                try:
+                    request('/')
+                    break
+                except Exception:
+                    time.sleep(0.1)
+            return [request(path) for path in paths]
+        finally:
+            p.kill()
+            p.wait()
+
+
+failed = 0
+for name, rules, paths in ROUTE_SETS:
+    compiled = run(rules, paths)
+    plain = run(rules, paths, '--route-no-compile')
+    for path, c, n in zip(paths, compiled, plain):
+        if c != n:
+            print('%s: %s compiled=%r plain=%r' % (name, path, c, n))
+            failed += 1
+    print('%s: %d requests checked' % (name, len(paths)))
+
+if failed:
+    print('%d mismatches' % failed)
+    sys.exit(1)
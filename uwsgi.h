@@ -435,7 +435,17 @@ struct uwsgi_lock_ops {
 #define uwsgi_wait_write_req(x) uwsgi.wait_write_hook(x->fd, uwsgi.shared->options[UWSGI_OPTION_SOCKET_TIMEOUT]) ; x->switches++
 
 #ifdef UWSGI_PCRE
+#ifdef UWSGI_PCRE2
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
+typedef pcre2_code uwsgi_pcre;
+// pcre2 keeps the jit code in the compiled pattern, the extra pointer is unused
+typedef void uwsgi_pcre_extra;
+#else
 #include <pcre.h>
+typedef pcre uwsgi_pcre;
+typedef pcre_extra uwsgi_pcre_extra;
+#endif
 #endif
 
 #ifdef UWSGI_MATHEVAL
@@ -453,14 +463,102 @@ struct uwsgi_dyn_dict {
 	int status;
 
 #ifdef UWSGI_PCRE
-	pcre *pattern;
-	pcre_extra *pattern_extra;
+	uwsgi_pcre *pattern;
+	uwsgi_pcre_extra *pattern_extra;
 #endif
 
 	struct uwsgi_dyn_dict *prev;
 	struct uwsgi_dyn_dict *next;
 };
 
+#define UWSGI_STATIC_ENCODINGS 3
+
+// a content-coding usable for static files variants
+struct uwsgi_static_encoding {
+	char *name;
+	int name_len;
+	// the suffix of precompressed siblings
+	char *suffix;
+	int suffix_len;
+	// NULL if not supported by the build
+	struct uwsgi_buffer *(*compress)(char *, size_t);
+};
+
+// a response status with a set of fixed headers, serialized once (see core/writer.c)
+struct uwsgi_header_template {
+	char *name;
+	char *status;
+	uint16_t status_len;
+	struct uwsgi_string_list *headers;
+	uint16_t header_cnt;
+	// " NNN message\r\n" followed by the header lines
+	struct uwsgi_buffer *serialized;
+	struct uwsgi_header_template *next;
+};
+
+// a per-core request log ring (see core/log_ring.c), the producer and the consumer fields are on different cache lines
+struct uwsgi_log_ring {
+	volatile uint64_t head;
+	uint64_t records;
+	uint64_t drops;
+	char pad0[40];
+	volatile uint64_t tail;
+	uint64_t drops_reported;
+	char pad1[48];
+	uint64_t size;
+	char pad2[56];
+	char buf[];
+};
+
+// a native stack sample (in the shared ring of the sampling profiler)
+#define UWSGI_PROFILER_DEPTH 64
+struct uwsgi_profiler_sample {
+	// position in the ring + 1, set when the sample is complete
+	uint64_t seq;
+	int depth;
+	void *frames[UWSGI_PROFILER_DEPTH];
+};
+
+struct uwsgi_profiler_ring {
+	volatile int enabled;
+	volatile uint64_t head;
+	uint64_t size;
+	struct uwsgi_profiler_sample samples[];
+};
+
+#define UWSGI_MAX_RANGES 16
+
+// a byte range (both ends included) of a memory body
+struct uwsgi_range {
+	uint64_t from;
+	uint64_t to;
+	// the part headers (multipart/byteranges) in uwsgi_ranges->parts
+	size_t header_pos;
+	size_t header_len;
+};
+
+// the ranges requested by the client: n = 0 (full body), -1 (not satisfiable), > 0 (number of ranges)
+struct uwsgi_ranges {
+	int n;
+	uint64_t size;
+	struct uwsgi_range r[UWSGI_MAX_RANGES];
+	char boundary[17];
+	// part headers and the closing boundary
+	struct uwsgi_buffer *parts;
+	size_t closing_pos;
+};
+
+// an item of the (immutable) mime types hash table
+struct uwsgi_mime_type {
+	char *ext;
+	int ext_len;
+	char *type;
+	int type_len;
+	// precomputed "Content-Type: <type>\r\n" line
+	char *header;
+	int header_len;
+};
+
 struct uwsgi_hook {
 	char *name;
 	int (*func)(char *);
@@ -470,8 +568,8 @@ struct uwsgi_hook {
 #ifdef UWSGI_PCRE
 struct uwsgi_regexp_list {
 
-	pcre *pattern;
-	pcre_extra *pattern_extra;
+	uwsgi_pcre *pattern;
+	uwsgi_pcre_extra *pattern_extra;
 
 	uint64_t custom;
 	char *custom_str;
@@ -599,6 +697,9 @@ struct uwsgi_logger {
 	char *name;
 	char *id;
 	 ssize_t(*func) (struct uwsgi_logger *, char *, size_t);
+	// optional, send multiple messages at once (used by --logger-queue)
+	 ssize_t(*batch_func) (struct uwsgi_logger *, struct iovec *, int);
+	struct uwsgi_logger_queue *queue;
 	int configured;
 	int fd;
 	void *data;
@@ -1028,10 +1129,11 @@ struct uwsgi_plugin {
 };
 
 #ifdef UWSGI_PCRE
-int uwsgi_regexp_build(char *, pcre **, pcre_extra **);
-int uwsgi_regexp_match(pcre *, pcre_extra *, char *, int);
-int uwsgi_regexp_match_ovec(pcre *, pcre_extra *, char *, int, int *, int);
-int uwsgi_regexp_ovector(pcre *, pcre_extra *);
+int uwsgi_regexp_build(char *, uwsgi_pcre **, uwsgi_pcre_extra **);
+int uwsgi_regexp_match(uwsgi_pcre *, uwsgi_pcre_extra *, char *, int);
+int uwsgi_regexp_match_ovec(uwsgi_pcre *, uwsgi_pcre_extra *, char *, int, int *, int);
+int uwsgi_regexp_ovector(uwsgi_pcre *, uwsgi_pcre_extra *);
+void uwsgi_regexp_free(uwsgi_pcre *, uwsgi_pcre_extra *);
 char *uwsgi_regexp_apply_ovec(char *, int, char *, int, int *, int);
 #endif
 
@@ -1113,10 +1215,12 @@ struct uwsgi_spooler {
 // close the request
 #define UWSGI_ROUTE_BREAK 2
 
+struct uwsgi_route_table;
+
 struct uwsgi_route {
 
-	pcre *pattern;
-	pcre_extra *pattern_extra;
+	uwsgi_pcre *pattern;
+	uwsgi_pcre_extra *pattern_extra;
 
 	char *orig_route;
 	
@@ -1161,6 +1265,9 @@ struct uwsgi_route {
 	// this is used by virtual route to free resources
 	void (*free)(struct uwsgi_route *);
 
+	// the compiled table (only in the first route of a list)
+	struct uwsgi_route_table *table;
+
 	struct uwsgi_route *next;
 
 };
@@ -1232,8 +1339,8 @@ struct uwsgi_alarm_ll {
 };
 
 struct uwsgi_alarm_log {
-	pcre *pattern;
-	pcre_extra *pattern_extra;
+	uwsgi_pcre *pattern;
+	uwsgi_pcre_extra *pattern_extra;
 	int negate;
 	struct uwsgi_alarm_ll *alarms;
 	struct uwsgi_alarm_log *next;
@@ -1283,9 +1390,35 @@ struct uwsgi_transformation {
 	struct uwsgi_buffer *ub;
 	uint64_t len;
 	uint64_t custom64;
+	// the route action generating the transformation (for stats)
+	char *name;
+	uint64_t bytes_in;
+	uint64_t bytes_out;
+	uint64_t usecs;
+	// called when the chain is freed
+	void (*free)(struct uwsgi_transformation *);
 	struct uwsgi_transformation *next;
 };
 
+/*
+	phases of a request timed by --trace-spans (the spans can overlap:
+	vars parsing happens while reading, writes and transformations while the app runs)
+*/
+#define UWSGI_SPAN_ACCEPT	0
+#define UWSGI_SPAN_READ		1
+#define UWSGI_SPAN_VARS		2
+#define UWSGI_SPAN_ROUTING	3
+#define UWSGI_SPAN_APP		4
+#define UWSGI_SPAN_TRANSFORM	5
+#define UWSGI_SPAN_WRITE	6
+#define UWSGI_SPAN_OFFLOAD	7
+#define UWSGI_SPAN_MAX		8
+
+// take the start time of a span (0 when tracing is disabled)
+#define uwsgi_span_begin() (uwsgi.trace_spans ? uwsgi_span_now() : 0)
+// add the time elapsed since t to the span of the request
+#define uwsgi_span_end(wsgi_req, span, t) do { uint64_t __span_t = (t); if (__span_t) (wsgi_req)->spans[span] += uwsgi_span_now() - __span_t; } while(0)
+
 struct wsgi_request {
 	int fd;
 	struct uwsgi_header *uh;
@@ -1307,6 +1440,12 @@ struct wsgi_request {
 	uint64_t start_of_request;
 	uint64_t start_of_request_in_sec;
 	uint64_t end_of_request;
+	// when the request has been passed to the plugin (for the app_time histogram)
+	uint64_t app_start;
+	// latency histogram chosen by the routing subsystem
+	struct uwsgi_histogram *histogram;
+	// nanoseconds spent in each phase of the request (--trace-spans)
+	uint64_t spans[UWSGI_SPAN_MAX];
 
 	char *uri;
 	uint16_t uri_len;
@@ -1452,6 +1591,11 @@ struct wsgi_request {
 
 	size_t range_from;
 	size_t range_to;
+	// raw Range and If-Range headers (only with honour-range)
+	char *range;
+	uint16_t range_len;
+	char *if_range;
+	uint16_t if_range_len;
 
 	// current socket mapped to request
 	struct uwsgi_socket *socket;
@@ -1522,6 +1666,8 @@ struct wsgi_request {
 	struct uwsgi_transformation *transformations;
 	char *transformed_chunk;
 	size_t transformed_chunk_len;
+	// the chunk moving along the transformation chain
+	struct uwsgi_buffer *transformation_chunk;
 
 	int is_raw;
 
@@ -1585,6 +1731,7 @@ struct uwsgi_clock {
 };
 
 struct uwsgi_subscribe_slot;
+struct uwsgi_subscription_client;
 struct uwsgi_stats_pusher;
 struct uwsgi_stats_pusher_instance;
 
@@ -1672,7 +1819,12 @@ struct uwsgi_server {
 	int logformat_vectors;
 	struct uwsgi_logchunk *logchunks;
 	void (*logit) (struct wsgi_request *);
-	struct iovec **logvectors;
+	struct uwsgi_logchunk *logformat_ops;
+	int logformat_ops_cnt;
+	struct uwsgi_logformat_core *logformat_cores;
+	uint64_t logformat_bufsize;
+	int logformat_json;
+	int logformat_binary;
 
 	// autoload plugins
 	int autoload;
@@ -1964,6 +2116,12 @@ struct uwsgi_server {
 	// honour the HTTP Range header
 	int honour_range;
 
+	// add the Date header to every response
+	int add_date_header;
+	struct uwsgi_string_list *header_templates_list;
+	struct uwsgi_string_list *header_templates_headers;
+	struct uwsgi_header_template *header_templates;
+
 	// route all of the logs to the master process
 	int req_log_master;
 	int log_master;
@@ -1971,6 +2129,14 @@ struct uwsgi_server {
 	size_t log_master_bufsize;
 	int log_master_stream;
 	int log_master_req_stream;
+	// per-core request log rings
+	uint64_t log_master_ring;
+	uint64_t log_queue_size;
+	int log_queue_block;
+	int log_queue_batch;
+	int log_queue_delay;
+	char *log_rings;
+	int log_ring_pipe[2];
 
 	int log_reopen;
 	int log_truncate;
@@ -2072,6 +2238,7 @@ struct uwsgi_server {
 
 #ifdef UWSGI_PCRE
 	int pcre_jit;
+	int pcre_no_jit;
 	struct uwsgi_regexp_list *log_drain_rules;
 	struct uwsgi_regexp_list *log_filter_rules;
 	struct uwsgi_regexp_list *log_route;
@@ -2112,6 +2279,8 @@ struct uwsgi_server {
 	struct uwsgi_dyn_dict *static_maps2;
 	struct uwsgi_dyn_dict *check_static;
 	struct uwsgi_dyn_dict *mimetypes;
+	struct uwsgi_mime_type *mime_table;
+	uint32_t mime_table_mask;
 	struct uwsgi_string_list *static_skip_ext;
 	struct uwsgi_string_list *static_index;
 	struct uwsgi_string_list *static_safe;
@@ -2120,6 +2289,9 @@ struct uwsgi_server {
 	int use_static_cache_paths;
 	char *static_cache_paths_name;
 	struct uwsgi_cache *static_cache_paths;
+	uint64_t static_cache_fds;
+	int static_cache_fds_ttl;
+	struct uwsgi_string_list *static_cache_fds_monitor;
 	int cache_expire_freq;
 	int cache_report_freed_items;
 	int cache_no_expire;
@@ -2144,6 +2316,13 @@ struct uwsgi_server {
 	struct uwsgi_dyn_dict *static_expires_path_info;
 	struct uwsgi_dyn_dict *static_expires_path_info_mtime;
 
+	struct uwsgi_string_list *static_encodings_list;
+	struct uwsgi_static_encoding *static_encodings[UWSGI_STATIC_ENCODINGS + 1];
+	char *static_compress_store;
+	uint64_t static_compress_store_size;
+	uint64_t static_compress_min_size;
+	uint64_t static_compress_max_size;
+
 	int static_gzip_all;
 	struct uwsgi_string_list *static_gzip_dir;
 	struct uwsgi_string_list *static_gzip_ext;
@@ -2356,6 +2535,8 @@ struct uwsgi_server {
 	struct uwsgi_route *response_routes;
 	struct uwsgi_route_condition *route_conditions;
 	struct uwsgi_route_var *route_vars;
+	int route_no_compile;
+	int log_transformations;
 #endif
 
 	int single_interpreter;
@@ -2487,6 +2668,21 @@ struct uwsgi_server {
 	struct uwsgi_stats_pusher *stats_pushers;
 	struct uwsgi_stats_pusher_instance *stats_pusher_instances;
 	int stats_pusher_default_freq;
+	int stats_pusher_refresh;
+	// values of the metrics (in list order) taken at each cycle of the stats pusher thread
+	int64_t *stats_pusher_snapshot;
+
+	int trace_spans;
+	uint64_t trace_spans_sample;
+	char *trace_spans_socket;
+	int trace_spans_fd;
+	struct uwsgi_histogram *histogram_spans[UWSGI_SPAN_MAX];
+
+	int sampling_profiler;
+	int sampling_profiler_hz;
+	uint64_t sampling_profiler_samples;
+	char *sampling_profiler_output;
+	struct uwsgi_profiler_ring *profiler_ring;
 
 	uint64_t queue_size;
 	uint64_t queue_blocksize;
@@ -2522,7 +2718,7 @@ struct uwsgi_server {
 	struct uwsgi_string_list *subscriptions;
 	struct uwsgi_string_list *subscriptions2;
 
-	struct uwsgi_subscribe_node *(*subscription_algo) (struct uwsgi_subscribe_slot *, struct uwsgi_subscribe_node *);
+	struct uwsgi_subscribe_node *(*subscription_algo) (struct uwsgi_subscribe_slot *, struct uwsgi_subscription_client *);
 	int subscription_dotsplit;
 
 	int never_swap;
@@ -2575,14 +2771,26 @@ struct uwsgi_server {
 	struct uwsgi_metric *metrics;
 	struct uwsgi_metric_collector *metric_collectors;
 	int has_metrics;
+	struct uwsgi_histogram *histograms;
+	int histograms_cnt;
+	int histogram_slots;
+	struct uwsgi_histogram *histogram_request_time;
+	struct uwsgi_histogram *histogram_app_time;
+	struct uwsgi_histogram *histogram_headers_size;
+	struct uwsgi_histogram *histogram_response_size;
 	char *metrics_dir;
 	int metrics_dir_restore;
 	uint64_t metrics_cnt;
+	struct uwsgi_metric **metrics_hash;
+	uint32_t metrics_hash_size;
+	int metric_shards;
+	int metric_shards_per_worker;
 	struct uwsgi_string_list *additional_metrics;
 	struct uwsgi_string_list *metrics_threshold;
 
 	int (*wait_write_hook) (int, int);
 	int (*wait_read_hook) (int, int);
+	int (*wait_milliseconds_hook) (int);
 
 	struct uwsgi_string_list *schemes;
 
@@ -2705,6 +2913,13 @@ struct uwsgi_shared {
 	uint64_t routed_signals;
 	uint64_t unrouted_signals;
 
+	// bumped by the master to invalidate the workers' open-file caches
+	uint64_t static_cache_generation;
+	// bytes used by the static compressed variants store
+	uint64_t static_compress_store_used;
+	// a process is evicting variants from the store
+	int static_compress_store_evicting;
+
 	uint64_t busy_workers;
 	uint64_t idle_workers;
 	uint64_t overloaded;
@@ -3160,6 +3375,9 @@ struct uwsgi_subscribe_req {
 
 	char *base;
 	uint16_t base_len;
+
+	char *algo;
+	uint16_t algo_len;
 };
 
 void uwsgi_nuclear_blast();
@@ -3216,7 +3434,10 @@ char *uwsgi_amqp_consume(int, uint64_t *, char **);
 
 int uwsgi_file_serve(struct wsgi_request *, char *, uint16_t, char *, uint16_t, int);
 int uwsgi_starts_with(char *, int, char *, int);
-int uwsgi_static_want_gzip(struct wsgi_request *, char *, size_t *, struct stat *);
+struct uwsgi_static_encoding *uwsgi_static_want_encoding(struct wsgi_request *, char *, size_t *, struct stat *);
+void uwsgi_static_encodings_init(void);
+int uwsgi_static_accepts_encoding(struct wsgi_request *, struct uwsgi_static_encoding *);
+int uwsgi_static_variant(struct uwsgi_static_encoding *, char *, size_t, struct stat *, int, char *, size_t *, struct stat *);
 
 #ifdef __sun__
 time_t timegm(struct tm *);
@@ -3412,6 +3633,17 @@ struct uwsgi_subscribe_node {
 	uint64_t weight;
 	uint64_t wrr;
 
+	// peak-EWMA of the response time (in microseconds)
+	double ewma;
+	uint64_t ewma_last;
+
+	// outlier detection (managed by the routers health checker)
+	int ejected;
+	uint64_t consecutive_errors;
+	// slow start (in seconds) after re-admission
+	time_t readmitted;
+	uint64_t slow_start;
+
 	time_t unix_check;
 
 	struct uwsgi_subscribe_slot *slot;
@@ -3419,11 +3651,17 @@ struct uwsgi_subscribe_node {
 	struct uwsgi_subscribe_node *next;
 };
 
+struct uwsgi_subscribe_ketama_point {
+	uint32_t hash;
+	struct uwsgi_subscribe_node *node;
+};
+
 struct uwsgi_subscribe_slot {
 
-	char key[0xff];
+	char *key;
 	uint16_t keylen;
 
+	// the full (seeded) hash of the key
 	uint32_t hash;
 
 	uint64_t hits;
@@ -3433,6 +3671,18 @@ struct uwsgi_subscribe_slot {
 	EVP_MD_CTX *sign_ctx;
 #endif
 
+	// per-key balancing algorithm (NULL means the global one)
+	struct uwsgi_subscribe_node *(*algo) (struct uwsgi_subscribe_slot *, struct uwsgi_subscription_client *);
+
+	// last time dead nodes have been checked
+	time_t last_sweep;
+
+	// lookup structures (rebuilt when the nodes change)
+	int dirty;
+	struct uwsgi_subscribe_node **index;
+	uint64_t index_len;
+	struct uwsgi_subscribe_ketama_point *ring;
+	uint64_t ring_len;
 
 	struct uwsgi_subscribe_node *nodes;
 
@@ -3440,16 +3690,36 @@ struct uwsgi_subscribe_slot {
 	struct uwsgi_subscribe_slot *next;
 };
 
+// the subscriptions hash table (buckets are doubled when slots outnumber them)
+// lookups never modify it, so the chains are stable while being walked
+struct uwsgi_subscriptions {
+	struct uwsgi_subscribe_slot **buckets;
+	uint64_t size;
+	uint64_t count;
+	uint32_t seed;
+	// increased whenever a slot or a node is added or removed
+	uint64_t generation;
+};
+
+// informations about the request being balanced
+struct uwsgi_subscription_client {
+	// used by hash-based algorithms
+	char *hash_key;
+	uint16_t hash_key_len;
+};
+
 void mule_send_msg(int, char *, size_t);
 
 uint32_t djb33x_hash(char *, uint64_t);
+uint32_t murmur3_hash(char *, uint64_t, uint32_t);
 void create_signal_pipe(int *);
 void create_msg_pipe(int *, int);
-struct uwsgi_subscribe_slot *uwsgi_get_subscribe_slot(struct uwsgi_subscribe_slot **, char *, uint16_t);
-struct uwsgi_subscribe_node *uwsgi_get_subscribe_node_by_name(struct uwsgi_subscribe_slot **, char *, uint16_t, char *, uint16_t);
-struct uwsgi_subscribe_node *uwsgi_get_subscribe_node(struct uwsgi_subscribe_slot **, char *, uint16_t);
-int uwsgi_remove_subscribe_node(struct uwsgi_subscribe_slot **, struct uwsgi_subscribe_node *);
-struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscribe_slot **, struct uwsgi_subscribe_req *);
+struct uwsgi_subscribe_slot *uwsgi_get_subscribe_slot(struct uwsgi_subscriptions *, char *, uint16_t);
+struct uwsgi_subscribe_node *uwsgi_get_subscribe_node_by_name(struct uwsgi_subscriptions *, char *, uint16_t, char *, uint16_t);
+struct uwsgi_subscribe_node *uwsgi_get_subscribe_node(struct uwsgi_subscriptions *, char *, uint16_t, struct uwsgi_subscription_client *);
+void uwsgi_subscribe_node_rtt(struct uwsgi_subscribe_node *, uint64_t);
+int uwsgi_remove_subscribe_node(struct uwsgi_subscriptions *, struct uwsgi_subscribe_node *);
+struct uwsgi_subscribe_node *uwsgi_add_subscribe_node(struct uwsgi_subscriptions *, struct uwsgi_subscribe_req *);
 
 ssize_t uwsgi_mule_get_msg(int, int, char *, size_t, int);
 
@@ -3463,7 +3733,7 @@ void uwsgi_configure();
 int uwsgi_read_response(int, struct uwsgi_header *, int, char **);
 char *uwsgi_simple_file_read(char *);
 
-void uwsgi_send_subscription(char *, char *, size_t, uint8_t, uint8_t, uint8_t, char *, char *);
+void uwsgi_send_subscription(char *, char *, size_t, uint8_t, uint8_t, uint8_t, char *, char *, char *);
 
 void uwsgi_subscribe(char *, uint8_t);
 void uwsgi_subscribe2(char *, uint8_t);
@@ -3484,6 +3754,7 @@ void uwsgi_apply_cap(cap_value_t *, int);
 #endif
 
 void uwsgi_register_logger(char *, ssize_t(*func) (struct uwsgi_logger *, char *, size_t));
+void uwsgi_register_logger_batch(char *, ssize_t(*func) (struct uwsgi_logger *, char *, size_t), ssize_t(*batch_func) (struct uwsgi_logger *, struct iovec *, int));
 void uwsgi_append_logger(struct uwsgi_logger *);
 void uwsgi_append_req_logger(struct uwsgi_logger *);
 struct uwsgi_logger *uwsgi_get_logger(char *);
@@ -3524,6 +3795,7 @@ void uwsgi_opt_add_dyn_dict(char *, char *, void *);
 void uwsgi_opt_binary_append_data(char *, char *, void *);
 #ifdef UWSGI_PCRE
 void uwsgi_opt_pcre_jit(char *, char *, void *);
+int uwsgi_regexp_jit(void);
 void uwsgi_opt_add_regexp_dyn_dict(char *, char *, void *);
 void uwsgi_opt_add_regexp_list(char *, char *, void *);
 void uwsgi_opt_add_regexp_custom_list(char *, char *, void *);
@@ -3668,6 +3940,19 @@ int uwsgi_cheaper_algo_backlog2(int);
 int uwsgi_cheaper_algo_manual(int);
 
 int uwsgi_master_log(void);
+void uwsgi_master_log_do(char *, size_t);
+void uwsgi_master_req_log_do(char *, size_t);
+void uwsgi_log_rings_init(void);
+int uwsgi_log_ring_push(struct wsgi_request *, struct iovec *, int);
+void uwsgi_log_rings_drain(int);
+
+// max number of messages passed to the batch function of a logger
+#define UWSGI_LOGGER_BATCH_MAX 256
+struct uwsgi_logger_queue;
+int uwsgi_logger_queue_push(struct uwsgi_logger *, char *, size_t);
+void uwsgi_logger_queues_flush(void);
+int uwsgi_logger_send_datagrams(int, struct msghdr *, int);
+void uwsgi_log_ring_stats(int, uint64_t *, uint64_t *);
 int uwsgi_master_req_log(void);
 void uwsgi_flush_logs(void);
 
@@ -3739,6 +4024,12 @@ struct uwsgi_stats_pusher_instance {
 	int retry_delay;
 	time_t next_retry;
 
+	// values of the metrics at the last successful push (delta pushers)
+	int64_t *pushed;
+	// the current push must send all of the metrics
+	int full;
+	time_t last_full;
+
 	struct uwsgi_stats_pusher_instance *next;
 };
 
@@ -3746,7 +4037,11 @@ struct uwsgi_thread;
 void uwsgi_stats_pusher_loop(struct uwsgi_thread *);
 
 void uwsgi_stats_pusher_setup(void);
+int uwsgi_stats_pusher_changed(struct uwsgi_stats_pusher_instance *, uint64_t);
+void uwsgi_stats_pusher_commit(struct uwsgi_stats_pusher_instance *);
 void uwsgi_send_stats(int, struct uwsgi_stats *(*func) (void));
+void uwsgi_stats_server_loop(struct uwsgi_thread *);
+struct uwsgi_buffer *uwsgi_stats_prometheus(void);
 struct uwsgi_stats *uwsgi_master_generate_stats(void);
 struct uwsgi_stats_pusher * uwsgi_register_stats_pusher(char *, void (*)(struct uwsgi_stats_pusher_instance *, time_t, char *, size_t));
 
@@ -3805,7 +4100,7 @@ char *uwsgi_md5(char *, size_t, char *);
 
 void uwsgi_opt_ssa(char *, char *, void *);
 
-int uwsgi_no_subscriptions(struct uwsgi_subscribe_slot **);
+int uwsgi_no_subscriptions(struct uwsgi_subscriptions *);
 void uwsgi_deadlock_check(pid_t);
 
 
@@ -3818,16 +4113,37 @@ struct uwsgi_logchunk {
 	int type;
 	int free;
 	ssize_t(*func) (struct wsgi_request *, char **);
+	int64_t(*num) (struct wsgi_request *);
+	// per-core time cache
+	int slot;
+	// resolved at the first use
+	struct uwsgi_metric *metric;
 	struct uwsgi_logchunk *next;
 };
 
+struct uwsgi_logformat_time {
+	time_t t;
+	size_t len;
+	char buf[64];
+};
+
+struct uwsgi_logformat_core {
+	char *buf;
+	char *strftime_buf;
+	// the raw strings expanded by strftime()
+	struct iovec *literals;
+	time_t literals_t;
+	struct uwsgi_logformat_time *times;
+};
+
 void uwsgi_build_log_format(char *);
+void uwsgi_compile_log_format(void);
 
 void uwsgi_add_logchunk(int, int, char *, size_t);
 
 void uwsgi_logit_simple(struct wsgi_request *);
 void uwsgi_logit_lf(struct wsgi_request *);
-void uwsgi_logit_lf_strftime(struct wsgi_request *);
+void uwsgi_logit_lf_binary(struct wsgi_request *);
 
 struct uwsgi_logvar *uwsgi_logvar_get(struct wsgi_request *, char *, uint8_t);
 void uwsgi_logvar_add(struct wsgi_request *, char *, uint8_t, char *, uint8_t);
@@ -4036,6 +4352,10 @@ struct uwsgi_offload_request {
 	// a uwsgi_buffer (will be destroyed at the end of the task)
 	struct uwsgi_buffer *ubuf;
 
+	// memory engine: send these slices (of buf and ubuf) instead of the whole buf (will be freed at the end of the task)
+	struct iovec *iov;
+	size_t iov_cnt;
+
 	struct uwsgi_offload_engine *engine;
 
 	// this pipe is used for notifications
@@ -4070,7 +4390,10 @@ int uwsgi_simple_write(struct wsgi_request *, char *, size_t);
 
 
 void uwsgi_subscription_set_algo(char *);
-struct uwsgi_subscribe_slot **uwsgi_subscription_init_ht(void);
+struct uwsgi_subscriptions *uwsgi_subscription_init_ht(void);
+struct uwsgi_subscribe_slot *uwsgi_subscriptions_next(struct uwsgi_subscriptions *, struct uwsgi_subscribe_slot *);
+int uwsgi_subscriptions_dump(struct uwsgi_subscriptions *, char *);
+int uwsgi_subscriptions_load(struct uwsgi_subscriptions *, char *);
 
 int uwsgi_check_pidfile(char *);
 void uwsgi_daemons_spawn_all();
@@ -4163,6 +4486,12 @@ int uwsgi_response_prepare_headers(struct wsgi_request *, char *, uint16_t);
 int uwsgi_response_prepare_headers_int(struct wsgi_request *, int);
 int uwsgi_response_add_header(struct wsgi_request *, char *, uint16_t, char *, uint16_t);
 int uwsgi_response_add_header_force(struct wsgi_request *, char *, uint16_t, char *, uint16_t);
+int uwsgi_response_add_header_line(struct wsgi_request *, char *, uint16_t, char *, uint16_t, char *, uint16_t);
+struct uwsgi_header_template *uwsgi_header_template_new(char *, char *, uint16_t);
+int uwsgi_header_template_add(struct uwsgi_header_template *, char *, uint16_t);
+struct uwsgi_header_template *uwsgi_header_template_get(char *);
+void uwsgi_header_templates_init(void);
+int uwsgi_response_prepare_template(struct wsgi_request *, struct uwsgi_header_template *);
 int uwsgi_response_commit_headers(struct wsgi_request *);
 int uwsgi_response_sendfile_do(struct wsgi_request *, int, size_t, size_t);
 int uwsgi_response_sendfile_do_can_close(struct wsgi_request *, int, size_t, size_t, int);
@@ -4171,6 +4500,7 @@ struct uwsgi_buffer *uwsgi_proto_base_add_header(struct wsgi_request *, char *,
 
 int uwsgi_simple_wait_write_hook(int, int);
 int uwsgi_simple_wait_read_hook(int, int);
+int uwsgi_simple_wait_milliseconds_hook(int);
 int uwsgi_response_write_headers_do(struct wsgi_request *);
 char *uwsgi_request_body_read(struct wsgi_request *, ssize_t , ssize_t *);
 char *uwsgi_request_body_readline(struct wsgi_request *, ssize_t, ssize_t *);
@@ -4186,6 +4516,11 @@ ssize_t uwsgi_sendfile_do(int, int, size_t, size_t);
 int uwsgi_proto_base_fix_headers(struct wsgi_request *);
 int uwsgi_response_add_content_length(struct wsgi_request *, uint64_t);
 int uwsgi_response_add_content_range(struct wsgi_request *, uint64_t, uint64_t, uint64_t);
+int uwsgi_ranges_parse(struct wsgi_request *, uint64_t, char *, uint16_t, struct uwsgi_ranges *);
+int uwsgi_response_prepare_ranges(struct wsgi_request *, struct uwsgi_ranges *, char *, uint16_t, int);
+int uwsgi_response_write_ranges(struct wsgi_request *, char *, struct uwsgi_ranges *);
+int uwsgi_offload_request_memory_ranges_do(struct wsgi_request *, char *, struct uwsgi_ranges *);
+void uwsgi_ranges_free(struct uwsgi_ranges *);
 int uwsgi_response_add_expires(struct wsgi_request *, uint64_t);
 int uwsgi_response_add_last_modified(struct wsgi_request *, uint64_t);
 int uwsgi_response_add_date(struct wsgi_request *, char *, uint16_t, uint64_t);
@@ -4314,6 +4649,8 @@ struct uwsgi_route_var *uwsgi_get_route_var(char *, uint16_t);
 struct uwsgi_route_var *uwsgi_register_route_var(char *, char *(*)(struct wsgi_request *, char *, uint16_t, uint16_t *));
 
 char *uwsgi_get_mime_type(char *, int, size_t *);
+struct uwsgi_mime_type *uwsgi_mime_type_get(char *, int);
+void uwsgi_mime_table_build(void);
 
 void config_magic_table_fill(char *, char *[]);
 
@@ -4322,6 +4659,7 @@ struct uwsgi_cron *uwsgi_cron_add(char *);
 int uwsgi_is_full_http(struct uwsgi_buffer *);
 
 int uwsgi_http_date(time_t t, char *);
+int uwsgi_http_date_cached(time_t t, char *);
 
 int uwsgi_apply_transformations(struct wsgi_request *wsgi_req, char *, size_t);
 int uwsgi_apply_final_transformations(struct wsgi_request *);
@@ -4498,9 +4836,18 @@ struct uwsgi_metric {
 	struct uwsgi_metric_child *children;
 	struct uwsgi_metric_threshold *thresholds;
 
+	// metrics updated by the api: the base value followed by a delta for each worker (or core), in shared memory
+	int64_t *shards;
+
+	// chain of the name lookup table
+	struct uwsgi_metric *hash_next;
+
         struct uwsgi_metric *next;
 };
 
+// every shard gets its own cache line
+#define UWSGI_METRIC_SHARD_STRIDE 8
+
 struct uwsgi_metric_child {
 	struct uwsgi_metric *um;
 	struct uwsgi_metric_child *next;
@@ -4509,6 +4856,47 @@ struct uwsgi_metric_child {
 void uwsgi_setup_metrics(void);
 void uwsgi_metrics_start_collector(void);
 
+/*
+	log-linear buckets: values below 32 are exact, then every power of two is split
+	in 32 buckets (max 3% error), up to 2^40
+*/
+#define UWSGI_HISTOGRAM_SUB_BITS 5
+#define UWSGI_HISTOGRAM_MAX_BITS 40
+#define UWSGI_HISTOGRAM_BUCKETS (((UWSGI_HISTOGRAM_MAX_BITS - UWSGI_HISTOGRAM_SUB_BITS) + 1) << UWSGI_HISTOGRAM_SUB_BITS)
+// count, sum, max and the buckets
+#define UWSGI_HISTOGRAM_SLOT_SIZE (UWSGI_HISTOGRAM_BUCKETS + 3)
+
+struct uwsgi_histogram {
+	char *name;
+	int id;
+	// a slot for each worker (or for each core in multithread mode), in shared memory
+	uint64_t *slots;
+	// merged view of the slots, used by the metrics collector
+	uint64_t *merged;
+	time_t merged_at;
+	struct uwsgi_histogram *next;
+};
+
+struct uwsgi_histogram *uwsgi_histogram_register(char *);
+struct uwsgi_histogram *uwsgi_histogram_find(char *);
+void uwsgi_histogram_add(struct uwsgi_histogram *, struct wsgi_request *, uint64_t);
+void uwsgi_histogram_merge(struct uwsgi_histogram *, uint64_t *);
+uint64_t uwsgi_histogram_quantile(uint64_t *, uint64_t);
+uint64_t uwsgi_histogram_bucket_value(int);
+void uwsgi_histograms_account(struct wsgi_request *);
+
+uint64_t uwsgi_span_now(void);
+void uwsgi_spans_register_histograms(void);
+void uwsgi_spans_init(void);
+void uwsgi_spans_account(struct wsgi_request *);
+
+void uwsgi_profiler_init(void);
+void uwsgi_profiler_worker_init(void);
+void uwsgi_profiler_thread_init(int);
+void uwsgi_profiler_start(int);
+void uwsgi_profiler_stop(int);
+extern char *uwsgi_span_names[];
+
 int uwsgi_metric_set(char *, char *, int64_t);
 int uwsgi_metric_inc(char *, char *, int64_t);
 int uwsgi_metric_dec(char *, char *, int64_t);
@@ -4517,6 +4905,14 @@ int uwsgi_metric_div(char *, char *, int64_t);
 int64_t uwsgi_metric_get(char *, char *);
 int64_t uwsgi_metric_getn(char *, size_t, char *, size_t);
 
+struct uwsgi_metric *uwsgi_metric_handle(char *, char *);
+int uwsgi_metric_set_handle(struct uwsgi_metric *, int64_t);
+int uwsgi_metric_inc_handle(struct uwsgi_metric *, int64_t);
+int uwsgi_metric_dec_handle(struct uwsgi_metric *, int64_t);
+int uwsgi_metric_mul_handle(struct uwsgi_metric *, int64_t);
+int uwsgi_metric_div_handle(struct uwsgi_metric *, int64_t);
+int64_t uwsgi_metric_get_handle(struct uwsgi_metric *);
+
 struct uwsgi_metric_collector *uwsgi_register_metric_collector(char *, int64_t (*)(struct uwsgi_metric *));
 struct uwsgi_metric *uwsgi_register_metric(char *, char *, uint8_t, char *, void *, uint32_t, void *);
 
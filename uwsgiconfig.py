@@ -77,6 +77,8 @@ report = {
     'debug': False,
     'plugin_dir': False,
     'zlib': False,
+    'brotli': False,
+    'zstd': False,
 }
 
 verbose_build = False
@@ -533,12 +535,12 @@ class uConf(object):
 
         self.config.readfp(open_profile(filename))
         self.gcc_list = ['core/utils', 'core/protocol', 'core/socket', 'core/logging', 'core/master', 'core/master_utils', 'core/emperor',
-            'core/notify', 'core/mule', 'core/subscription', 'core/stats', 'core/sendfile', 'core/async', 'core/master_checks', 'core/fifo',
-            'core/offload', 'core/io', 'core/static', 'core/websockets', 'core/spooler', 'core/snmp', 'core/exceptions', 'core/config',
+            'core/notify', 'core/mule', 'core/subscription', 'core/stats', 'core/stats_server', 'core/sendfile', 'core/async', 'core/master_checks', 'core/fifo',
+            'core/offload', 'core/io', 'core/static', 'core/static_encodings', 'core/ranges', 'core/log_ring', 'core/log_queue', 'core/websockets', 'core/spooler', 'core/snmp', 'core/exceptions', 'core/config',
             'core/setup_utils', 'core/clock', 'core/init', 'core/buffer', 'core/reader', 'core/writer', 'core/alarm', 'core/cron', 'core/hooks',
             'core/plugins', 'core/lock', 'core/cache', 'core/daemons', 'core/errors', 'core/hash', 'core/master_events', 'core/chunked',
             'core/queue', 'core/event', 'core/signal', 'core/strings', 'core/progress', 'core/timebomb', 'core/ini', 'core/fsmon', 'core/mount',
-            'core/metrics',
+            'core/metrics', 'core/tracing', 'core/profiler',
             'core/rpc', 'core/gateway', 'core/loop', 'core/cookie', 'core/querystring', 'core/rb_timers', 'core/transformations', 'core/uwsgi']
         # add protocols
         self.gcc_list.append('proto/base')
@@ -628,6 +630,9 @@ class uConf(object):
         self.libs = ['-lpthread', '-lm', '-rdynamic']
         if uwsgi_os in ('Linux', 'GNU', 'GNU/kFreeBSD'):
             self.libs.append('-ldl')
+        # timer_create() (sampling profiler) is in librt before glibc 2.17
+        if uwsgi_os == 'Linux':
+            self.libs.append('-lrt')
         if uwsgi_os == 'GNU/kFreeBSD':
             self.cflags.append('-D__GNU_kFreeBSD__')
             self.libs.append('-lbsd')
@@ -717,6 +722,17 @@ class uConf(object):
             self.gcc_list.append('core/zlib')
             report['zlib'] = True
 
+        # compressors for the static files variants
+        if self.get('brotli', 'auto') and self.has_include('brotli/encode.h'):
+            self.cflags.append('-DUWSGI_BROTLI')
+            self.libs.append('-lbrotlienc')
+            report['brotli'] = True
+
+        if self.get('zstd', 'auto') and self.has_include('zstd.h'):
+            self.cflags.append('-DUWSGI_ZSTD')
+            self.libs.append('-lzstd')
+            report['zstd'] = True
+
         if uwsgi_os == 'OpenBSD':
             try:
                 obsd_major = int(uwsgi_os_k.split('.')[0])
@@ -929,7 +945,20 @@ class uConf(object):
 
         # re-enable after pcre fix
         if self.get('pcre'):
-            if self.get('pcre') == 'auto':
+            # pcre2 (with jit) is preferred, legacy pcre is used as a fallback
+            pcre2conf = None
+            if self.get('pcre2', 'auto'):
+                pcre2conf = spcall('pcre2-config --libs8')
+            if pcre2conf:
+                self.libs.append(pcre2conf)
+                pcre2conf = spcall("pcre2-config --cflags")
+                self.cflags.append(pcre2conf)
+                self.gcc_list.append('core/regexp')
+                self.cflags.append("-DUWSGI_PCRE")
+                self.cflags.append("-DUWSGI_PCRE2")
+                has_pcre = True
+
+            elif self.get('pcre') == 'auto':
                 pcreconf = spcall('pcre-config --libs')
                 if pcreconf:
                     self.libs.append(pcreconf)